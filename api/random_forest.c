@@ -0,0 +1,458 @@
+/*
+@author andrii dobroshynski
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "random_forest.h"
+#include "../model/checkpoint.h"
+#include "../model/forest.h"
+#include "../eval/eval.h"
+#include "../utils/memory.h"
+
+/*
+A model behind the opaque handle of the API.
+*/
+struct RandomForest
+{
+    RandomForestParameters params; // 'n_estimators' is the number of trees once trained.
+    size_t n_requested;            // Trees 'rf_train' trains, a time budget or 'rf_prune' can leave fewer.
+
+    size_t n_features;
+    const DecisionTreeNode **trees; // NULL until the model is trained or loaded.
+    ObliviousForest *oblivious;     // Lookup tables of 'trees' for models of oblivious trees, NULL otherwise.
+    BranchProfile *profile;         // Branches counted by 'rf_profile', NULL until it is called.
+    LayoutForest *layout;           // 'trees' laid out for 'profile', NULL without one.
+};
+
+static __thread char last_error[256];
+
+/*
+Records the error of the calling thread returned by 'rf_last_error'.
+*/
+void set_last_error(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(last_error, sizeof(last_error), format, args);
+    va_end(args);
+}
+
+/*
+Returns the default configuration of this version of the library.
+*/
+RandomForestConfig default_config()
+{
+    return (RandomForestConfig){
+        struct_size : sizeof(RandomForestConfig),
+        n_estimators : 3,
+        max_depth : 7,
+        min_samples_leaf : 3,
+        max_features : 3,
+        extra_trees : 0,
+        quantile_bins : 0,
+        compact : 0,
+        seed : 0,
+        max_split_samples : 0,
+        oblivious : 0,
+        time_budget : 0
+    };
+}
+
+void rf_config_init(RandomForestConfig *config, size_t struct_size)
+{
+    RandomForestConfig defaults = default_config();
+    if (struct_size > sizeof(RandomForestConfig))
+        struct_size = sizeof(RandomForestConfig);
+    memcpy(config, &defaults, struct_size);
+    if (struct_size >= sizeof(size_t))
+        config->struct_size = struct_size;
+}
+
+RandomForest *rf_create(const RandomForestConfig *caller_config)
+{
+    // A caller built against an older header passes a shorter struct, the fields it does not have keep
+    // their defaults.
+    RandomForestConfig defaults = default_config();
+    if (caller_config != NULL)
+    {
+        if (caller_config->struct_size <= offsetof(RandomForestConfig, n_estimators))
+        {
+            set_last_error("config->struct_size is not set, initialize the config with rf_config_init");
+            return NULL;
+        }
+        size_t struct_size = caller_config->struct_size < sizeof(RandomForestConfig) ? caller_config->struct_size
+                                                                                     : sizeof(RandomForestConfig);
+        memcpy(&defaults, caller_config, struct_size);
+    }
+    const RandomForestConfig *config = &defaults;
+
+    if (config->n_estimators == 0 || config->max_features == 0)
+    {
+        set_last_error("n_estimators and max_features must be > 0");
+        return NULL;
+    }
+    if (config->time_budget < 0)
+    {
+        set_last_error("time_budget must be >= 0, got %g", config->time_budget);
+        return NULL;
+    }
+
+    RandomForest *forest = malloc(sizeof(RandomForest));
+    forest->params = (RandomForestParameters){
+        n_estimators : config->n_estimators,
+        max_depth : config->max_depth,
+        min_samples_leaf : config->min_samples_leaf,
+        max_features : config->max_features,
+        split_mode : config->extra_trees     ? SPLIT_MODE_RANDOM
+                     : config->quantile_bins ? SPLIT_MODE_QUANTILE
+                                             : SPLIT_MODE_BEST,
+        max_bins : config->quantile_bins,
+        compact_trees : config->compact,
+        quantize : 0,
+        seed : config->seed,
+        max_split_samples : config->max_split_samples,
+        oblivious : config->oblivious,
+        time_budget : config->time_budget
+    };
+    forest->n_requested = config->n_estimators;
+    forest->n_features = 0;
+    forest->trees = NULL;
+    forest->oblivious = NULL;
+    forest->profile = NULL;
+    forest->layout = NULL;
+    return forest;
+}
+
+/*
+Rebuilds the lookup tables of a model of oblivious trees after its trees changed. A model whose trees can't
+be compiled (too deep) keeps predicting from its trees.
+*/
+void compile_oblivious(RandomForest *forest)
+{
+    free_oblivious_forest(forest->oblivious);
+    forest->oblivious = NULL;
+    if (forest->params.oblivious)
+        forest->oblivious = compile_oblivious_forest(forest->trees, forest->params.n_estimators);
+}
+
+/*
+Drops the branch profile and the layout of a model whose trees changed, neither of which match them anymore.
+*/
+void drop_layout(RandomForest *forest)
+{
+    free_branch_profile(forest->profile);
+    free_layout_forest(forest->layout);
+    forest->profile = NULL;
+    forest->layout = NULL;
+}
+
+/*
+Grows the model from 'n_existing' to 'n_existing' + 'n_new' trees, training the new trees on 'data'. Under a
+time budget fewer trees can be added, 'params.n_estimators' always counts the trees the model has.
+*/
+int grow_forest(RandomForest *forest, const double *data, size_t rows, size_t cols, size_t n_existing, size_t n_new)
+{
+    if (rows == 0 || cols < 2)
+    {
+        set_last_error("training data must have at least one row and one feature column, got %zu x %zu", rows, cols);
+        return -1;
+    }
+    if (n_existing > 0 && cols - 1 != forest->n_features)
+    {
+        set_last_error("model has %zu features but the data has %zu", forest->n_features, cols - 1);
+        return -1;
+    }
+
+    // The trees only keep pointers to rows while they are grown, so the rows can point into the caller's
+    // buffer instead of a copy.
+    double **row_pointers = tracked_malloc(rows * sizeof(double *), MEMORY_TAG_DATA);
+    for (size_t i = 0; i < rows; ++i)
+        row_pointers[i] = (double *)data + i * cols;
+
+    // Features are sampled without replacement, so never ask for more than there are.
+    RandomForestParameters params = forest->params;
+    if (params.max_features > cols - 1)
+        params.max_features = cols - 1;
+
+    const struct dim csv_dim = (struct dim){rows : rows, cols : cols};
+    const ModelContext ctx = (ModelContext){
+        testingFoldIdx : 0,
+        rowsPerFold : 0 /* No testing fold, train on every row. */,
+        split_candidates : NULL
+    };
+    size_t n_trained;
+    forest->trees = extend_model(forest->trees, n_existing, n_new, row_pointers, &params, &csv_dim, &ctx, &n_trained);
+    forest->params.n_estimators = n_existing + n_trained;
+    if (params.next_tree_index)
+        forest->params.next_tree_index = params.next_tree_index + n_trained;
+    forest->n_features = cols - 1;
+    compile_oblivious(forest);
+    drop_layout(forest);
+
+    tracked_free(row_pointers, MEMORY_TAG_DATA);
+    return 0;
+}
+
+int rf_train(RandomForest *forest, const double *data, size_t rows, size_t cols)
+{
+    if (forest->trees)
+    {
+        free_random_forest(&forest->trees, forest->params.n_estimators);
+        forest->trees = NULL;
+    }
+    forest->params.next_tree_index = 0;
+    return grow_forest(forest, data, rows, cols, 0, forest->n_requested);
+}
+
+int rf_add_trees(RandomForest *forest, const double *data, size_t rows, size_t cols, size_t n_trees)
+{
+    if (n_trees == 0)
+    {
+        set_last_error("n_trees must be > 0");
+        return -1;
+    }
+    return grow_forest(forest, data, rows, cols, forest->trees ? forest->params.n_estimators : 0, n_trees);
+}
+
+int rf_prune(RandomForest *forest,
+             const double *data,
+             size_t rows,
+             size_t cols,
+             double epsilon,
+             double *accuracies,
+             double *latencies)
+{
+    if (forest->trees == NULL)
+    {
+        set_last_error("model is not trained");
+        return -1;
+    }
+    if (rows == 0 || cols != forest->n_features + 1)
+    {
+        set_last_error("model has %zu features but the held out data has %zu rows of %zu columns", forest->n_features, rows, cols);
+        return -1;
+    }
+
+    double **row_pointers = tracked_malloc(rows * sizeof(double *), MEMORY_TAG_DATA);
+    for (size_t i = 0; i < rows; ++i)
+        row_pointers[i] = (double *)data + i * cols;
+
+    // The held out rows are a single testing fold.
+    const struct dim csv_dim = (struct dim){rows : rows, cols : cols};
+    const ModelContext ctx = (ModelContext){testingFoldIdx : 0, rowsPerFold : rows, split_candidates : NULL};
+
+    size_t n_estimators = forest->params.n_estimators;
+    double *prefix_accuracies = tracked_malloc(n_estimators * sizeof(double), MEMORY_TAG_EVAL);
+    order_trees_greedily(forest->trees, n_estimators, row_pointers, &csv_dim, &ctx, prefix_accuracies);
+    size_t n_kept = select_tree_prefix(prefix_accuracies, n_estimators, epsilon);
+
+    if (accuracies)
+        memcpy(accuracies, prefix_accuracies, n_estimators * sizeof(double));
+    if (latencies)
+    {
+        for (size_t k = 0; k < n_estimators; ++k)
+            latencies[k] = time_prefix_predictions(forest->trees, k + 1, row_pointers, &ctx, RF_PRUNE_TIMED_ROWS);
+    }
+    tracked_free(prefix_accuracies, MEMORY_TAG_EVAL);
+    tracked_free(row_pointers, MEMORY_TAG_DATA);
+
+    long freeCount = 0;
+    for (size_t t = n_kept; t < n_estimators; ++t)
+        free_decision_tree_node(forest->trees[t], &freeCount);
+    // Trees added later are seeded past every tree the model had, the kept ones included.
+    if (forest->params.next_tree_index == 0)
+        forest->params.next_tree_index = n_estimators;
+    forest->params.n_estimators = n_kept;
+
+    compile_oblivious(forest);
+    drop_layout(forest);
+    return (int)n_kept;
+}
+
+int rf_predict(const RandomForest *forest, const double *row)
+{
+    if (forest->trees == NULL)
+    {
+        set_last_error("model is not trained");
+        return -1;
+    }
+    if (forest->oblivious)
+        return predict_oblivious(forest->oblivious, row);
+    if (forest->layout)
+        return predict_layout(forest->layout, row);
+    return predict_model((const DecisionTreeNode ***)&forest->trees, forest->params.n_estimators, (double *)row);
+}
+
+int rf_predict_batch(const RandomForest *forest, const double *rows, size_t n_rows, int *predictions)
+{
+    if (forest->trees == NULL)
+    {
+        set_last_error("model is not trained");
+        return -1;
+    }
+
+    if (forest->oblivious)
+    {
+        predict_oblivious_batch(forest->oblivious, rows, n_rows, forest->n_features, predictions);
+        return 0;
+    }
+    if (forest->layout)
+    {
+        predict_layout_batch(forest->layout, rows, n_rows, forest->n_features, predictions);
+        return 0;
+    }
+
+    // Count the votes for class 1 of every row tree by tree.
+    for (size_t i = 0; i < n_rows; ++i)
+        predictions[i] = 0;
+
+    for (size_t t = 0; t < forest->params.n_estimators; ++t)
+    {
+        for (size_t i = 0; i < n_rows; ++i)
+        {
+            int prediction;
+            make_prediction(forest->trees[t], (double *)rows + i * forest->n_features, &prediction);
+            predictions[i] += prediction;
+        }
+    }
+
+    // Majority vote, ties go to class 0 same as in 'predict_model'.
+    int n_estimators = (int)forest->params.n_estimators;
+    for (size_t i = 0; i < n_rows; ++i)
+        predictions[i] = predictions[i] > n_estimators - predictions[i] ? 1 : 0;
+
+    return 0;
+}
+
+int rf_profile(RandomForest *forest, const double *rows, size_t n_rows, size_t cols)
+{
+    if (forest->trees == NULL)
+    {
+        set_last_error("model is not trained");
+        return -1;
+    }
+    if (cols < forest->n_features)
+    {
+        set_last_error("model has %zu features but the rows have %zu columns", forest->n_features, cols);
+        return -1;
+    }
+
+    if (forest->profile == NULL)
+        forest->profile = create_branch_profile(forest->trees, forest->params.n_estimators);
+    for (size_t i = 0; i < n_rows; ++i)
+        profile_row(forest->profile, forest->trees, rows + i * cols);
+
+    LayoutForest *layout = layout_random_forest(forest->trees, forest->params.n_estimators, forest->profile);
+    if (layout == NULL)
+    {
+        set_last_error("model is too large to lay out");
+        return -1;
+    }
+    free_layout_forest(forest->layout);
+    forest->layout = layout;
+    return 0;
+}
+
+size_t rf_n_features(const RandomForest *forest)
+{
+    return forest->n_features;
+}
+
+size_t rf_n_trees(const RandomForest *forest)
+{
+    return forest->trees ? forest->params.n_estimators : 0;
+}
+
+int rf_save(const RandomForest *forest, const char *file_name)
+{
+    if (forest->trees == NULL)
+    {
+        set_last_error("model is not trained");
+        return -1;
+    }
+
+    FILE *file = fopen(file_name, "wb");
+    if (file == NULL)
+    {
+        set_last_error("can't open file for writing: %s", file_name);
+        return -1;
+    }
+
+    int status = save_random_forest(forest->trees, &forest->params, forest->n_features, file);
+    if (status == 0 && forest->profile)
+        status = save_branch_profile(forest->profile, file);
+    if (fclose(file) != 0)
+        status = -1;
+
+    if (status != 0)
+        set_last_error("failed to write model file %s", file_name);
+    return status;
+}
+
+RandomForest *rf_load(const char *file_name)
+{
+    FILE *file = fopen(file_name, "rb");
+    if (file == NULL)
+    {
+        set_last_error("can't open file: %s", file_name);
+        return NULL;
+    }
+
+    RandomForest *forest = malloc(sizeof(RandomForest));
+    forest->trees = load_random_forest(file, &forest->params, &forest->n_features);
+    if (forest->trees == NULL)
+    {
+        set_last_error("%s is not a model file, or is truncated or corrupt", file_name);
+        fclose(file);
+        free(forest);
+        return NULL;
+    }
+    forest->n_requested = forest->params.n_estimators;
+
+    // A model saved after 'rf_profile' is laid out for its profile again.
+    forest->profile = load_branch_profile(file, forest->trees, forest->params.n_estimators);
+    forest->layout = forest->profile ? layout_random_forest(forest->trees, forest->params.n_estimators, forest->profile) : NULL;
+    fclose(file);
+
+    forest->oblivious = NULL;
+    compile_oblivious(forest);
+    return forest;
+}
+
+void rf_free(RandomForest *forest)
+{
+    if (forest == NULL)
+        return;
+    if (forest->trees)
+        free_random_forest(&forest->trees, forest->params.n_estimators);
+    free_oblivious_forest(forest->oblivious);
+    drop_layout(forest);
+    free(forest);
+}
+
+void rf_set_memory_budget(size_t bytes)
+{
+    set_memory_budget(bytes);
+}
+
+void rf_set_checkpoint(const char *dir, double interval)
+{
+    set_checkpoint(dir, interval);
+}
+
+size_t rf_memory_usage()
+{
+    return get_memory_usage(MEMORY_TAG_COUNT);
+}
+
+size_t rf_memory_peak()
+{
+    return get_memory_peak(MEMORY_TAG_COUNT);
+}
+
+const char *rf_last_error()
+{
+    return last_error;
+}
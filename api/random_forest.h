@@ -0,0 +1,218 @@
+/*
+@author andrii dobroshynski
+*/
+
+#ifndef random_forest_h
+#define random_forest_h
+
+#include <stddef.h>
+
+/*
+Public C API of librandomforest, for training and serving random forest models in-process. The model is
+only reachable through an opaque RandomForest handle, so the layout of the model can change without breaking
+programs built against this header.
+
+Errors are reported through return values (-1 or NULL), with a description of the last error of the calling
+thread available from 'rf_last_error'. Malformed training data (class targets other than 0 / 1) still aborts
+the process, same as for the command line tool.
+
+Thread safety:
+  - 'rf_predict', 'rf_predict_batch', 'rf_save' and 'rf_n_features' only read the model, so any number of
+    threads can call them on the same model at the same time. The stats and memory counters they update are
+    process-wide and atomic.
+  - 'rf_train', 'rf_add_trees', 'rf_prune', 'rf_profile' and 'rf_free' modify the model and must not run concurrently with any other
+    call on it.
+  - Training draws from the process-wide 'rand()' state, which is seeded before every tree from 'seed' and
+    the index of the tree if 'seed' is non-zero. Models trained concurrently from several threads are valid
+    but not reproducible.
+*/
+
+/*
+Version of this API, increased whenever a function or struct of this header changes. Changes that break
+programs built against an older header also bump the SOVERSION of the shared library.
+*/
+#define RANDOM_FOREST_API_VERSION 10
+
+#if defined(__GNUC__)
+#define RF_API __attribute__((visibility("default")))
+#else
+#define RF_API
+#endif
+
+typedef struct RandomForest RandomForest;
+
+/*
+Training configuration, see 'rf_default_config' for the defaults. New fields are only ever appended, and
+'struct_size' tells the library how many of them the caller knows about, so a program built against an older
+header keeps working with a newer library: the fields it does not know keep their defaults.
+*/
+struct RandomForestConfig
+{
+    size_t struct_size;      // 'sizeof(RandomForestConfig)' of the caller, set by 'rf_config_init'.
+    size_t n_estimators;     // Number of trees in the forest.
+    size_t max_depth;        // Maximum depth of a tree.
+    size_t min_samples_leaf; // Minimum number of rows at a leaf node.
+    size_t max_features;     // Number of features considered per split, capped at the number of features.
+    int extra_trees;         // Non-zero to draw one random threshold per sampled feature.
+    size_t quantile_bins;    // Non-zero to only search splits over this many quantile bins per feature.
+    int compact;             // Non-zero to compact every tree after training.
+    unsigned int seed;       // Non-zero to make every tree reproducible, including trees added later.
+    size_t max_split_samples; // Non-zero to search the split of larger nodes on a sample of this many rows.
+    int oblivious;           // Non-zero to grow oblivious trees, which predict from branch-free lookup tables.
+    double time_budget;      // Non-zero to stop starting trees after this many seconds of 'rf_train' or 'rf_add_trees'.
+};
+
+typedef struct RandomForestConfig RandomForestConfig;
+
+/*
+Fills the first 'struct_size' bytes of 'config' with the default configuration, the same as the one used by
+the command line tool, and sets 'config->struct_size'.
+*/
+RF_API void rf_config_init(RandomForestConfig *config, size_t struct_size);
+
+/*
+Returns the default configuration. Inline, so that the struct is only ever passed by value within the program
+and never across the library boundary.
+*/
+static inline RandomForestConfig rf_default_config()
+{
+    RandomForestConfig config;
+    rf_config_init(&config, sizeof(RandomForestConfig));
+    return config;
+}
+
+/*
+Creates an untrained model with the given 'config', or the defaults if 'config' is NULL. Returns NULL if
+'config->struct_size' is not set.
+*/
+RF_API RandomForest *rf_create(const RandomForestConfig *config);
+
+/*
+Trains the model on 'rows' rows of 'cols' doubles each, stored row-major in 'data' with the class target
+(0 or 1) in the last column. A model that was trained before is replaced. Returns 0 on success or -1.
+*/
+RF_API int rf_train(RandomForest *forest, const double *data, size_t rows, size_t cols);
+
+/*
+Warm start: appends 'n_trees' trees trained on 'data' (same layout as for 'rf_train') to the model, keeping
+its existing trees, or trains a model of 'n_trees' trees if it is not trained yet. Works on trained and on
+loaded models, the data must have the features the model was trained on. With a non-zero 'seed' the new
+trees continue the seeding of the existing ones, so growing a model from 100 to 150 trees gives the same
+model as training 150 trees at once on the same data. Returns 0 on success or -1.
+
+With a 'time_budget' both 'rf_train' and 'rf_add_trees' stop starting trees once the next one is not
+expected to finish within the budget. Trees that were started are finished and at least one tree is trained,
+so the model can have fewer trees than asked for, see 'rf_n_trees'. With a seed those are the first trees of
+the model that would have been trained without the budget.
+*/
+RF_API int rf_add_trees(RandomForest *forest, const double *data, size_t rows, size_t cols, size_t n_trees);
+
+/*
+Number of held out rows 'rf_prune' times the predictions of every smaller model on.
+*/
+#define RF_PRUNE_TIMED_ROWS 256
+
+/*
+Shrinks a trained model to the fewest trees that are about as accurate as all of them, for cheaper
+predictions. The trees are ordered by greedy forward selection on the 'rows' held out rows of 'data' (same
+layout as for 'rf_train', rows the model was not trained on): every next tree is the one that makes the
+majority vote of the trees before it most accurate. The smallest first trees whose accuracy on the held out
+rows is at most 'epsilon' below that of the whole model are kept and the others freed.
+
+If not NULL, 'accuracies' and 'latencies' (with room for the number of trees before pruning) receive the
+accuracy on the held out rows and the mean prediction time per row in seconds of the first 'k + 1' trees
+for every 'k'. That is the trade-off curve between the size of the model and its accuracy. The branch
+profile of the model is dropped. Trees added to a pruned model are seeded past all trees it had before, which
+'rf_save' keeps with the model, so they never repeat a kept or dropped tree. Returns the number of trees kept
+or -1.
+*/
+RF_API int rf_prune(RandomForest *forest,
+                    const double *data,
+                    size_t rows,
+                    size_t cols,
+                    double epsilon,
+                    double *accuracies,
+                    double *latencies);
+
+/*
+Returns the predicted class target (0 or 1) of a single 'row' of 'rf_n_features' doubles, or -1 if the
+model is not trained.
+*/
+RF_API int rf_predict(const RandomForest *forest, const double *row);
+
+/*
+Predicts 'n_rows' rows of 'rf_n_features' doubles each, stored row-major in 'rows', into 'predictions'.
+Walks every tree for all rows before moving to the next tree, which keeps the tree in cache. Returns 0 on
+success or -1 if the model is not trained.
+*/
+RF_API int rf_predict_batch(const RandomForest *forest, const double *rows, size_t n_rows, int *predictions);
+
+/*
+Counts the branches the 'n_rows' rows of 'cols' doubles each, stored row-major in 'rows', take through the
+model, such as its training data or a sample of scoring traffic, and lays out its nodes for them: every node
+is followed in memory by the child more rows went to, and the most visited nodes are packed together, which
+makes single-row 'rf_predict' calls miss the cache less. Counts add up over calls. Predictions do not change.
+The counts are saved with the model by 'rf_save' and the layout is rebuilt by 'rf_load', training or adding
+trees drops them. Only the first 'rf_n_features' values of a row are read, so training data can be passed
+with its class target column. Returns 0 on success or -1.
+*/
+RF_API int rf_profile(RandomForest *forest, const double *rows, size_t n_rows, size_t cols);
+
+/*
+Returns the number of features a row must have, 0 if the model is not trained.
+*/
+RF_API size_t rf_n_features(const RandomForest *forest);
+
+/*
+Returns the number of trees of the model, 0 if the model is not trained.
+*/
+RF_API size_t rf_n_trees(const RandomForest *forest);
+
+/*
+Saves a trained model into 'file_name'. Returns 0 on success or -1.
+*/
+RF_API int rf_save(const RandomForest *forest, const char *file_name);
+
+/*
+Loads a model saved with 'rf_save'. Returns NULL if the file can't be read, is not a model or is corrupt.
+*/
+RF_API RandomForest *rf_load(const char *file_name);
+
+/*
+Frees the model, NULL is ignored.
+*/
+RF_API void rf_free(RandomForest *forest);
+
+/*
+Caps the memory of training in this process at 'bytes', 0 for no cap (the default). Training never goes over
+the budget to grow a tree deeper, it makes a leaf instead, so a model trained under a tight budget has
+shallower trees. Applies to every model of the process.
+*/
+RF_API void rf_set_memory_budget(size_t bytes);
+
+/*
+Checkpoints the trees of every model of this process being trained with a non-zero 'seed' (and no
+'time_budget') into the existing directory 'dir' every 'interval' seconds, NULL to stop (the default). If the
+process is killed, training the same model on the same data again reads the checkpointed trees back and only
+trains the rest, which gives the same model as a training that was never killed. Checkpoints are written to a
+temporary file and renamed into place, and removed once their model is trained. The string 'dir' must stay
+valid until checkpoints are stopped.
+*/
+RF_API void rf_set_checkpoint(const char *dir, double interval);
+
+/*
+Returns the number of bytes the library currently has allocated in this process.
+*/
+RF_API size_t rf_memory_usage();
+
+/*
+Returns the highest number of bytes the library had allocated at once in this process.
+*/
+RF_API size_t rf_memory_peak();
+
+/*
+Returns a description of the last error of the calling thread.
+*/
+RF_API const char *rf_last_error();
+
+#endif // random_forest_h
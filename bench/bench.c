@@ -0,0 +1,461 @@
+/*
+@author andrii dobroshynski
+*/
+
+#include <argp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../eval/eval.h"
+#include "../utils/memory.h"
+#include "../utils/synthetic.h"
+
+/* Program documentation. */
+static char doc[] =
+    "rf-bench -- Repeatable benchmarks of random-forests-c on synthetic data, reported as JSON";
+
+/* The options we understand. */
+static struct argp_option options[] = {
+    {"rows", 'r', "number", 0, "Number of rows of synthetic data. Defaults to 100.", 0},
+    {"cols", 'c', "number", 0, "Number of columns of synthetic data, including the class target. Defaults to 20.", 0},
+    {"classes", 'k', "number", 0, "Number of class target values, only 2 is supported for now. Defaults to 2.", 0},
+    {"informative", 'i', "fraction", 0, "Fraction of features the class target depends on. Defaults to 0.2.", 0},
+    {"sparsity", 'z', "fraction", 0, "Fraction of feature values that are zero. Defaults to 0.", 0},
+    {"seed", 's', "number", 0, "Random seed for the data and the model. Defaults to 1.", 0},
+    {"n_estimators", 'n', "number", 0, "Number of trees. Defaults to 5.", 1},
+    {"max_depth", 'd', "number", 0, "Maximum depth of a tree. Defaults to 7.", 1},
+    {"max_features", 'm', "number", 0, "Number of features considered per split. Defaults to 3.", 1},
+    {"k_folds", 'f', "number", 0, "Number of folds for the cross_validate benchmark. Defaults to 5.", 1},
+    {"extra_trees", 'x', 0, 0, "Grow extremely randomized trees.", 1},
+    {"max_split_samples", 'N', "number", 0, "Search the split of larger nodes on a sample of this many rows. Defaults to 0, all rows.", 1},
+    {"oblivious", 'O', 0, 0, "Grow oblivious trees, predict_model then predicts from their lookup tables.", 1},
+    {"layout", 'L', 0, 0, "Lay out the model for the branches the data takes through it, predict_model then predicts from the layout.", 1},
+    {"repeat", 'R', "number", 0, "Number of times every benchmark is run, the fastest run is reported. Defaults to 3.", 2},
+    {"output", 'o', "file", 0, "Write the JSON report into 'file' instead of stdout.", 2},
+    {"baseline", 'b', "file", 0, "Compare against a JSON report from an earlier run and exit with status 2 on regressions.", 2},
+    {"tolerance", 't', "fraction", 0, "Allowed slowdown against the baseline before reporting a regression. Defaults to 0.1.", 2},
+    {0}};
+
+/* Used by main to communicate with parse_opt. */
+struct arguments
+{
+    SyntheticDataParameters data_params;
+    RandomForestParameters params;
+    int layout;
+    int k_folds;
+    int repeat;
+    char *output;
+    char *baseline;
+    double tolerance;
+};
+
+/* Parse a single option. */
+static error_t
+parse_opt(int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+
+    switch (key)
+    {
+    case 'r':
+        arguments->data_params.rows = atol(arg);
+        break;
+    case 'c':
+        arguments->data_params.cols = atol(arg);
+        break;
+    case 'k':
+        arguments->data_params.classes = atol(arg);
+        break;
+    case 'i':
+        arguments->data_params.informative = atof(arg);
+        break;
+    case 'z':
+        arguments->data_params.sparsity = atof(arg);
+        break;
+    case 's':
+        arguments->data_params.seed = strtoull(arg, NULL, 10);
+        break;
+    case 'n':
+        arguments->params.n_estimators = atol(arg);
+        break;
+    case 'd':
+        arguments->params.max_depth = atol(arg);
+        break;
+    case 'm':
+        arguments->params.max_features = atol(arg);
+        break;
+    case 'f':
+        arguments->k_folds = atoi(arg);
+        break;
+    case 'x':
+        arguments->params.split_mode = SPLIT_MODE_RANDOM;
+        break;
+    case 'N':
+        arguments->params.max_split_samples = atol(arg);
+        break;
+    case 'O':
+        arguments->params.oblivious = 1;
+        break;
+    case 'L':
+        arguments->layout = 1;
+        break;
+    case 'R':
+        arguments->repeat = atoi(arg);
+        break;
+    case 'o':
+        arguments->output = arg;
+        break;
+    case 'b':
+        arguments->baseline = arg;
+        break;
+    case 't':
+        arguments->tolerance = atof(arg);
+        break;
+
+    case ARGP_KEY_ARG:
+        argp_usage(state);
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/*
+Data and models shared by the benchmarks.
+*/
+struct BenchmarkState
+{
+    const struct arguments *arguments;
+    struct dim csv_dim;
+    char csv_file[64];
+
+    double **data;                         // Generated data in the pivoted two-dimensional layout.
+    double *flat_data;                     // Same data in the flat layout 'parse_csv' produces.
+    const DecisionTreeNode **random_forest; // Model used by the predict benchmark.
+    ObliviousForest *oblivious_forest;      // Lookup tables of the model with --oblivious.
+    LayoutForest *layout_forest;            // Model laid out for its branches on the data with --layout.
+    ModelContext ctx;
+};
+
+/*
+A single benchmark along with the number of rows it processes per run.
+*/
+struct Benchmark
+{
+    const char *name;
+    void (*run)(struct BenchmarkState *state);
+    size_t (*rows)(const struct BenchmarkState *state);
+};
+
+/*
+Result of a benchmark: the fastest wall time over all runs and the most memory the benchmark allocated
+through the library on top of what was already allocated when it began.
+*/
+struct BenchmarkResult
+{
+    const char *name;
+    size_t rows;
+    double wall_time;
+    size_t peak_memory_kb;
+    double baseline_wall_time;
+};
+
+size_t all_rows(const struct BenchmarkState *state)
+{
+    return state->csv_dim.rows;
+}
+
+size_t all_rows_per_fold(const struct BenchmarkState *state)
+{
+    return state->csv_dim.rows * state->arguments->k_folds;
+}
+
+void run_csv_load(struct BenchmarkState *state)
+{
+    struct dim csv_dim = parse_csv_dims(state->csv_file);
+    double *data = tracked_malloc(sizeof(double) * csv_dim.rows * csv_dim.cols, MEMORY_TAG_DATA);
+    parse_csv(state->csv_file, &data, csv_dim, NULL, 0);
+    tracked_free(data, MEMORY_TAG_DATA);
+}
+
+void run_pivot_data(struct BenchmarkState *state)
+{
+    double **pivoted_data;
+    pivot_data(state->flat_data, state->csv_dim, &pivoted_data);
+    tracked_free(pivoted_data, MEMORY_TAG_DATA);
+}
+
+void run_split_search(struct BenchmarkState *state)
+{
+    srand(state->arguments->data_params.seed);
+    DecisionTreeDataSplit split = calculate_best_data_split(state->data,
+                                                            state->arguments->params.max_features,
+                                                            state->arguments->params.split_mode,
+                                                            state->arguments->params.max_split_samples,
+                                                            state->csv_dim.rows,
+                                                            state->csv_dim.cols,
+                                                            &state->ctx);
+    free_decision_tree_data(split.data);
+}
+
+void run_train_model(struct BenchmarkState *state)
+{
+    srand(state->arguments->data_params.seed);
+    const DecisionTreeNode **random_forest = train_model(state->data,
+                                                         &state->arguments->params,
+                                                         &state->csv_dim,
+                                                         &state->ctx,
+                                                         NULL);
+    free_random_forest(&random_forest, state->arguments->params.n_estimators);
+}
+
+void run_predict_model(struct BenchmarkState *state)
+{
+    if (state->random_forest == NULL)
+    {
+        srand(state->arguments->data_params.seed);
+        state->random_forest = train_model(state->data, &state->arguments->params, &state->csv_dim, &state->ctx, NULL);
+        if (state->arguments->params.oblivious)
+            state->oblivious_forest = compile_oblivious_forest(state->random_forest, state->arguments->params.n_estimators);
+        if (state->arguments->layout)
+        {
+            BranchProfile *profile = create_branch_profile(state->random_forest, state->arguments->params.n_estimators);
+            for (size_t i = 0; i < state->csv_dim.rows; ++i)
+                profile_row(profile, state->random_forest, state->data[i]);
+            state->layout_forest = layout_random_forest(state->random_forest, state->arguments->params.n_estimators, profile);
+            free_branch_profile(profile);
+        }
+    }
+
+    volatile int sink = 0;
+    for (size_t i = 0; i < state->csv_dim.rows; ++i)
+    {
+        if (state->oblivious_forest)
+            sink += predict_oblivious(state->oblivious_forest, state->data[i]);
+        else if (state->layout_forest)
+            sink += predict_layout(state->layout_forest, state->data[i]);
+        else
+            sink += predict_model(&state->random_forest, state->arguments->params.n_estimators, state->data[i]);
+    }
+    (void)sink;
+}
+
+void run_cross_validate(struct BenchmarkState *state)
+{
+    srand(state->arguments->data_params.seed);
+    cross_validate(state->data, &state->arguments->params, &state->csv_dim, state->arguments->k_folds, NULL);
+}
+
+/*
+Looks up the wall time of the benchmark 'name' in a JSON report written by an earlier run. Returns a
+negative value if the report has no such benchmark.
+*/
+double find_baseline_wall_time(const char *report, const char *name)
+{
+    char key[128];
+    snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+
+    const char *entry = strstr(report, key);
+    if (entry == NULL)
+        return -1;
+
+    const char *wall_time = strstr(entry, "\"wall_time_s\":");
+    if (wall_time == NULL)
+        return -1;
+    return atof(wall_time + strlen("\"wall_time_s\":"));
+}
+
+/*
+Reads the whole file at 'file_name' into a newly allocated string.
+*/
+char *read_file(const char *file_name)
+{
+    FILE *file = fopen(file_name, "r");
+    if (file == NULL)
+    {
+        printf("Error: can't open file: %s\n", file_name);
+        exit(-1);
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+
+    char *contents = malloc(size + 1);
+    contents[fread(contents, 1, size, file)] = '\0';
+    fclose(file);
+    return contents;
+}
+
+void write_report(FILE *out,
+                  const struct arguments *arguments,
+                  size_t data_kb,
+                  const struct BenchmarkResult *results,
+                  size_t n_results)
+{
+    const SyntheticDataParameters *data_params = &arguments->data_params;
+    const RandomForestParameters *params = &arguments->params;
+
+    fprintf(out, "{\n  \"config\": {\n");
+    fprintf(out, "    \"rows\": %ld,\n    \"cols\": %ld,\n    \"classes\": %ld,\n", data_params->rows, data_params->cols, data_params->classes);
+    fprintf(out, "    \"informative\": %g,\n    \"sparsity\": %g,\n    \"seed\": %llu,\n", data_params->informative, data_params->sparsity, (unsigned long long)data_params->seed);
+    fprintf(out, "    \"n_estimators\": %ld,\n    \"max_depth\": %ld,\n    \"max_features\": %ld,\n", params->n_estimators, params->max_depth, params->max_features);
+    fprintf(out, "    \"split_mode\": %d,\n    \"max_split_samples\": %ld,\n", params->split_mode, params->max_split_samples);
+    fprintf(out, "    \"oblivious\": %d,\n    \"layout\": %d,\n", params->oblivious, arguments->layout);
+    fprintf(out, "    \"k_folds\": %d,\n    \"repeat\": %d,\n", arguments->k_folds, arguments->repeat);
+    fprintf(out, "    \"data_kb\": %ld\n  },\n", data_kb);
+
+    fprintf(out, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i < n_results; ++i)
+    {
+        const struct BenchmarkResult *result = &results[i];
+        fprintf(out, "    {\"name\": \"%s\", \"wall_time_s\": %.9f, \"rows\": %ld, \"rows_per_s\": %.1f, \"peak_memory_kb\": %ld",
+                result->name,
+                result->wall_time,
+                result->rows,
+                result->rows / result->wall_time,
+                result->peak_memory_kb);
+        if (result->baseline_wall_time > 0)
+        {
+            double ratio = result->wall_time / result->baseline_wall_time;
+            fprintf(out, ", \"baseline_wall_time_s\": %.9f, \"ratio\": %.4f, \"regression\": %s",
+                    result->baseline_wall_time,
+                    ratio,
+                    ratio > 1 + arguments->tolerance ? "true" : "false");
+        }
+        fprintf(out, "}%s\n", i + 1 < n_results ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct arguments arguments = {
+        data_params : {rows : 100, cols : 20, classes : 2, informative : 0.2, sparsity : 0, seed : 1},
+        params : {n_estimators : 5, max_depth : 7, min_samples_leaf : 2, max_features : 3},
+        layout : 0,
+        k_folds : 5,
+        repeat : 3,
+        output : NULL,
+        baseline : NULL,
+        tolerance : 0.1
+    };
+
+    static struct argp argp = {options, parse_opt, 0, doc};
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    // Benchmarks only report through the JSON, keep the library quiet.
+    set_log_level(0);
+
+    if (arguments.data_params.classes != 2)
+    {
+        printf("Error: currently only support binary classification, got --classes=%ld\n", arguments.data_params.classes);
+        exit(1);
+    }
+    if (arguments.params.max_features > arguments.data_params.cols - 1)
+        arguments.params.max_features = arguments.data_params.cols - 1;
+
+    struct BenchmarkState state = {
+        arguments : &arguments,
+        csv_dim : {rows : arguments.data_params.rows, cols : arguments.data_params.cols},
+        random_forest : NULL,
+        oblivious_forest : NULL,
+        layout_forest : NULL,
+        ctx : {testingFoldIdx : 0, rowsPerFold : 0}
+    };
+
+    // Generate the data once and keep a csv copy of it for the load benchmark.
+    state.data = generate_synthetic_data(&arguments.data_params);
+    state.flat_data = tracked_malloc(sizeof(double) * state.csv_dim.rows * state.csv_dim.cols, MEMORY_TAG_DATA);
+    for (size_t i = 0; i < state.csv_dim.rows; ++i)
+        memcpy(state.flat_data + i * state.csv_dim.cols, state.data[i], sizeof(double) * state.csv_dim.cols);
+
+    // The generated data and its flat copy are held by every benchmark, so they are reported once.
+    size_t data_kb = get_memory_usage(MEMORY_TAG_COUNT) / 1024;
+
+    snprintf(state.csv_file, sizeof(state.csv_file), "/tmp/rf-bench-XXXXXX");
+    int fd = mkstemp(state.csv_file);
+    if (fd < 0)
+    {
+        printf("Error: can't create a temporary file for the csv data\n");
+        exit(1);
+    }
+    close(fd);
+    write_csv(state.data, &state.csv_dim, state.csv_file);
+
+    const struct Benchmark benchmarks[] = {
+        {"csv_load", run_csv_load, all_rows},
+        {"pivot_data", run_pivot_data, all_rows},
+        {"split_search", run_split_search, all_rows},
+        {"train_model", run_train_model, all_rows},
+        {"predict_model", run_predict_model, all_rows},
+        {"cross_validate", run_cross_validate, all_rows_per_fold},
+    };
+    size_t n_benchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+    char *baseline = arguments.baseline ? read_file(arguments.baseline) : NULL;
+
+    struct BenchmarkResult results[sizeof(benchmarks) / sizeof(benchmarks[0])];
+    int regressions = 0;
+    for (size_t b = 0; b < n_benchmarks; ++b)
+    {
+        // A first untimed run of predict_model trains the model it uses.
+        if (benchmarks[b].run == run_predict_model)
+            run_predict_model(&state);
+
+        // Peaks are measured per benchmark, above what earlier benchmarks left allocated.
+        size_t usage_before = get_memory_usage(MEMORY_TAG_COUNT);
+        reset_memory_peaks();
+
+        double best = -1;
+        for (int r = 0; r < arguments.repeat; ++r)
+        {
+            double begin = get_monotonic_time();
+            benchmarks[b].run(&state);
+            double elapsed = get_monotonic_time() - begin;
+            if (best < 0 || elapsed < best)
+                best = elapsed;
+        }
+
+        results[b] = (struct BenchmarkResult){
+            name : benchmarks[b].name,
+            rows : benchmarks[b].rows(&state),
+            wall_time : best,
+            peak_memory_kb : (get_memory_peak(MEMORY_TAG_COUNT) - usage_before) / 1024,
+            baseline_wall_time : baseline ? find_baseline_wall_time(baseline, benchmarks[b].name) : -1
+        };
+
+        if (results[b].baseline_wall_time > 0 &&
+            results[b].wall_time > results[b].baseline_wall_time * (1 + arguments.tolerance))
+            ++regressions;
+    }
+
+    FILE *out = arguments.output ? fopen(arguments.output, "w") : stdout;
+    if (out == NULL)
+    {
+        printf("Error: can't open file for writing: %s\n", arguments.output);
+        exit(-1);
+    }
+    write_report(out, &arguments, data_kb, results, n_benchmarks);
+    if (out != stdout)
+        fclose(out);
+
+    unlink(state.csv_file);
+    free(baseline);
+    tracked_free(state.data, MEMORY_TAG_DATA);
+    tracked_free(state.flat_data, MEMORY_TAG_DATA);
+    if (state.random_forest)
+        free_random_forest(&state.random_forest, arguments.params.n_estimators);
+    free_oblivious_forest(state.oblivious_forest);
+    free_layout_forest(state.layout_forest);
+
+    if (regressions)
+    {
+        fprintf(stderr, "%d benchmark(s) regressed by more than %.0f%% against %s\n",
+                regressions, arguments.tolerance * 100, arguments.baseline);
+        return 2;
+    }
+    return 0;
+}
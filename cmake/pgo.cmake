@@ -0,0 +1,45 @@
+# Profile-guided optimization workflow, run by the 'pgo' target:
+#
+#   cmake -P cmake/pgo.cmake -DSOURCE_DIR=<source> -DBINARY_DIR=<build> [-DC_COMPILER=...] [-DC_FLAGS=...]
+#
+# Both phases use the same build directory, since GCC names the profile of every object after its path.
+
+if(NOT SOURCE_DIR OR NOT BINARY_DIR)
+    message(FATAL_ERROR "SOURCE_DIR and BINARY_DIR must be set")
+endif()
+
+set(PROFILE_DIR "${BINARY_DIR}/pgo-profile")
+set(CONFIGURE_ARGS
+    -S "${SOURCE_DIR}"
+    -B "${BINARY_DIR}"
+    -DCMAKE_BUILD_TYPE=Release
+    "-DCMAKE_C_FLAGS=${C_FLAGS}"
+    "-DRANDOM_FOREST_MARCH=${MARCH}"
+    "-DRANDOM_FOREST_PGO_DIR=${PROFILE_DIR}")
+if(C_COMPILER)
+    list(APPEND CONFIGURE_ARGS "-DCMAKE_C_COMPILER=${C_COMPILER}")
+endif()
+
+function(run_step)
+    execute_process(COMMAND ${ARGN} RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "PGO step failed (${result}): ${ARGN}")
+    endif()
+endfunction()
+
+# 1. Instrumented build.
+file(REMOVE_RECURSE "${PROFILE_DIR}")
+run_step(${CMAKE_COMMAND} ${CONFIGURE_ARGS} -DRANDOM_FOREST_PGO=GENERATE)
+run_step(${CMAKE_COMMAND} --build "${BINARY_DIR}")
+
+# 2. Representative workload: loading, split search, training, scoring and cross validation on synthetic
+#    data, with both the exhaustive and the randomized split search.
+set(WORKLOAD_ARGS --rows=400 --cols=20 --n_estimators=10 --max_depth=10 --repeat=1 --output=${BINARY_DIR}/pgo-workload.json)
+run_step("${BINARY_DIR}/rf-bench" ${WORKLOAD_ARGS})
+run_step("${BINARY_DIR}/rf-bench" ${WORKLOAD_ARGS} --extra_trees --seed=2)
+
+# 3. Optimized build with the recorded profile.
+run_step(${CMAKE_COMMAND} ${CONFIGURE_ARGS} -DRANDOM_FOREST_PGO=USE)
+run_step(${CMAKE_COMMAND} --build "${BINARY_DIR}")
+
+message(STATUS "PGO-optimized binaries are in ${BINARY_DIR}")
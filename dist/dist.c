@@ -0,0 +1,871 @@
+/*
+@author andrii dobroshynski
+*/
+
+#define _GNU_SOURCE
+
+#include <argp.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "../model/forest.h"
+#include "../utils/data.h"
+#include "../utils/memory.h"
+#include "../utils/utils.h"
+
+/*
+Protocol between a worker and the coordinator. All integers are native-endian, same as in the model file, so
+all hosts must be of the same kind of machine.
+
+  worker hello:       "RFDIST1\0", uint64 rows, uint64 cols, uint64 data hash
+  coordinator config: uint64[DIST_CONFIG_FIELDS] training parameters, see 'write_config'
+  coordinator assign: uint64 tree index, or DIST_DONE once every tree is trained
+  worker tree:        uint64 tree index, uint64 size, 'size' bytes of the tree in 'save_tree_node' form
+
+The coordinator closes the connection instead of sending the config if the worker loaded different data.
+Every worker has at most one tree assigned at a time, so faster workers train more trees, and the tree of a
+worker that goes away is assigned to another one. With a time budget the coordinator stops assigning trees once
+the next one is not expected to finish in time, lets the workers finish the trees they have and sends them
+DIST_DONE early.
+*/
+
+static const char DIST_MAGIC[8] = {'R', 'F', 'D', 'I', 'S', 'T', '1', '\0'};
+
+#define DIST_CONFIG_FIELDS 8
+#define DIST_DONE UINT64_MAX
+
+/* Most workers of a single coordinator. */
+#define MAX_WORKERS 256
+
+/* Program documentation. */
+static char doc[] =
+    "rf-dist -- Trains a random forest across worker processes, locally or on several hosts\v"
+    "Addresses are 'unix:<path>' or 'tcp:<host>:<port>'. Run the coordinator with --local=N to fork N local "
+    "workers, or with --listen=ADDRESS --workers=N and start N workers with --connect=ADDRESS on hosts that have "
+    "the same CSV_FILE. With the same --seed the model is the same as one trained in a single process.";
+
+/* A description of the arguments we accept. */
+static char args_doc[] = "CSV_FILE";
+
+/* The options we understand. */
+static struct argp_option options[] = {
+    {"local", 'L', "number", 0, "Coordinate this many workers forked on this host.", 0},
+    {"listen", 'a', "address", 0, "Coordinate workers connecting to 'address'.", 0},
+    {"workers", 'W', "number", 0, "Number of workers to wait for with --listen. Defaults to 1.", 0},
+    {"connect", 'k', "address", 0, "Run as a worker of the coordinator at 'address'.", 0},
+    {"n_estimators", 'n', "number", 0, "Number of trees. Defaults to 3.", 1},
+    {"max_depth", 'd', "number", 0, "Maximum depth of a tree. Defaults to 7.", 1},
+    {"min_samples_leaf", 'l', "number", 0, "Minimum number of rows at a leaf. Defaults to 3.", 1},
+    {"max_features", 'm', "number", 0, "Number of features considered per split. Defaults to 3.", 1},
+    {"extra_trees", 'x', 0, 0, "Grow extremely randomized trees.", 1},
+    {"quantile_bins", 'q', "number", 0, "Only search splits over this many quantile bins per feature.", 1},
+    {"compact", 'C', 0, 0, "Compact every tree after training.", 1},
+    {"seed", 's', "number", 0, "Seed of the model, must be non-zero. Defaults to 1.", 1},
+    {"time_budget", 'B', "seconds", 0, "Stop handing out trees once the next one is not expected to finish within this many seconds of training. Trees being trained are finished, the model keeps the first trees that all finished.", 1},
+    {"save_model", 'o', "file", 0, "Save the trained model to 'file', for loading with 'rf_load'.", 2},
+    {"verify", 'V', 0, 0, "Also train the model in this process and check that it is identical.", 2},
+    {0}};
+
+/* Used by main to communicate with parse_opt. */
+struct arguments
+{
+    RandomForestParameters params;
+    size_t local_workers;
+    size_t workers;
+    char *listen_address;
+    char *connect_address;
+    char *model_output;
+    int verify;
+    char *csv_file;
+};
+
+/* Parse a single option. */
+static error_t
+parse_opt(int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+
+    switch (key)
+    {
+    case 'L':
+        arguments->local_workers = atol(arg);
+        break;
+    case 'a':
+        arguments->listen_address = arg;
+        break;
+    case 'W':
+        arguments->workers = atol(arg);
+        break;
+    case 'k':
+        arguments->connect_address = arg;
+        break;
+    case 'n':
+        arguments->params.n_estimators = atol(arg);
+        break;
+    case 'd':
+        arguments->params.max_depth = atol(arg);
+        break;
+    case 'l':
+        arguments->params.min_samples_leaf = atol(arg);
+        break;
+    case 'm':
+        arguments->params.max_features = atol(arg);
+        break;
+    case 'x':
+        arguments->params.split_mode = SPLIT_MODE_RANDOM;
+        break;
+    case 'q':
+        arguments->params.split_mode = SPLIT_MODE_QUANTILE;
+        arguments->params.max_bins = atol(arg);
+        break;
+    case 'C':
+        arguments->params.compact_trees = 1;
+        break;
+    case 's':
+        arguments->params.seed = strtoul(arg, NULL, 10);
+        break;
+    case 'B':
+        arguments->params.time_budget = atof(arg);
+        break;
+    case 'o':
+        arguments->model_output = arg;
+        break;
+    case 'V':
+        arguments->verify = 1;
+        break;
+
+    case ARGP_KEY_ARG:
+        if (state->arg_num >= 1)
+            argp_usage(state);
+        arguments->csv_file = arg;
+        break;
+
+    case ARGP_KEY_END:
+        if (state->arg_num < 1)
+            argp_usage(state);
+        if ((arguments->local_workers > 0) + (arguments->listen_address != NULL) + (arguments->connect_address != NULL) != 1)
+            argp_error(state, "exactly one of --local, --listen or --connect must be given");
+        if (arguments->params.seed == 0)
+            argp_error(state, "--seed must be non-zero, the trees are seeded from it");
+        if (arguments->params.time_budget < 0)
+            argp_error(state, "--time_budget must be >= 0");
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Our argp parser. */
+static struct argp argp = {options, parse_opt, args_doc, doc, 0, 0, 0};
+
+/*
+A transport that workers and the coordinator talk over, picked by the prefix of the address.
+*/
+struct Transport
+{
+    const char *prefix;
+    int (*listen)(const char *address);
+    int (*connect)(const char *address);
+};
+
+/*
+Fills in 'address' for the Unix domain socket at 'path'.
+*/
+void unix_socket_address(const char *path, struct sockaddr_un *address)
+{
+    (*address) = (struct sockaddr_un){sun_family : AF_UNIX};
+    if (strlen(path) >= sizeof(address->sun_path))
+    {
+        fprintf(stderr, "Error: socket path is too long: %s\n", path);
+        exit(1);
+    }
+    strcpy(address->sun_path, path);
+}
+
+int listen_unix(const char *path)
+{
+    struct sockaddr_un address;
+    unix_socket_address(path, &address);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, MAX_WORKERS) != 0)
+        return -1;
+    return fd;
+}
+
+int connect_unix(const char *path)
+{
+    struct sockaddr_un address;
+    unix_socket_address(path, &address);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+        return -1;
+    return fd;
+}
+
+/*
+Resolves 'host:port' into addresses for a TCP socket, 'passive' for listening. Returns NULL on failure.
+*/
+struct addrinfo *resolve_tcp(const char *address, int passive)
+{
+    const char *colon = strrchr(address, ':');
+    if (colon == NULL)
+    {
+        fprintf(stderr, "Error: expected 'tcp:<host>:<port>', got: tcp:%s\n", address);
+        exit(1);
+    }
+    char host[256];
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - address), address);
+
+    struct addrinfo hints = {ai_flags : passive ? AI_PASSIVE : 0, ai_family : AF_UNSPEC, ai_socktype : SOCK_STREAM};
+    struct addrinfo *result = NULL;
+    if (getaddrinfo(host[0] ? host : NULL, colon + 1, &hints, &result) != 0)
+        return NULL;
+    return result;
+}
+
+/*
+Tree messages are small and sent whole, so don't delay them.
+*/
+void set_no_delay(int fd)
+{
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+int listen_tcp(const char *address)
+{
+    struct addrinfo *result = resolve_tcp(address, 1);
+    int fd = -1;
+    for (struct addrinfo *info = result; info && fd < 0; info = info->ai_next)
+    {
+        fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        int one = 1;
+        if (fd >= 0 &&
+            (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+             bind(fd, info->ai_addr, info->ai_addrlen) != 0 ||
+             listen(fd, MAX_WORKERS) != 0))
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (result)
+        freeaddrinfo(result);
+    return fd;
+}
+
+int connect_tcp(const char *address)
+{
+    struct addrinfo *result = resolve_tcp(address, 0);
+    int fd = -1;
+    for (struct addrinfo *info = result; info && fd < 0; info = info->ai_next)
+    {
+        fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+        if (fd >= 0 && connect(fd, info->ai_addr, info->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (result)
+        freeaddrinfo(result);
+    if (fd >= 0)
+        set_no_delay(fd);
+    return fd;
+}
+
+static const struct Transport transports[] = {
+    {"unix:", listen_unix, connect_unix},
+    {"tcp:", listen_tcp, connect_tcp}};
+
+/*
+Returns the transport of 'address' and points 'rest' past its prefix.
+*/
+const struct Transport *find_transport(const char *address, const char **rest)
+{
+    for (size_t i = 0; i < sizeof(transports) / sizeof(transports[0]); ++i)
+    {
+        size_t length = strlen(transports[i].prefix);
+        if (strncmp(address, transports[i].prefix, length) == 0)
+        {
+            (*rest) = address + length;
+            return &transports[i];
+        }
+    }
+    fprintf(stderr, "Error: unknown transport of address %s, expected 'unix:<path>' or 'tcp:<host>:<port>'\n", address);
+    exit(1);
+}
+
+int write_all(int fd, const void *data, size_t size)
+{
+    const char *bytes = data;
+    while (size > 0)
+    {
+        ssize_t n = write(fd, bytes, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        bytes += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int read_all(int fd, void *data, size_t size)
+{
+    char *bytes = data;
+    while (size > 0)
+    {
+        ssize_t n = read(fd, bytes, size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        bytes += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/*
+Loads CSV_FILE into the pivoted two-dimensional layout.
+*/
+double **load_data(const char *file_name, struct dim *csv_dim)
+{
+    (*csv_dim) = parse_csv_dims(file_name);
+    if (csv_dim->rows == 0 || csv_dim->cols < 2)
+    {
+        fprintf(stderr, "Error: expected at least one row and one feature column in %s\n", file_name);
+        exit(1);
+    }
+
+    double *data = malloc(sizeof(double) * csv_dim->rows * csv_dim->cols);
+    parse_csv(file_name, &data, (*csv_dim), NULL, 0);
+
+    double **pivoted_data;
+    pivot_data(data, (*csv_dim), &pivoted_data);
+    free(data);
+    return pivoted_data;
+}
+
+void write_config(int fd, const RandomForestParameters *params)
+{
+    uint64_t config[DIST_CONFIG_FIELDS] = {
+        params->n_estimators,
+        params->max_depth,
+        params->min_samples_leaf,
+        params->max_features,
+        params->split_mode,
+        params->max_bins,
+        params->compact_trees,
+        params->seed};
+    write_all(fd, config, sizeof(config));
+}
+
+int read_config(int fd, RandomForestParameters *params)
+{
+    uint64_t config[DIST_CONFIG_FIELDS];
+    if (read_all(fd, config, sizeof(config)) != 0 || config[4] > SPLIT_MODE_QUANTILE)
+        return -1;
+
+    (*params) = (RandomForestParameters){
+        n_estimators : config[0],
+        max_depth : config[1],
+        min_samples_leaf : config[2],
+        max_features : config[3],
+        split_mode : (DecisionTreeSplitMode)config[4],
+        max_bins : config[5],
+        compact_trees : (int)config[6],
+        quantize : 0,
+        seed : (unsigned int)config[7]
+    };
+    return 0;
+}
+
+/*
+Context every tree is trained with: no testing fold, and with 'SPLIT_MODE_QUANTILE' the candidates computed
+from all rows, the same as 'extend_model' computes them.
+*/
+ModelContext training_context(double **data, const RandomForestParameters *params, const struct dim *csv_dim)
+{
+    ModelContext ctx = (ModelContext){
+        testingFoldIdx : 0,
+        rowsPerFold : 0 /* No testing fold, train on every row. */,
+        split_candidates : NULL
+    };
+    if (params->split_mode == SPLIT_MODE_QUANTILE)
+        ctx.split_candidates = compute_split_candidates(data, params, csv_dim, &ctx);
+    return ctx;
+}
+
+/*
+Runs a worker on the connection 'fd' until the coordinator is done with it. Returns 0 on success.
+*/
+int run_worker(int fd, double **data, const struct dim *csv_dim)
+{
+    uint64_t hello[3] = {csv_dim->rows, csv_dim->cols, hash_data(data, csv_dim)};
+    RandomForestParameters params;
+    if (write_all(fd, DIST_MAGIC, sizeof(DIST_MAGIC)) != 0 ||
+        write_all(fd, hello, sizeof(hello)) != 0 ||
+        read_config(fd, &params) != 0)
+    {
+        fprintf(stderr, "Error: the coordinator rejected this worker, is it training on the same data?\n");
+        return -1;
+    }
+
+    ModelContext ctx = training_context(data, &params, csv_dim);
+    long nodeId = 0;
+    size_t n_trees = 0;
+
+    uint64_t tree_index = 0;
+    while (read_all(fd, &tree_index, sizeof(tree_index)) == 0 && tree_index != DIST_DONE)
+    {
+        DecisionTreeNode *tree = (DecisionTreeNode *)train_indexed_tree(data, &params, csv_dim, tree_index, &nodeId, &ctx);
+        if (params.compact_trees)
+        {
+            long removedCount = 0;
+            tree = compact_tree(tree, &removedCount);
+        }
+
+        char *buffer = NULL;
+        size_t size = 0;
+        FILE *stream = open_memstream(&buffer, &size);
+        save_tree_node(tree, stream);
+        fclose(stream);
+
+        uint64_t header[2] = {tree_index, size};
+        int status = write_all(fd, header, sizeof(header)) == 0 && write_all(fd, buffer, size) == 0 ? 0 : -1;
+
+        free(buffer);
+        long freeCount = 0;
+        free_decision_tree_node(tree, &freeCount);
+        if (status != 0)
+            break;
+        ++n_trees;
+    }
+
+    if (ctx.split_candidates)
+        free_split_candidates((SplitCandidates *)ctx.split_candidates);
+
+    if (tree_index != DIST_DONE)
+    {
+        fprintf(stderr, "Error: lost the connection to the coordinator\n");
+        return -1;
+    }
+    if (log_level > 0)
+        printf("worker trained %ld trees\n", n_trees);
+    return 0;
+}
+
+/*
+A worker connected to the coordinator.
+*/
+struct Worker
+{
+    int fd; // -1 once the worker is gone.
+    pid_t pid; // Forked local workers only, 0 otherwise.
+    uint64_t tree; // Tree the worker is training, DIST_DONE if none.
+    double assign_time; // When 'tree' was assigned.
+};
+
+/*
+Checks the hello of a new worker and sends it the config. Returns 0 if the worker can train trees.
+*/
+int accept_worker(struct Worker *worker, const RandomForestParameters *params, const uint64_t *expected_hello)
+{
+    char magic[sizeof(DIST_MAGIC)];
+    uint64_t hello[3];
+    if (read_all(worker->fd, magic, sizeof(magic)) != 0 ||
+        memcmp(magic, DIST_MAGIC, sizeof(magic)) != 0 ||
+        read_all(worker->fd, hello, sizeof(hello)) != 0)
+    {
+        fprintf(stderr, "Error: rejected a worker that does not speak the protocol\n");
+        return -1;
+    }
+    if (memcmp(hello, expected_hello, sizeof(hello)) != 0)
+    {
+        fprintf(stderr, "Error: rejected a worker with different data: %llu x %llu rows and columns\n",
+                (unsigned long long)hello[0],
+                (unsigned long long)hello[1]);
+        return -1;
+    }
+    write_config(worker->fd, params);
+    return 0;
+}
+
+/*
+Hands out the trees to the 'n_workers' workers and collects the trained trees of 'n_features' features into
+'random_forest'. Returns the number of trees trained. Under 'params->time_budget' no tree is handed out once
+the mean time a tree took so far would take it past the budget, and the trees not trained are left NULL.
+*/
+size_t coordinate(struct Worker *workers,
+                  size_t n_workers,
+                  const RandomForestParameters *params,
+                  size_t n_features,
+                  const DecisionTreeNode **random_forest)
+{
+    size_t n_trees = params->n_estimators;
+    double begin_time = get_monotonic_time();
+    double tree_time = 0; // Total time the trained trees took, from being assigned to being received.
+    int out_of_time = 0;
+    size_t n_busy = 0;
+
+    // Trees still to hand out: first the ones of workers that went away, then the next new one.
+    uint64_t *requeued = malloc(sizeof(uint64_t) * n_trees);
+    size_t n_requeued = 0;
+    size_t next_tree = 0;
+    size_t n_done = 0;
+    size_t n_alive = n_workers;
+
+    struct pollfd *fds = malloc(sizeof(struct pollfd) * n_workers);
+
+    while (n_alive > 0 && (out_of_time ? n_busy > 0 : n_done < n_trees))
+    {
+        // Keep every idle worker busy, as long as the time budget allows for another tree.
+        for (size_t w = 0; w < n_workers && !out_of_time; ++w)
+        {
+            struct Worker *worker = &workers[w];
+            if (worker->fd < 0 || worker->tree != DIST_DONE)
+                continue;
+            double now = get_monotonic_time();
+            if (params->time_budget > 0 && n_done > 0 && now + tree_time / n_done > begin_time + params->time_budget)
+            {
+                out_of_time = 1;
+                break;
+            }
+            if (n_requeued > 0)
+                worker->tree = requeued[--n_requeued];
+            else if (next_tree < n_trees)
+                worker->tree = next_tree++;
+            else
+                break;
+            worker->assign_time = now;
+
+            if (write_all(worker->fd, &worker->tree, sizeof(worker->tree)) != 0)
+            {
+                fprintf(stderr, "Error: lost worker %ld, tree %llu is trained by another worker\n", w, (unsigned long long)worker->tree);
+                requeued[n_requeued++] = worker->tree;
+                close(worker->fd);
+                worker->fd = -1;
+                --n_alive;
+            }
+            else
+                ++n_busy;
+        }
+        if (n_busy == 0)
+            break;
+
+        for (size_t w = 0; w < n_workers; ++w)
+            fds[w] = (struct pollfd){fd : workers[w].tree != DIST_DONE ? workers[w].fd : -1, events : POLLIN};
+
+        if (poll(fds, n_workers, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "Error: poll failed: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        for (size_t w = 0; w < n_workers; ++w)
+        {
+            if (fds[w].revents == 0)
+                continue;
+
+            // A worker only answers once it trained the whole tree, so the rest of the message follows right
+            // away.
+            struct Worker *worker = &workers[w];
+            uint64_t header[2];
+            char *buffer = NULL;
+            DecisionTreeNode *tree = NULL;
+            if (read_all(worker->fd, header, sizeof(header)) == 0 && header[0] == worker->tree &&
+                (buffer = malloc(header[1])) != NULL && read_all(worker->fd, buffer, header[1]) == 0)
+            {
+                FILE *stream = fmemopen(buffer, header[1], "rb");
+                long nodeId = 0;
+                tree = load_tree_node(stream, n_features, 0, &nodeId);
+                fclose(stream);
+            }
+            free(buffer);
+            --n_busy;
+
+            if (tree == NULL)
+            {
+                fprintf(stderr, "Error: lost worker %ld, tree %llu is trained by another worker\n", w, (unsigned long long)worker->tree);
+                requeued[n_requeued++] = worker->tree;
+                close(worker->fd);
+                worker->fd = -1;
+                --n_alive;
+                continue;
+            }
+
+            random_forest[worker->tree] = tree;
+            worker->tree = DIST_DONE;
+            tree_time += get_monotonic_time() - worker->assign_time;
+            ++n_done;
+        }
+    }
+
+    free(fds);
+    free(requeued);
+    return n_done;
+}
+
+/*
+Forks 'n_workers' local workers, each connected to the coordinator over its own socket pair. The workers
+share the already loaded data with the coordinator.
+*/
+void fork_local_workers(struct Worker *workers, size_t n_workers, double **data, const struct dim *csv_dim)
+{
+    for (size_t w = 0; w < n_workers; ++w)
+    {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+        {
+            fprintf(stderr, "Error: can't create a socket pair: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            fprintf(stderr, "Error: can't fork a worker: %s\n", strerror(errno));
+            exit(1);
+        }
+        if (pid == 0)
+        {
+            for (size_t other = 0; other < w; ++other)
+                close(workers[other].fd);
+            close(pair[0]);
+            _exit(run_worker(pair[1], data, csv_dim) == 0 ? 0 : 1);
+        }
+
+        close(pair[1]);
+        workers[w] = (struct Worker){fd : pair[0], pid : pid, tree : DIST_DONE};
+    }
+}
+
+/*
+Accepts 'n_workers' workers on the 'listen_fd' socket.
+*/
+void accept_remote_workers(struct Worker *workers, size_t n_workers, int listen_fd)
+{
+    for (size_t w = 0; w < n_workers; ++w)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+            {
+                --w;
+                continue;
+            }
+            fprintf(stderr, "Error: can't accept a worker: %s\n", strerror(errno));
+            exit(1);
+        }
+        set_no_delay(fd);
+        workers[w] = (struct Worker){fd : fd, pid : 0, tree : DIST_DONE};
+    }
+}
+
+/*
+Trains the model in this process and checks that it is identical to the one trained by the workers.
+*/
+int verify_model(const DecisionTreeNode **random_forest, double **data, const RandomForestParameters *params, const struct dim *csv_dim)
+{
+    const ModelContext ctx = (ModelContext){
+        testingFoldIdx : 0,
+        rowsPerFold : 0 /* No testing fold, train on every row. */,
+        split_candidates : NULL
+    };
+    const DecisionTreeNode **local_forest = train_model(data, params, csv_dim, &ctx, NULL);
+
+    char *buffers[2] = {NULL, NULL};
+    size_t sizes[2] = {0, 0};
+    const DecisionTreeNode **forests[2] = {random_forest, local_forest};
+    for (int f = 0; f < 2; ++f)
+    {
+        FILE *stream = open_memstream(&buffers[f], &sizes[f]);
+        save_random_forest(forests[f], params, csv_dim->cols - 1, stream);
+        fclose(stream);
+    }
+
+    int identical = sizes[0] == sizes[1] && memcmp(buffers[0], buffers[1], sizes[0]) == 0;
+    printf("verify: distributed model is %s the single-process model (%ld bytes)\n",
+           identical ? "identical to" : "DIFFERENT from",
+           sizes[0]);
+
+    free(buffers[0]);
+    free(buffers[1]);
+    free_random_forest(&local_forest, params->n_estimators);
+    return identical ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    struct arguments arguments;
+    arguments.params = (RandomForestParameters){
+        n_estimators : 3,
+        max_depth : 7,
+        min_samples_leaf : 3,
+        max_features : 3,
+        split_mode : SPLIT_MODE_BEST,
+        max_bins : 0,
+        compact_trees : 0,
+        quantize : 0,
+        seed : 1
+    };
+    arguments.local_workers = 0;
+    arguments.workers = 1;
+    arguments.listen_address = NULL;
+    arguments.connect_address = NULL;
+    arguments.model_output = NULL;
+    arguments.verify = 0;
+    arguments.csv_file = NULL;
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    // A worker that goes away must not take the coordinator with it.
+    signal(SIGPIPE, SIG_IGN);
+
+    struct dim csv_dim;
+    double **data = load_data(arguments.csv_file, &csv_dim);
+
+    if (arguments.connect_address)
+    {
+        const char *address;
+        const struct Transport *transport = find_transport(arguments.connect_address, &address);
+        int fd = transport->connect(address);
+        if (fd < 0)
+        {
+            fprintf(stderr, "Error: can't connect to %s: %s\n", arguments.connect_address, strerror(errno));
+            exit(1);
+        }
+        int status = run_worker(fd, data, &csv_dim);
+        close(fd);
+        tracked_free(data, MEMORY_TAG_DATA);
+        return status == 0 ? 0 : 1;
+    }
+
+    // Features are sampled without replacement, so never ask for more than there are.
+    RandomForestParameters params = arguments.params;
+    if (params.max_features > csv_dim.cols - 1)
+        params.max_features = csv_dim.cols - 1;
+
+    size_t n_workers = arguments.local_workers ? arguments.local_workers : arguments.workers;
+    if (n_workers == 0 || n_workers > MAX_WORKERS || params.n_estimators == 0)
+    {
+        fprintf(stderr, "Error: need 1 to %d workers and at least one tree\n", MAX_WORKERS);
+        exit(1);
+    }
+
+    double begin_time = get_monotonic_time();
+
+    struct Worker *workers = malloc(sizeof(struct Worker) * n_workers);
+    if (arguments.local_workers)
+    {
+        fork_local_workers(workers, n_workers, data, &csv_dim);
+    }
+    else
+    {
+        const char *address;
+        const struct Transport *transport = find_transport(arguments.listen_address, &address);
+        int listen_fd = transport->listen(address);
+        if (listen_fd < 0)
+        {
+            fprintf(stderr, "Error: can't listen on %s: %s\n", arguments.listen_address, strerror(errno));
+            exit(1);
+        }
+        printf("waiting for %ld workers on %s\n", n_workers, arguments.listen_address);
+        fflush(stdout);
+        accept_remote_workers(workers, n_workers, listen_fd);
+        close(listen_fd);
+    }
+
+    const uint64_t expected_hello[3] = {csv_dim.rows, csv_dim.cols, hash_data(data, &csv_dim)};
+    for (size_t w = 0; w < n_workers; ++w)
+    {
+        workers[w].tree = DIST_DONE;
+        if (accept_worker(&workers[w], &params, expected_hello) != 0)
+        {
+            close(workers[w].fd);
+            workers[w].fd = -1;
+        }
+    }
+
+    const DecisionTreeNode **random_forest = tracked_calloc(params.n_estimators, sizeof(DecisionTreeNode *), MEMORY_TAG_TREE_NODES);
+    size_t n_trained = coordinate(workers, n_workers, &params, csv_dim.cols - 1, random_forest);
+
+    // Let the workers exit.
+    const uint64_t done = DIST_DONE;
+    for (size_t w = 0; w < n_workers; ++w)
+    {
+        if (workers[w].fd >= 0)
+        {
+            write_all(workers[w].fd, &done, sizeof(done));
+            close(workers[w].fd);
+        }
+        if (workers[w].pid > 0)
+            waitpid(workers[w].pid, NULL, 0);
+    }
+    free(workers);
+
+    if (n_trained == 0 || (n_trained < params.n_estimators && params.time_budget <= 0))
+    {
+        fprintf(stderr, "Error: every worker went away, only %ld of %ld trees were trained\n", n_trained, params.n_estimators);
+        exit(1);
+    }
+
+    // Out of time, the model is the first trees that were all trained, the same as the model of that many trees.
+    // Trees after a gap left by a worker that went away are dropped.
+    if (n_trained < params.n_estimators)
+    {
+        size_t n_prefix = 0;
+        while (n_prefix < params.n_estimators && random_forest[n_prefix] != NULL)
+            ++n_prefix;
+        long n_freed = 0;
+        for (size_t i = n_prefix; i < params.n_estimators; ++i)
+            if (random_forest[i] != NULL)
+                free_decision_tree_node(random_forest[i], &n_freed);
+        printf("time budget of %gs reached after %ld of %ld trees\n", params.time_budget, n_prefix, params.n_estimators);
+        params.n_estimators = n_prefix;
+    }
+    params.time_budget = 0;
+
+    printf("trained %ld trees on %ld workers (time taken: %fs)\n", params.n_estimators, n_workers, get_monotonic_time() - begin_time);
+
+    int status = 0;
+    if (arguments.model_output)
+    {
+        FILE *file = fopen(arguments.model_output, "wb");
+        if (file == NULL || save_random_forest(random_forest, &params, csv_dim.cols - 1, file) != 0 || fclose(file) != 0)
+        {
+            fprintf(stderr, "Error: failed to write model file %s\n", arguments.model_output);
+            status = 1;
+        }
+    }
+
+    if (arguments.verify && verify_model(random_forest, data, &params, &csv_dim) != 0)
+        status = 1;
+
+    free_random_forest(&random_forest, params.n_estimators);
+    tracked_free(data, MEMORY_TAG_DATA);
+    return status;
+}
@@ -0,0 +1,267 @@
+/*
+@author andrii dobroshynski
+*/
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#include "cache.h"
+#include "../utils/memory.h"
+
+#define CV_CACHE_MAGIC "RFCVC1\0\0"
+
+static const char *cache_dir = NULL;
+static size_t cache_max_bytes = 0;
+static int cache_store_models = 0;
+static size_t cache_hits = 0;
+static size_t cache_misses = 0;
+
+// Hash of the last dataset hashed, so that the folds of a cross validation and the configurations of a search
+// only hash the data once. The data of a run is never changed in place, so its address and dimensions are
+// enough to tell whether it is the same.
+static double **hashed_data = NULL;
+static struct dim hashed_dim;
+static uint64_t hashed_data_hash;
+
+void set_cv_cache(const char *dir, size_t max_bytes, int store_models)
+{
+    cache_dir = dir;
+    cache_max_bytes = max_bytes;
+    cache_store_models = store_models;
+}
+
+int cv_cache_enabled(const RandomForestParameters *params)
+{
+    // Models trained under a time budget depend on how fast the machine was at the time, and under a memory
+    // budget on how much memory everything else of the process held.
+    return cache_dir != NULL && params->seed != 0 && params->time_budget <= 0 && get_memory_budget() == 0;
+}
+
+uint64_t cv_cache_key(double **data,
+                      const struct dim *csv_dim,
+                      const RandomForestParameters *params,
+                      int k_folds,
+                      size_t fold,
+                      const SplitCandidates *split_candidates,
+                      const size_t *extra,
+                      size_t n_extra)
+{
+    if (data != hashed_data || csv_dim->rows != hashed_dim.rows || csv_dim->cols != hashed_dim.cols)
+    {
+        hashed_data = data;
+        hashed_dim = (*csv_dim);
+        hashed_data_hash = hash_data(data, csv_dim);
+    }
+
+    // Every field is hashed on its own rather than the struct, which has padding.
+    const uint64_t words[] = {
+        CV_CACHE_VERSION,
+        hashed_data_hash,
+        csv_dim->rows,
+        csv_dim->cols,
+        params->n_estimators,
+        params->max_depth,
+        params->min_samples_leaf,
+        params->max_features,
+        params->split_mode,
+        params->max_bins,
+        params->compact_trees,
+        params->quantize,
+        params->seed,
+        params->max_split_samples,
+        params->oblivious,
+        k_folds,
+        fold,
+        n_extra};
+    uint64_t key = hash_words(0xCBF29CE484222325ULL, words, sizeof(words) / sizeof(uint64_t));
+
+    for (size_t i = 0; i < n_extra; ++i)
+    {
+        uint64_t value = extra[i];
+        key = hash_words(key, &value, 1);
+    }
+
+    if (split_candidates)
+    {
+        for (size_t j = 0; j < split_candidates->n_features; ++j)
+        {
+            uint64_t count = split_candidates->counts[j];
+            key = hash_words(key, &count, 1);
+            key = hash_words(key, (const uint64_t *)split_candidates->values[j], count);
+        }
+    }
+    return key;
+}
+
+/*
+Writes the path of the file of 'key' with 'extension' into 'path'.
+*/
+void cv_cache_path(char *path, size_t size, uint64_t key, const char *extension)
+{
+    snprintf(path, size, "%s/%016lx.%s", cache_dir, key, extension);
+}
+
+int cv_cache_lookup(uint64_t key, double *values, size_t n_values)
+{
+    char path[4096];
+    cv_cache_path(path, sizeof(path), key, "cv");
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        ++cache_misses;
+        return 0;
+    }
+
+    char magic[8];
+    uint64_t header[2];
+    int hit = fread(magic, sizeof(magic), 1, file) == 1 &&
+              memcmp(magic, CV_CACHE_MAGIC, sizeof(magic)) == 0 &&
+              fread(header, sizeof(header), 1, file) == 1 &&
+              header[0] == key &&
+              header[1] == n_values &&
+              fread(values, sizeof(double), n_values, file) == n_values;
+    fclose(file);
+
+    if (hit)
+    {
+        // Refresh the modification time, which eviction goes by.
+        utime(path, NULL);
+        ++cache_hits;
+    }
+    else
+        ++cache_misses;
+    return hit;
+}
+
+/*
+A file of the cache, for eviction.
+*/
+struct CacheFile
+{
+    char name[64];
+    time_t mtime;
+    off_t size;
+};
+
+int compare_cache_file_mtime(const void *a, const void *b)
+{
+    const struct CacheFile *first = a;
+    const struct CacheFile *second = b;
+    if (first->mtime != second->mtime)
+        return first->mtime < second->mtime ? -1 : 1;
+    return strcmp(first->name, second->name);
+}
+
+/*
+Removes the least recently used files of the cache until its files take at most 'cache_max_bytes'. Only files
+named like entries and models are counted and removed, anything else in the directory is left alone.
+*/
+void evict_cv_cache()
+{
+    DIR *dir = opendir(cache_dir);
+    if (dir == NULL)
+        return;
+
+    size_t n_files = 0;
+    size_t capacity = 64;
+    struct CacheFile *files = tracked_malloc(capacity * sizeof(struct CacheFile), MEMORY_TAG_EVAL);
+    size_t total_bytes = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        const char *extension = strchr(entry->d_name, '.');
+        if (extension == NULL || extension - entry->d_name != 16 ||
+            (strcmp(extension, ".cv") != 0 && strcmp(extension, ".model") != 0))
+            continue;
+
+        char path[4096];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, entry->d_name);
+        if (stat(path, &st) != 0)
+            continue;
+
+        if (n_files == capacity)
+        {
+            capacity *= 2;
+            files = tracked_realloc(files, capacity * sizeof(struct CacheFile), MEMORY_TAG_EVAL);
+        }
+        snprintf(files[n_files].name, sizeof(files[n_files].name), "%s", entry->d_name);
+        files[n_files].mtime = st.st_mtime;
+        files[n_files].size = st.st_size;
+        total_bytes += st.st_size;
+        ++n_files;
+    }
+    closedir(dir);
+
+    qsort(files, n_files, sizeof(struct CacheFile), compare_cache_file_mtime);
+    for (size_t i = 0; i < n_files && total_bytes > cache_max_bytes; ++i)
+    {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", cache_dir, files[i].name);
+        if (unlink(path) == 0)
+            total_bytes -= files[i].size;
+    }
+
+    tracked_free(files, MEMORY_TAG_EVAL);
+}
+
+void cv_cache_store(uint64_t key,
+                    const double *values,
+                    size_t n_values,
+                    const DecisionTreeNode **random_forest,
+                    const RandomForestParameters *params,
+                    size_t n_features)
+{
+    char path[4096];
+    char temp_path[4096];
+
+    // The model goes first, so that an entry is never there without the model it was stored with.
+    if (cache_store_models && random_forest)
+    {
+        cv_cache_path(path, sizeof(path), key, "model");
+        snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", path, (int)getpid());
+
+        FILE *file = fopen(temp_path, "wb");
+        if (file == NULL)
+            return;
+        int status = save_random_forest(random_forest, params, n_features, file);
+        if (fclose(file) != 0 || status != 0 || rename(temp_path, path) != 0)
+        {
+            unlink(temp_path);
+            return;
+        }
+    }
+
+    cv_cache_path(path, sizeof(path), key, "cv");
+    snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", path, (int)getpid());
+
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL)
+        return;
+    const uint64_t header[2] = {key, n_values};
+    int status = fwrite(CV_CACHE_MAGIC, 8, 1, file) == 1 &&
+                 fwrite(header, sizeof(header), 1, file) == 1 &&
+                 fwrite(values, sizeof(double), n_values, file) == n_values;
+    if (fclose(file) != 0 || !status || rename(temp_path, path) != 0)
+    {
+        unlink(temp_path);
+        return;
+    }
+
+    evict_cv_cache();
+}
+
+size_t get_cv_cache_hits()
+{
+    return cache_hits;
+}
+
+size_t get_cv_cache_misses()
+{
+    return cache_misses;
+}
@@ -0,0 +1,81 @@
+/*
+@author andrii dobroshynski
+*/
+
+#ifndef cache_h
+#define cache_h
+
+#include <stdint.h>
+#include "../model/forest.h"
+#include "../utils/data.h"
+
+/*
+Version of the results in the cache. Bump it with every change to training or evaluation that changes the
+results of a cross validation, so that entries written by older code are never read back.
+*/
+#define CV_CACHE_VERSION 1
+
+/*
+Opt-in on-disk cache of cross validation results, keyed by a hash of the dataset, the parameters, the number
+of folds, the fold and CV_CACHE_VERSION. Every fold is an entry of its own, so an interrupted run or search
+picks up at the first fold it did not finish. Entries are written to a temporary file and renamed into
+place, so a killed process never leaves a partial entry behind.
+
+Only folds trained with a non-zero 'params->seed' are cached, since without it the trees depend on the state
+of 'rand()' left by whatever ran before. Split candidates passed in for 'SPLIT_MODE_QUANTILE' are part of
+the key.
+
+When the files of the cache take more than its size limit, the least recently used entries (by modification
+time, which a hit refreshes) are removed until it fits again.
+*/
+
+/*
+Enables the cache in directory 'dir', which must exist, holding up to 'max_bytes' of entries. With
+'store_models' the model trained on every fold is also saved next to its entry as '<key>.model', in the
+form of 'save_random_forest' (so it can be read with 'rf_load'). A NULL 'dir' disables the cache.
+*/
+void set_cv_cache(const char *dir, size_t max_bytes, int store_models);
+
+/*
+Returns whether a cross validation with 'params' is cached, which it is if it is reproducible: seeded and
+without a time or memory budget.
+*/
+int cv_cache_enabled(const RandomForestParameters *params);
+
+/*
+Returns the key of the 'fold' of a 'k_folds' cross validation of 'data' with 'params'. 'extra' holds any
+other 'n_extra' values the results depend on, such as the prefixes scored by 'cross_validate_prefixes'.
+*/
+uint64_t cv_cache_key(double **data,
+                      const struct dim *csv_dim,
+                      const RandomForestParameters *params,
+                      int k_folds,
+                      size_t fold,
+                      const SplitCandidates *split_candidates,
+                      const size_t *extra,
+                      size_t n_extra);
+
+/*
+Reads the 'n_values' results cached under 'key' into 'values'. Returns 1 on a hit and 0 otherwise.
+*/
+int cv_cache_lookup(uint64_t key, double *values, size_t n_values);
+
+/*
+Caches the 'n_values' results of 'values' under 'key', along with the fold model 'random_forest' if the
+cache stores models, and evicts old entries if the cache went over its size limit. Failing to write is not
+an error, the results are just not cached.
+*/
+void cv_cache_store(uint64_t key,
+                    const double *values,
+                    size_t n_values,
+                    const DecisionTreeNode **random_forest,
+                    const RandomForestParameters *params,
+                    size_t n_features);
+
+/*
+Returns the number of lookups that hit and missed the cache so far.
+*/
+size_t get_cv_cache_hits();
+size_t get_cv_cache_misses();
+
+#endif // cache_h
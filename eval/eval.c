@@ -2,86 +2,316 @@
 @author andrii dobroshynski
 */
 
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "eval.h"
+#include "cache.h"
+#include "../utils/trace.h"
+#include "../utils/memory.h"
 
-void hyperparameter_search(double **data, struct dim *csv_dim)
+static const char *hyperparameter_names[HYPERPARAMETER_COUNT] = {
+    "n_estimators", "max_depth", "min_samples_leaf", "max_features"};
+
+int parse_hyperparameter_grid(const char *spec, HyperparameterGrid *grid)
+{
+    for (int h = 0; h < HYPERPARAMETER_COUNT; ++h)
+        grid->counts[h] = 0;
+
+    char *copy = strdup(spec);
+    char *entry_state = NULL;
+    int status = 0;
+    for (char *entry = strtok_r(copy, ";", &entry_state); entry && status == 0; entry = strtok_r(NULL, ";", &entry_state))
+    {
+        char *values = strchr(entry, '=');
+        if (values == NULL)
+        {
+            status = -1;
+            break;
+        }
+        *values++ = '\0';
+
+        int h = 0;
+        while (h < HYPERPARAMETER_COUNT && strcmp(entry, hyperparameter_names[h]) != 0)
+            ++h;
+        if (h == HYPERPARAMETER_COUNT || grid->counts[h] > 0)
+        {
+            status = -1;
+            break;
+        }
+
+        char *value_state = NULL;
+        for (char *value = strtok_r(values, ",", &value_state); value; value = strtok_r(NULL, ",", &value_state))
+        {
+            char *end;
+            long parsed = strtol(value, &end, 10);
+            if (*end != '\0' || parsed <= 0 || grid->counts[h] == MAX_GRID_VALUES)
+            {
+                status = -1;
+                break;
+            }
+            grid->values[h][grid->counts[h]++] = parsed;
+        }
+        if (grid->counts[h] == 0)
+            status = -1;
+    }
+    free(copy);
+    return status;
+}
+
+/*
+Returns the number of configurations of 'grid'.
+*/
+size_t count_grid_configs(const HyperparameterGrid *grid)
+{
+    size_t n_configs = 1;
+    for (int h = 0; h < HYPERPARAMETER_COUNT; ++h)
+        if (grid->counts[h] > 0)
+            n_configs *= grid->counts[h];
+    return n_configs;
+}
+
+/*
+Returns the parameters of the configuration at index 'config' of 'grid', counting through the values of the
+last hyperparameter fastest.
+*/
+RandomForestParameters grid_config(const HyperparameterGrid *grid, const RandomForestParameters *base_params, size_t config)
+{
+    RandomForestParameters params = (*base_params);
+    size_t *fields[HYPERPARAMETER_COUNT] = {
+        &params.n_estimators, &params.max_depth, &params.min_samples_leaf, &params.max_features};
+
+    for (int h = HYPERPARAMETER_COUNT - 1; h >= 0; --h)
+    {
+        if (grid->counts[h] == 0)
+            continue;
+        (*fields[h]) = grid->values[h][config % grid->counts[h]];
+        config /= grid->counts[h];
+    }
+    return params;
+}
+
+/*
+Orders results by accuracy, best first, and by their place in the grid otherwise.
+*/
+int compare_result_accuracy(const void *a, const void *b)
 {
-    // Init the options for number of trees to: 10, 100, 1000.
-    size_t n = 3;
+    const HyperparameterResult *first = *(const HyperparameterResult **)a;
+    const HyperparameterResult *second = *(const HyperparameterResult **)b;
+    if (first->accuracy != second->accuracy)
+        return first->accuracy > second->accuracy ? -1 : 1;
+    return first->config < second->config ? -1 : 1;
+}
 
-    size_t *estimators = malloc(sizeof(size_t) * n);
-    estimators[0] = 10;
-    estimators[1] = 50;
-    estimators[2] = 100;
+/*
+Orders the leaderboard: configurations that survived more rounds first, then by accuracy.
+*/
+int compare_leaderboard(const void *a, const void *b)
+{
+    const HyperparameterResult *first = a;
+    const HyperparameterResult *second = b;
+    if (first->round != second->round)
+        return first->round > second->round ? -1 : 1;
+    if (first->accuracy != second->accuracy)
+        return first->accuracy > second->accuracy ? -1 : 1;
+    return first->config < second->config ? -1 : 1;
+}
 
-    // Init the options for the max depth for a tree to: 3, 7, 10.
-    size_t *max_depths = malloc(sizeof(size_t) * n);
-    max_depths[0] = 3;
-    max_depths[1] = 7;
-    max_depths[2] = 10;
+/*
+Returns whether configurations 'a' and 'b' of a round can be scored from the same forest, which they can
+when they agree on everything but their number of trees and depth. Compacted trees lose the inner nodes that
+truncation needs, so those configurations are always trained on their own.
+*/
+int share_forest(const HyperparameterResult *a, const HyperparameterResult *b)
+{
+    return a->params.min_samples_leaf == b->params.min_samples_leaf &&
+           a->params.max_features == b->params.max_features &&
+           a->n_folds == b->n_folds &&
+           !a->params.compact_trees;
+}
 
-    // Defaults based on SKLearn's defaults / hand picked in order to compare performance
-    // with the same parameters.
-    size_t max_features = 3;
-    size_t min_samples_leaf = 2;
-    size_t max_depth = 7;
+/*
+Appends 'value' to the 'count' values of 'values' unless it is already one of them.
+*/
+void add_distinct(size_t *values, size_t *count, size_t value)
+{
+    for (size_t i = 0; i < (*count); ++i)
+        if (values[i] == value)
+            return;
+    values[(*count)++] = value;
+}
 
-    // Number of folds for cross validation.
-    size_t k_folds = 5;
+/*
+Returns the index of 'value' in 'values', which must contain it.
+*/
+size_t index_of(const size_t *values, size_t value)
+{
+    size_t i = 0;
+    while (values[i] != value)
+        ++i;
+    return i;
+}
 
-    // Best params computed from running the hyperparameter search.
-    size_t best_n_estimators = -1;
-    double best_accuracy = -1;
+HyperparameterResult *hyperparameter_search(double **data,
+                                            const struct dim *csv_dim,
+                                            const HyperparameterGrid *grid,
+                                            const RandomForestParameters *base_params,
+                                            const HyperparameterSearchParameters *search,
+                                            SplitCandidates *const *fold_split_candidates,
+                                            size_t *n_results)
+{
+    size_t n_configs = count_grid_configs(grid);
+    int k_folds = search->k_folds;
 
-    for (size_t i = 0; i < n; ++i)
+    HyperparameterResult *results = tracked_malloc(n_configs * sizeof(HyperparameterResult), MEMORY_TAG_EVAL);
+    HyperparameterResult **alive = tracked_malloc(n_configs * sizeof(HyperparameterResult *), MEMORY_TAG_EVAL);
+    for (size_t c = 0; c < n_configs; ++c)
     {
-        size_t n_estimators = estimators[i]; /* Number of trees in the forest. */
+        results[c] = (HyperparameterResult){
+            config : c,
+            params : grid_config(grid, base_params, c),
+            accuracy : -1,
+            round : -1,
+            n_trees : 0,
+            n_folds : 0
+        };
+        alive[c] = &results[c];
+    }
+    size_t n_alive = n_configs;
+
+    // Scratch of the configurations that share a forest in a round, see 'share_forest'.
+    char *grouped = tracked_malloc(n_configs, MEMORY_TAG_EVAL);
+    HyperparameterResult **members = tracked_malloc(n_configs * sizeof(HyperparameterResult *), MEMORY_TAG_EVAL);
+    size_t *tree_counts = tracked_malloc(n_configs * sizeof(size_t), MEMORY_TAG_EVAL);
+    size_t *depths = tracked_malloc(n_configs * sizeof(size_t), MEMORY_TAG_EVAL);
 
-        for (size_t j = 0; j < n; ++j)
+    // With successive halving, enough rounds that the last one, at the full budget, is left with at most
+    // 'eta' configurations.
+    int n_rounds = 1;
+    if (search->mode == SEARCH_MODE_HALVING && search->eta > 1)
+        n_rounds += (int)floor(log((double)n_configs) / log(search->eta) + 1e-9);
+
+    // Trees trained across all folds, against what evaluating every configuration with its full budget takes.
+    size_t trees_trained = 0;
+    size_t full_budget_trees = 0;
+    for (size_t c = 0; c < n_configs; ++c)
+        full_budget_trees += results[c].params.n_estimators * k_folds;
+
+    for (int round = 0; round < n_rounds; ++round)
+    {
+        // Fraction of the full budget of every configuration in this round, growing 'eta' times per round.
+        double budget = pow(search->eta, round - (n_rounds - 1));
+        if (log_level > 0)
+            printf("[hyperparameter search] round %d: %ld configurations at %.1f%% of their budget\n",
+                   round, n_alive, budget * 100);
+
+        for (size_t a = 0; a < n_alive; ++a)
+        {
+            alive[a]->round = round;
+            alive[a]->n_trees = (size_t)ceil(alive[a]->params.n_estimators * budget);
+            alive[a]->n_folds = (int)ceil(k_folds * budget);
+            grouped[a] = 0;
+        }
+
+        // Configurations that only differ in their number of trees and depth are scored together, as the
+        // prefixes and depth cutoffs of a single forest with the most trees and the largest depth of them.
+        for (size_t a = 0; a < n_alive; ++a)
         {
-            size_t max_depth = max_depths[j];
+            if (grouped[a])
+                continue;
+
+            double trace_begin = trace_span_begin();
+
+            RandomForestParameters params = alive[a]->params;
+            params.n_estimators = 0;
+            params.max_depth = 0;
+            size_t n_members = 0;
+            size_t n_tree_counts = 0;
+            size_t n_depths = 0;
+            for (size_t b = a; b < n_alive; ++b)
+            {
+                if (grouped[b] || (b != a && !share_forest(alive[a], alive[b])))
+                    continue;
 
-            RandomForestParameters params = {
-                n_estimators : n_estimators,
-                max_depth : max_depth,
-                min_samples_leaf : min_samples_leaf,
-                max_features : max_features
-            };
+                HyperparameterResult *member = alive[b];
+                grouped[b] = 1;
+                members[n_members++] = member;
+                add_distinct(tree_counts, &n_tree_counts, member->n_trees);
+                add_distinct(depths, &n_depths, member->params.max_depth);
+                params.n_estimators = member->n_trees > params.n_estimators ? member->n_trees : params.n_estimators;
+                params.max_depth = member->params.max_depth > params.max_depth ? member->params.max_depth : params.max_depth;
+            }
+            int n_folds = alive[a]->n_folds;
 
-            if (log_level > 0)
+            if (log_level > 1)
             {
-                printf("[hyperparameter search] running cross_validate\n");
+                printf("[hyperparameter search] running cross_validate on %d of %d folds for %ld configurations\n",
+                       n_folds, k_folds, n_members);
                 printf("[hyperparameter search] ");
                 print_params(&params);
             }
 
-            double cv_accuracy = cross_validate(data,
-                                                &params,
-                                                csv_dim,
-                                                k_folds);
+            double *accuracies = tracked_malloc(n_tree_counts * n_depths * sizeof(double), MEMORY_TAG_EVAL);
+            cross_validate_prefixes(data,
+                                    &params,
+                                    csv_dim,
+                                    k_folds,
+                                    n_folds,
+                                    tree_counts,
+                                    n_tree_counts,
+                                    depths,
+                                    n_depths,
+                                    fold_split_candidates,
+                                    accuracies);
+            for (size_t m = 0; m < n_members; ++m)
+                members[m]->accuracy = accuracies[index_of(tree_counts, members[m]->n_trees) * n_depths +
+                                                  index_of(depths, members[m]->params.max_depth)];
+            tracked_free(accuracies, MEMORY_TAG_EVAL);
 
-            if (log_level > 0)
-                printf("[hyperparameter search] cross validation accuracy: %f%% (%ld%%)\n",
-                       (cv_accuracy * 100),
-                       (long)(cv_accuracy * 100));
+            trees_trained += params.n_estimators * n_folds;
 
-            // Update best accuracy and best parameters found so far from the hyperparameter search.
-            if (cv_accuracy > best_accuracy)
-            {
-                best_accuracy = cv_accuracy;
-                best_n_estimators = n_estimators;
-            }
+            trace_span_end("hyperparameter_config", "config", alive[a]->config, trace_begin);
         }
+
+        // Only the best configurations go on to the next round.
+        if (round + 1 < n_rounds)
+        {
+            qsort(alive, n_alive, sizeof(HyperparameterResult *), compare_result_accuracy);
+            n_alive = (size_t)ceil(n_alive / search->eta);
+        }
+    }
+
+    qsort(results, n_configs, sizeof(HyperparameterResult), compare_leaderboard);
+
+    if (log_level > 0)
+    {
+        printf("[hyperparameter search] run complete: %ld configurations in %d rounds, trained %ld trees "
+               "(%ld with the full budget for every configuration)\n",
+               n_configs, n_rounds, trees_trained, full_budget_trees);
+        printf("  %4s %12s %9s %16s %12s %5s %6s %5s %8s\n",
+               "rank", "n_estimators", "max_depth", "min_samples_leaf", "max_features", "round", "trees", "folds", "accuracy");
+        for (size_t c = 0; c < n_configs; ++c)
+            printf("  %4ld %12ld %9ld %16ld %12ld %5d %6ld %5d %8.4f\n",
+                   c + 1,
+                   results[c].params.n_estimators,
+                   results[c].params.max_depth,
+                   results[c].params.min_samples_leaf,
+                   results[c].params.max_features,
+                   results[c].round,
+                   results[c].n_trees,
+                   results[c].n_folds,
+                   results[c].accuracy);
     }
 
-    // Free auxillary buffers.
-    free(estimators);
-    free(max_depths);
+    tracked_free(alive, MEMORY_TAG_EVAL);
+    tracked_free(grouped, MEMORY_TAG_EVAL);
+    tracked_free(members, MEMORY_TAG_EVAL);
+    tracked_free(tree_counts, MEMORY_TAG_EVAL);
+    tracked_free(depths, MEMORY_TAG_EVAL);
 
-    printf("[hyperparameter search] run complete\n  best_accuracy: %f\n  best_n_estimators (trees): %ld\n",
-           best_accuracy, best_n_estimators);
+    (*n_results) = n_configs;
+    return results;
 }
 
 double eval_model(const DecisionTreeNode **random_forest,
@@ -94,15 +324,57 @@ double eval_model(const DecisionTreeNode **random_forest,
     // computed with 'num_correct' / 'rowsPerFold' (or how many predictions we make).
     long num_correct = 0;
 
+    // Optionally convert the model into the compact inference format, in which case every row is mapped
+    // to its bins before making a prediction.
+    QuantizedForest *quantized_forest = NULL;
+    uint16_t *bins = NULL;
+    if (params->quantize)
+    {
+        quantized_forest = quantize_random_forest(random_forest, params->n_estimators);
+        if (quantized_forest == NULL)
+            exit(1);
+        bins = tracked_malloc(quantized_forest->n_features * sizeof(uint16_t), MEMORY_TAG_EVAL);
+
+        if (log_level > 0)
+            printf("quantized random forest: %ld nodes in %ld bytes\n",
+                   quantized_forest->n_nodes,
+                   quantized_forest_size(quantized_forest));
+    }
+
+    // Forests of oblivious trees are evaluated from their lookup tables, which make the same predictions.
+    ObliviousForest *oblivious_forest = NULL;
+    if (!quantized_forest && params->oblivious)
+    {
+        oblivious_forest = compile_oblivious_forest(random_forest, params->n_estimators);
+        if (oblivious_forest && log_level > 0)
+            printf("oblivious random forest: %ld trees of depth up to %ld in %ld bytes\n",
+                   oblivious_forest->n_estimators,
+                   oblivious_forest->max_depth,
+                   oblivious_forest_size(oblivious_forest));
+    }
+
     // Since we are evaluating the model on a single fold (to control overfitting), we start
     // iterating the rows for which we are getting predictions at an offset that can be computed
     // as 'testingFoldIdx * rowsPerFold' and make predictions for 'rowsPerFold' number of rows
     size_t row_id_offset = ctx->testingFoldIdx * ctx->rowsPerFold;
     for (size_t row_id = row_id_offset; row_id < row_id_offset + ctx->rowsPerFold; ++row_id)
     {
-        int prediction = predict_model(&random_forest,
+        int prediction;
+        if (quantized_forest)
+        {
+            quantize_row(quantized_forest, data[row_id], bins);
+            prediction = predict_quantized(quantized_forest, bins);
+        }
+        else if (oblivious_forest)
+        {
+            prediction = predict_oblivious(oblivious_forest, data[row_id]);
+        }
+        else
+        {
+            prediction = predict_model(&random_forest,
                                        params->n_estimators,
                                        data[row_id]);
+        }
         int ground_truth = (int)data[row_id][csv_dim->cols - 1];
 
         if (log_level > 1)
@@ -111,48 +383,405 @@ double eval_model(const DecisionTreeNode **random_forest,
         if (prediction == ground_truth)
             ++num_correct;
     }
+
+    if (quantized_forest)
+    {
+        free_quantized_forest(quantized_forest);
+        tracked_free(bins, MEMORY_TAG_EVAL);
+    }
+    free_oblivious_forest(oblivious_forest);
+
     return (double)num_correct / (double)ctx->rowsPerFold;
 }
 
 double cross_validate(double **data,
                       const RandomForestParameters *params,
                       const struct dim *csv_dim,
-                      const int k_folds)
+                      const int k_folds,
+                      const SplitCandidates *split_candidates)
+{
+    return cross_validate_folds(data, params, csv_dim, k_folds, k_folds, split_candidates);
+}
+
+double cross_validate_folds(double **data,
+                            const RandomForestParameters *params,
+                            const struct dim *csv_dim,
+                            const int k_folds,
+                            const int n_folds,
+                            const SplitCandidates *split_candidates)
 {
     // Sum of all accuracies on every evaluated fold.
     double sumAccuracy = 0;
 
+    // A time budget is for the whole cross validation, every fold gets an even share of what is left of it.
+    double begin_time = get_monotonic_time();
+
     // Iterate through the fold indeces and fit models on the selections. The current 'foldIdx' is the index
     // of the fold in the array of all loaded data that is the fold that's currently the test fold, with all of
     // the other folds being used for training.
-    for (size_t foldIdx = 0; foldIdx < k_folds; ++foldIdx)
+    for (size_t foldIdx = 0; foldIdx < n_folds; ++foldIdx)
     {
+        double trace_begin = trace_span_begin();
+
         const ModelContext ctx = (ModelContext){
             testingFoldIdx : foldIdx /* Fold to use for evaluation. */,
-            rowsPerFold : csv_dim->rows / k_folds /* Number of rows per fold. */
+            rowsPerFold : csv_dim->rows / k_folds /* Number of rows per fold. */,
+            split_candidates : split_candidates
         };
 
+        // Folds that were cross validated before with the same data and parameters are read from the cache.
+        uint64_t cache_key = 0;
+        double accuracy;
+        if (cv_cache_enabled(params))
+        {
+            cache_key = cv_cache_key(data, csv_dim, params, k_folds, foldIdx, split_candidates, NULL, 0);
+            if (cv_cache_lookup(cache_key, &accuracy, 1))
+            {
+                sumAccuracy += accuracy;
+                trace_span_end("cross_validate_fold", "fold", foldIdx, trace_begin);
+                continue;
+            }
+        }
+
+        RandomForestParameters fold_params = (*params);
+        if (params->time_budget > 0)
+        {
+            double remaining = params->time_budget - (get_monotonic_time() - begin_time);
+            // Once the budget ran out a fold still gets the one tree every model has.
+            fold_params.time_budget = remaining > 0 ? remaining / (n_folds - foldIdx) : 1e-9;
+        }
+
         // Train an instance of the model with every fold of data except of the fold indentified by
         // 'foldIdx' used for training the the 'foldIdx' fold withheld from training in order to be
         // used for evaluation.
         const DecisionTreeNode **random_forest = (const DecisionTreeNode **)train_model(
             data,
-            params,
+            &fold_params,
             csv_dim,
-            &ctx);
+            &ctx,
+            &fold_params.n_estimators);
 
         // Evaluate the model that was just trained. We use the fold identified by 'foldIdx' to evaluate
         // the model.
-        const double accuracy = eval_model(
+        accuracy = eval_model(
             random_forest /* Model to evaluate. */,
             data,
-            params,
+            &fold_params,
             csv_dim,
             &ctx);
         sumAccuracy += accuracy;
 
+        if (cv_cache_enabled(params))
+            cv_cache_store(cache_key, &accuracy, 1, random_forest, params, csv_dim->cols - 1);
+
         // Free memory that was used to store the model.
+        free_random_forest(&random_forest, fold_params.n_estimators);
+
+        trace_span_end("cross_validate_fold", "fold", foldIdx, trace_begin);
+    }
+
+    return sumAccuracy / n_folds;
+}
+
+void eval_model_prefixes(const DecisionTreeNode **random_forest,
+                         double **data,
+                         const struct dim *csv_dim,
+                         const ModelContext *ctx,
+                         const size_t *tree_counts,
+                         size_t n_tree_counts,
+                         const size_t *depths,
+                         size_t n_depths,
+                         double *accuracies)
+{
+    size_t n_trees = 0;
+    for (size_t t = 0; t < n_tree_counts; ++t)
+        n_trees = tree_counts[t] > n_trees ? tree_counts[t] : n_trees;
+    size_t max_depth = 0;
+    for (size_t d = 0; d < n_depths; ++d)
+        max_depth = depths[d] > max_depth ? depths[d] : max_depth;
+
+    long *num_correct = tracked_calloc(n_tree_counts * n_depths, sizeof(long), MEMORY_TAG_EVAL);
+    int *predictions = tracked_malloc(max_depth * sizeof(int), MEMORY_TAG_EVAL);
+    // Running count of the votes for class 1 at every depth cutoff, over the trees seen so far.
+    size_t *votes = tracked_malloc(n_depths * sizeof(size_t), MEMORY_TAG_EVAL);
+
+    size_t row_id_offset = ctx->testingFoldIdx * ctx->rowsPerFold;
+    for (size_t row_id = row_id_offset; row_id < row_id_offset + ctx->rowsPerFold; ++row_id)
+    {
+        int ground_truth = (int)data[row_id][csv_dim->cols - 1];
+
+        for (size_t d = 0; d < n_depths; ++d)
+            votes[d] = 0;
+
+        for (size_t i = 0; i < n_trees; ++i)
+        {
+            make_truncated_predictions(random_forest[i], data[row_id], predictions, max_depth);
+            for (size_t d = 0; d < n_depths; ++d)
+                votes[d] += predictions[depths[d] - 1];
+
+            // Once the votes of a whole prefix are in, score its majority the same way as 'predict_model'.
+            for (size_t t = 0; t < n_tree_counts; ++t)
+            {
+                if (tree_counts[t] != i + 1)
+                    continue;
+                for (size_t d = 0; d < n_depths; ++d)
+                {
+                    int prediction = votes[d] > (i + 1) - votes[d];
+                    num_correct[t * n_depths + d] += prediction == ground_truth;
+                }
+            }
+        }
+    }
+
+    for (size_t c = 0; c < n_tree_counts * n_depths; ++c)
+        accuracies[c] = (double)num_correct[c] / (double)ctx->rowsPerFold;
+
+    tracked_free(num_correct, MEMORY_TAG_EVAL);
+    tracked_free(predictions, MEMORY_TAG_EVAL);
+    tracked_free(votes, MEMORY_TAG_EVAL);
+}
+
+void order_trees_greedily(const DecisionTreeNode **random_forest,
+                          size_t n_estimators,
+                          double **data,
+                          const struct dim *csv_dim,
+                          const ModelContext *ctx,
+                          double *accuracies)
+{
+    size_t n_rows = ctx->rowsPerFold;
+    size_t row_id_offset = ctx->testingFoldIdx * ctx->rowsPerFold;
+
+    // Vote of every tree for every row of the fold, which is all that the ordering needs.
+    uint8_t *tree_votes = tracked_malloc(n_estimators * n_rows, MEMORY_TAG_EVAL);
+    int *ground_truth = tracked_malloc(n_rows * sizeof(int), MEMORY_TAG_EVAL);
+    for (size_t r = 0; r < n_rows; ++r)
+    {
+        ground_truth[r] = (int)data[row_id_offset + r][csv_dim->cols - 1];
+        for (size_t t = 0; t < n_estimators; ++t)
+        {
+            int prediction;
+            make_prediction(random_forest[t], data[row_id_offset + r], &prediction);
+            tree_votes[t * n_rows + r] = (uint8_t)prediction;
+        }
+    }
+
+    // Votes for class 1 of every row by the trees picked so far, which are the first 'k' of 'random_forest'.
+    size_t *votes = tracked_calloc(n_rows, sizeof(size_t), MEMORY_TAG_EVAL);
+    for (size_t k = 0; k < n_estimators; ++k)
+    {
+        size_t best_tree = k;
+        long best_correct = -1;
+        for (size_t t = k; t < n_estimators; ++t)
+        {
+            // Majority of the picked trees and tree 't', ties go to class 0 same as in 'predict_model'.
+            const uint8_t *tree = tree_votes + t * n_rows;
+            long correct = 0;
+            for (size_t r = 0; r < n_rows; ++r)
+            {
+                size_t ones = votes[r] + tree[r];
+                correct += (ones > (k + 1) - ones) == ground_truth[r];
+            }
+            if (correct > best_correct)
+            {
+                best_tree = t;
+                best_correct = correct;
+            }
+        }
+
+        // Swap the picked tree into place, along with its votes.
+        const DecisionTreeNode *picked = random_forest[best_tree];
+        random_forest[best_tree] = random_forest[k];
+        random_forest[k] = picked;
+        for (size_t r = 0; r < n_rows; ++r)
+        {
+            uint8_t vote = tree_votes[best_tree * n_rows + r];
+            tree_votes[best_tree * n_rows + r] = tree_votes[k * n_rows + r];
+            tree_votes[k * n_rows + r] = vote;
+            votes[r] += vote;
+        }
+        accuracies[k] = (double)best_correct / (double)n_rows;
+    }
+
+    tracked_free(tree_votes, MEMORY_TAG_EVAL);
+    tracked_free(ground_truth, MEMORY_TAG_EVAL);
+    tracked_free(votes, MEMORY_TAG_EVAL);
+}
+
+size_t select_tree_prefix(const double *accuracies, size_t n_estimators, double epsilon)
+{
+    double target = accuracies[n_estimators - 1] - epsilon;
+    for (size_t k = 0; k < n_estimators; ++k)
+        if (accuracies[k] >= target)
+            return k + 1;
+    return n_estimators;
+}
+
+double time_prefix_predictions(const DecisionTreeNode **random_forest,
+                               size_t n_trees,
+                               double **data,
+                               const ModelContext *ctx,
+                               size_t max_rows)
+{
+    size_t n_rows = ctx->rowsPerFold < max_rows ? ctx->rowsPerFold : max_rows;
+    size_t row_id_offset = ctx->testingFoldIdx * ctx->rowsPerFold;
+
+    volatile int sink = 0;
+    double begin = get_monotonic_time();
+    for (size_t row_id = row_id_offset; row_id < row_id_offset + n_rows; ++row_id)
+        sink += predict_model(&random_forest, n_trees, data[row_id]);
+    (void)sink;
+    return n_rows ? (get_monotonic_time() - begin) / (double)n_rows : 0;
+}
+
+void cross_validate_prefixes(double **data,
+                             const RandomForestParameters *params,
+                             const struct dim *csv_dim,
+                             const int k_folds,
+                             const int n_folds,
+                             const size_t *tree_counts,
+                             size_t n_tree_counts,
+                             const size_t *depths,
+                             size_t n_depths,
+                             SplitCandidates *const *fold_split_candidates,
+                             double *accuracies)
+{
+    size_t n_accuracies = n_tree_counts * n_depths;
+    double *fold_accuracies = tracked_malloc(n_accuracies * sizeof(double), MEMORY_TAG_EVAL);
+    for (size_t c = 0; c < n_accuracies; ++c)
+        accuracies[c] = 0;
+
+    // Prefixes and depths scored, which are part of the cache key next to the parameters of the forest.
+    size_t n_scored = 1 + n_tree_counts + n_depths;
+    size_t *scored = tracked_malloc(n_scored * sizeof(size_t), MEMORY_TAG_EVAL);
+    scored[0] = n_tree_counts;
+    memcpy(scored + 1, tree_counts, n_tree_counts * sizeof(size_t));
+    memcpy(scored + 1 + n_tree_counts, depths, n_depths * sizeof(size_t));
+
+    for (size_t foldIdx = 0; foldIdx < n_folds; ++foldIdx)
+    {
+        double trace_begin = trace_span_begin();
+
+        const SplitCandidates *split_candidates = fold_split_candidates ? fold_split_candidates[foldIdx] : NULL;
+        const ModelContext ctx = (ModelContext){
+            testingFoldIdx : foldIdx,
+            rowsPerFold : csv_dim->rows / k_folds,
+            split_candidates : split_candidates
+        };
+
+        uint64_t cache_key = 0;
+        int cached = 0;
+        if (cv_cache_enabled(params))
+        {
+            cache_key = cv_cache_key(data, csv_dim, params, k_folds, foldIdx, split_candidates, scored, n_scored);
+            cached = cv_cache_lookup(cache_key, fold_accuracies, n_accuracies);
+        }
+
+        if (!cached)
+        {
+            const DecisionTreeNode **random_forest = (const DecisionTreeNode **)train_model(
+                data,
+                params,
+                csv_dim,
+                &ctx,
+                NULL);
+
+            eval_model_prefixes(random_forest, data, csv_dim, &ctx, tree_counts, n_tree_counts, depths, n_depths, fold_accuracies);
+
+            if (cv_cache_enabled(params))
+                cv_cache_store(cache_key, fold_accuracies, n_accuracies, random_forest, params, csv_dim->cols - 1);
+
+            free_random_forest(&random_forest, params->n_estimators);
+        }
+
+        for (size_t c = 0; c < n_accuracies; ++c)
+            accuracies[c] += fold_accuracies[c] / n_folds;
+
+        trace_span_end("cross_validate_fold", "fold", foldIdx, trace_begin);
+    }
+
+    tracked_free(fold_accuracies, MEMORY_TAG_EVAL);
+    tracked_free(scored, MEMORY_TAG_EVAL);
+}
+
+double eval_model_sparse(const DecisionTreeNode **random_forest,
+                         const SparseMatrix *data,
+                         const RandomForestParameters *params,
+                         const ModelContext *ctx)
+{
+    long num_correct = 0;
+
+    QuantizedForest *quantized_forest = NULL;
+    uint16_t *bins = NULL;
+    if (params->quantize)
+    {
+        quantized_forest = quantize_random_forest(random_forest, params->n_estimators);
+        if (quantized_forest == NULL)
+            exit(1);
+        bins = tracked_malloc(quantized_forest->n_features * sizeof(uint16_t), MEMORY_TAG_EVAL);
+    }
+
+    size_t row_id_offset = ctx->testingFoldIdx * ctx->rowsPerFold;
+    for (size_t row_id = row_id_offset; row_id < row_id_offset + ctx->rowsPerFold; ++row_id)
+    {
+        // Traverse the trees with the row in its sparse form.
+        size_t offset = data->row_ptr[row_id];
+        size_t nnz = data->row_ptr[row_id + 1] - offset;
+        int prediction;
+        if (quantized_forest)
+        {
+            quantize_sparse_row(quantized_forest, data->col_idx + offset, data->values + offset, nnz, bins);
+            prediction = predict_quantized(quantized_forest, bins);
+        }
+        else
+        {
+            prediction = predict_model_sparse(&random_forest,
+                                              params->n_estimators,
+                                              data->col_idx + offset,
+                                              data->values + offset,
+                                              nnz);
+        }
+        int ground_truth = (int)data->labels[row_id];
+
+        if (log_level > 1)
+            printf("majority vote: %d | %d ground truth\n", prediction, ground_truth);
+
+        if (prediction == ground_truth)
+            ++num_correct;
+    }
+
+    if (quantized_forest)
+    {
+        free_quantized_forest(quantized_forest);
+        tracked_free(bins, MEMORY_TAG_EVAL);
+    }
+
+    return (double)num_correct / (double)ctx->rowsPerFold;
+}
+
+double cross_validate_sparse(const SparseMatrix *data,
+                             const RandomForestParameters *params,
+                             const int k_folds,
+                             const SplitCandidates *split_candidates)
+{
+    double sumAccuracy = 0;
+
+    for (size_t foldIdx = 0; foldIdx < k_folds; ++foldIdx)
+    {
+        double trace_begin = trace_span_begin();
+
+        const ModelContext ctx = (ModelContext){
+            testingFoldIdx : foldIdx /* Fold to use for evaluation. */,
+            rowsPerFold : data->rows / k_folds /* Number of rows per fold. */,
+            split_candidates : split_candidates
+        };
+
+        const DecisionTreeNode **random_forest = train_model_sparse(data, params, &ctx);
+
+        sumAccuracy += eval_model_sparse(random_forest, data, params, &ctx);
+
         free_random_forest(&random_forest, params->n_estimators);
+
+        trace_span_end("cross_validate_sparse_fold", "fold", foldIdx, trace_begin);
     }
 
     return sumAccuracy / k_folds;
@@ -9,21 +9,222 @@
 #include "../model/forest.h"
 #include "../utils/utils.h"
 #include "../utils/data.h"
+#include "../utils/sparse.h"
 
 /*
-Runs a hyperparameter search across a number of pre-defined parameters for the random forest model and
-reports the best parameters. Calls 'cross_validate' on each parameter configuration to get the cross validation
-accuracy for each set-up. Can be adjusted to run across as many parameters as needed.
+Hyperparameters that a search can vary.
 */
-void hyperparameter_search(double **data, struct dim *csv_dim);
+enum Hyperparameter
+{
+    HYPERPARAMETER_N_ESTIMATORS,
+    HYPERPARAMETER_MAX_DEPTH,
+    HYPERPARAMETER_MIN_SAMPLES_LEAF,
+    HYPERPARAMETER_MAX_FEATURES,
+    HYPERPARAMETER_COUNT
+};
+
+/*
+Most values of a single hyperparameter in a grid.
+*/
+#define MAX_GRID_VALUES 64
+
+/*
+Grid of values to search for every hyperparameter, every combination of the values is a configuration.
+Hyperparameters without values keep the value of the base parameters of the search.
+*/
+struct HyperparameterGrid
+{
+    size_t values[HYPERPARAMETER_COUNT][MAX_GRID_VALUES];
+    size_t counts[HYPERPARAMETER_COUNT];
+};
+
+typedef struct HyperparameterGrid HyperparameterGrid;
+
+/*
+How 'hyperparameter_search' spends its compute on the configurations.
+*/
+enum SearchMode
+{
+    SEARCH_MODE_GRID = 0,   // Full cross validation of every configuration.
+    SEARCH_MODE_HALVING = 1 // Successive halving, see 'hyperparameter_search'.
+};
+
+typedef enum SearchMode SearchMode;
+
+/*
+Parameters for a hyperparameter search.
+*/
+struct HyperparameterSearchParameters
+{
+    SearchMode mode;
+    int k_folds; // Number of cross validation folds of the full budget.
+    double eta;  // With 'SEARCH_MODE_HALVING' the top '1 / eta' of the configurations survive every round.
+};
+
+typedef struct HyperparameterSearchParameters HyperparameterSearchParameters;
+
+/*
+Result of a single configuration of a hyperparameter search, at the largest budget it was evaluated with.
+*/
+struct HyperparameterResult
+{
+    size_t config; // Index of the configuration in the grid.
+    RandomForestParameters params;
+    double accuracy;
+    int round;       // Last round the configuration was evaluated in, starting at 0.
+    size_t n_trees;  // Number of trees it was last evaluated with.
+    int n_folds;     // Number of folds it was last evaluated on.
+};
+
+typedef struct HyperparameterResult HyperparameterResult;
+
+/*
+Parses a grid of the form 'n_estimators=10,50,100;max_depth=3,7', with hyperparameter names as in
+RandomForestParameters. Returns 0 on success or -1 if 'spec' is malformed.
+*/
+int parse_hyperparameter_grid(const char *spec, HyperparameterGrid *grid);
+
+/*
+Searches the configurations of 'grid' on top of 'base_params' and returns the leaderboard of all of them,
+best first, with the number of configurations in 'n_results'. The leaderboard is printed when 'log_level' is
+above 0.
+
+With 'SEARCH_MODE_GRID' every configuration is cross validated on all 'k_folds' folds. With
+'SEARCH_MODE_HALVING' the configurations are first evaluated on a small budget, a fraction of their trees and
+of the folds, and only the best '1 / eta' of them go on to the next round, in which the budget is 'eta' times
+larger, until fewer than 'eta' survivors are cross validated with their full budget. Every round costs about
+as much as that last one, so a grid of 'n' configurations costs about 'log_eta(n)' times a handful of full
+cross validations instead of 'n' of them. The leaderboard ranks configurations that survived longer first.
+
+In both modes, the configurations of a round that only differ in 'n_estimators' and 'max_depth' are scored
+from one forest per fold with 'cross_validate_prefixes', so a grid over those two costs a single forest of
+the most trees and largest depth.
+
+Optional 'fold_split_candidates' (can be NULL) hold the candidates of each of the 'search->k_folds' folds for
+'SPLIT_MODE_QUANTILE', taken without the rows of its testing fold, see 'split_candidates_for_folds'.
+Without them every fold sketches the rows it is trained on.
+*/
+HyperparameterResult *hyperparameter_search(double **data,
+                                            const struct dim *csv_dim,
+                                            const HyperparameterGrid *grid,
+                                            const RandomForestParameters *base_params,
+                                            const HyperparameterSearchParameters *search,
+                                            SplitCandidates *const *fold_split_candidates,
+                                            size_t *n_results);
 
 /*
 Runs k-fold cross validation on the 'data' and returns the accuracy. In the process builds up a random
-forest model for each iteration and evaluates on a separate test fold.
+forest model for each iteration and evaluates on a separate test fold. Optional 'split_candidates' (can be
+NULL) are shared by every fold when training with 'SPLIT_MODE_QUANTILE'. If a cache was set with
+'set_cv_cache', folds are read from it when they were cross validated before and stored into it otherwise.
+
+A 'params->time_budget' is for all folds together: every fold gets an even share of the time left when it
+starts, and its model has as many trees as fit into that share.
 */
 double cross_validate(double **data,
                       const RandomForestParameters *params,
                       const struct dim *csv_dim,
-                      const int k_folds);
+                      const int k_folds,
+                      const SplitCandidates *split_candidates);
+
+/*
+Same as 'cross_validate', but only evaluates the first 'n_folds' of the 'k_folds' folds and returns their
+mean accuracy, for a cheaper estimate.
+*/
+double cross_validate_folds(double **data,
+                            const RandomForestParameters *params,
+                            const struct dim *csv_dim,
+                            const int k_folds,
+                            const int n_folds,
+                            const SplitCandidates *split_candidates);
+
+/*
+Returns the accuracy of 'random_forest' on the testing fold of 'ctx', predicting in the QuantizedForest format
+with 'params->quantize' and from lookup tables for oblivious trees.
+*/
+double eval_model(const DecisionTreeNode **random_forest,
+                  double **data,
+                  const RandomForestParameters *params,
+                  const struct dim *csv_dim,
+                  const ModelContext *ctx);
+
+/*
+Evaluates a family of forests that are all part of 'random_forest' on the testing fold of 'ctx' in a single
+pass over its rows: for every count in 'tree_counts' the forest of its first trees, and for every depth in
+'depths' with the trees truncated at that depth (see 'make_truncated_predictions'). The accuracy of the
+first 'tree_counts[t]' trees truncated at 'depths[d]' is written into 'accuracies[t * n_depths + d]'. The
+forest must have at least the largest of 'tree_counts' trees, grown with at least the largest of 'depths'.
+*/
+void eval_model_prefixes(const DecisionTreeNode **random_forest,
+                         double **data,
+                         const struct dim *csv_dim,
+                         const ModelContext *ctx,
+                         const size_t *tree_counts,
+                         size_t n_tree_counts,
+                         const size_t *depths,
+                         size_t n_depths,
+                         double *accuracies);
+
+/*
+Orders the 'n_estimators' trees of 'random_forest' in place for pruning, by greedy forward selection on the
+testing fold of 'ctx': the tree picked next is the one whose vote, together with those of the trees picked
+before it, gives the most accurate majority on the fold (ties go to the earlier tree). 'accuracies[k]' is
+set to the accuracy on the fold of the first 'k + 1' trees in the new order, so the last one is the accuracy
+of the whole forest.
+*/
+void order_trees_greedily(const DecisionTreeNode **random_forest,
+                          size_t n_estimators,
+                          double **data,
+                          const struct dim *csv_dim,
+                          const ModelContext *ctx,
+                          double *accuracies);
+
+/*
+Given the 'accuracies' of the prefixes of a forest ordered by 'order_trees_greedily', returns the smallest
+number of trees whose accuracy is at most 'epsilon' below that of the whole forest.
+*/
+size_t select_tree_prefix(const double *accuracies, size_t n_estimators, double epsilon);
+
+/*
+Returns the mean time in seconds 'predict_model' takes for a row with the first 'n_trees' trees of
+'random_forest', timed on up to 'max_rows' rows of the testing fold of 'ctx'.
+*/
+double time_prefix_predictions(const DecisionTreeNode **random_forest,
+                               size_t n_trees,
+                               double **data,
+                               const ModelContext *ctx,
+                               size_t max_rows);
+
+/*
+Same as 'cross_validate_folds', but trains a single forest per fold with 'params' and scores all of its
+prefixes and depth cutoffs of 'tree_counts' and 'depths' with 'eval_model_prefixes', writing their mean
+accuracies into 'accuracies' (laid out the same). 'params' must have the largest of 'tree_counts' as
+'n_estimators' and the largest of 'depths' as 'max_depth', and no 'time_budget' since every prefix needs
+all of its trees. Fold 'f' is trained with 'fold_split_candidates[f]' if they are not NULL.
+
+With a non-zero 'params->seed' a prefix of the forest is exactly the forest trained with fewer trees. A
+truncated tree is grown the same way as a tree of the smaller depth, but is not the identical tree, since
+the random feature draws of the deeper nodes shift the draws of the nodes grown after them.
+*/
+void cross_validate_prefixes(double **data,
+                             const RandomForestParameters *params,
+                             const struct dim *csv_dim,
+                             const int k_folds,
+                             const int n_folds,
+                             const size_t *tree_counts,
+                             size_t n_tree_counts,
+                             const size_t *depths,
+                             size_t n_depths,
+                             SplitCandidates *const *fold_split_candidates,
+                             double *accuracies);
+
+/*
+Runs k-fold cross validation on sparse 'data' and returns the accuracy, same as 'cross_validate' does for
+dense data. The trees differ from the dense ones, see 'grow_sparse_tree'.
+*/
+double cross_validate_sparse(const SparseMatrix *data,
+                             const RandomForestParameters *params,
+                             const int k_folds,
+                             const SplitCandidates *split_candidates);
 
 #endif // eval_h
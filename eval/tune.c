@@ -0,0 +1,277 @@
+/*
+@author andrii dobroshynski
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "tune.h"
+#include "eval.h"
+#include "../utils/memory.h"
+#include "../utils/sketch.h"
+
+/*
+Least number of rows a candidate is scored against to measure the cost of scoring, and least time predictions
+are timed for.
+*/
+#define AUTO_TUNE_SCAN_ROWS (1 << 22)
+#define AUTO_TUNE_MIN_SECONDS 0.01
+
+/*
+Returns the cost in seconds of scoring a candidate threshold against a single one of the 'rows' rows of 'data',
+the inner loop of every split search.
+*/
+double measure_scan_seconds(double **data, size_t rows, size_t cols)
+{
+    const ModelContext ctx = (ModelContext){
+        testingFoldIdx : 0,
+        rowsPerFold : 0 /* No testing fold. */,
+        split_candidates : NULL
+    };
+    DecisionTreeTargetClasses classes = get_target_class_values(data, rows, cols, &ctx);
+    size_t *class_counts = tracked_malloc(2 * classes.count * sizeof(size_t), MEMORY_TAG_SPLIT_SCRATCH);
+
+    size_t repeats = (AUTO_TUNE_SCAN_ROWS + rows - 1) / rows;
+    volatile double sink = 0;
+    double begin = get_monotonic_time();
+    for (size_t r = 0; r < repeats; ++r)
+    {
+        int feature_index = r % (cols - 1);
+        sink += calculate_gini_index(data, rows, cols, feature_index, data[r % rows][feature_index], &classes, class_counts);
+    }
+    double seconds = (get_monotonic_time() - begin) / (double)(repeats * rows);
+    (void)sink;
+
+    tracked_free(class_counts, MEMORY_TAG_SPLIT_SCRATCH);
+    tracked_free(classes.labels, MEMORY_TAG_SPLIT_SCRATCH);
+    return seconds;
+}
+
+/*
+Cost model of training a tree with 'params' on 'rows' rows of 'n_features' features: the number of times a
+candidate threshold is scored against a row, plus the rows partitioned, in a balanced tree of 'max_depth'
+levels. With 'SPLIT_MODE_QUANTILE' every model also sketches every feature once, which its trees share.
+*/
+double split_search_units(const RandomForestParameters *params, size_t rows, size_t n_features)
+{
+    size_t bins = params->max_bins ? params->max_bins : DEFAULT_MAX_BINS;
+    double units = 0;
+    double node_rows = rows;
+    double nodes = 1;
+    for (size_t depth = 0; depth < params->max_depth && node_rows > params->min_samples_leaf; ++depth)
+    {
+        double search_rows = params->max_split_samples && node_rows > params->max_split_samples
+                                 ? params->max_split_samples
+                                 : node_rows;
+        double candidates = params->split_mode == SPLIT_MODE_QUANTILE ? bins
+                            : params->split_mode == SPLIT_MODE_RANDOM ? 1
+                                                                      : search_rows;
+        units += nodes * (params->max_features * candidates * search_rows + node_rows);
+        nodes *= 2;
+        node_rows /= 2;
+    }
+    if (params->split_mode == SPLIT_MODE_QUANTILE)
+        units += (double)rows * n_features / params->n_estimators;
+    return units;
+}
+
+/*
+Returns the seconds 'eval_model' takes per row of the testing fold of 'ctx'.
+*/
+double time_eval_model(const DecisionTreeNode **random_forest,
+                       double **data,
+                       const RandomForestParameters *params,
+                       const struct dim *csv_dim,
+                       const ModelContext *ctx)
+{
+    size_t repeats = 0;
+    double begin = get_monotonic_time();
+    double elapsed;
+    do
+    {
+        eval_model(random_forest, data, params, csv_dim, ctx);
+        ++repeats;
+    } while ((elapsed = get_monotonic_time() - begin) < AUTO_TUNE_MIN_SECONDS);
+    return elapsed / (double)(repeats * ctx->rowsPerFold);
+}
+
+/*
+Sets 'params' up for 'engine', starting from an exact split search.
+*/
+void set_engine(RandomForestParameters *params, AutoTuneEngine engine)
+{
+    if (engine == AUTO_TUNE_SAMPLED)
+        params->max_split_samples = AUTO_TUNE_SPLIT_SAMPLES;
+    else if (engine == AUTO_TUNE_HISTOGRAM)
+    {
+        params->split_mode = SPLIT_MODE_QUANTILE;
+        params->max_bins = params->max_bins ? params->max_bins : DEFAULT_MAX_BINS;
+    }
+}
+
+void auto_tune(double **data, const struct dim *csv_dim, RandomForestParameters *params, AutoTuneResult *result)
+{
+    const char *engine_names[AUTO_TUNE_ENGINE_COUNT] = {"exact", "sampled", "histogram"};
+    size_t n_features = csv_dim->cols - 1;
+    size_t bins = params->max_bins ? params->max_bins : DEFAULT_MAX_BINS;
+
+    memset(result, 0, sizeof(AutoTuneResult));
+    result->cores = sysconf(_SC_NPROCESSORS_ONLN);
+    result->l2_cache = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    result->llc_cache = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (result->llc_cache <= 0)
+        result->llc_cache = result->l2_cache;
+    result->working_set = csv_dim->rows * (csv_dim->cols * sizeof(double) + sizeof(double *));
+
+    // Rows evenly spread over the data, in case it is sorted. Every fifth of them is moved to the end, where it
+    // is the testing fold of the sample.
+    size_t n_sample = csv_dim->rows < AUTO_TUNE_SAMPLE_ROWS ? csv_dim->rows : AUTO_TUNE_SAMPLE_ROWS;
+    n_sample -= n_sample % 5;
+    if (n_sample == 0 || n_features == 0)
+        return;
+    size_t stride = csv_dim->rows / n_sample;
+    size_t n_held_out = n_sample / 5;
+    double **sample = tracked_malloc(n_sample * sizeof(double *), MEMORY_TAG_EVAL);
+    for (size_t i = 0; i < n_sample; ++i)
+        sample[i % 5 == 4 ? n_sample - n_held_out + i / 5 : i - i / 5] = data[i * stride];
+    const struct dim sample_dim = (struct dim){rows : n_sample, cols : csv_dim->cols};
+    const ModelContext ctx = (ModelContext){
+        testingFoldIdx : 4,
+        rowsPerFold : n_held_out,
+        split_candidates : NULL
+    };
+
+    // Shape of the values: zeros, and features that a histogram of 'bins' bins represents exactly.
+    size_t n_zeros = 0;
+    double *column = tracked_malloc(n_sample * sizeof(double), MEMORY_TAG_EVAL);
+    for (size_t j = 0; j < n_features; ++j)
+    {
+        for (size_t i = 0; i < n_sample; ++i)
+        {
+            column[i] = sample[i][j];
+            n_zeros += column[i] == 0;
+        }
+        qsort(column, n_sample, sizeof(double), compare_doubles);
+        size_t n_distinct = 1;
+        for (size_t i = 1; i < n_sample; ++i)
+            n_distinct += column[i] != column[i - 1];
+        result->low_cardinality_features += n_distinct <= bins;
+    }
+    tracked_free(column, MEMORY_TAG_EVAL);
+    result->sparsity = (double)n_zeros / (double)(n_sample * n_features);
+
+    result->scan_seconds[0] = measure_scan_seconds(sample, n_sample, csv_dim->cols);
+    result->scan_seconds[1] = measure_scan_seconds(data, csv_dim->rows, csv_dim->cols);
+
+    // Calibration trees are seeded so that every engine grows the same kind of trees, and are never compacted,
+    // which would be timed along with them. Their output would drown the log.
+    RandomForestParameters calibration_params = (*params);
+    calibration_params.n_estimators = params->n_estimators < AUTO_TUNE_MAX_TREES ? params->n_estimators : AUTO_TUNE_MAX_TREES;
+    calibration_params.seed = params->seed ? params->seed : 1;
+    calibration_params.compact_trees = 0;
+    calibration_params.quantize = 0;
+    calibration_params.time_budget = 0;
+    int saved_log_level = log_level;
+    set_log_level(0);
+
+    // Only an exact split search is tuned, otherwise the configured one is timed as the only choice.
+    int tuned = params->split_mode == SPLIT_MODE_BEST && params->max_split_samples == 0 && !params->oblivious;
+    const DecisionTreeNode **forests[AUTO_TUNE_ENGINE_COUNT] = {NULL};
+    for (int e = 0; e < (tuned ? AUTO_TUNE_ENGINE_COUNT : 1); ++e)
+    {
+        // Sampling the rows of a node changes nothing if no node has more rows than the sample.
+        if (e == AUTO_TUNE_SAMPLED && csv_dim->rows <= AUTO_TUNE_SPLIT_SAMPLES)
+            continue;
+
+        RandomForestParameters engine_params = calibration_params;
+        if (tuned)
+            set_engine(&engine_params, (AutoTuneEngine)e);
+
+        AutoTuneCost *cost = &result->costs[e];
+        double begin = get_monotonic_time();
+        forests[e] = train_model(sample, &engine_params, &sample_dim, &ctx, NULL);
+        cost->measured_seconds = (get_monotonic_time() - begin) / engine_params.n_estimators;
+        cost->accuracy = eval_model(forests[e], sample, &engine_params, &sample_dim, &ctx);
+        cost->calibrated = 1;
+
+        // The model is off by about the same factor on all rows as on the sample, once the cost of scoring is
+        // that of all rows.
+        engine_params.n_estimators = params->n_estimators;
+        cost->predicted_seconds = result->scan_seconds[0] * split_search_units(&engine_params, n_sample - n_held_out, n_features);
+        cost->full_seconds = result->scan_seconds[1] * split_search_units(&engine_params, csv_dim->rows, n_features) *
+                             (cost->measured_seconds / cost->predicted_seconds);
+
+        if (e == AUTO_TUNE_EXACT ||
+            (cost->accuracy >= result->costs[AUTO_TUNE_EXACT].accuracy - AUTO_TUNE_ACCURACY_TOLERANCE &&
+             cost->full_seconds < result->costs[result->engine].full_seconds))
+            result->engine = (AutoTuneEngine)e;
+    }
+
+    // Both formats make the same predictions, so the faster one is picked. Oblivious trees are evaluated from
+    // their lookup tables instead.
+    RandomForestParameters eval_params = calibration_params;
+    if (tuned)
+        set_engine(&eval_params, result->engine);
+    result->predict_seconds[0] = time_eval_model(forests[result->engine], sample, &eval_params, &sample_dim, &ctx);
+    if (!params->oblivious)
+    {
+        eval_params.quantize = 1;
+        result->predict_seconds[1] = time_eval_model(forests[result->engine], sample, &eval_params, &sample_dim, &ctx);
+        result->quantize = result->predict_seconds[1] < result->predict_seconds[0];
+    }
+    else
+        result->quantize = params->quantize;
+
+    set_log_level(saved_log_level);
+    for (int e = 0; e < AUTO_TUNE_ENGINE_COUNT; ++e)
+        if (forests[e])
+            free_random_forest(&forests[e], calibration_params.n_estimators);
+    tracked_free(sample, MEMORY_TAG_EVAL);
+
+    if (tuned)
+        set_engine(params, result->engine);
+    params->quantize = result->quantize;
+
+    if (log_level > 0)
+    {
+        printf("[auto tune] %ld rows, %ld features, %.1f%% zeros, %ld of %ld features with at most %ld distinct values\n",
+               csv_dim->rows, n_features, result->sparsity * 100, result->low_cardinality_features, n_features, bins);
+        printf("[auto tune] %ld cores, %ld KB L2 and %ld KB last level cache, %.1f MB of data (%s the last level cache)\n",
+               result->cores,
+               result->l2_cache / 1024,
+               result->llc_cache / 1024,
+               result->working_set / 1e6,
+               result->working_set <= (size_t)result->llc_cache ? "fits into" : "larger than");
+        printf("[auto tune] scoring a candidate against a row: %.2f ns on the sample, %.2f ns on all rows\n",
+               result->scan_seconds[0] * 1e9, result->scan_seconds[1] * 1e9);
+        printf("[auto tune] %10s %16s %16s %16s %9s\n", "engine", "predicted (s)", "measured (s)", "all rows (s)", "accuracy");
+        for (int e = 0; e < AUTO_TUNE_ENGINE_COUNT; ++e)
+        {
+            const AutoTuneCost *cost = &result->costs[e];
+            if (cost->calibrated)
+                printf("[auto tune] %10s %16.6f %16.6f %16.6f %8.2f%%%s\n",
+                       tuned ? engine_names[e] : "configured",
+                       cost->predicted_seconds,
+                       cost->measured_seconds,
+                       cost->full_seconds,
+                       cost->accuracy * 100,
+                       e == (int)result->engine ? " (picked)" : "");
+        }
+        printf("[auto tune] seconds are per tree, predicted and measured on %ld sample rows, predicted for all rows\n",
+               n_sample - n_held_out);
+        if (params->oblivious)
+            printf("[auto tune] evaluating from lookup tables: %.3f us per row\n", result->predict_seconds[0] * 1e6);
+        else
+            printf("[auto tune] evaluating %s: %.3f us per row from the trees, %.3f us quantized\n",
+                   result->quantize ? "quantized" : "the trees",
+                   result->predict_seconds[0] * 1e6,
+                   result->predict_seconds[1] * 1e6);
+
+        double train_seconds = result->costs[result->engine].full_seconds * params->n_estimators;
+        printf("[auto tune] training is single-threaded, %ld trees take about %.2fs", params->n_estimators, train_seconds);
+        if (result->cores > 1)
+            printf(", rf-dist --local=%ld about %.2fs", result->cores, train_seconds / result->cores);
+        printf("\n");
+    }
+}
@@ -0,0 +1,104 @@
+/*
+@author andrii dobroshynski
+*/
+
+#ifndef tune_h
+#define tune_h
+
+#include "../model/forest.h"
+#include "../utils/data.h"
+
+/*
+Split search engines 'auto_tune' picks from. They grow trees with the same parameters, the approximate ones
+only score fewer candidate thresholds or fewer rows per candidate.
+*/
+enum AutoTuneEngine
+{
+    AUTO_TUNE_EXACT,     // Every row value is a candidate, scored against all rows ('SPLIT_MODE_BEST').
+    AUTO_TUNE_SAMPLED,   // Same, on a sample of the rows of large nodes ('max_split_samples').
+    AUTO_TUNE_HISTOGRAM, // Only the quantile bin edges are candidates ('SPLIT_MODE_QUANTILE').
+    AUTO_TUNE_ENGINE_COUNT
+};
+
+typedef enum AutoTuneEngine AutoTuneEngine;
+
+/*
+Most rows of the calibration sample, of which every fifth is held out to compare the accuracy of the engines.
+*/
+#define AUTO_TUNE_SAMPLE_ROWS 2000
+
+/*
+Most trees trained per engine for the calibration.
+*/
+#define AUTO_TUNE_MAX_TREES 5
+
+/*
+'max_split_samples' of the sampled engine.
+*/
+#define AUTO_TUNE_SPLIT_SAMPLES 512
+
+/*
+Most an approximate engine may lose in accuracy against the exact one on the held out rows of the sample to
+be picked.
+*/
+#define AUTO_TUNE_ACCURACY_TOLERANCE 0.01
+
+/*
+Cost of an engine, in seconds of training per tree.
+*/
+struct AutoTuneCost
+{
+    int calibrated;           // Whether the engine was tried, only the exact split search is tuned.
+    double predicted_seconds; // On the sample, from the cost model.
+    double measured_seconds;  // On the sample.
+    double full_seconds;      // On all rows, from the cost model scaled by how far off it was on the sample.
+    double accuracy;          // On the held out rows of the sample.
+};
+
+typedef struct AutoTuneCost AutoTuneCost;
+
+/*
+What 'auto_tune' found out about the machine and the data and what it picked.
+*/
+struct AutoTuneResult
+{
+    long cores;          // Online cores, 0 if unknown.
+    long l2_cache;       // Bytes, 0 if unknown.
+    long llc_cache;      // Bytes of the last level cache, 0 if unknown.
+    size_t working_set;  // Bytes of the rows and the row pointers of the data.
+    double sparsity;     // Share of feature values of the sample that are zero.
+    size_t low_cardinality_features; // Features with at most as many distinct values in the sample as bins.
+
+    double scan_seconds[2]; // Cost of scoring a candidate against a row on the sample and on all rows.
+    AutoTuneCost costs[AUTO_TUNE_ENGINE_COUNT];
+    AutoTuneEngine engine;
+
+    double predict_seconds[2]; // Per held out row, from the trees and in the QuantizedForest format.
+    int quantize;
+};
+
+typedef struct AutoTuneResult AutoTuneResult;
+
+/*
+Auto mode: picks the fastest way to train and evaluate a model with 'params' on 'data' and writes it into
+'params'. Looks at the shape and the sparsity of the data, the parameters and the cores and caches of the
+machine, then calibrates on a sample of the rows:
+
+  - The cost of a split search is modelled as the number of rows every candidate threshold is scored against
+    in a balanced tree of 'max_depth' levels. The cost of scoring one candidate against one row is measured
+    on the sample and on all rows, which does not fit into the caches if the data is large.
+  - A few trees are trained on the sample with every split search engine, and the ratio of their measured to
+    their modelled cost corrects the prediction of every engine for all rows.
+  - The fastest engine for all rows whose accuracy on the held out rows of the sample is within
+    AUTO_TUNE_ACCURACY_TOLERANCE of the exact search is picked. Only an exact split search is tuned, a split
+    mode or 'max_split_samples' picked by the caller is kept.
+  - The evaluation format, trees or 'quantize', is the one that predicted the held out rows faster. Both
+    make the same predictions.
+
+Training is single-threaded, so there is no threading to pick, the log says how long 'rf-dist' over all
+cores would take instead. The findings, the predicted and measured costs and the choice are written into
+'result' and printed if 'log_level' is above 0.
+*/
+void auto_tune(double **data, const struct dim *csv_dim, RandomForestParameters *params, AutoTuneResult *result);
+
+#endif // tune_h
@@ -5,14 +5,132 @@
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include "api/random_forest.h"
+#include "eval/cache.h"
 #include "eval/eval.h"
+#include "eval/tune.h"
+#include "model/checkpoint.h"
 #include "utils/argparse.h"
 #include "utils/data.h"
+#include "utils/memory.h"
+#include "utils/stats.h"
+#include "utils/trace.h"
 #include "utils/utils.h"
 
+const char *argp_program_version =
+    "random-forests-c 1.0";
+const char *argp_program_bug_address =
+    "https://github.com/dobroshynski/random-forests-c";
+
 /* Our argp parser. */
 static struct argp argp = {options, parse_opt, args_doc, doc};
 
+/*
+Writes the collected stats as JSON if requested with '--stats', either to stdout or to the given file.
+*/
+void report_stats(const struct arguments *arguments, double wall_time)
+{
+    if (!arguments->stats)
+        return;
+
+    if (!STATS_ENABLED)
+        fprintf(stderr, "Warning: built without RANDOM_FOREST_STATS, only the wall time is reported\n");
+
+    FILE *out = stdout;
+    if (arguments->stats_output)
+    {
+        out = fopen(arguments->stats_output, "w");
+        if (out == NULL)
+        {
+            printf("Error: can't open file for writing: %s\n", arguments->stats_output);
+            exit(-1);
+        }
+    }
+
+    write_stats_json(out, wall_time);
+
+    if (out != stdout)
+        fclose(out);
+}
+
+/*
+Loads a sparse input file (libsvm text or binary CSR) and runs cross validation on it without ever
+storing the data densely.
+*/
+int run_sparse(const char *file_name,
+               const struct arguments *arguments,
+               const RandomForestParameters *params,
+               const int k_folds)
+{
+    SparseMatrix *data = arguments->format == INPUT_FORMAT_LIBSVM
+                             ? parse_libsvm(file_name)
+                             : load_sparse_binary(file_name);
+
+    if (log_level > 0)
+        printf("using:\n  rows: %ld, features: %ld, non-zero values: %ld (%.2f%% dense)\nread from sparse file:\n  \"%s\"\n",
+               data->rows,
+               data->cols,
+               data->nnz,
+               100.0 * data->nnz / ((double)data->rows * data->cols),
+               file_name);
+
+    if (arguments->csr_output)
+        save_sparse_binary(data, arguments->csr_output);
+
+    double begin_time = get_monotonic_time();
+
+    double cv_accuracy = cross_validate_sparse(data, params, k_folds, NULL /* split_candidates */);
+    printf("cross validation accuracy: %f%% (%ld%%)\n",
+           (cv_accuracy * 100),
+           (long)(cv_accuracy * 100));
+
+    printf("(time taken: %fs)\n", get_monotonic_time() - begin_time);
+
+    free_sparse_matrix(data);
+    return 0;
+}
+
+/*
+Prunes the model for --prune on the 'rows' held out rows of 'data' and prints the trade-off between the
+number of trees, the accuracy and the prediction time of the smaller models. Only the models that are more
+accurate than every smaller one are printed, the others are never worth shipping.
+*/
+void prune_model(RandomForest *forest, const double *data, size_t rows, size_t cols, double epsilon)
+{
+    size_t n_trees = rf_n_trees(forest);
+    double *accuracies = tracked_malloc(n_trees * sizeof(double), MEMORY_TAG_EVAL);
+    double *latencies = tracked_malloc(n_trees * sizeof(double), MEMORY_TAG_EVAL);
+
+    int n_kept = rf_prune(forest, data, rows, cols, epsilon, accuracies, latencies);
+    if (n_kept < 0)
+    {
+        printf("Error: failed to prune the model: %s\n", rf_last_error());
+        exit(1);
+    }
+
+    if (log_level > 0)
+    {
+        printf("pruning on %ld held out rows:\n  trees | accuracy | us per row\n", rows);
+        double best = -1;
+        for (size_t k = 0; k < n_trees; ++k)
+        {
+            if (accuracies[k] <= best && k + 1 != (size_t)n_kept && k + 1 != n_trees)
+                continue;
+            best = accuracies[k] > best ? accuracies[k] : best;
+            printf("  %5ld | %7.3f%% | %10.3f%s\n",
+                   k + 1,
+                   accuracies[k] * 100,
+                   latencies[k] * 1e6,
+                   k + 1 == (size_t)n_kept ? " (kept)" : "");
+        }
+        printf("kept %d of %ld trees, held out accuracy %f%% against %f%% with all trees\n",
+               n_kept, n_trees, accuracies[n_kept - 1] * 100, accuracies[n_trees - 1] * 100);
+    }
+
+    tracked_free(accuracies, MEMORY_TAG_EVAL);
+    tracked_free(latencies, MEMORY_TAG_EVAL);
+}
+
 int main(int argc, char **argv)
 {
     struct arguments arguments;
@@ -21,23 +139,204 @@ int main(int argc, char **argv)
     arguments.log_level = 1;
     arguments.rows = 0;
     arguments.cols = 0;
+    arguments.extra_trees = 0;
+    arguments.quantile_bins = 0;
+    arguments.max_split_samples = 0;
+    arguments.oblivious = 0;
+    arguments.auto_tune = 0;
+    arguments.compact = 0;
+    arguments.quantize = 0;
+    arguments.memory_budget_mb = 0;
+    arguments.time_budget = 0;
+    arguments.search = SEARCH_NONE;
+    arguments.grid = NULL;
+    arguments.eta = 3;
+    arguments.cache_dir = NULL;
+    arguments.cache_size_mb = 1024;
+    arguments.cache_models = 0;
+    arguments.checkpoint_dir = NULL;
+    arguments.checkpoint_interval = 60;
+    arguments.resume = 0;
+    arguments.format = INPUT_FORMAT_CSV;
+    arguments.csr_output = NULL;
+    arguments.model_output = NULL;
+    arguments.warm_start = NULL;
+    arguments.prune = 0;
+    arguments.prune_epsilon = 0;
+    arguments.profile_layout = 0;
+    arguments.random_seed = 0;
+    arguments.stats = 0;
+    arguments.stats_output = NULL;
+    arguments.trace_output = NULL;
 
     /* Parse our arguments; every option seen by parse_opt will
      be reflected in arguments. */
     argp_parse(&argp, argc, argv, 0, 0, &arguments);
 
+    // Wall time of the whole run, reported along with the stats.
+    double run_begin_time = get_monotonic_time();
+
+    // The trace is written when the process exits.
+    if (arguments.trace_output)
+        start_trace(arguments.trace_output);
+
     // Set the log level to whatever was parsed from the arguments or the default value.
     set_log_level(arguments.log_level);
 
+    set_memory_budget(arguments.memory_budget_mb * 1024 * 1024);
+
+    // Cached results are only valid for reproducible runs, which need every tree seeded from --seed.
+    if (arguments.cache_dir)
+    {
+        if (!arguments.random_seed)
+        {
+            printf("Error: --cache requires a non-zero --seed\n");
+            exit(1);
+        }
+        set_cv_cache(arguments.cache_dir, arguments.cache_size_mb * 1024 * 1024, arguments.cache_models);
+    }
+
+    // Checkpoints need every tree seeded, so a run without --seed draws one and checkpoints it along with the
+    // trees. Done folds are checkpointed by the cache, which never evicts them from the checkpoint directory.
+    if (arguments.checkpoint_dir)
+    {
+        if (arguments.cache_dir || arguments.format != INPUT_FORMAT_CSV || arguments.checkpoint_interval < 0)
+        {
+            printf("Error: --checkpoint is only supported for csv input without --cache and needs an interval >= 0\n");
+            exit(1);
+        }
+        if (!arguments.resume && has_checkpoint(arguments.checkpoint_dir))
+        {
+            printf("Error: %s holds a checkpoint, pass --resume to continue from it or use an empty directory\n", arguments.checkpoint_dir);
+            exit(1);
+        }
+        set_checkpoint(arguments.checkpoint_dir, arguments.checkpoint_interval);
+
+        if (!arguments.random_seed && arguments.resume)
+            arguments.random_seed = load_checkpoint_seed();
+        if (!arguments.random_seed)
+            arguments.random_seed = (int)(time(NULL) & 0x7FFFFFFF) | 1;
+        if (save_checkpoint_seed(arguments.random_seed) != 0)
+        {
+            printf("Error: can't write a checkpoint into %s\n", arguments.checkpoint_dir);
+            exit(1);
+        }
+        set_cv_cache(arguments.checkpoint_dir, SIZE_MAX, 0);
+    }
+    else if (arguments.resume)
+    {
+        printf("Error: --resume needs the --checkpoint directory of the run\n");
+        exit(1);
+    }
+
     // Optionally set the random seed if a specific random seed was provided via an argument.
     if (arguments.random_seed)
         srand(arguments.random_seed);
     else
         srand(time(NULL));
 
+    const int k_folds = 1;
+
+    // Configurations of a search are compared on 5 folds, since a single fold is too noisy to rank them.
+    const int search_k_folds = 5;
+
+    if (log_level > 0)
+        printf("using:\n  k_folds: %d\n", k_folds);
+
+    // Example configuration for a random forest model, which --auto tunes once the data is loaded.
+    RandomForestParameters params = {
+        n_estimators : 3 /* Number of trees in the random forest model. */,
+        max_depth : 7 /* Maximum depth of a tree in the model. */,
+        min_samples_leaf : 3,
+        max_features : 3,
+        split_mode : arguments.extra_trees     ? SPLIT_MODE_RANDOM
+                     : arguments.quantile_bins ? SPLIT_MODE_QUANTILE
+                                               : SPLIT_MODE_BEST,
+        max_bins : arguments.quantile_bins,
+        compact_trees : arguments.compact,
+        quantize : arguments.quantize,
+        seed : arguments.cache_dir || arguments.checkpoint_dir ? arguments.random_seed : 0,
+        max_split_samples : arguments.max_split_samples,
+        oblivious : arguments.oblivious,
+        time_budget : arguments.time_budget
+    };
+
+    // Print random forest parameters.
+    if (log_level > 0)
+        print_params(&params);
+
     // Read the csv file from args which must be parsed now.
     const char *file_name = arguments.args[0];
 
+    // The hyperparameter search needs a grid to search over, parsed up front so that a typo fails fast.
+    HyperparameterGrid grid;
+    if (arguments.search != SEARCH_NONE)
+    {
+        if (arguments.grid == NULL || parse_hyperparameter_grid(arguments.grid, &grid) != 0)
+        {
+            printf("Error: --search needs a valid --grid, e.g. 'n_estimators=10,50;max_depth=3,7'\n");
+            exit(1);
+        }
+        if (arguments.eta <= 1)
+        {
+            printf("Error: --eta must be > 1\n");
+            exit(1);
+        }
+        if (arguments.format != INPUT_FORMAT_CSV)
+        {
+            printf("Error: --search is only supported for csv input\n");
+            exit(1);
+        }
+    }
+
+    // Extremely randomized trees draw their thresholds, so they would silently ignore the quantile bins.
+    if (arguments.extra_trees && arguments.quantile_bins)
+    {
+        printf("Error: --extra_trees and --quantile_bins can't be combined\n");
+        exit(1);
+    }
+
+    if (arguments.prune && (arguments.model_output == NULL || arguments.prune_epsilon < 0))
+    {
+        printf("Error: --prune needs --save_model and an epsilon >= 0\n");
+        exit(1);
+    }
+
+    // Every fold of a search needs all of its trees, and a warm start keeps the parameters of the model it
+    // starts from.
+    if (arguments.time_budget < 0 ||
+        (arguments.time_budget > 0 && (arguments.search != SEARCH_NONE || arguments.warm_start || arguments.format != INPUT_FORMAT_CSV)))
+    {
+        printf("Error: --time_budget must be >= 0 and is only supported for csv input without --search and --warm_start\n");
+        exit(1);
+    }
+
+    if (arguments.auto_tune && (arguments.search != SEARCH_NONE || arguments.format != INPUT_FORMAT_CSV))
+    {
+        printf("Error: --auto is only supported for csv input without --search\n");
+        exit(1);
+    }
+
+    // Sparse inputs are loaded straight into CSR form and never densified.
+    if (arguments.format != INPUT_FORMAT_CSV)
+    {
+        if (arguments.oblivious)
+        {
+            printf("Error: --oblivious is only supported for csv input\n");
+            exit(1);
+        }
+        // The sparse split search always scans every row of a node.
+        if (arguments.max_split_samples)
+        {
+            printf("Error: --max_split_samples is only supported for csv input\n");
+            exit(1);
+        }
+
+        int status = run_sparse(file_name, &arguments, &params, k_folds);
+        report_stats(&arguments, get_monotonic_time() - run_begin_time);
+        return status;
+    }
+
     // If the values for rows and cols were provided as arguments, then use them for the
     // 'dim' struct, otherwise call 'parse_csv_dims()' to parse the csv file provided to
     // compute the size of the csv file.
@@ -55,51 +354,204 @@ int main(int argc, char **argv)
                csv_dim.cols,
                file_name);
 
-    // Allocate memory for the data coming from the .csv and read in the data.
-    double *data = malloc(sizeof(double) * csv_dim.rows * csv_dim.cols);
-    parse_csv(file_name, &data, csv_dim);
+    // If splits are searched over quantile bins, sketch every feature column of every fold while reading the
+    // csv file so that the bin edges are available without another pass over (or sorting of) the data. The
+    // bin edges of a fold are merged from the sketches of the other folds, same as a fold sketches only the
+    // rows it is trained on when no bin edges are given.
+    const int eval_k_folds = arguments.search != SEARCH_NONE ? search_k_folds : k_folds;
+    size_t n_features = csv_dim.cols - 1;
+    size_t rows_per_fold = csv_dim.rows / eval_k_folds ? csv_dim.rows / eval_k_folds : 1;
+    size_t n_chunks = (csv_dim.rows + rows_per_fold - 1) / rows_per_fold;
+    QuantileSketch **sketches = NULL;
+    if (arguments.quantile_bins)
+    {
+        sketches = tracked_malloc(sizeof(QuantileSketch *) * n_chunks * n_features, MEMORY_TAG_DATA);
+        for (size_t j = 0; j < n_chunks * n_features; ++j)
+            sketches[j] = empty_quantile_sketch(SKETCH_CAPACITY);
+    }
 
-    // Compute a checksum of the data to verify that loaded correctly.
-    if (log_level > 1)
-        printf("data checksum = %f\n", _1d_checksum(data, csv_dim.rows * csv_dim.cols));
+    // The flat and the pivoted copy of the data are held at once while pivoting, if that does not fit into
+    // the memory budget there is no way to train on the data.
+    size_t data_bytes = sizeof(double) * csv_dim.rows * csv_dim.cols;
+    if (!memory_budget_allows(2 * data_bytes + sizeof(double *) * csv_dim.rows))
+    {
+        printf("Error: %ld x %ld rows and columns of data don't fit into the memory budget of %ld MB\n",
+               csv_dim.rows, csv_dim.cols, arguments.memory_budget_mb);
+        exit(1);
+    }
 
-    const int k_folds = 1;
+    // Allocate memory for the data coming from the .csv and read in the data.
+    double *data = tracked_malloc(data_bytes, MEMORY_TAG_DATA);
+    parse_csv(file_name, &data, csv_dim, sketches, rows_per_fold);
 
-    if (log_level > 0)
-        printf("using:\n  k_folds: %d\n", k_folds);
+    SplitCandidates **fold_split_candidates = NULL;
+    if (sketches)
+    {
+        fold_split_candidates =
+            split_candidates_for_folds(sketches, n_chunks, n_features, eval_k_folds, arguments.quantile_bins);
 
-    // Example configuration for a random forest model.
-    const RandomForestParameters params = {
-        n_estimators : 3 /* Number of trees in the random forest model. */,
-        max_depth : 7 /* Maximum depth of a tree in the model. */,
-        min_samples_leaf : 3,
-        max_features : 3
-    };
+        for (size_t j = 0; j < n_chunks * n_features; ++j)
+            free_quantile_sketch(sketches[j]);
+        tracked_free(sketches, MEMORY_TAG_DATA);
+    }
 
-    // Print random forest parameters.
-    if (log_level > 0)
-        print_params(&params);
+    // Compute a checksum of the data to verify that loaded correctly.
+    if (log_level > 1)
+        printf("data checksum = %f\n", _1d_checksum(data, csv_dim.rows * csv_dim.cols));
 
     // Pivot the csv file data into a two dimensional array.
     double **pivoted_data;
     pivot_data(data, csv_dim, &pivoted_data);
 
+    // The flat copy is only needed again to train the saved model through the library API, otherwise it is
+    // freed right away rather than holding the data twice while training.
+    if (!arguments.model_output)
+    {
+        tracked_free(data, MEMORY_TAG_DATA);
+        data = NULL;
+    }
+
     if (log_level > 1)
         printf("checksum of pivoted 2d array: %f\n", _2d_checksum(pivoted_data, csv_dim.rows, csv_dim.cols));
 
+    // Calibrating is not part of the time taken, which compares the training it picked to the one it didn't.
+    if (arguments.auto_tune)
+    {
+        AutoTuneResult tune_result;
+        auto_tune(pivoted_data, &csv_dim, &params, &tune_result);
+
+        // Bin edges are taken from all rows, same as with --quantile_bins for the single fold.
+        if (params.split_mode == SPLIT_MODE_QUANTILE && fold_split_candidates == NULL)
+        {
+            const ModelContext ctx = (ModelContext){
+                testingFoldIdx : 0,
+                rowsPerFold : 0 /* No testing fold. */,
+                split_candidates : NULL
+            };
+            fold_split_candidates = tracked_malloc(sizeof(SplitCandidates *), MEMORY_TAG_DATA);
+            fold_split_candidates[0] = compute_split_candidates(pivoted_data, &params, &csv_dim, &ctx);
+        }
+        if (log_level > 0)
+            print_params(&params);
+    }
+
     // Start the clock for timing.
-    clock_t begin_clock = clock();
+    double begin_time = get_monotonic_time();
 
-    double cv_accuracy = cross_validate(pivoted_data, &params, &csv_dim, k_folds);
-    printf("cross validation accuracy: %f%% (%ld%%)\n",
-           (cv_accuracy * 100),
-           (long)(cv_accuracy * 100));
+    if (arguments.search != SEARCH_NONE)
+    {
+        const HyperparameterSearchParameters search = {
+            mode : arguments.search == SEARCH_HALVING ? SEARCH_MODE_HALVING : SEARCH_MODE_GRID,
+            k_folds : search_k_folds,
+            eta : arguments.eta
+        };
+
+        size_t n_results;
+        HyperparameterResult *results =
+            hyperparameter_search(pivoted_data, &csv_dim, &grid, &params, &search, fold_split_candidates, &n_results);
+        printf("best configuration: cross validation accuracy: %f%% (%ld%%)\n",
+               (results[0].accuracy * 100),
+               (long)(results[0].accuracy * 100));
+        print_params(&results[0].params);
+        tracked_free(results, MEMORY_TAG_EVAL);
+    }
+    else
+    {
+        double cv_accuracy = cross_validate(pivoted_data,
+                                            &params,
+                                            &csv_dim,
+                                            k_folds,
+                                            fold_split_candidates ? fold_split_candidates[0] : NULL);
+        printf("cross validation accuracy: %f%% (%ld%%)\n",
+               (cv_accuracy * 100),
+               (long)(cv_accuracy * 100));
+    }
 
     // Record and output the time taken to run.
-    clock_t end_clock = clock();
-    printf("(time taken: %fs)\n", (double)(end_clock - begin_clock) / CLOCKS_PER_SEC);
+    printf("(time taken: %fs)\n", get_monotonic_time() - begin_time);
+
+    if (log_level > 0 && arguments.cache_dir)
+        printf("cross validation cache: %ld folds read, %ld trained\n", get_cv_cache_hits(), get_cv_cache_misses());
+    else if (log_level > 0 && arguments.checkpoint_dir)
+        printf("checkpoint: %ld folds read, %ld trained, %ld trees read\n",
+               get_cv_cache_hits(), get_cv_cache_misses(), get_checkpoint_trees_restored());
+
+    // Optionally store the data in the binary sparse form for later runs.
+    if (arguments.csr_output)
+    {
+        SparseMatrix *sparse_data = dense_to_sparse(pivoted_data, &csv_dim);
+        save_sparse_binary(sparse_data, arguments.csr_output);
+        free_sparse_matrix(sparse_data);
+    }
+
+    // Optionally train the final model on every row through the library API and save it. With a warm start
+    // the trees are added to an existing model instead.
+    if (arguments.model_output)
+    {
+        RandomForestConfig config = rf_default_config();
+        config.n_estimators = params.n_estimators;
+        config.max_depth = params.max_depth;
+        config.min_samples_leaf = params.min_samples_leaf;
+        config.max_features = params.max_features;
+        config.extra_trees = arguments.extra_trees;
+        config.quantile_bins = params.split_mode == SPLIT_MODE_QUANTILE ? params.max_bins : 0;
+        config.compact = arguments.compact;
+        config.seed = arguments.random_seed;
+        config.max_split_samples = params.max_split_samples;
+        config.oblivious = arguments.oblivious;
+        config.time_budget = arguments.time_budget;
+
+        // Pruning needs rows the model was not trained on, the last fifth of the rows is held out for it.
+        size_t held_out_rows = arguments.prune ? csv_dim.rows / 5 : 0;
+        size_t train_rows = csv_dim.rows - held_out_rows;
+
+        RandomForest *forest = arguments.warm_start ? rf_load(arguments.warm_start) : rf_create(&config);
+        if (forest == NULL || rf_add_trees(forest, data, train_rows, csv_dim.cols, params.n_estimators) != 0)
+        {
+            printf("Error: failed to save the model: %s\n", rf_last_error());
+            exit(1);
+        }
+
+        if (arguments.prune)
+            prune_model(forest, data + train_rows * csv_dim.cols, held_out_rows, csv_dim.cols, arguments.prune_epsilon);
+
+        if ((arguments.profile_layout && rf_profile(forest, data, csv_dim.rows, csv_dim.cols) != 0) ||
+            rf_save(forest, arguments.model_output) != 0)
+        {
+            printf("Error: failed to save the model: %s\n", rf_last_error());
+            exit(1);
+        }
+        if (log_level > 0 && arguments.warm_start)
+            printf("added %ld trees trained on %s%ld rows to the model from %s and saved it to %s\n",
+                   params.n_estimators, arguments.prune ? "" : "all ", train_rows, arguments.warm_start, arguments.model_output);
+        else if (log_level > 0)
+            printf("saved model of %ld trees trained on %s%ld rows to %s\n",
+                   rf_n_trees(forest), arguments.prune ? "" : "all ", train_rows, arguments.model_output);
+        rf_free(forest);
+    }
 
     // Free loaded csv file data.
-    free(data);
-    free(pivoted_data);
+    tracked_free(data, MEMORY_TAG_DATA);
+    tracked_free(pivoted_data, MEMORY_TAG_DATA);
+
+    if (log_level > 0)
+    {
+        printf("peak memory: %ld bytes (data %ld, tree nodes %ld, split scratch %ld, eval %ld)\n",
+               get_memory_peak(MEMORY_TAG_COUNT),
+               get_memory_peak(MEMORY_TAG_DATA),
+               get_memory_peak(MEMORY_TAG_TREE_NODES),
+               get_memory_peak(MEMORY_TAG_SPLIT_SCRATCH),
+               get_memory_peak(MEMORY_TAG_EVAL));
+        if (get_budget_leaves() > 0)
+            printf("memory budget: made %ld nodes leaves instead of splitting them\n", get_budget_leaves());
+    }
+
+    if (fold_split_candidates)
+    {
+        for (int fold = 0; fold < eval_k_folds; ++fold)
+            free_split_candidates(fold_split_candidates[fold]);
+        tracked_free(fold_split_candidates, MEMORY_TAG_DATA);
+    }
+
+    report_stats(&arguments, get_monotonic_time() - run_begin_time);
 }
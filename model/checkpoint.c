@@ -0,0 +1,224 @@
+/*
+@author andrii dobroshynski
+*/
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "checkpoint.h"
+#include "../utils/memory.h"
+
+#define CHECKPOINT_MAGIC "RFCKPT1\0"
+#define CHECKPOINT_SEED_FILE "run.seed"
+
+static const char *checkpoint_dir = NULL;
+static double checkpoint_interval = 0;
+static size_t trees_restored = 0;
+
+void set_checkpoint(const char *dir, double interval)
+{
+    checkpoint_dir = dir;
+    checkpoint_interval = interval;
+}
+
+int checkpoint_enabled(const RandomForestParameters *params)
+{
+    // Trees trained under a memory budget depend on the memory the rest of the run held, which a resumed run
+    // does not hold the same way.
+    return checkpoint_dir != NULL && params->seed != 0 && params->time_budget <= 0 && get_memory_budget() == 0;
+}
+
+int has_checkpoint(const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return 0;
+
+    int found = 0;
+    struct dirent *entry;
+    while (!found && (entry = readdir(d)) != NULL)
+    {
+        const char *extension = strrchr(entry->d_name, '.');
+        found = strcmp(entry->d_name, CHECKPOINT_SEED_FILE) == 0 ||
+                (extension && (strcmp(extension, ".ckpt") == 0 || strcmp(extension, ".cv") == 0));
+    }
+    closedir(d);
+    return found;
+}
+
+/*
+Writes into 'path' the path of the file 'name' of the checkpoint directory.
+*/
+void checkpoint_path(char *path, size_t size, const char *name)
+{
+    snprintf(path, size, "%s/%s", checkpoint_dir, name);
+}
+
+int save_checkpoint_seed(unsigned int seed)
+{
+    char path[4096];
+    char temp_path[4096];
+    checkpoint_path(path, sizeof(path), CHECKPOINT_SEED_FILE);
+    snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", path, (int)getpid());
+
+    FILE *file = fopen(temp_path, "w");
+    if (file == NULL)
+        return -1;
+    int status = fprintf(file, "%u\n", seed) > 0;
+    if (fclose(file) != 0 || !status || rename(temp_path, path) != 0)
+    {
+        unlink(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+unsigned int load_checkpoint_seed()
+{
+    char path[4096];
+    checkpoint_path(path, sizeof(path), CHECKPOINT_SEED_FILE);
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return 0;
+    unsigned int seed = 0;
+    if (fscanf(file, "%u", &seed) != 1)
+        seed = 0;
+    fclose(file);
+    return seed;
+}
+
+uint64_t checkpoint_key(double **data,
+                        const struct dim *csv_dim,
+                        const RandomForestParameters *params,
+                        const ModelContext *ctx,
+                        size_t first_index)
+{
+    // Every field is hashed on its own rather than the struct, which has padding. 'compact_trees' is left out
+    // since trees are saved before they are compacted.
+    const uint64_t words[] = {
+        CHECKPOINT_VERSION,
+        hash_data(data, csv_dim),
+        csv_dim->rows,
+        csv_dim->cols,
+        params->max_depth,
+        params->min_samples_leaf,
+        params->max_features,
+        params->split_mode,
+        params->max_bins,
+        params->seed,
+        params->max_split_samples,
+        params->oblivious,
+        ctx->testingFoldIdx,
+        ctx->rowsPerFold,
+        first_index};
+    uint64_t key = hash_words(0xCBF29CE484222325ULL, words, sizeof(words) / sizeof(uint64_t));
+
+    if (ctx->split_candidates)
+    {
+        for (size_t j = 0; j < ctx->split_candidates->n_features; ++j)
+        {
+            uint64_t count = ctx->split_candidates->counts[j];
+            key = hash_words(key, &count, 1);
+            key = hash_words(key, (const uint64_t *)ctx->split_candidates->values[j], count);
+        }
+    }
+    return key;
+}
+
+/*
+Writes into 'path' the path of the checkpoint of 'key'.
+*/
+void checkpoint_key_path(char *path, size_t size, uint64_t key)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%016lx.ckpt", key);
+    checkpoint_path(path, size, name);
+}
+
+int checkpoint_due(double last_time)
+{
+    return get_monotonic_time() - last_time >= checkpoint_interval;
+}
+
+size_t load_checkpoint(uint64_t key, size_t n_features, const DecisionTreeNode **random_forest, size_t max_trees)
+{
+    char path[4096];
+    checkpoint_key_path(path, sizeof(path), key);
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return 0;
+
+    char magic[8];
+    uint64_t header[2];
+    if (fread(magic, sizeof(magic), 1, file) != 1 ||
+        memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 ||
+        fread(header, sizeof(header), 1, file) != 1 ||
+        header[0] != key)
+    {
+        fclose(file);
+        return 0;
+    }
+
+    size_t n_trees = header[1] < max_trees ? header[1] : max_trees;
+    long nodeId = 0;
+    for (size_t i = 0; i < n_trees; ++i)
+    {
+        random_forest[i] = load_tree_node(file, n_features, 0, &nodeId);
+        if (random_forest[i] == NULL)
+        {
+            // A damaged checkpoint is trained again from the start.
+            long freeCount = 0;
+            for (size_t j = 0; j < i; ++j)
+                free_decision_tree_node(random_forest[j], &freeCount);
+            n_trees = 0;
+            break;
+        }
+    }
+    fclose(file);
+
+    trees_restored += n_trees;
+    if (log_level > 0 && n_trees > 0)
+        printf("resumed from a checkpoint of %ld trees\n", n_trees);
+    return n_trees;
+}
+
+int save_checkpoint(uint64_t key, const DecisionTreeNode **random_forest, size_t n_trees)
+{
+    char path[4096];
+    char temp_path[4096];
+    checkpoint_key_path(path, sizeof(path), key);
+    snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", path, (int)getpid());
+
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL)
+        return -1;
+    const uint64_t header[2] = {key, n_trees};
+    int status = fwrite(CHECKPOINT_MAGIC, 8, 1, file) == 1 &&
+                 fwrite(header, sizeof(header), 1, file) == 1;
+    for (size_t i = 0; status && i < n_trees; ++i)
+        status = save_full_tree_node(random_forest[i], file) == 0;
+
+    // Flushed to disk before the rename, so that a crash of the machine can't leave an empty file behind.
+    status = status && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0 || !status || rename(temp_path, path) != 0)
+    {
+        unlink(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+void remove_checkpoint(uint64_t key)
+{
+    char path[4096];
+    checkpoint_key_path(path, sizeof(path), key);
+    unlink(path);
+}
+
+size_t get_checkpoint_trees_restored()
+{
+    return trees_restored;
+}
@@ -0,0 +1,98 @@
+/*
+@author andrii dobroshynski
+*/
+
+#ifndef checkpoint_h
+#define checkpoint_h
+
+#include <stdint.h>
+#include "forest.h"
+#include "../utils/data.h"
+
+/*
+Opt-in checkpoints of the trees of a training in progress, so that a run that gets killed picks up at the
+tree it was training instead of starting over. 'extend_model' saves the trees it trained so far every
+'interval' seconds into a file of its own, keyed by a hash of the data, the parameters, the testing fold and
+the index of its first tree, and removes the file once it is done.
+
+Only trainings with a non-zero 'params->seed' and without a time or memory budget are checkpointed. Every
+tree is then seeded from the seed and its index, so the state of 'rand()' at a tree is known without saving
+it, and the trees trained after a resume are the ones the killed run would have trained. Files are written to a temporary
+file and renamed into place, so a killed process never leaves a partial checkpoint behind.
+
+Completed folds and configurations are checkpointed by pointing the cross validation cache (see
+'eval/cache.h') at the same directory.
+*/
+
+/*
+Version of the checkpoints, bump it with every change to training that changes the trees trained.
+*/
+#define CHECKPOINT_VERSION 1
+
+/*
+Enables checkpoints in the existing directory 'dir', saved every 'interval' seconds while a model is trained.
+A NULL 'dir' disables them.
+*/
+void set_checkpoint(const char *dir, double interval);
+
+/*
+Returns whether a training with 'params' is checkpointed.
+*/
+int checkpoint_enabled(const RandomForestParameters *params);
+
+/*
+Returns whether 'dir' holds anything a run with checkpoints in it left behind: checkpoints, cached folds or
+the seed of the run.
+*/
+int has_checkpoint(const char *dir);
+
+/*
+Saves the seed 'seed' of the run, so that a resumed run that was started without one trains the same trees.
+Returns 0 on success or -1.
+*/
+int save_checkpoint_seed(unsigned int seed);
+
+/*
+Returns the seed saved by 'save_checkpoint_seed', or 0 if there is none.
+*/
+unsigned int load_checkpoint_seed();
+
+/*
+Returns the key of the checkpoint of the training of the trees from index 'first_index' on 'data' with
+'params', leaving out the testing fold of 'ctx'.
+*/
+uint64_t checkpoint_key(double **data,
+                        const struct dim *csv_dim,
+                        const RandomForestParameters *params,
+                        const ModelContext *ctx,
+                        size_t first_index);
+
+/*
+Returns whether a checkpoint last saved (or, before the first, started) at 'last_time' is due to be saved
+again.
+*/
+int checkpoint_due(double last_time);
+
+/*
+Reads up to 'max_trees' trees of 'n_features' features of the checkpoint of 'key' into 'random_forest'. Returns
+the number of trees read, 0 if there is no such checkpoint or it is damaged.
+*/
+size_t load_checkpoint(uint64_t key, size_t n_features, const DecisionTreeNode **random_forest, size_t max_trees);
+
+/*
+Saves the 'n_trees' trees of 'random_forest' as the checkpoint of 'key', replacing the one before. Returns 0
+on success or -1, in which case the checkpoint before is kept.
+*/
+int save_checkpoint(uint64_t key, const DecisionTreeNode **random_forest, size_t n_trees);
+
+/*
+Removes the checkpoint of 'key' once its training is done.
+*/
+void remove_checkpoint(uint64_t key);
+
+/*
+Returns the number of trees read from checkpoints so far.
+*/
+size_t get_checkpoint_trees_restored();
+
+#endif // checkpoint_h
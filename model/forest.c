@@ -3,6 +3,10 @@
 */
 
 #include "forest.h"
+#include "checkpoint.h"
+#include "../utils/stats.h"
+#include "../utils/trace.h"
+#include "../utils/memory.h"
 
 const DecisionTreeNode *train_model_tree(double **data,
                                          const RandomForestParameters *params,
@@ -10,9 +14,30 @@ const DecisionTreeNode *train_model_tree(double **data,
                                          long *nodeId /* Ascending node ID generator */,
                                          const ModelContext *ctx)
 {
+    STATS_PHASE_BEGIN(STATS_PHASE_TRAIN_TREE);
+
+    // Oblivious trees are grown level by level rather than node by node.
+    if (params->oblivious)
+    {
+        DecisionTreeNode *root = grow_oblivious_tree(data,
+                                                     params->max_depth,
+                                                     params->min_samples_leaf,
+                                                     params->max_features,
+                                                     params->split_mode,
+                                                     params->max_split_samples,
+                                                     csv_dim->rows,
+                                                     csv_dim->cols,
+                                                     nodeId,
+                                                     ctx);
+        STATS_PHASE_END(STATS_PHASE_TRAIN_TREE);
+        return root;
+    }
+
     DecisionTreeNode *root = empty_node(nodeId);
     DecisionTreeDataSplit data_split = calculate_best_data_split(data,
                                                                  params->max_features,
+                                                                 params->split_mode,
+                                                                 params->max_split_samples,
                                                                  csv_dim->rows,
                                                                  csv_dim->cols,
                                                                  ctx);
@@ -33,6 +58,8 @@ const DecisionTreeNode *train_model_tree(double **data,
          params->max_depth,
          params->min_samples_leaf,
          params->max_features,
+         params->split_mode,
+         params->max_split_samples,
          1 /* Current depth. */,
          csv_dim->rows,
          csv_dim->cols,
@@ -40,35 +67,313 @@ const DecisionTreeNode *train_model_tree(double **data,
          ctx);
 
     // Free any temp memory.
-    free(data_split.data);
+    tracked_free(data_split.data, MEMORY_TAG_SPLIT_SCRATCH);
+
+    STATS_PHASE_END(STATS_PHASE_TRAIN_TREE);
 
     return root;
 }
 
+unsigned int get_tree_seed(unsigned int seed, size_t tree_index)
+{
+    // splitmix64 finalizer, so that the seeds of neighbouring trees are unrelated.
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL * (tree_index + 1);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return (unsigned int)(z ^ (z >> 31));
+}
+
+const DecisionTreeNode *train_indexed_tree(double **data,
+                                           const RandomForestParameters *params,
+                                           const struct dim *csv_dim,
+                                           size_t tree_index,
+                                           long *nodeId,
+                                           const ModelContext *ctx)
+{
+    if (params->seed)
+        srand(get_tree_seed(params->seed, tree_index));
+
+    double trace_begin = trace_span_begin();
+    const DecisionTreeNode *tree = train_model_tree(data, params, csv_dim, nodeId, ctx);
+    trace_span_end("train_model_tree", "tree", tree_index, trace_begin);
+    return tree;
+}
+
 const DecisionTreeNode **train_model(double **data,
                                      const RandomForestParameters *params,
                                      const struct dim *csv_dim,
-                                     const ModelContext *ctx)
+                                     const ModelContext *ctx,
+                                     size_t *n_trained)
 {
-    // Random forest model which is stored as a contigious list of pointers to DecisionTreeNode structs.
-    const DecisionTreeNode **random_forest = (const DecisionTreeNode **)
-        malloc(sizeof(DecisionTreeNode *) * params->n_estimators);
+    return extend_model(NULL, 0, params->n_estimators, data, params, csv_dim, ctx, n_trained);
+}
+
+/*
+Returns whether a training that began at 'begin_time' should start another tree under 'params->time_budget',
+which it always should without a budget or before the first tree. The next tree is expected to take as long
+as the mean of the 'n_trained' trees trained since 'trees_begin_time'.
+*/
+int time_budget_allows_tree(const RandomForestParameters *params, double begin_time, double trees_begin_time, size_t n_trained)
+{
+    if (params->time_budget <= 0 || n_trained == 0)
+        return 1;
+
+    double now = get_monotonic_time();
+    return now + (now - trees_begin_time) / n_trained <= begin_time + params->time_budget;
+}
+
+const DecisionTreeNode **extend_model(const DecisionTreeNode **random_forest,
+                                      size_t n_existing,
+                                      size_t n_new,
+                                      double **data,
+                                      const RandomForestParameters *params,
+                                      const struct dim *csv_dim,
+                                      const ModelContext *ctx,
+                                      size_t *n_trained)
+{
+    double begin_time = get_monotonic_time();
+
+    // Random forest model which is stored as a contigious list of pointers to DecisionTreeNode structs, the
+    // existing trees are kept as they are.
+    random_forest = (const DecisionTreeNode **)
+        tracked_realloc(random_forest, sizeof(DecisionTreeNode *) * (n_existing + n_new), MEMORY_TAG_TREE_NODES);
 
     // Node ID generator. We use this such that every node in the tree gets assigned a strictly
     // increasing ID for debugging.
     long nodeId = 0;
 
+    // The quantile split mode needs candidate thresholds, so compute them here if the caller did not
+    // provide any.
+    SplitCandidates *split_candidates = NULL;
+    if (params->split_mode == SPLIT_MODE_QUANTILE && ctx->split_candidates == NULL)
+        split_candidates = compute_split_candidates(data, params, csv_dim, ctx);
+
+    const ModelContext train_ctx = (ModelContext){
+        testingFoldIdx : ctx->testingFoldIdx,
+        rowsPerFold : ctx->rowsPerFold,
+        split_candidates : split_candidates ? split_candidates : ctx->split_candidates
+    };
+
+    size_t first_index = params->next_tree_index ? params->next_tree_index : n_existing;
+
+    // Trees saved by a run that was killed before it finished are read back rather than trained again.
+    uint64_t checkpoint = 0;
+    size_t n_restored = 0;
+    if (checkpoint_enabled(params) && n_new > 0)
+    {
+        checkpoint = checkpoint_key(data, csv_dim, params, ctx, first_index);
+        n_restored = load_checkpoint(checkpoint, csv_dim->cols - 1, random_forest + n_existing, n_new);
+    }
+
     // Populate the array with allocated memory for the random forest with pointers to individual decision
-    // trees.
+    // trees, as long as the time budget allows for another one.
+    double trees_begin_time = get_monotonic_time();
+    double checkpoint_time = trees_begin_time;
+    size_t n_added = n_restored;
+    while (n_added < n_new && time_budget_allows_tree(params, begin_time, trees_begin_time, n_added - n_restored))
+    {
+        random_forest[n_existing + n_added] = train_indexed_tree(data, params, csv_dim, first_index + n_added, &nodeId, &train_ctx);
+        ++n_added;
+
+        if (checkpoint && n_added < n_new && checkpoint_due(checkpoint_time))
+        {
+            save_checkpoint(checkpoint, random_forest + n_existing, n_added);
+            checkpoint_time = get_monotonic_time();
+        }
+    }
+    if (checkpoint)
+        remove_checkpoint(checkpoint);
+    record_stats_trees(n_new, n_added);
+
+    if (split_candidates)
+        free_split_candidates(split_candidates);
+
+    if (n_added < n_new)
+    {
+        if (log_level > 0)
+            printf("time budget of %gs reached after %ld of %ld trees\n", params->time_budget, n_added, n_new);
+        random_forest = (const DecisionTreeNode **)
+            tracked_realloc(random_forest, sizeof(DecisionTreeNode *) * (n_existing + n_added), MEMORY_TAG_TREE_NODES);
+    }
+    if (n_trained)
+        (*n_trained) = n_added;
+
+    // Compaction would merge nodes of different levels of an oblivious tree, which then could no longer be
+    // compiled into an ObliviousForest.
+    if (params->compact_trees && !params->oblivious)
+        compact_random_forest(random_forest + n_existing, n_added, NULL, NULL);
+
+    return random_forest;
+}
+
+SplitCandidates *compute_split_candidates(double **data,
+                                          const RandomForestParameters *params,
+                                          const struct dim *csv_dim,
+                                          const ModelContext *ctx)
+{
+    size_t n_features = csv_dim->cols - 1;
+    QuantileSketch **sketches = tracked_malloc(n_features * sizeof(QuantileSketch *), MEMORY_TAG_DATA);
+    for (size_t j = 0; j < n_features; ++j)
+        sketches[j] = empty_quantile_sketch(SKETCH_CAPACITY);
+
+    // A single fold has no rows to withhold, the model is trained on every row, so every row is sketched.
+    sketch_data_columns(data, 0, csv_dim->rows, csv_dim->cols, sketches, ctx->rowsPerFold >= csv_dim->rows ? NULL : ctx);
+
+    SplitCandidates *split_candidates = split_candidates_from_sketches(
+        sketches,
+        n_features,
+        params->max_bins ? params->max_bins : DEFAULT_MAX_BINS);
+
+    for (size_t j = 0; j < n_features; ++j)
+        free_quantile_sketch(sketches[j]);
+    tracked_free(sketches, MEMORY_TAG_DATA);
+
+    return split_candidates;
+}
+
+const DecisionTreeNode **train_model_sparse(const SparseMatrix *data,
+                                            const RandomForestParameters *params,
+                                            const ModelContext *ctx)
+{
+    const DecisionTreeNode **random_forest = (const DecisionTreeNode **)
+        tracked_malloc(sizeof(DecisionTreeNode *) * params->n_estimators, MEMORY_TAG_TREE_NODES);
+
+    long nodeId = 0;
+
+    // Column-wise view of the data so that the split search can visit the non-zero values of a feature.
+    SparseColumns *columns = sparse_to_columns(data);
+
+    // A single fold is trained on every row (see 'grow_sparse_tree'), so every row is sketched.
+    const ModelContext all_rows_ctx = (ModelContext){testingFoldIdx : 0, rowsPerFold : 0, split_candidates : NULL};
+    SplitCandidates *split_candidates = NULL;
+    if (params->split_mode == SPLIT_MODE_QUANTILE && ctx->split_candidates == NULL)
+        split_candidates = compute_sparse_split_candidates(columns, params, ctx->rowsPerFold >= data->rows ? &all_rows_ctx : ctx);
+
+    const ModelContext train_ctx = (ModelContext){
+        testingFoldIdx : ctx->testingFoldIdx,
+        rowsPerFold : ctx->rowsPerFold,
+        split_candidates : split_candidates ? split_candidates : ctx->split_candidates
+    };
+
     for (size_t i = 0; i < params->n_estimators; ++i)
     {
-        random_forest[i] = train_model_tree(data, params, csv_dim, &nodeId, ctx);
+        if (params->seed)
+            srand(get_tree_seed(params->seed, i));
+
+        STATS_PHASE_BEGIN(STATS_PHASE_TRAIN_TREE);
+        double trace_begin = trace_span_begin();
+        random_forest[i] = grow_sparse_tree(data,
+                                            columns,
+                                            params->max_depth,
+                                            params->min_samples_leaf,
+                                            params->max_features,
+                                            params->split_mode,
+                                            &nodeId,
+                                            &train_ctx);
+        trace_span_end("grow_sparse_tree", "tree", i, trace_begin);
+        STATS_PHASE_END(STATS_PHASE_TRAIN_TREE);
     }
+    record_stats_trees(params->n_estimators, params->n_estimators);
+
+    if (split_candidates)
+        free_split_candidates(split_candidates);
+    free_sparse_columns(columns);
+
+    if (params->compact_trees)
+        compact_random_forest(random_forest, params->n_estimators, NULL, NULL);
+
     return random_forest;
 }
 
+SplitCandidates *compute_sparse_split_candidates(const SparseColumns *columns,
+                                                 const RandomForestParameters *params,
+                                                 const ModelContext *ctx)
+{
+    QuantileSketch **sketches = tracked_malloc(columns->cols * sizeof(QuantileSketch *), MEMORY_TAG_DATA);
+    for (size_t j = 0; j < columns->cols; ++j)
+    {
+        sketches[j] = empty_quantile_sketch(SKETCH_CAPACITY);
+        for (size_t k = columns->col_ptr[j]; k < columns->col_ptr[j + 1]; ++k)
+            if (!is_row_part_of_testing_fold(columns->row_idx[k], ctx))
+                quantile_sketch_update(sketches[j], columns->values[k]);
+    }
+
+    SplitCandidates *split_candidates = split_candidates_from_sketches(
+        sketches,
+        columns->cols,
+        params->max_bins ? params->max_bins : DEFAULT_MAX_BINS);
+
+    // Add zero and the smallest non-zero value to the candidates of every feature, keeping them sorted and
+    // unique.
+    for (size_t j = 0; j < columns->cols; ++j)
+    {
+        size_t count = split_candidates->counts[j];
+        double *values = tracked_malloc((count + 2) * sizeof(double), MEMORY_TAG_DATA);
+        double extra[2] = {0, sketches[j]->n ? sketches[j]->min : 0};
+        if (extra[1] < extra[0])
+        {
+            extra[0] = extra[1];
+            extra[1] = 0;
+        }
+
+        size_t merged = 0;
+        size_t a = 0;
+        size_t b = 0;
+        while (a < count || b < 2)
+        {
+            double value;
+            if (b == 2 || (a < count && split_candidates->values[j][a] < extra[b]))
+                value = split_candidates->values[j][a++];
+            else
+                value = extra[b++];
+
+            if (merged == 0 || values[merged - 1] != value)
+                values[merged++] = value;
+        }
+
+        tracked_free(split_candidates->values[j], MEMORY_TAG_DATA);
+        split_candidates->values[j] = values;
+        split_candidates->counts[j] = merged;
+
+        free_quantile_sketch(sketches[j]);
+    }
+    tracked_free(sketches, MEMORY_TAG_DATA);
+
+    return split_candidates;
+}
+
+int predict_model_sparse(const DecisionTreeNode ***random_forest,
+                         size_t n_estimators,
+                         const uint32_t *indices,
+                         const double *values,
+                         size_t nnz)
+{
+    STATS_PHASE_BEGIN(STATS_PHASE_PREDICT);
+
+    size_t ones = 0;
+    for (size_t i = 0; i < n_estimators; ++i)
+    {
+        int prediction;
+        make_prediction_sparse((*random_forest)[i] /* root of the tree */,
+                               indices,
+                               values,
+                               nnz,
+                               &prediction);
+        ones += prediction;
+    }
+
+    STATS_PHASE_END(STATS_PHASE_PREDICT);
+
+    if (ones > n_estimators - ones)
+        return 1;
+    else
+        return 0;
+}
+
 int predict_model(const DecisionTreeNode ***random_forest, size_t n_estimators, double *row)
 {
+    STATS_PHASE_BEGIN(STATS_PHASE_PREDICT);
+
     int zeroes = 0;
     int ones = 0;
     for (size_t i = 0; i < n_estimators; ++i)
@@ -89,12 +394,221 @@ int predict_model(const DecisionTreeNode ***random_forest, size_t n_estimators,
             exit(1);
         }
     }
+
+    STATS_PHASE_END(STATS_PHASE_PREDICT);
+
     if (ones > zeroes)
         return 1;
     else
         return 0;
 }
 
+void compact_random_forest(const DecisionTreeNode **random_forest,
+                           size_t n_estimators,
+                           long *nodes_before,
+                           long *nodes_after)
+{
+    long before = 0;
+    long after = 0;
+    for (size_t i = 0; i < n_estimators; ++i)
+    {
+        before += count_tree_nodes(random_forest[i]);
+
+        long removedCount = 0;
+        random_forest[i] = compact_tree((DecisionTreeNode *)random_forest[i], &removedCount);
+
+        after += count_tree_nodes(random_forest[i]);
+    }
+
+    if (log_level > 0)
+        printf("compacted random forest: %ld -> %ld nodes\n", before, after);
+
+    if (nodes_before)
+        (*nodes_before) = before;
+    if (nodes_after)
+        (*nodes_after) = after;
+}
+
+/*
+Magic bytes at the start of a saved model file, the last byte is the version of the format. Version 2 added
+the seed to the header, version 3 'max_split_samples', version 4 'oblivious' and version 5 'next_tree_index',
+files of older versions are still read.
+*/
+static const char MODEL_MAGIC[8] = {'R', 'F', 'M', 'O', 'D', 'E', 'L', '5'};
+
+/*
+Number of header fields of every version of the model format.
+*/
+#define MODEL_HEADER_FIELDS_V1 8
+#define MODEL_HEADER_FIELDS_V2 9
+#define MODEL_HEADER_FIELDS_V3 10
+#define MODEL_HEADER_FIELDS_V4 11
+#define MODEL_HEADER_FIELDS 12
+
+/*
+Deepest tree accepted when loading a model, guards the recursion against corrupt files.
+*/
+#define MODEL_MAX_TREE_DEPTH 4096
+
+/*
+A single node of a saved model. Which children follow the node (in pre-order) is stored in 'children'.
+*/
+struct SavedTreeNode
+{
+    double split_value;
+    int64_t split_index;
+    int32_t left_leaf;
+    int32_t right_leaf;
+    uint32_t children; // Bit 0: has a left child, bit 1: has a right child.
+    uint32_t reserved;
+};
+
+/*
+Writes 'node' and its subtrees in pre-order, with the leaf values of the sides that have a child only if
+'inner_leaves' is set.
+*/
+int write_tree_node(const DecisionTreeNode *node, int inner_leaves, FILE *file)
+{
+    struct SavedTreeNode saved = {
+        split_value : node->split_value,
+        split_index : node->split_index,
+        left_leaf : node->leftChild && !inner_leaves ? 0 : node->left_leaf,
+        right_leaf : node->rightChild && !inner_leaves ? 0 : node->right_leaf,
+        children : (node->leftChild ? 1u : 0u) | (node->rightChild ? 2u : 0u),
+        reserved : 0
+    };
+    if (fwrite(&saved, sizeof(saved), 1, file) != 1)
+        return -1;
+    if (node->leftChild && write_tree_node(node->leftChild, inner_leaves, file) != 0)
+        return -1;
+    if (node->rightChild && write_tree_node(node->rightChild, inner_leaves, file) != 0)
+        return -1;
+    return 0;
+}
+
+int save_tree_node(const DecisionTreeNode *node, FILE *file)
+{
+    // The leaf values of a side with a child are only read to truncate a tree while training, so store them as
+    // zero.
+    return write_tree_node(node, 0, file);
+}
+
+int save_full_tree_node(const DecisionTreeNode *node, FILE *file)
+{
+    return write_tree_node(node, 1, file);
+}
+
+DecisionTreeNode *load_tree_node(FILE *file, size_t n_features, int depth, long *nodeId)
+{
+    // A corrupt split index would be read past the end of a row, and a corrupt leaf value would be rejected
+    // while predicting.
+    struct SavedTreeNode saved;
+    if (depth > MODEL_MAX_TREE_DEPTH || fread(&saved, sizeof(saved), 1, file) != 1 ||
+        saved.split_index < 0 || (uint64_t)saved.split_index >= n_features ||
+        (saved.left_leaf != 0 && saved.left_leaf != 1) ||
+        (saved.right_leaf != 0 && saved.right_leaf != 1))
+        return NULL;
+
+    DecisionTreeNode *node = empty_node(nodeId);
+    node->split_value = saved.split_value;
+    node->split_index = saved.split_index;
+    node->left_leaf = saved.left_leaf;
+    node->right_leaf = saved.right_leaf;
+
+    int failed = 0;
+    if (saved.children & 1u)
+        failed = (node->leftChild = load_tree_node(file, n_features, depth + 1, nodeId)) == NULL;
+    if (!failed && (saved.children & 2u))
+        failed = (node->rightChild = load_tree_node(file, n_features, depth + 1, nodeId)) == NULL;
+
+    if (failed)
+    {
+        long freeCount = 0;
+        free_decision_tree_node(node, &freeCount);
+        return NULL;
+    }
+    return node;
+}
+
+int save_random_forest(const DecisionTreeNode **random_forest,
+                       const RandomForestParameters *params,
+                       size_t n_features,
+                       FILE *file)
+{
+    uint64_t header[MODEL_HEADER_FIELDS] = {
+        params->n_estimators,
+        n_features,
+        params->max_depth,
+        params->min_samples_leaf,
+        params->max_features,
+        params->split_mode,
+        params->max_bins,
+        params->compact_trees,
+        params->seed,
+        params->max_split_samples,
+        params->oblivious,
+        params->next_tree_index};
+    if (fwrite(MODEL_MAGIC, sizeof(MODEL_MAGIC), 1, file) != 1 ||
+        fwrite(header, sizeof(header), 1, file) != 1)
+        return -1;
+
+    for (size_t i = 0; i < params->n_estimators; ++i)
+        if (save_tree_node(random_forest[i], file) != 0)
+            return -1;
+    return 0;
+}
+
+const DecisionTreeNode **load_random_forest(FILE *file, RandomForestParameters *params, size_t *n_features)
+{
+    char magic[8];
+    if (fread(magic, sizeof(magic), 1, file) != 1 ||
+        memcmp(magic, MODEL_MAGIC, sizeof(magic) - 1) != 0 ||
+        magic[7] < '1' || magic[7] > '5')
+        return NULL;
+
+    uint64_t header[MODEL_HEADER_FIELDS] = {0};
+    size_t n_fields = magic[7] == '1'   ? MODEL_HEADER_FIELDS_V1
+                      : magic[7] == '2' ? MODEL_HEADER_FIELDS_V2
+                      : magic[7] == '3' ? MODEL_HEADER_FIELDS_V3
+                      : magic[7] == '4' ? MODEL_HEADER_FIELDS_V4
+                                        : MODEL_HEADER_FIELDS;
+    if (fread(header, sizeof(uint64_t), n_fields, file) != n_fields ||
+        header[0] == 0 ||
+        header[5] > SPLIT_MODE_QUANTILE)
+        return NULL;
+
+    (*params) = (RandomForestParameters){
+        n_estimators : header[0],
+        max_depth : header[2],
+        min_samples_leaf : header[3],
+        max_features : header[4],
+        split_mode : (DecisionTreeSplitMode)header[5],
+        max_bins : header[6],
+        compact_trees : (int)header[7],
+        quantize : 0,
+        seed : (unsigned int)header[8],
+        max_split_samples : header[9],
+        oblivious : (int)header[10],
+        next_tree_index : header[11]
+    };
+    (*n_features) = header[1];
+
+    const DecisionTreeNode **random_forest = (const DecisionTreeNode **)
+        tracked_malloc(sizeof(DecisionTreeNode *) * params->n_estimators, MEMORY_TAG_TREE_NODES);
+
+    long nodeId = 0;
+    for (size_t i = 0; i < params->n_estimators; ++i)
+    {
+        random_forest[i] = load_tree_node(file, *n_features, 0, &nodeId);
+        if (random_forest[i] == NULL)
+        {
+            free_random_forest(&random_forest, i);
+            return NULL;
+        }
+    }
+    return random_forest;
+}
+
 void free_random_forest(const DecisionTreeNode ***random_forest, const size_t length)
 {
     long freeCount = 0;
@@ -104,7 +618,7 @@ void free_random_forest(const DecisionTreeNode ***random_forest, const size_t le
         free_decision_tree_node((*random_forest)[idx], &freeCount);
     }
     // Free the actual array of pointers to the nodes.
-    free(*random_forest);
+    tracked_free(*random_forest, MEMORY_TAG_TREE_NODES);
 
     if (log_level > 2)
         printf("total DecisionTreeNode freed: %ld\n", freeCount);
@@ -112,9 +626,23 @@ void free_random_forest(const DecisionTreeNode ***random_forest, const size_t le
 
 void print_params(const RandomForestParameters *params)
 {
-    printf("using RandomForestParameters:\n  n_estimators: %ld\n  max_depth: %ld\n  min_samples_leaf: %ld\n  max_features: %ld\n",
+    const char *split_modes[] = {"best", "random", "quantile"};
+    printf("using RandomForestParameters:\n  n_estimators: %ld\n  max_depth: %ld\n  min_samples_leaf: %ld\n  max_features: %ld\n  split_mode: %s\n",
            params->n_estimators,
            params->max_depth,
            params->min_samples_leaf,
-           params->max_features);
+           params->max_features,
+           split_modes[params->split_mode]);
+    if (params->split_mode == SPLIT_MODE_QUANTILE)
+        printf("  max_bins: %ld\n", params->max_bins ? params->max_bins : DEFAULT_MAX_BINS);
+    if (params->compact_trees)
+        printf("  compact_trees: yes\n");
+    if (params->max_split_samples)
+        printf("  max_split_samples: %ld\n", params->max_split_samples);
+    if (params->oblivious)
+        printf("  oblivious: yes\n");
+    if (params->time_budget > 0)
+        printf("  time_budget: %gs\n", params->time_budget);
+    if (params->quantize)
+        printf("  quantize: yes\n");
 }
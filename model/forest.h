@@ -5,11 +5,26 @@
 #ifndef forest_h
 #define forest_h
 
+#include <stdio.h>
 #include <stdlib.h>
 #include "tree.h"
+#include "sparse_tree.h"
+#include "oblivious.h"
+#include "layout.h"
+#include "quantized.h"
 
 extern int log_level;
 
+/*
+Number of quantile bins per feature used with 'SPLIT_MODE_QUANTILE' when 'max_bins' is not set.
+*/
+#define DEFAULT_MAX_BINS 32
+
+/*
+Capacity of every level of the quantile sketches used to compute the split candidates.
+*/
+#define SKETCH_CAPACITY 256
+
 /*
 Parameters for a Random Forest model.
 */
@@ -19,6 +34,16 @@ struct RandomForestParameters
     size_t max_depth;        // Maximum depth of a tree.
     size_t min_samples_leaf; // Minimum number of data samples at a leaf node.
     size_t max_features;     // Number of features considered when calculating the best data split.
+
+    DecisionTreeSplitMode split_mode; // How candidate thresholds are picked, defaults to an exhaustive search.
+    size_t max_bins;                  // Number of quantile bins per feature with 'SPLIT_MODE_QUANTILE'.
+    int compact_trees;                // Whether to compact every tree after training, see 'compact_tree'.
+    int quantize;                     // Whether to evaluate the model in the QuantizedForest format.
+    unsigned int seed;                // If non-zero, 'rand()' is seeded before every tree, see 'get_tree_seed'.
+    size_t max_split_samples;         // If non-zero, larger nodes search their split on a sample of this many rows.
+    int oblivious;                    // Whether to grow oblivious trees, see 'grow_oblivious_tree'. Never compacted.
+    double time_budget;               // If non-zero, seconds after which no more trees are started, see 'extend_model'.
+    size_t next_tree_index;           // If non-zero, index the next tree added is seeded with, see 'extend_model'.
 };
 
 typedef struct RandomForestParameters RandomForestParameters;
@@ -39,14 +64,94 @@ train_model_tree(double **data,
                  long *nodeId /* Ascending node ID generator */,
                  const ModelContext *ctx);
 
+/*
+Computes the per-feature candidate thresholds for 'SPLIT_MODE_QUANTILE' by streaming the training rows of
+'data' (rows not part of the testing fold in 'ctx', or every row if that fold covers all of them) through one
+quantile sketch per feature.
+*/
+SplitCandidates *compute_split_candidates(double **data,
+                                          const RandomForestParameters *params,
+                                          const struct dim *csv_dim,
+                                          const ModelContext *ctx);
+
+/*
+Returns the seed used for the tree at 'tree_index' of a model trained with a non-zero 'seed'. Seeding every
+tree on its own makes a tree depend only on the seed, its index and the data, so a forest grown in several
+steps with 'extend_model' has the same trees as one trained in a single step.
+*/
+unsigned int get_tree_seed(unsigned int seed, size_t tree_index);
+
+/*
+Trains the tree at 'tree_index' of a model the way 'train_model' does, seeding 'rand()' for it first if
+'params->seed' is set. With a seed the tree only depends on its index, so the trees of a model can be trained
+in any order or in separate processes and still make up the same model.
+*/
+const DecisionTreeNode *train_indexed_tree(double **data,
+                                           const RandomForestParameters *params,
+                                           const struct dim *csv_dim,
+                                           size_t tree_index,
+                                           long *nodeId,
+                                           const ModelContext *ctx);
+
 /*
 Trains a random forest model that is comprised of individually built decision trees. Returns an array 
 of pointers to DecisionTreeNode's that are the roots of the decision trees in the random forest model.
+
+With 'SPLIT_MODE_QUANTILE' the candidate thresholds are taken from 'ctx->split_candidates' if present
+(for example computed while loading the data), or otherwise computed from the training data.
+
+The model has 'params->n_estimators' trees, or fewer if 'params->time_budget' ran out first (see
+'extend_model'). The number of trees is written into 'n_trained' if it is not NULL, which it must not be with
+a time budget.
 */
 const DecisionTreeNode **train_model(double **data,
                                      const RandomForestParameters *params,
                                      const struct dim *csv_dim,
-                                     const ModelContext *ctx);
+                                     const ModelContext *ctx,
+                                     size_t *n_trained);
+
+/*
+Warm start: grows the 'n_existing' trees of 'random_forest' (can be NULL if 'n_existing' is 0) by 'n_new'
+trees trained on 'data' the same way 'train_model' does, leaving the existing trees untouched. The existing
+trees may come from training on other data or from 'load_random_forest'. 'params->n_estimators' is ignored.
+Returns the grown array, which replaces 'random_forest'.
+
+The new trees are seeded as the trees at 'params->next_tree_index' onwards, or at 'n_existing' onwards if it
+is 0. A model whose trees were dropped or reordered (see 'rf_prune') sets it past every tree it ever had, so
+that no tree is trained twice.
+
+With a 'params->time_budget' no tree is started once the mean time of the trees trained so far would take
+training past the budget, counted from the call. A tree that was started is always finished and at least one
+tree is trained, so fewer than 'n_new' trees can be added. The number of trees added is written into
+'n_trained' if it is not NULL. With a seed the trees added are the first of the ones 'n_new' would have been.
+*/
+const DecisionTreeNode **extend_model(const DecisionTreeNode **random_forest,
+                                      size_t n_existing,
+                                      size_t n_new,
+                                      double **data,
+                                      const RandomForestParameters *params,
+                                      const struct dim *csv_dim,
+                                      const ModelContext *ctx,
+                                      size_t *n_trained);
+
+
+/*
+Trains a random forest model on sparse 'data', same as 'train_model' does for dense data. With
+'SPLIT_MODE_QUANTILE' and no 'ctx->split_candidates' the candidates are computed from the non-zero values
+of every feature, with zero always kept as a candidate. 'params->time_budget' is not supported and ignored.
+*/
+const DecisionTreeNode **train_model_sparse(const SparseMatrix *data,
+                                            const RandomForestParameters *params,
+                                            const ModelContext *ctx);
+
+/*
+Computes the per-feature candidate thresholds for 'SPLIT_MODE_QUANTILE' on sparse data by sketching only
+the non-zero values of every feature. Zero and the smallest non-zero value of each feature are always
+included so that splitting off the implicit-zero rows stays possible.
+*/
+SplitCandidates *compute_sparse_split_candidates(const SparseColumns *columns,
+                                                 const RandomForestParameters *params,
+                                                 const ModelContext *ctx);
 
 /*
 Given a single row, gets predictions from every decision tree in the 'random_forest' model
@@ -55,6 +160,60 @@ that is the majority vote.
 */
 int predict_model(const DecisionTreeNode ***random_forest, size_t n_estimators, double *row);
 
+/*
+Same as 'predict_model' for a single row given in sparse form ('nnz' values with ascending feature 'indices').
+*/
+int predict_model_sparse(const DecisionTreeNode ***random_forest,
+                         size_t n_estimators,
+                         const uint32_t *indices,
+                         const double *values,
+                         size_t nnz);
+
+/*
+Compacts every tree of the 'random_forest' model in place with 'compact_tree', which never changes the
+predictions of the model. The total number of nodes before and after compaction are written into
+'nodes_before' and 'nodes_after'.
+*/
+void compact_random_forest(const DecisionTreeNode **random_forest,
+                           size_t n_estimators,
+                           long *nodes_before,
+                           long *nodes_after);
+
+/*
+Writes the 'random_forest' model along with its 'params' and the number of features it was trained on into
+'file' in a binary form: a header followed by the nodes of every tree in pre-order. The form is native-endian,
+so it is only meant to be read back on the same kind of machine. Returns 0 on success or -1 if writing failed.
+*/
+int save_random_forest(const DecisionTreeNode **random_forest,
+                       const RandomForestParameters *params,
+                       size_t n_features,
+                       FILE *file);
+
+/*
+Reads a model written by 'save_random_forest' from 'file', filling in 'params' and 'n_features'. Returns the
+model, or NULL if the file is not a model or is truncated or corrupt.
+*/
+const DecisionTreeNode **load_random_forest(FILE *file, RandomForestParameters *params, size_t *n_features);
+
+/*
+Writes a single tree in the node form of 'save_random_forest' into 'file'. Returns 0 on success or -1.
+*/
+int save_tree_node(const DecisionTreeNode *node, FILE *file);
+
+/*
+Same as 'save_tree_node', but also keeps the leaf values of the sides of nodes that have a child, which
+truncating a tree to a smaller depth reads. A tree read back with 'load_tree_node' is then the same as the
+trained tree in every way but its node IDs.
+*/
+int save_full_tree_node(const DecisionTreeNode *node, FILE *file);
+
+/*
+Reads a single tree of a model of 'n_features' features written by 'save_tree_node' from 'file' at 'depth' 0.
+Returns NULL if the tree is truncated, deeper than a model file allows, splits on a feature out of range or has
+a leaf value other than 0 or 1.
+*/
+DecisionTreeNode *load_tree_node(FILE *file, size_t n_features, int depth, long *nodeId);
+
 /*
 Frees memory for a given random forest model (array of pointers to DecisionTreeNode's).
 */
@@ -0,0 +1,382 @@
+/*
+@author andrii dobroshynski
+*/
+
+#include <math.h>
+#include <string.h>
+#include "hoeffding.h"
+#include "../utils/memory.h"
+
+/*
+Range of the gini gain of a binary split of two class targets, used in the Hoeffding bound.
+*/
+#define GINI_GAIN_RANGE 0.5
+
+OnlineForestParameters default_online_forest_parameters()
+{
+    return (OnlineForestParameters){
+        n_trees : 10,
+        max_features : 3,
+        max_depth : 12,
+        max_nodes : 1024,
+        grace_period : 200,
+        delta : 1e-6,
+        tie_threshold : 0.05,
+        seed : 1
+    };
+}
+
+/*
+Returns the next value of the splitmix64 generator with 'state'.
+*/
+uint64_t next_online_random(uint64_t *state)
+{
+    uint64_t z = ((*state) += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/*
+Returns a uniform random number in [0, 1).
+*/
+double next_online_uniform(uint64_t *state)
+{
+    return (next_online_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+Draws from a Poisson(1) distribution (Knuth's method), the number of times a tree learns a row.
+*/
+int next_online_poisson(uint64_t *state)
+{
+    const double limit = exp(-1.0);
+    int k = 0;
+    double p = next_online_uniform(state);
+    while (p > limit)
+    {
+        ++k;
+        p *= next_online_uniform(state);
+    }
+    return k;
+}
+
+/*
+Turns the node at 'index' of 'tree' into a leaf with fresh statistics over newly sampled features.
+*/
+void init_online_leaf(OnlineForest *forest, struct HoeffdingTree *tree, size_t index, int depth, const double *class_weight)
+{
+    struct HoeffdingNode *node = &tree->nodes[index];
+    node->feature = -1;
+    node->threshold = 0;
+    node->left = 0;
+    node->right = 0;
+    node->depth = depth;
+    node->class_weight[0] = class_weight[0];
+    node->class_weight[1] = class_weight[1];
+    node->weight_at_last_attempt = class_weight[0] + class_weight[1];
+
+    // Sample the features of the leaf without replacement with a partial Fisher-Yates shuffle.
+    size_t max_features = forest->params.max_features;
+    int *scratch = forest->feature_scratch;
+    for (size_t j = 0; j < forest->n_features; ++j)
+        scratch[j] = (int)j;
+
+    node->features = tracked_malloc(max_features * sizeof(int), MEMORY_TAG_TREE_NODES);
+    for (size_t j = 0; j < max_features; ++j)
+    {
+        size_t k = j + next_online_random(&forest->random_state) % (forest->n_features - j);
+        int temp = scratch[j];
+        scratch[j] = scratch[k];
+        scratch[k] = temp;
+        node->features[j] = scratch[j];
+    }
+
+    node->stats = tracked_malloc(max_features * sizeof(struct HoeffdingFeatureStats), MEMORY_TAG_TREE_NODES);
+    for (size_t j = 0; j < max_features; ++j)
+        node->stats[j] = (struct HoeffdingFeatureStats){
+            weight : {0, 0},
+            mean : {0, 0},
+            m2 : {0, 0},
+            min : INFINITY,
+            max : -INFINITY
+        };
+}
+
+/*
+Returns the index of the leaf of 'tree' that 'row' falls into.
+*/
+size_t find_online_leaf(const struct HoeffdingTree *tree, const double *row)
+{
+    size_t index = 0;
+    while (tree->nodes[index].feature >= 0)
+    {
+        const struct HoeffdingNode *node = &tree->nodes[index];
+        index = row[node->feature] < node->threshold ? node->left : node->right;
+    }
+    return index;
+}
+
+double gini_of_weights(double w0, double w1)
+{
+    double total = w0 + w1;
+    if (total <= 0)
+        return 0;
+    double p0 = w0 / total;
+    double p1 = w1 / total;
+    return 1.0 - (p0 * p0 + p1 * p1);
+}
+
+/*
+Estimates the weight of the rows of class target 'k' with a value of the feature below 'threshold' from the
+Gaussian approximation of the feature.
+*/
+double estimate_weight_below(const struct HoeffdingFeatureStats *stats, int k, double threshold)
+{
+    if (stats->weight[k] <= 0)
+        return 0;
+
+    double sd = sqrt(stats->m2[k] / stats->weight[k]);
+    if (sd <= 0)
+        return stats->mean[k] < threshold ? stats->weight[k] : 0;
+
+    return stats->weight[k] * 0.5 * erfc(-(threshold - stats->mean[k]) / (sd * M_SQRT2));
+}
+
+/*
+Finds the best threshold of the feature with 'stats' for the leaf with 'class_weight'. Returns the gini gain
+of the split and writes the threshold and the estimated class target weights of the left side.
+*/
+double best_online_threshold(const struct HoeffdingFeatureStats *stats,
+                             const double *class_weight,
+                             double *threshold,
+                             double *left_weight)
+{
+    double best_gain = -1;
+    if (!(stats->max > stats->min))
+        return best_gain;
+
+    double total = class_weight[0] + class_weight[1];
+    double parent_gini = gini_of_weights(class_weight[0], class_weight[1]);
+
+    for (int c = 1; c <= HOEFFDING_CANDIDATES; ++c)
+    {
+        double candidate = stats->min + (stats->max - stats->min) * c / (HOEFFDING_CANDIDATES + 1);
+
+        double left[2];
+        double right[2];
+        for (int k = 0; k < 2; ++k)
+        {
+            left[k] = estimate_weight_below(stats, k, candidate);
+            right[k] = class_weight[k] - left[k];
+            if (right[k] < 0)
+                right[k] = 0;
+        }
+
+        double left_total = left[0] + left[1];
+        double right_total = right[0] + right[1];
+        double gain = parent_gini -
+                      (left_total / total) * gini_of_weights(left[0], left[1]) -
+                      (right_total / total) * gini_of_weights(right[0], right[1]);
+        if (gain > best_gain)
+        {
+            best_gain = gain;
+            *threshold = candidate;
+            left_weight[0] = left[0];
+            left_weight[1] = left[1];
+        }
+    }
+    return best_gain;
+}
+
+/*
+Splits the leaf at 'index' if the Hoeffding bound shows that its best feature is the right choice.
+*/
+void attempt_online_split(OnlineForest *forest, struct HoeffdingTree *tree, size_t index)
+{
+    struct HoeffdingNode *node = &tree->nodes[index];
+    double total = node->class_weight[0] + node->class_weight[1];
+    node->weight_at_last_attempt = total;
+
+    // Pure leaves have nothing to gain from a split.
+    if (node->class_weight[0] == 0 || node->class_weight[1] == 0)
+        return;
+
+    double best_gain = -1;
+    double second_gain = 0; // Not splitting at all has a gain of zero.
+    int best_feature = -1;
+    double best_threshold = 0;
+    double best_left[2] = {0, 0};
+    for (size_t j = 0; j < forest->params.max_features; ++j)
+    {
+        double threshold;
+        double left[2];
+        double gain = best_online_threshold(&node->stats[j], node->class_weight, &threshold, left);
+        if (gain > best_gain)
+        {
+            if (best_gain > second_gain)
+                second_gain = best_gain;
+            best_gain = gain;
+            best_feature = node->features[j];
+            best_threshold = threshold;
+            best_left[0] = left[0];
+            best_left[1] = left[1];
+        }
+        else if (gain > second_gain)
+        {
+            second_gain = gain;
+        }
+    }
+    if (best_feature < 0 || best_gain <= 0)
+        return;
+
+    double epsilon = sqrt(GINI_GAIN_RANGE * GINI_GAIN_RANGE * log(1.0 / forest->params.delta) / (2.0 * total));
+    if (best_gain - second_gain <= epsilon && epsilon >= forest->params.tie_threshold)
+        return;
+
+    // Turn the leaf into an inner node with two fresh leaves, which start out with the estimated class target
+    // weights of their side so that they predict sensibly right away.
+    int depth = node->depth;
+    double class_weight[2] = {node->class_weight[0], node->class_weight[1]};
+    tracked_free(node->features, MEMORY_TAG_TREE_NODES);
+    tracked_free(node->stats, MEMORY_TAG_TREE_NODES);
+    node->features = NULL;
+    node->stats = NULL;
+    node->feature = best_feature;
+    node->threshold = best_threshold;
+
+    if (tree->n_nodes + 2 > tree->capacity)
+    {
+        tree->capacity *= 2;
+        tree->nodes = tracked_realloc(tree->nodes, tree->capacity * sizeof(struct HoeffdingNode), MEMORY_TAG_TREE_NODES);
+    }
+    size_t left = tree->n_nodes++;
+    size_t right = tree->n_nodes++;
+    tree->nodes[index].left = left;
+    tree->nodes[index].right = right;
+
+    double right_weight[2] = {class_weight[0] - best_left[0], class_weight[1] - best_left[1]};
+    init_online_leaf(forest, tree, left, depth + 1, best_left);
+    init_online_leaf(forest, tree, right, depth + 1, right_weight);
+}
+
+/*
+Adds a row with 'weight' to the statistics of the leaf at 'index' and attempts a split when due.
+*/
+void learn_online_row(OnlineForest *forest, struct HoeffdingTree *tree, size_t index, const double *row, int label, double weight)
+{
+    struct HoeffdingNode *node = &tree->nodes[index];
+    node->class_weight[label] += weight;
+
+    for (size_t j = 0; j < forest->params.max_features; ++j)
+    {
+        struct HoeffdingFeatureStats *stats = &node->stats[j];
+        double value = row[node->features[j]];
+
+        // Weighted Welford update of the mean and variance.
+        stats->weight[label] += weight;
+        double delta = value - stats->mean[label];
+        stats->mean[label] += weight * delta / stats->weight[label];
+        stats->m2[label] += weight * delta * (value - stats->mean[label]);
+
+        if (value < stats->min)
+            stats->min = value;
+        if (value > stats->max)
+            stats->max = value;
+    }
+
+    double total = node->class_weight[0] + node->class_weight[1];
+    if (total - node->weight_at_last_attempt >= forest->params.grace_period &&
+        node->depth < (int)forest->params.max_depth &&
+        tree->n_nodes + 2 <= forest->params.max_nodes)
+        attempt_online_split(forest, tree, index);
+}
+
+OnlineForest *create_online_forest(const OnlineForestParameters *params, size_t n_features)
+{
+    OnlineForest *forest = tracked_malloc(sizeof(OnlineForest), MEMORY_TAG_TREE_NODES);
+    forest->params = *params;
+    if (forest->params.max_features > n_features)
+        forest->params.max_features = n_features;
+    forest->n_features = n_features;
+    forest->random_state = params->seed;
+    forest->feature_scratch = tracked_malloc(n_features * sizeof(int), MEMORY_TAG_TREE_NODES);
+
+    const double no_weight[2] = {0, 0};
+    forest->trees = tracked_malloc(params->n_trees * sizeof(struct HoeffdingTree), MEMORY_TAG_TREE_NODES);
+    for (size_t t = 0; t < params->n_trees; ++t)
+    {
+        struct HoeffdingTree *tree = &forest->trees[t];
+        tree->capacity = 16;
+        tree->nodes = tracked_malloc(tree->capacity * sizeof(struct HoeffdingNode), MEMORY_TAG_TREE_NODES);
+        tree->n_nodes = 1;
+        init_online_leaf(forest, tree, 0, 0, no_weight);
+    }
+    return forest;
+}
+
+void update_online_forest(OnlineForest *forest, const double *row, int label)
+{
+    if (label != 0 && label != 1)
+    {
+        printf("Error: currently only support binary classification, i.e. class target values 0/1, got: %d\n", label);
+        exit(1);
+    }
+
+    for (size_t t = 0; t < forest->params.n_trees; ++t)
+    {
+        int weight = next_online_poisson(&forest->random_state);
+        if (weight == 0)
+            continue;
+
+        struct HoeffdingTree *tree = &forest->trees[t];
+        learn_online_row(forest, tree, find_online_leaf(tree, row), row, label, weight);
+    }
+}
+
+void update_online_forest_batch(OnlineForest *forest, const double *data, size_t rows)
+{
+    size_t cols = forest->n_features + 1;
+    for (size_t i = 0; i < rows; ++i)
+        update_online_forest(forest, data + i * cols, (int)data[i * cols + forest->n_features]);
+}
+
+int predict_online_forest(const OnlineForest *forest, const double *row)
+{
+    size_t ones = 0;
+    for (size_t t = 0; t < forest->params.n_trees; ++t)
+    {
+        const struct HoeffdingTree *tree = &forest->trees[t];
+        const struct HoeffdingNode *leaf = &tree->nodes[find_online_leaf(tree, row)];
+        ones += leaf->class_weight[1] > leaf->class_weight[0];
+    }
+    if (ones > forest->params.n_trees - ones)
+        return 1;
+    else
+        return 0;
+}
+
+size_t count_online_forest_nodes(const OnlineForest *forest)
+{
+    size_t count = 0;
+    for (size_t t = 0; t < forest->params.n_trees; ++t)
+        count += forest->trees[t].n_nodes;
+    return count;
+}
+
+void free_online_forest(OnlineForest *forest)
+{
+    for (size_t t = 0; t < forest->params.n_trees; ++t)
+    {
+        struct HoeffdingTree *tree = &forest->trees[t];
+        for (size_t i = 0; i < tree->n_nodes; ++i)
+        {
+            tracked_free(tree->nodes[i].features, MEMORY_TAG_TREE_NODES);
+            tracked_free(tree->nodes[i].stats, MEMORY_TAG_TREE_NODES);
+        }
+        tracked_free(tree->nodes, MEMORY_TAG_TREE_NODES);
+    }
+    tracked_free(forest->trees, MEMORY_TAG_TREE_NODES);
+    tracked_free(forest->feature_scratch, MEMORY_TAG_TREE_NODES);
+    tracked_free(forest, MEMORY_TAG_TREE_NODES);
+}
@@ -0,0 +1,130 @@
+/*
+@author andrii dobroshynski
+*/
+
+#ifndef hoeffding_h
+#define hoeffding_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "../utils/utils.h"
+
+/*
+Online random forest of Hoeffding trees (VFDT) for data that arrives as a stream. Rows are learned one at a
+time (or in mini-batches) and then discarded: every leaf keeps sufficient statistics of the rows that reached
+it, namely the class target counts and, for each of its sampled features, the weighted mean and variance of
+the feature per class target. Every 'grace_period' rows a leaf estimates the gini gain of a number of
+candidate thresholds per feature from those Gaussian statistics and splits once the Hoeffding bound shows,
+with confidence '1 - delta', that the best feature is better than the runner-up (or the two are tied within
+'tie_threshold').
+
+Every tree sees each row a Poisson(1) number of times (online bagging), and the trees are capped at
+'max_depth' and 'max_nodes', so the memory of the model and the work per update are bounded and do not grow
+with the number of rows seen.
+*/
+
+/*
+Number of candidate thresholds per feature evaluated at a split attempt, evenly spaced between the smallest
+and the largest value of the feature seen at the leaf.
+*/
+#define HOEFFDING_CANDIDATES 16
+
+/*
+Parameters for an OnlineForest.
+*/
+struct OnlineForestParameters
+{
+    size_t n_trees;        // Number of trees in the forest.
+    size_t max_features;   // Number of features sampled for every leaf.
+    size_t max_depth;      // Maximum depth of a tree.
+    size_t max_nodes;      // Maximum number of nodes of a tree.
+    double grace_period;   // Weight of rows a leaf sees between split attempts.
+    double delta;          // Allowed probability of choosing the wrong split feature.
+    double tie_threshold;  // Split anyway once the Hoeffding bound drops below this.
+    uint64_t seed;         // Seed of the forest's own random number state.
+};
+
+typedef struct OnlineForestParameters OnlineForestParameters;
+
+/*
+Running statistics of one feature of the rows that reached a leaf.
+*/
+struct HoeffdingFeatureStats
+{
+    double weight[2]; // Weight of the rows of every class target.
+    double mean[2];
+    double m2[2]; // Sum of the squared differences from the mean, the variance is 'm2 / weight'.
+    double min;
+    double max;
+};
+
+/*
+A node of a Hoeffding tree, stored in the node array of the tree. Inner nodes send a row left when
+'row[feature] < threshold', same as DecisionTreeNode's.
+*/
+struct HoeffdingNode
+{
+    int feature; // -1 for leaves.
+    double threshold;
+    size_t left;
+    size_t right;
+    int depth;
+
+    // Leaves only.
+    double class_weight[2];
+    double weight_at_last_attempt;
+    int *features; // Sampled feature indices, 'max_features' of them.
+    struct HoeffdingFeatureStats *stats;
+};
+
+struct HoeffdingTree
+{
+    struct HoeffdingNode *nodes;
+    size_t n_nodes;
+    size_t capacity;
+};
+
+struct OnlineForest
+{
+    OnlineForestParameters params;
+    size_t n_features;
+    struct HoeffdingTree *trees;
+    uint64_t random_state;
+    int *feature_scratch;
+};
+
+typedef struct OnlineForest OnlineForest;
+
+/*
+Returns the default parameters for an OnlineForest.
+*/
+OnlineForestParameters default_online_forest_parameters();
+
+/*
+Creates an OnlineForest of single-leaf trees for rows of 'n_features' features.
+*/
+OnlineForest *create_online_forest(const OnlineForestParameters *params, size_t n_features);
+
+/*
+Learns a single 'row' of 'n_features' features with the class target 'label' (0 or 1).
+*/
+void update_online_forest(OnlineForest *forest, const double *row, int label);
+
+/*
+Learns 'rows' rows stored row-major in 'data', with 'n_features' features followed by the class target.
+*/
+void update_online_forest_batch(OnlineForest *forest, const double *data, size_t rows);
+
+/*
+Returns the majority vote of the trees for the class target of 'row'.
+*/
+int predict_online_forest(const OnlineForest *forest, const double *row);
+
+/*
+Returns the total number of nodes of all trees.
+*/
+size_t count_online_forest_nodes(const OnlineForest *forest);
+
+void free_online_forest(OnlineForest *forest);
+
+#endif // hoeffding_h
@@ -0,0 +1,356 @@
+/*
+@author andrii dobroshynski
+*/
+
+#include <string.h>
+#include "layout.h"
+#include "../utils/memory.h"
+#include "../utils/stats.h"
+
+/*
+Guards the size of a LayoutNode at compile time.
+*/
+typedef char layout_node_size_check[sizeof(LayoutNode) == 16 ? 1 : -1];
+
+/*
+Magic bytes of the profile section that 'save_branch_profile' appends to a model file.
+*/
+static const char PROFILE_MAGIC[8] = {'R', 'F', 'P', 'R', 'O', 'F', 'L', '1'};
+
+/*
+Records the pre-order index of the right child of every node of the tree rooted at 'node', which has
+pre-order index 'index', into 'right'. Returns the index of the first node after the tree.
+*/
+uint32_t index_right_children(const DecisionTreeNode *node, uint32_t index, uint32_t *right)
+{
+    uint32_t next = index + 1;
+    if (node->leftChild)
+        next = index_right_children(node->leftChild, next, right);
+
+    right[index] = node->rightChild ? next : 0;
+    if (node->rightChild)
+        next = index_right_children(node->rightChild, next, right);
+    return next;
+}
+
+BranchProfile *create_branch_profile(const DecisionTreeNode **random_forest, size_t n_estimators)
+{
+    BranchProfile *profile = tracked_malloc(sizeof(BranchProfile), MEMORY_TAG_TREE_NODES);
+    profile->n_estimators = n_estimators;
+    profile->n_nodes = tracked_malloc(n_estimators * sizeof(size_t), MEMORY_TAG_TREE_NODES);
+    profile->right = tracked_malloc(n_estimators * sizeof(uint32_t *), MEMORY_TAG_TREE_NODES);
+    profile->counts = tracked_malloc(n_estimators * sizeof(uint64_t *), MEMORY_TAG_TREE_NODES);
+
+    for (size_t t = 0; t < n_estimators; ++t)
+    {
+        size_t n_nodes = count_tree_nodes(random_forest[t]);
+        profile->n_nodes[t] = n_nodes;
+        profile->right[t] = tracked_malloc(n_nodes * sizeof(uint32_t), MEMORY_TAG_TREE_NODES);
+        profile->counts[t] = tracked_calloc(2 * n_nodes, sizeof(uint64_t), MEMORY_TAG_TREE_NODES);
+        index_right_children(random_forest[t], 0, profile->right[t]);
+    }
+    return profile;
+}
+
+void profile_row(BranchProfile *profile, const DecisionTreeNode **random_forest, const double *row)
+{
+    for (size_t t = 0; t < profile->n_estimators; ++t)
+    {
+        const DecisionTreeNode *node = random_forest[t];
+        uint32_t index = 0;
+        while (node)
+        {
+            // A row goes right unless its value is less than the threshold, same as in 'make_prediction'.
+            int go_right = !(row[node->split_index] < node->split_value);
+            profile->counts[t][2 * index + go_right]++;
+
+            index = go_right ? profile->right[t][index] : index + 1;
+            node = go_right ? node->rightChild : node->leftChild;
+        }
+    }
+}
+
+int save_branch_profile(const BranchProfile *profile, FILE *file)
+{
+    uint64_t n_estimators = profile->n_estimators;
+    if (fwrite(PROFILE_MAGIC, sizeof(PROFILE_MAGIC), 1, file) != 1 ||
+        fwrite(&n_estimators, sizeof(n_estimators), 1, file) != 1)
+        return -1;
+
+    for (size_t t = 0; t < profile->n_estimators; ++t)
+    {
+        uint64_t n_nodes = profile->n_nodes[t];
+        if (fwrite(&n_nodes, sizeof(n_nodes), 1, file) != 1 ||
+            fwrite(profile->counts[t], sizeof(uint64_t), 2 * n_nodes, file) != 2 * n_nodes)
+            return -1;
+    }
+    return 0;
+}
+
+BranchProfile *load_branch_profile(FILE *file, const DecisionTreeNode **random_forest, size_t n_estimators)
+{
+    char magic[8];
+    uint64_t saved_n_estimators;
+    if (fread(magic, sizeof(magic), 1, file) != 1 ||
+        memcmp(magic, PROFILE_MAGIC, sizeof(magic)) != 0 ||
+        fread(&saved_n_estimators, sizeof(saved_n_estimators), 1, file) != 1 ||
+        saved_n_estimators != n_estimators)
+        return NULL;
+
+    BranchProfile *profile = create_branch_profile(random_forest, n_estimators);
+    for (size_t t = 0; t < n_estimators; ++t)
+    {
+        uint64_t n_nodes;
+        if (fread(&n_nodes, sizeof(n_nodes), 1, file) != 1 ||
+            n_nodes != profile->n_nodes[t] ||
+            fread(profile->counts[t], sizeof(uint64_t), 2 * n_nodes, file) != 2 * n_nodes)
+        {
+            free_branch_profile(profile);
+            return NULL;
+        }
+    }
+    return profile;
+}
+
+void free_branch_profile(BranchProfile *profile)
+{
+    if (profile == NULL)
+        return;
+    for (size_t t = 0; t < profile->n_estimators; ++t)
+    {
+        tracked_free(profile->right[t], MEMORY_TAG_TREE_NODES);
+        tracked_free(profile->counts[t], MEMORY_TAG_TREE_NODES);
+    }
+    tracked_free(profile->n_nodes, MEMORY_TAG_TREE_NODES);
+    tracked_free(profile->right, MEMORY_TAG_TREE_NODES);
+    tracked_free(profile->counts, MEMORY_TAG_TREE_NODES);
+    tracked_free(profile, MEMORY_TAG_TREE_NODES);
+}
+
+/*
+A run of nodes waiting to be placed, starting at 'node' (pre-order index 'index') which 'count' rows reached.
+'parent' is the index of the placed node that points to it, or UINT32_MAX for the root of a tree.
+*/
+struct PendingRun
+{
+    uint64_t count;
+    const DecisionTreeNode *node;
+    uint32_t index;
+    uint32_t parent;
+};
+
+/*
+Returns whether run 'a' is placed before run 'b': the one more rows reached goes first, ties go in pre-order.
+*/
+int run_precedes(const struct PendingRun *a, const struct PendingRun *b)
+{
+    return a->count != b->count ? a->count > b->count : a->index < b->index;
+}
+
+void push_run(struct PendingRun *heap, size_t *n_heap, struct PendingRun run)
+{
+    size_t i = (*n_heap)++;
+    while (i > 0 && run_precedes(&run, &heap[(i - 1) / 2]))
+    {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = run;
+}
+
+struct PendingRun pop_run(struct PendingRun *heap, size_t *n_heap)
+{
+    struct PendingRun top = heap[0];
+    struct PendingRun last = heap[--(*n_heap)];
+
+    size_t i = 0;
+    for (;;)
+    {
+        size_t child = 2 * i + 1;
+        if (child >= (*n_heap))
+            break;
+        if (child + 1 < (*n_heap) && run_precedes(&heap[child + 1], &heap[child]))
+            ++child;
+        if (!run_precedes(&heap[child], &last))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    if ((*n_heap) > 0)
+        heap[i] = last;
+    return top;
+}
+
+/*
+Places the nodes of tree 't' into 'forest->nodes' starting at '*next' and returns the index of its root.
+'pending' has room for every node of the tree.
+*/
+uint32_t layout_tree(const DecisionTreeNode *root,
+                     size_t t,
+                     const BranchProfile *profile,
+                     LayoutForest *forest,
+                     struct PendingRun *pending,
+                     size_t *next)
+{
+    uint32_t root_index = (uint32_t)(*next);
+    size_t n_pending = 0;
+    push_run(pending, &n_pending, (struct PendingRun){count : 0, node : root, index : 0, parent : UINT32_MAX});
+
+    while (n_pending > 0)
+    {
+        struct PendingRun run = pop_run(pending, &n_pending);
+        if (run.parent != UINT32_MAX)
+            forest->nodes[run.parent].info |= (uint32_t)(*next) << LAYOUT_CHILD_SHIFT;
+
+        // Follow the run down the more likely child of every node, which goes right after it.
+        const DecisionTreeNode *node = run.node;
+        uint32_t index = run.index;
+        while (node)
+        {
+            uint32_t placed = (uint32_t)(*next)++;
+            LayoutNode encoded = {
+                split_value : node->split_value,
+                split_index : (uint32_t)node->split_index,
+                info : 0
+            };
+            if (!node->leftChild)
+                encoded.info |= LAYOUT_LEFT_LEAF | (node->left_leaf ? LAYOUT_LEFT_CLASS : 0);
+            if (!node->rightChild)
+                encoded.info |= LAYOUT_RIGHT_LEAF | (node->right_leaf ? LAYOUT_RIGHT_CLASS : 0);
+
+            uint32_t right_index = profile->right[t][index];
+            uint64_t left_count = profile->counts[t][2 * index];
+            uint64_t right_count = profile->counts[t][2 * index + 1];
+
+            int next_right = node->rightChild && (!node->leftChild || right_count > left_count);
+            if (next_right)
+                encoded.info |= LAYOUT_NEXT_RIGHT;
+            forest->nodes[placed] = encoded;
+
+            // The other child starts a run of its own, placed once it is the most likely one left.
+            if (node->leftChild && node->rightChild)
+            {
+                push_run(pending, &n_pending, (struct PendingRun){
+                    count : next_right ? left_count : right_count,
+                    node : next_right ? node->leftChild : node->rightChild,
+                    index : next_right ? index + 1 : right_index,
+                    parent : placed
+                });
+            }
+
+            index = next_right ? right_index : index + 1;
+            node = next_right ? node->rightChild : node->leftChild;
+        }
+    }
+    return root_index;
+}
+
+LayoutForest *layout_random_forest(const DecisionTreeNode **random_forest,
+                                   size_t n_estimators,
+                                   const BranchProfile *profile)
+{
+    size_t n_nodes = 0;
+    size_t max_tree_nodes = 0;
+    for (size_t t = 0; t < n_estimators; ++t)
+    {
+        size_t tree_nodes = count_tree_nodes(random_forest[t]);
+        n_nodes += tree_nodes;
+        max_tree_nodes = tree_nodes > max_tree_nodes ? tree_nodes : max_tree_nodes;
+    }
+    if (n_nodes >= ((size_t)1 << (32 - LAYOUT_CHILD_SHIFT)))
+    {
+        printf("Error: random forest is too large to lay out\n");
+        return NULL;
+    }
+
+    LayoutForest *forest = tracked_malloc(sizeof(LayoutForest), MEMORY_TAG_TREE_NODES);
+    forest->n_estimators = n_estimators;
+    forest->n_nodes = n_nodes;
+    forest->nodes = tracked_malloc(n_nodes * sizeof(LayoutNode), MEMORY_TAG_TREE_NODES);
+    forest->roots = tracked_malloc(n_estimators * sizeof(uint32_t), MEMORY_TAG_TREE_NODES);
+
+    // An empty profile ties every run, which places them in pre-order.
+    BranchProfile *empty_profile = profile ? NULL : create_branch_profile(random_forest, n_estimators);
+
+    struct PendingRun *pending = tracked_malloc(max_tree_nodes * sizeof(struct PendingRun), MEMORY_TAG_TREE_NODES);
+    size_t next = 0;
+    for (size_t t = 0; t < n_estimators; ++t)
+        forest->roots[t] = layout_tree(random_forest[t], t, profile ? profile : empty_profile, forest, pending, &next);
+    tracked_free(pending, MEMORY_TAG_TREE_NODES);
+    free_branch_profile(empty_profile);
+
+    if (log_level > 1)
+        printf("laid out random forest: %ld nodes, %ld bytes\n", forest->n_nodes, layout_forest_size(forest));
+
+    return forest;
+}
+
+/*
+Walks the tree whose root is at 'index' for 'row' and returns the class of the leaf it reaches.
+*/
+static inline int predict_layout_tree(const LayoutNode *nodes, uint32_t index, const double *row)
+{
+    for (;;)
+    {
+        const LayoutNode *node = &nodes[index];
+        int go_right = !(row[node->split_index] < node->split_value);
+        if (go_right)
+        {
+            if (node->info & LAYOUT_RIGHT_LEAF)
+                return (node->info & LAYOUT_RIGHT_CLASS) != 0;
+        }
+        else
+        {
+            if (node->info & LAYOUT_LEFT_LEAF)
+                return (node->info & LAYOUT_LEFT_CLASS) != 0;
+        }
+        index = go_right == ((node->info & LAYOUT_NEXT_RIGHT) != 0) ? index + 1 : node->info >> LAYOUT_CHILD_SHIFT;
+    }
+}
+
+int predict_layout(const LayoutForest *forest, const double *row)
+{
+    STATS_PHASE_BEGIN(STATS_PHASE_PREDICT);
+
+    size_t ones = 0;
+    for (size_t t = 0; t < forest->n_estimators; ++t)
+        ones += predict_layout_tree(forest->nodes, forest->roots[t], row);
+
+    STATS_PHASE_END(STATS_PHASE_PREDICT);
+
+    // Ties go to class 0, same as in 'predict_model'.
+    return ones > forest->n_estimators - ones ? 1 : 0;
+}
+
+void predict_layout_batch(const LayoutForest *forest,
+                          const double *rows,
+                          size_t n_rows,
+                          size_t stride,
+                          int *predictions)
+{
+    for (size_t i = 0; i < n_rows; ++i)
+        predictions[i] = 0;
+
+    // Tree by tree, so that the nodes of a tree stay in cache across all rows.
+    for (size_t t = 0; t < forest->n_estimators; ++t)
+        for (size_t i = 0; i < n_rows; ++i)
+            predictions[i] += predict_layout_tree(forest->nodes, forest->roots[t], rows + i * stride);
+
+    int n_estimators = (int)forest->n_estimators;
+    for (size_t i = 0; i < n_rows; ++i)
+        predictions[i] = predictions[i] > n_estimators - predictions[i] ? 1 : 0;
+}
+
+size_t layout_forest_size(const LayoutForest *forest)
+{
+    return sizeof(LayoutForest) + forest->n_nodes * sizeof(LayoutNode) + forest->n_estimators * sizeof(uint32_t);
+}
+
+void free_layout_forest(LayoutForest *forest)
+{
+    if (forest == NULL)
+        return;
+    tracked_free(forest->nodes, MEMORY_TAG_TREE_NODES);
+    tracked_free(forest->roots, MEMORY_TAG_TREE_NODES);
+    tracked_free(forest, MEMORY_TAG_TREE_NODES);
+}
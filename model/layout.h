@@ -0,0 +1,123 @@
+/*
+@author andrii dobroshynski
+*/
+
+#ifndef layout_h
+#define layout_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "tree.h"
+
+typedef struct BranchProfile BranchProfile;
+typedef struct LayoutNode LayoutNode;
+typedef struct LayoutForest LayoutForest;
+
+/*
+How often the rows seen so far went down either side of every node of a forest. Nodes of a tree are numbered
+in pre-order, the order 'save_tree_node' writes them in, so a profile stays valid for a saved and loaded copy
+of the same trees.
+*/
+struct BranchProfile
+{
+    size_t n_estimators;
+    size_t *n_nodes;    // Number of nodes of every tree.
+    uint32_t **right;   // Pre-order index of the right child of every node of every tree, 0 if it has none.
+    uint64_t **counts;  // Rows that went left ('2 * i') and right ('2 * i + 1') at node 'i' of every tree.
+};
+
+/*
+Creates an empty profile of the trees of 'random_forest'.
+*/
+BranchProfile *create_branch_profile(const DecisionTreeNode **random_forest, size_t n_estimators);
+
+/*
+Counts the branches 'row' takes through every tree of 'random_forest', which 'profile' was created for.
+*/
+void profile_row(BranchProfile *profile, const DecisionTreeNode **random_forest, const double *row);
+
+/*
+Appends 'profile' to a model file, after the trees written by 'save_random_forest'. Returns 0 on success or
+-1 if writing failed.
+*/
+int save_branch_profile(const BranchProfile *profile, FILE *file);
+
+/*
+Reads the profile saved after the trees of a model file by 'save_branch_profile'. Returns NULL if the file
+has none, which is the case for every model saved without one, or if it does not match the trees of
+'random_forest'.
+*/
+BranchProfile *load_branch_profile(FILE *file, const DecisionTreeNode **random_forest, size_t n_estimators);
+
+void free_branch_profile(BranchProfile *profile);
+
+/*
+Flags packed into the low bits of 'LayoutNode.info', the remaining high bits hold the index of the child
+that is not stored right after the node.
+*/
+#define LAYOUT_LEFT_LEAF 0x1u
+#define LAYOUT_LEFT_CLASS 0x2u
+#define LAYOUT_RIGHT_LEAF 0x4u
+#define LAYOUT_RIGHT_CLASS 0x8u
+#define LAYOUT_NEXT_RIGHT 0x10u // The right child is the next node, the left one is at the stored index.
+#define LAYOUT_CHILD_SHIFT 5
+
+/*
+Inference-only encoding of a DecisionTreeNode in 16 bytes, four to a cache line. Same as in the
+QuantizedNode format leaves are bits of their parent, but thresholds are kept as they are so no row has to
+be mapped to bins first.
+*/
+struct LayoutNode
+{
+    double split_value;
+    uint32_t split_index;
+    uint32_t info;
+};
+
+/*
+A random forest model laid out for the branches of a BranchProfile. Every node is followed by its child
+that more rows went to, so the likely path through a tree is a run of consecutive nodes. Runs are placed
+hottest first, starting from the whole tree and then from the cold children along the runs placed so far,
+which packs the nodes most rows visit into the first cache lines and pages of a tree.
+*/
+struct LayoutForest
+{
+    size_t n_estimators;
+    size_t n_nodes;
+    LayoutNode *nodes;
+    uint32_t *roots;
+};
+
+/*
+Lays out 'random_forest' for the branches counted in 'profile', which makes exactly the same predictions.
+Without a profile (NULL) the left child always comes next, which is plain pre-order. Returns NULL if the
+forest has more than 2^27 nodes.
+*/
+LayoutForest *layout_random_forest(const DecisionTreeNode **random_forest,
+                                   size_t n_estimators,
+                                   const BranchProfile *profile);
+
+/*
+Returns the class target value that is the majority vote of the trees of 'forest' for 'row', same as
+'predict_model'.
+*/
+int predict_layout(const LayoutForest *forest, const double *row);
+
+/*
+Predicts the 'n_rows' rows of 'rows', which are 'stride' doubles apart, tree by tree into 'predictions'.
+*/
+void predict_layout_batch(const LayoutForest *forest,
+                          const double *rows,
+                          size_t n_rows,
+                          size_t stride,
+                          int *predictions);
+
+/*
+Returns the number of bytes used by the 'forest'.
+*/
+size_t layout_forest_size(const LayoutForest *forest);
+
+void free_layout_forest(LayoutForest *forest);
+
+#endif // layout_h
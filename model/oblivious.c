@@ -0,0 +1,391 @@
+/*
+@author andrii dobroshynski
+*/
+
+#include "oblivious.h"
+#include "../utils/memory.h"
+#include "../utils/stats.h"
+#include "../utils/trace.h"
+
+/*
+A node of the level of an oblivious tree being grown: its rows and the child pointer of its parent that it
+is stored into.
+*/
+struct ObliviousLevelNode
+{
+    double **data;
+    size_t rows;
+    DecisionTreeNode **link;
+};
+
+/*
+Finds the split of a level of 'n_nodes' nodes with the lowest impurity over all of them. Candidates are drawn
+from and scored on 'search', which holds the rows of every node (or a sample of them). Returns 0 if no
+candidate was found.
+*/
+int find_level_split(struct ObliviousLevelNode *search,
+                     size_t n_nodes,
+                     size_t max_features,
+                     DecisionTreeSplitMode split_mode,
+                     size_t cols,
+                     const DecisionTreeTargetClasses *classes,
+                     const ModelContext *ctx,
+                     int *best_index,
+                     double *best_value)
+{
+    size_t total_rows = 0;
+    for (size_t i = 0; i < n_nodes; ++i)
+        total_rows += search[i].rows;
+
+    // The rows of all nodes in one buffer, to draw the candidate thresholds of the level from.
+    double **level_rows = tracked_malloc(total_rows * sizeof(double *), MEMORY_TAG_SPLIT_SCRATCH);
+    size_t offset = 0;
+    for (size_t i = 0; i < n_nodes; ++i)
+    {
+        for (size_t k = 0; k < search[i].rows; ++k)
+            level_rows[offset++] = search[i].data[k];
+    }
+
+    int *features = sample_features(max_features, cols);
+    size_t *class_counts = tracked_malloc(2 * classes->count * sizeof(size_t), MEMORY_TAG_SPLIT_SCRATCH);
+
+    int found_split = 0;
+    double best_gini = DBL_MAX;
+    for (size_t f = 0; f < max_features; ++f)
+    {
+        int feature_index = features[f];
+
+        size_t n_candidates = total_rows;
+        double *candidate_values = NULL;
+        double random_threshold = 0;
+        if (split_mode == SPLIT_MODE_RANDOM)
+        {
+            random_threshold = get_random_threshold(level_rows, feature_index, total_rows);
+            n_candidates = 1;
+            candidate_values = &random_threshold;
+        }
+        else if (split_mode == SPLIT_MODE_QUANTILE)
+        {
+            n_candidates = ctx->split_candidates->counts[feature_index];
+            candidate_values = ctx->split_candidates->values[feature_index];
+        }
+
+        STATS_ADD(STATS_CANDIDATE_SPLITS, n_candidates);
+        for (size_t j = 0; j < n_candidates; ++j)
+        {
+            double value = candidate_values != NULL ? candidate_values[j] : level_rows[j][feature_index];
+
+            // Impurity of the level is that of every node, weighted by its share of the rows.
+            double gini = 0;
+            for (size_t i = 0; i < n_nodes; ++i)
+                gini += calculate_gini_index(search[i].data, search[i].rows, cols, feature_index, value, classes, class_counts) *
+                        ((double)search[i].rows / (double)total_rows);
+
+            if (gini < best_gini)
+            {
+                (*best_index) = feature_index;
+                (*best_value) = value;
+                best_gini = gini;
+                found_split = 1;
+            }
+        }
+    }
+
+    tracked_free(level_rows, MEMORY_TAG_SPLIT_SCRATCH);
+    tracked_free(features, MEMORY_TAG_SPLIT_SCRATCH);
+    tracked_free(class_counts, MEMORY_TAG_SPLIT_SCRATCH);
+    return found_split;
+}
+
+DecisionTreeNode *grow_oblivious_tree(double **data,
+                                      size_t max_depth,
+                                      size_t min_samples_leaf,
+                                      size_t max_features,
+                                      DecisionTreeSplitMode split_mode,
+                                      size_t max_split_samples,
+                                      size_t rows,
+                                      size_t cols,
+                                      long *nodeId,
+                                      const ModelContext *ctx)
+{
+    if (split_mode == SPLIT_MODE_QUANTILE && ctx->split_candidates == NULL)
+    {
+        printf("Error: the quantile split mode requires split candidates in the ModelContext\n");
+        exit(1);
+    }
+
+    DecisionTreeNode *root = NULL;
+    DecisionTreeTargetClasses classes = get_target_class_values(data, rows, cols, ctx);
+
+    // A level has at most twice the nodes of the one above it, with the root on its own at the top. The rows of
+    // the root are the caller's, the rows of every other node are the halves of a split.
+    size_t n_level = 1;
+    struct ObliviousLevelNode *level = tracked_malloc(sizeof(struct ObliviousLevelNode), MEMORY_TAG_SPLIT_SCRATCH);
+    level[0] = (struct ObliviousLevelNode){data : data, rows : rows, link : &root};
+
+    for (size_t depth = 1; n_level > 0; ++depth)
+    {
+        STATS_DEPTH(depth);
+        double trace_begin = trace_span_begin();
+
+        size_t level_rows = 0;
+        for (size_t i = 0; i < n_level; ++i)
+            level_rows += level[i].rows;
+
+        // Levels with more rows than 'max_split_samples' search their split on a sample, to which every node
+        // contributes in proportion to its rows.
+        struct ObliviousLevelNode *search = level;
+        if (max_split_samples > 0 && level_rows > max_split_samples)
+        {
+            search = tracked_malloc(n_level * sizeof(struct ObliviousLevelNode), MEMORY_TAG_SPLIT_SCRATCH);
+            for (size_t i = 0; i < n_level; ++i)
+            {
+                size_t n_samples = level[i].rows * max_split_samples / level_rows;
+                n_samples = n_samples > 0 ? n_samples : 1;
+                search[i] = (struct ObliviousLevelNode){
+                    data : sample_rows(level[i].data, level[i].rows, n_samples),
+                    rows : n_samples,
+                    link : NULL
+                };
+            }
+        }
+
+        int split_index = -1;
+        double split_value = 0;
+        int found_split = find_level_split(search, n_level, max_features, split_mode, cols, &classes, ctx, &split_index, &split_value);
+
+        if (search != level)
+        {
+            for (size_t i = 0; i < n_level; ++i)
+                tracked_free(search[i].data, MEMORY_TAG_SPLIT_SCRATCH);
+            tracked_free(search, MEMORY_TAG_SPLIT_SCRATCH);
+        }
+
+        // Split every node of the level the same way, the sides that are split further make up the next level.
+        size_t n_next = 0;
+        struct ObliviousLevelNode *next = tracked_malloc(2 * n_level * sizeof(struct ObliviousLevelNode), MEMORY_TAG_SPLIT_SCRATCH);
+        for (size_t i = 0; i < n_level && found_split; ++i)
+        {
+            DecisionTreeNode *node = empty_node(nodeId);
+            node->split_index = split_index;
+            node->split_value = split_value;
+            (*level[i].link) = node;
+
+            DecisionTreeData *halves = split_dataset(split_index, split_value, level[i].data, level[i].rows, cols);
+
+            // Both sides keep their majority class even when they are split further, see 'grow'. An empty side
+            // predicts the majority of the node.
+            int majority = get_leaf_node_class_value(level[i].data, level[i].rows, cols);
+            for (int side = 0; side < 2; ++side)
+            {
+                DecisionTreeData half = halves[side];
+                int leaf = half.length > 0 ? get_leaf_node_class_value(half.data, half.length, cols) : majority;
+                if (side == 0)
+                    node->left_leaf = leaf;
+                else
+                    node->right_leaf = leaf;
+
+                if (depth < max_depth && half.length > min_samples_leaf && split_fits_budget(half.length))
+                    next[n_next++] = (struct ObliviousLevelNode){
+                        data : half.data,
+                        rows : half.length,
+                        link : side == 0 ? &node->leftChild : &node->rightChild
+                    };
+                else
+                    tracked_free(half.data, MEMORY_TAG_SPLIT_SCRATCH);
+            }
+            tracked_free(halves, MEMORY_TAG_SPLIT_SCRATCH);
+        }
+
+        for (size_t i = 0; i < n_level; ++i)
+            if (level[i].data != data)
+                tracked_free(level[i].data, MEMORY_TAG_SPLIT_SCRATCH);
+        tracked_free(level, MEMORY_TAG_SPLIT_SCRATCH);
+
+        level = next;
+        n_level = n_next;
+
+        trace_span_end("grow_oblivious_level", "depth", depth, trace_begin);
+    }
+    tracked_free(level, MEMORY_TAG_SPLIT_SCRATCH);
+    tracked_free(classes.labels, MEMORY_TAG_SPLIT_SCRATCH);
+
+    // Without a single candidate the root is a leaf of the majority class.
+    if (root == NULL)
+    {
+        root = empty_node(nodeId);
+        root->split_index = 0;
+        root->split_value = DBL_MAX;
+        root->left_leaf = get_leaf_node_class_value(data, rows, cols);
+        root->right_leaf = root->left_leaf;
+    }
+    return root;
+}
+
+/*
+Records the split of every level of the tree rooted at 'node' into 'features' and 'thresholds' and the number
+of levels into 'depth'. Returns 0 if two nodes at the same depth split differently or the tree is deeper than
+OBLIVIOUS_MAX_DEPTH.
+*/
+int collect_level_splits(const DecisionTreeNode *node, size_t level, uint32_t *features, double *thresholds, size_t *depth)
+{
+    if (node == NULL)
+        return 1;
+    if (level >= OBLIVIOUS_MAX_DEPTH)
+        return 0;
+
+    if (level == (*depth))
+    {
+        features[level] = (uint32_t)node->split_index;
+        thresholds[level] = node->split_value;
+        (*depth)++;
+    }
+    else if (features[level] != (uint32_t)node->split_index || thresholds[level] != node->split_value)
+        return 0;
+
+    return collect_level_splits(node->leftChild, level + 1, features, thresholds, depth) &&
+           collect_level_splits(node->rightChild, level + 1, features, thresholds, depth);
+}
+
+/*
+Fills the leaves of the tree rooted at 'node', at 'level', whose path so far gives the high bits 'index' of
+the leaf index. A side without a child covers every leaf below it.
+*/
+void fill_leaves(const DecisionTreeNode *node, size_t level, size_t depth, size_t index, uint8_t *leaves)
+{
+    for (int side = 0; side < 2; ++side)
+    {
+        const DecisionTreeNode *child = side == 0 ? node->leftChild : node->rightChild;
+        size_t side_index = (index << 1) | side;
+        if (child)
+        {
+            fill_leaves(child, level + 1, depth, side_index, leaves);
+            continue;
+        }
+
+        size_t span = (size_t)1 << (depth - level - 1);
+        uint8_t leaf = (uint8_t)(side == 0 ? node->left_leaf : node->right_leaf);
+        for (size_t i = side_index * span; i < (side_index + 1) * span; ++i)
+            leaves[i] = leaf;
+    }
+}
+
+ObliviousForest *compile_oblivious_forest(const DecisionTreeNode **random_forest, size_t n_estimators)
+{
+    uint32_t features[OBLIVIOUS_MAX_DEPTH];
+    double thresholds[OBLIVIOUS_MAX_DEPTH];
+
+    // First pass for the depths, which give the size of the tables.
+    uint32_t *depths = tracked_malloc(n_estimators * sizeof(uint32_t), MEMORY_TAG_TREE_NODES);
+    size_t *leaf_offsets = tracked_malloc(n_estimators * sizeof(size_t), MEMORY_TAG_TREE_NODES);
+    size_t max_depth = 0;
+    size_t n_leaves = 0;
+    for (size_t t = 0; t < n_estimators; ++t)
+    {
+        size_t depth = 0;
+        if (!collect_level_splits(random_forest[t], 0, features, thresholds, &depth))
+        {
+            tracked_free(depths, MEMORY_TAG_TREE_NODES);
+            tracked_free(leaf_offsets, MEMORY_TAG_TREE_NODES);
+            return NULL;
+        }
+        depths[t] = depth;
+        leaf_offsets[t] = n_leaves;
+        n_leaves += (size_t)1 << depth;
+        max_depth = depth > max_depth ? depth : max_depth;
+    }
+
+    ObliviousForest *forest = tracked_malloc(sizeof(ObliviousForest), MEMORY_TAG_TREE_NODES);
+    forest->n_estimators = n_estimators;
+    forest->max_depth = max_depth;
+    forest->depths = depths;
+    forest->leaf_offsets = leaf_offsets;
+    forest->features = tracked_calloc(n_estimators * max_depth, sizeof(uint32_t), MEMORY_TAG_TREE_NODES);
+    forest->thresholds = tracked_calloc(n_estimators * max_depth, sizeof(double), MEMORY_TAG_TREE_NODES);
+    forest->leaves = tracked_malloc(n_leaves, MEMORY_TAG_TREE_NODES);
+
+    for (size_t t = 0; t < n_estimators; ++t)
+    {
+        size_t depth = 0;
+        collect_level_splits(random_forest[t], 0, forest->features + t * max_depth, forest->thresholds + t * max_depth, &depth);
+        fill_leaves(random_forest[t], 0, depth, 0, forest->leaves + leaf_offsets[t]);
+    }
+    return forest;
+}
+
+int predict_oblivious(const ObliviousForest *forest, const double *row)
+{
+    STATS_PHASE_BEGIN(STATS_PHASE_PREDICT);
+
+    size_t ones = 0;
+    for (size_t t = 0; t < forest->n_estimators; ++t)
+    {
+        const uint32_t *features = forest->features + t * forest->max_depth;
+        const double *thresholds = forest->thresholds + t * forest->max_depth;
+
+        // A row goes right unless its value is less than the threshold, same as in 'make_prediction'.
+        size_t index = 0;
+        for (size_t level = 0; level < forest->depths[t]; ++level)
+            index = (index << 1) | !(row[features[level]] < thresholds[level]);
+        ones += forest->leaves[forest->leaf_offsets[t] + index];
+    }
+
+    STATS_PHASE_END(STATS_PHASE_PREDICT);
+
+    // Ties go to class 0, same as in 'predict_model'.
+    return ones > forest->n_estimators - ones ? 1 : 0;
+}
+
+void predict_oblivious_batch(const ObliviousForest *forest,
+                             const double *rows,
+                             size_t n_rows,
+                             size_t stride,
+                             int *predictions)
+{
+    for (size_t i = 0; i < n_rows; ++i)
+        predictions[i] = 0;
+
+    // Tree by tree, so that the splits and leaves of a tree stay in cache across all rows.
+    for (size_t t = 0; t < forest->n_estimators; ++t)
+    {
+        const uint32_t *features = forest->features + t * forest->max_depth;
+        const double *thresholds = forest->thresholds + t * forest->max_depth;
+        const uint8_t *leaves = forest->leaves + forest->leaf_offsets[t];
+        size_t depth = forest->depths[t];
+
+        for (size_t i = 0; i < n_rows; ++i)
+        {
+            const double *row = rows + i * stride;
+            size_t index = 0;
+            for (size_t level = 0; level < depth; ++level)
+                index = (index << 1) | !(row[features[level]] < thresholds[level]);
+            predictions[i] += leaves[index];
+        }
+    }
+
+    int n_estimators = (int)forest->n_estimators;
+    for (size_t i = 0; i < n_rows; ++i)
+        predictions[i] = predictions[i] > n_estimators - predictions[i] ? 1 : 0;
+}
+
+size_t oblivious_forest_size(const ObliviousForest *forest)
+{
+    size_t n_leaves = 0;
+    for (size_t t = 0; t < forest->n_estimators; ++t)
+        n_leaves += (size_t)1 << forest->depths[t];
+    return forest->n_estimators * (sizeof(uint32_t) + sizeof(size_t)) +
+           forest->n_estimators * forest->max_depth * (sizeof(uint32_t) + sizeof(double)) +
+           n_leaves;
+}
+
+void free_oblivious_forest(ObliviousForest *forest)
+{
+    if (forest == NULL)
+        return;
+    tracked_free(forest->depths, MEMORY_TAG_TREE_NODES);
+    tracked_free(forest->leaf_offsets, MEMORY_TAG_TREE_NODES);
+    tracked_free(forest->features, MEMORY_TAG_TREE_NODES);
+    tracked_free(forest->thresholds, MEMORY_TAG_TREE_NODES);
+    tracked_free(forest->leaves, MEMORY_TAG_TREE_NODES);
+    tracked_free(forest, MEMORY_TAG_TREE_NODES);
+}
@@ -0,0 +1,87 @@
+/*
+@author andrii dobroshynski
+*/
+
+#ifndef oblivious_h
+#define oblivious_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "tree.h"
+
+typedef struct ObliviousForest ObliviousForest;
+
+/*
+Deepest oblivious tree that 'compile_oblivious_forest' encodes, a tree has '2^depth' leaves.
+*/
+#define OBLIVIOUS_MAX_DEPTH 24
+
+/*
+Grows an oblivious (symmetric) tree on the 'rows' rows of 'data' and returns its root. Every node at a given
+depth splits on the same feature and value, the split of a level being the one with the lowest Gini impurity
+over all nodes of the level, weighted by their number of rows. Features are sampled and candidate thresholds
+picked per level the same way 'calculate_best_data_split' does per node, and a side of a node becomes a leaf
+at 'max_depth', when it has at most 'min_samples_leaf' rows or when its split would go over the memory
+budget, same as in 'grow'. With 'max_split_samples' every node of a level contributes a share of the sample
+in proportion to its rows.
+
+The tree is stored as regular DecisionTreeNode's, so it predicts, saves and loads like any other tree, and
+'compile_oblivious_forest' turns a forest of such trees into lookup tables.
+*/
+DecisionTreeNode *grow_oblivious_tree(double **data,
+                                      size_t max_depth,
+                                      size_t min_samples_leaf,
+                                      size_t max_features,
+                                      DecisionTreeSplitMode split_mode,
+                                      size_t max_split_samples,
+                                      size_t rows,
+                                      size_t cols,
+                                      long *nodeId,
+                                      const ModelContext *ctx);
+
+/*
+Inference-only form of a forest of oblivious trees. A tree of depth 'd' is its 'd' level splits and a table
+of '2^d' leaves: a row makes the 'd' comparisons of the levels, which give the bits of the index of its leaf
+from the most significant (the root) down, so predicting takes no branches.
+*/
+struct ObliviousForest
+{
+    size_t n_estimators;
+    size_t max_depth;      // Depth of the deepest tree, the stride of 'features' and 'thresholds'.
+    uint32_t *depths;      // Depth of every tree.
+    uint32_t *features;    // Split feature of every level of every tree.
+    double *thresholds;    // Split value of every level of every tree.
+    size_t *leaf_offsets;  // Offset of the leaves of every tree in 'leaves'.
+    uint8_t *leaves;       // Class of every leaf of every tree.
+};
+
+/*
+Converts a trained forest of oblivious trees into an ObliviousForest which makes exactly the same predictions.
+Returns NULL if a tree is not oblivious (two nodes at the same depth split differently, as in trees grown by
+'grow') or is deeper than OBLIVIOUS_MAX_DEPTH.
+*/
+ObliviousForest *compile_oblivious_forest(const DecisionTreeNode **random_forest, size_t n_estimators);
+
+/*
+Returns the class target value that is the majority vote of the trees of 'forest' for 'row', same as
+'predict_model'.
+*/
+int predict_oblivious(const ObliviousForest *forest, const double *row);
+
+/*
+Predicts the 'n_rows' rows of 'rows', which are 'stride' doubles apart, tree by tree into 'predictions'.
+*/
+void predict_oblivious_batch(const ObliviousForest *forest,
+                             const double *rows,
+                             size_t n_rows,
+                             size_t stride,
+                             int *predictions);
+
+/*
+Returns the number of bytes taken by the splits and leaves of 'forest'.
+*/
+size_t oblivious_forest_size(const ObliviousForest *forest);
+
+void free_oblivious_forest(ObliviousForest *forest);
+
+#endif // oblivious_h
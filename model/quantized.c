@@ -0,0 +1,244 @@
+/*
+@author andrii dobroshynski
+*/
+
+#include <math.h>
+#include "quantized.h"
+#include "../utils/stats.h"
+#include "../utils/memory.h"
+
+/*
+Guards the size of a QuantizedNode at compile time.
+*/
+typedef char quantized_node_size_check[sizeof(QuantizedNode) == 8 ? 1 : -1];
+
+int compare_thresholds(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+Counts the nodes of a tree and records the split value of every node under its feature in 'thresholds',
+growing the per-feature arrays as needed.
+*/
+void collect_thresholds(const DecisionTreeNode *node, QuantizedForest *forest, size_t *capacities)
+{
+    forest->n_nodes++;
+
+    size_t feature = node->split_index;
+    if (forest->n_thresholds[feature] == capacities[feature])
+    {
+        capacities[feature] = capacities[feature] ? 2 * capacities[feature] : 8;
+        forest->thresholds[feature] = tracked_realloc(forest->thresholds[feature], capacities[feature] * sizeof(double), MEMORY_TAG_TREE_NODES);
+    }
+    forest->thresholds[feature][forest->n_thresholds[feature]++] = node->split_value;
+
+    if (node->leftChild)
+        collect_thresholds(node->leftChild, forest, capacities);
+    if (node->rightChild)
+        collect_thresholds(node->rightChild, forest, capacities);
+}
+
+/*
+Returns the bin index of 'value' given the sorted distinct 'thresholds' of a feature, which is the number
+of thresholds less than or equal to 'value'. For a threshold at (1-based) position 'k' it holds that
+'value < thresholds[k - 1]' exactly when the bin index is less than 'k'. NaN is less than no threshold, so it
+goes to the last bin and always right, same as in 'make_prediction'.
+*/
+size_t get_bin_index(const double *thresholds, size_t n_thresholds, double value)
+{
+    if (isnan(value))
+        return n_thresholds;
+
+    size_t lo = 0;
+    size_t hi = n_thresholds;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (thresholds[mid] <= value)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+Writes the tree rooted at 'node' in pre-order into 'forest->nodes' starting at '*next' and returns the
+index of the root.
+*/
+uint32_t encode_tree(const DecisionTreeNode *node, QuantizedForest *forest, size_t *next)
+{
+    uint32_t index = (uint32_t)(*next)++;
+    size_t feature = node->split_index;
+
+    QuantizedNode encoded = {
+        feature : (uint16_t)feature,
+        threshold : (uint16_t)(get_bin_index(forest->thresholds[feature],
+                                             forest->n_thresholds[feature],
+                                             node->split_value)),
+        info : 0
+    };
+
+    if (node->leftChild)
+        encode_tree(node->leftChild, forest, next);
+    else
+        encoded.info |= QUANTIZED_LEFT_LEAF | (node->left_leaf ? QUANTIZED_LEFT_CLASS : 0);
+
+    if (node->rightChild)
+        encoded.info |= encode_tree(node->rightChild, forest, next) << QUANTIZED_CHILD_SHIFT;
+    else
+        encoded.info |= QUANTIZED_RIGHT_LEAF | (node->right_leaf ? QUANTIZED_RIGHT_CLASS : 0);
+
+    forest->nodes[index] = encoded;
+    return index;
+}
+
+QuantizedForest *quantize_random_forest(const DecisionTreeNode **random_forest, size_t n_estimators)
+{
+    size_t n_features = 0;
+    for (size_t i = 0; i < n_estimators; ++i)
+    {
+        size_t max = get_max_split_index(random_forest[i]) + 1;
+        if (max > n_features)
+            n_features = max;
+    }
+    if (n_features > UINT16_MAX + 1)
+    {
+        printf("Error: can't quantize a random forest that splits on feature indices above %d\n", UINT16_MAX);
+        return NULL;
+    }
+
+    QuantizedForest *forest = tracked_malloc(sizeof(QuantizedForest), MEMORY_TAG_TREE_NODES);
+    forest->n_estimators = n_estimators;
+    forest->n_nodes = 0;
+    forest->n_features = n_features;
+    forest->n_thresholds = tracked_calloc(n_features, sizeof(size_t), MEMORY_TAG_TREE_NODES);
+    forest->thresholds = tracked_calloc(n_features, sizeof(double *), MEMORY_TAG_TREE_NODES);
+    forest->nodes = NULL;
+    forest->roots = tracked_malloc(n_estimators * sizeof(uint32_t), MEMORY_TAG_TREE_NODES);
+
+    // Gather the split values of every feature and reduce them to the sorted distinct bin edges.
+    size_t *capacities = tracked_calloc(n_features, sizeof(size_t), MEMORY_TAG_TREE_NODES);
+    for (size_t i = 0; i < n_estimators; ++i)
+        collect_thresholds(random_forest[i], forest, capacities);
+    tracked_free(capacities, MEMORY_TAG_TREE_NODES);
+
+    int encodable = forest->n_nodes < ((size_t)1 << (32 - QUANTIZED_CHILD_SHIFT));
+    for (size_t f = 0; f < n_features; ++f)
+    {
+        size_t count = forest->n_thresholds[f];
+        qsort(forest->thresholds[f], count, sizeof(double), compare_thresholds);
+
+        size_t distinct = 0;
+        for (size_t k = 0; k < count; ++k)
+            if (distinct == 0 || forest->thresholds[f][distinct - 1] != forest->thresholds[f][k])
+                forest->thresholds[f][distinct++] = forest->thresholds[f][k];
+        forest->n_thresholds[f] = distinct;
+
+        if (distinct > UINT16_MAX)
+            encodable = 0;
+    }
+    if (!encodable)
+    {
+        printf("Error: random forest is too large to quantize\n");
+        free_quantized_forest(forest);
+        return NULL;
+    }
+
+    forest->nodes = tracked_malloc(forest->n_nodes * sizeof(QuantizedNode), MEMORY_TAG_TREE_NODES);
+    size_t next = 0;
+    for (size_t i = 0; i < n_estimators; ++i)
+        forest->roots[i] = encode_tree(random_forest[i], forest, &next);
+
+    if (log_level > 1)
+        printf("quantized random forest: %ld nodes, %ld bytes\n", forest->n_nodes, quantized_forest_size(forest));
+
+    return forest;
+}
+
+void quantize_row(const QuantizedForest *forest, const double *row, uint16_t *bins)
+{
+    for (size_t f = 0; f < forest->n_features; ++f)
+        bins[f] = (uint16_t)get_bin_index(forest->thresholds[f], forest->n_thresholds[f], row[f]);
+}
+
+void quantize_sparse_row(const QuantizedForest *forest,
+                         const uint32_t *indices,
+                         const double *values,
+                         size_t nnz,
+                         uint16_t *bins)
+{
+    // Every feature not stored in the row is zero, so start from the bins of zero.
+    for (size_t f = 0; f < forest->n_features; ++f)
+        bins[f] = (uint16_t)get_bin_index(forest->thresholds[f], forest->n_thresholds[f], 0);
+
+    for (size_t k = 0; k < nnz && indices[k] < forest->n_features; ++k)
+        bins[indices[k]] = (uint16_t)get_bin_index(forest->thresholds[indices[k]],
+                                                   forest->n_thresholds[indices[k]],
+                                                   values[k]);
+}
+
+int predict_quantized(const QuantizedForest *forest, const uint16_t *bins)
+{
+    STATS_PHASE_BEGIN(STATS_PHASE_PREDICT);
+
+    size_t ones = 0;
+    for (size_t i = 0; i < forest->n_estimators; ++i)
+    {
+        uint32_t index = forest->roots[i];
+        for (;;)
+        {
+            QuantizedNode node = forest->nodes[index];
+            if (bins[node.feature] < node.threshold)
+            {
+                if (node.info & QUANTIZED_LEFT_LEAF)
+                {
+                    ones += (node.info & QUANTIZED_LEFT_CLASS) != 0;
+                    break;
+                }
+                index = index + 1;
+            }
+            else
+            {
+                if (node.info & QUANTIZED_RIGHT_LEAF)
+                {
+                    ones += (node.info & QUANTIZED_RIGHT_CLASS) != 0;
+                    break;
+                }
+                index = node.info >> QUANTIZED_CHILD_SHIFT;
+            }
+        }
+    }
+
+    STATS_PHASE_END(STATS_PHASE_PREDICT);
+
+    if (ones > forest->n_estimators - ones)
+        return 1;
+    else
+        return 0;
+}
+
+size_t quantized_forest_size(const QuantizedForest *forest)
+{
+    size_t size = sizeof(QuantizedForest) +
+                  forest->n_nodes * sizeof(QuantizedNode) +
+                  forest->n_estimators * sizeof(uint32_t) +
+                  forest->n_features * (sizeof(size_t) + sizeof(double *));
+    for (size_t f = 0; f < forest->n_features; ++f)
+        size += forest->n_thresholds[f] * sizeof(double);
+    return size;
+}
+
+void free_quantized_forest(QuantizedForest *forest)
+{
+    for (size_t f = 0; f < forest->n_features; ++f)
+        tracked_free(forest->thresholds[f], MEMORY_TAG_TREE_NODES);
+    tracked_free(forest->thresholds, MEMORY_TAG_TREE_NODES);
+    tracked_free(forest->n_thresholds, MEMORY_TAG_TREE_NODES);
+    tracked_free(forest->nodes, MEMORY_TAG_TREE_NODES);
+    tracked_free(forest->roots, MEMORY_TAG_TREE_NODES);
+    tracked_free(forest, MEMORY_TAG_TREE_NODES);
+}
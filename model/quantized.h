@@ -0,0 +1,95 @@
+/*
+@author andrii dobroshynski
+*/
+
+#ifndef quantized_h
+#define quantized_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "tree.h"
+
+typedef struct QuantizedNode QuantizedNode;
+typedef struct QuantizedForest QuantizedForest;
+
+/*
+Flags packed into the low bits of 'QuantizedNode.info', the remaining high bits hold the index of the
+right child.
+*/
+#define QUANTIZED_LEFT_LEAF 0x1u
+#define QUANTIZED_LEFT_CLASS 0x2u
+#define QUANTIZED_RIGHT_LEAF 0x4u
+#define QUANTIZED_RIGHT_CLASS 0x8u
+#define QUANTIZED_CHILD_SHIFT 4
+
+/*
+Inference-only encoding of a DecisionTreeNode in 8 bytes. Nodes of a tree are stored in pre-order, so the
+left child of a node (if it is not a leaf) is always the next node and only the index of the right child
+is stored. Leaves are not stored as nodes, the class target of a leaf is a single bit of its parent.
+
+The threshold is stored as a bin index: a row goes left iff the bin of its value for 'feature' is less
+than 'threshold'. See 'quantize_row'.
+*/
+struct QuantizedNode
+{
+    uint16_t feature;
+    uint16_t threshold;
+    uint32_t info;
+};
+
+/*
+A random forest model in the QuantizedNode format. 'thresholds[f]' holds the sorted distinct split values
+used on feature 'f' anywhere in the forest, which are the edges of the bins values of 'f' are mapped to.
+*/
+struct QuantizedForest
+{
+    size_t n_estimators;
+    size_t n_nodes;
+    QuantizedNode *nodes;
+    uint32_t *roots;
+
+    size_t n_features;
+    size_t *n_thresholds;
+    double **thresholds;
+};
+
+/*
+Converts a trained random forest model into a QuantizedForest which makes exactly the same predictions.
+Returns NULL if the model cannot be encoded, i.e. it splits on a feature index above 65535, uses more
+than 65535 distinct thresholds on a feature or has more than 2^28 nodes.
+*/
+QuantizedForest *quantize_random_forest(const DecisionTreeNode **random_forest, size_t n_estimators);
+
+/*
+Maps every value of 'row' used by the 'forest' to its bin, the number of thresholds of the feature that
+are less than or equal to the value (all of them for NaN), and writes the bins into 'bins'
+('forest->n_features' of them).
+*/
+void quantize_row(const QuantizedForest *forest, const double *row, uint16_t *bins);
+
+/*
+Same as 'quantize_row' for a row given in sparse form ('nnz' values with ascending feature 'indices').
+*/
+void quantize_sparse_row(const QuantizedForest *forest,
+                         const uint32_t *indices,
+                         const double *values,
+                         size_t nnz,
+                         uint16_t *bins);
+
+/*
+Given a row quantized with 'quantize_row', gets predictions from every tree in the 'forest' and returns
+the class target value that is the majority vote, same as 'predict_model'.
+*/
+int predict_quantized(const QuantizedForest *forest, const uint16_t *bins);
+
+/*
+Returns the number of bytes used by the 'forest'.
+*/
+size_t quantized_forest_size(const QuantizedForest *forest);
+
+/*
+Frees memory for a given QuantizedForest.
+*/
+void free_quantized_forest(QuantizedForest *forest);
+
+#endif // quantized_h
@@ -0,0 +1,468 @@
+/*
+@author andrii dobroshynski
+*/
+
+#include "sparse_tree.h"
+#include "../utils/stats.h"
+#include "../utils/memory.h"
+
+/*
+A distinct value of a feature within a node along with how many rows of each class target (0 / 1) have
+that value. All rows where the feature is zero are aggregated into a single entry.
+*/
+struct SparseSplitEntry
+{
+    double value;
+    size_t counts[2];
+};
+
+/*
+Best split found for a node, with the node's rows partitioned into the two halves.
+*/
+struct SparseNodeSplit
+{
+    int index;
+    double value;
+    double gini;
+
+    size_t *left;
+    size_t left_count;
+    size_t *right;
+    size_t right_count;
+};
+
+/*
+Parameters and scratch buffers shared by every node while growing a single tree.
+*/
+struct SparseTreeBuilder
+{
+    const SparseMatrix *data;
+    const SparseColumns *columns;
+
+    size_t max_depth;
+    size_t min_samples_leaf;
+    size_t max_features;
+    DecisionTreeSplitMode split_mode;
+    long *nodeId;
+    const ModelContext *ctx;
+
+    // Rows of the node currently being split are marked with the current 'stamp', which allows testing
+    // whether an entry of a column belongs to the node in constant time.
+    long *row_stamp;
+    long stamp;
+
+    struct SparseSplitEntry *entries;
+    int *features;
+};
+
+int compare_sparse_split_entries(const void *a, const void *b)
+{
+    double x = ((const struct SparseSplitEntry *)a)->value;
+    double y = ((const struct SparseSplitEntry *)b)->value;
+    return (x > y) - (x < y);
+}
+
+/*
+Computes the weighted gini index of a split given the class target counts of the two halves.
+*/
+double calculate_gini_index_from_counts(const size_t *left_counts, const size_t *right_counts)
+{
+    double n_instances = (double)(left_counts[0] + left_counts[1] + right_counts[0] + right_counts[1]);
+    const size_t *groups[2] = {left_counts, right_counts};
+
+    double gini = 0.0;
+    for (size_t i = 0; i < 2; ++i)
+    {
+        double size = (double)(groups[i][0] + groups[i][1]);
+        if (size == 0)
+            continue;
+
+        double p0 = (double)groups[i][0] / size;
+        double p1 = (double)groups[i][1] / size;
+        gini += (1.0 - (p0 * p0 + p1 * p1)) * (size / n_instances);
+    }
+    return gini;
+}
+
+/*
+Returns the class target of 'row', which must be 0 or 1.
+*/
+int get_sparse_row_label(const SparseMatrix *data, size_t row)
+{
+    int class_label = (int)data->labels[row];
+    if (class_label != 0 && class_label != 1)
+    {
+        printf("Error: currently only support binary classification, i.e. class target values 0/1, got: %d\n",
+               class_label);
+        exit(1);
+    }
+    return class_label;
+}
+
+/*
+Returns the leaf node class value for the rows, the class target of the majority of the rows.
+*/
+int get_sparse_leaf_node_class_value(const SparseMatrix *data, const size_t *rows, size_t n)
+{
+    size_t ones = 0;
+    for (size_t i = 0; i < n; ++i)
+        ones += get_sparse_row_label(data, rows[i]);
+
+    if (ones >= n - ones)
+        return 1;
+    else
+        return 0;
+}
+
+/*
+Collects the distinct values of the feature at 'feature_index' among the 'n' rows of the node into
+'builder->entries', sorted ascending, and returns the number of entries. Only non-zero values of the
+feature are visited, either by scanning its column or, when the column holds more values than the
+node has rows, by looking the feature up in each of the node's rows. The remaining rows of the node
+are added as a single entry for the value zero.
+*/
+size_t gather_sparse_split_entries(struct SparseTreeBuilder *builder,
+                                   int feature_index,
+                                   const size_t *rows,
+                                   size_t n,
+                                   const size_t *node_counts)
+{
+    const SparseMatrix *data = builder->data;
+    const SparseColumns *columns = builder->columns;
+    struct SparseSplitEntry *entries = builder->entries;
+
+    size_t nnz = 0;
+    size_t nnz_counts[2] = {0, 0};
+
+    size_t column_begin = columns->col_ptr[feature_index];
+    size_t column_end = columns->col_ptr[feature_index + 1];
+    if (column_end - column_begin <= n)
+    {
+        for (size_t k = column_begin; k < column_end; ++k)
+        {
+            size_t row = columns->row_idx[k];
+            if (builder->row_stamp[row] != builder->stamp)
+                continue;
+
+            int label = get_sparse_row_label(data, row);
+            entries[nnz] = (struct SparseSplitEntry){value : columns->values[k]};
+            entries[nnz++].counts[label] = 1;
+            nnz_counts[label]++;
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            size_t row = rows[i];
+            size_t offset = data->row_ptr[row];
+            double value = sparse_row_value(data->col_idx + offset,
+                                            data->values + offset,
+                                            data->row_ptr[row + 1] - offset,
+                                            feature_index);
+            if (value == 0)
+                continue;
+
+            int label = get_sparse_row_label(data, row);
+            entries[nnz] = (struct SparseSplitEntry){value : value};
+            entries[nnz++].counts[label] = 1;
+            nnz_counts[label]++;
+        }
+    }
+
+    size_t count = nnz;
+    if (nnz < n)
+    {
+        entries[count++] = (struct SparseSplitEntry){
+            value : 0,
+            counts : {node_counts[0] - nnz_counts[0], node_counts[1] - nnz_counts[1]}
+        };
+    }
+
+    qsort(entries, count, sizeof(struct SparseSplitEntry), compare_sparse_split_entries);
+
+    // Merge entries with equal values so that every entry is a distinct candidate threshold.
+    size_t distinct = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (distinct > 0 && entries[distinct - 1].value == entries[i].value)
+        {
+            entries[distinct - 1].counts[0] += entries[i].counts[0];
+            entries[distinct - 1].counts[1] += entries[i].counts[1];
+        }
+        else
+        {
+            entries[distinct++] = entries[i];
+        }
+    }
+    return distinct;
+}
+
+/*
+Calculates the best split for the 'n' rows of a node and partitions the rows into the two halves.
+*/
+struct SparseNodeSplit calculate_best_sparse_split(struct SparseTreeBuilder *builder, const size_t *rows, size_t n)
+{
+    const SparseMatrix *data = builder->data;
+
+    STATS_PHASE_BEGIN(STATS_PHASE_SPLIT_SEARCH);
+
+    size_t node_counts[2] = {0, 0};
+    builder->stamp++;
+    for (size_t i = 0; i < n; ++i)
+    {
+        builder->row_stamp[rows[i]] = builder->stamp;
+        node_counts[get_sparse_row_label(data, rows[i])]++;
+    }
+
+    double best_value = DBL_MAX;
+    double best_gini = DBL_MAX;
+    int best_index = INT_MAX;
+
+    // Randomly select the features to consider, same as for dense data.
+    int *features = builder->features;
+    for (size_t i = 0; i < builder->max_features; ++i)
+        features[i] = -1;
+
+    size_t count = 0;
+    while (count < builder->max_features)
+    {
+        int index = rand() % (int)data->cols;
+        if (!contains_int(features, builder->max_features, index))
+            features[count++] = index;
+    }
+
+    for (size_t i = 0; i < builder->max_features; ++i)
+    {
+        int feature_index = features[i];
+        size_t n_entries = gather_sparse_split_entries(builder, feature_index, rows, n, node_counts);
+        struct SparseSplitEntry *entries = builder->entries;
+        STATS_ADD(STATS_ROWS_SCANNED, n_entries);
+
+        // Sweep the candidate thresholds in ascending order while accumulating the class target counts of
+        // the rows that fall to the left (value < threshold) of the current threshold.
+        size_t left_counts[2] = {0, 0};
+        size_t right_counts[2];
+        size_t entry = 0;
+
+        size_t n_candidates = n_entries;
+        double *candidate_values = NULL;
+        double random_threshold = 0;
+        if (builder->split_mode == SPLIT_MODE_RANDOM)
+        {
+            random_threshold = draw_random_threshold(entries[0].value, entries[n_entries - 1].value);
+            n_candidates = 1;
+            candidate_values = &random_threshold;
+        }
+        else if (builder->split_mode == SPLIT_MODE_QUANTILE)
+        {
+            n_candidates = builder->ctx->split_candidates->counts[feature_index];
+            candidate_values = builder->ctx->split_candidates->values[feature_index];
+        }
+
+        STATS_ADD(STATS_CANDIDATE_SPLITS, n_candidates);
+        STATS_ADD(STATS_GINI_EVALUATIONS, n_candidates);
+        for (size_t j = 0; j < n_candidates; ++j)
+        {
+            double value = candidate_values != NULL ? candidate_values[j] : entries[j].value;
+            while (entry < n_entries && entries[entry].value < value)
+            {
+                left_counts[0] += entries[entry].counts[0];
+                left_counts[1] += entries[entry].counts[1];
+                ++entry;
+            }
+            right_counts[0] = node_counts[0] - left_counts[0];
+            right_counts[1] = node_counts[1] - left_counts[1];
+
+            double gini = calculate_gini_index_from_counts(left_counts, right_counts);
+            if (gini < best_gini)
+            {
+                best_index = feature_index;
+                best_value = value;
+                best_gini = gini;
+            }
+        }
+    }
+
+    // Partition the rows of the node on the best split.
+    STATS_PHASE_BEGIN(STATS_PHASE_PARTITION);
+    STATS_ADD(STATS_ROWS_SCANNED, n);
+    STATS_ADD(STATS_BYTES_ALLOCATED, 2 * n * sizeof(size_t));
+    struct SparseNodeSplit split = {
+        index : best_index,
+        value : best_value,
+        gini : best_gini,
+        left : tracked_malloc(n * sizeof(size_t), MEMORY_TAG_SPLIT_SCRATCH),
+        left_count : 0,
+        right : tracked_malloc(n * sizeof(size_t), MEMORY_TAG_SPLIT_SCRATCH),
+        right_count : 0
+    };
+    for (size_t i = 0; i < n; ++i)
+    {
+        size_t row = rows[i];
+        size_t offset = data->row_ptr[row];
+        double value = sparse_row_value(data->col_idx + offset,
+                                        data->values + offset,
+                                        data->row_ptr[row + 1] - offset,
+                                        best_index);
+        if (value < best_value)
+            split.left[split.left_count++] = row;
+        else
+            split.right[split.right_count++] = row;
+    }
+    STATS_PHASE_END(STATS_PHASE_PARTITION);
+
+    if (log_level > 1)
+        printf("sparse split on feature %d < %f (gini %f): %ld | %ld\n",
+               best_index, best_value, best_gini, split.left_count, split.right_count);
+
+    STATS_PHASE_END(STATS_PHASE_SPLIT_SEARCH);
+
+    return split;
+}
+
+/*
+Returns whether splitting a half of 'n' rows fits into the memory budget, same as 'split_fits_budget' for dense
+data, except that both sides of a sparse split take room for every row of the half. Counts a budget leaf if it
+does not.
+*/
+int sparse_split_fits_budget(size_t n)
+{
+    if (memory_budget_allows(2 * n * sizeof(size_t) + sizeof(DecisionTreeNode)))
+        return 1;
+    record_budget_leaf();
+    return 0;
+}
+
+/*
+Recursively grows a DecisionTreeNode on sparse data by splitting each half of 'split' and creating
+left / right children, mirroring 'grow' for dense data.
+*/
+void grow_sparse(struct SparseTreeBuilder *builder,
+                 DecisionTreeNode *decision_tree,
+                 struct SparseNodeSplit *split,
+                 int depth)
+{
+    STATS_DEPTH(depth);
+
+    if (depth >= builder->max_depth)
+    {
+        decision_tree->left_leaf = get_sparse_leaf_node_class_value(builder->data, split->left, split->left_count);
+        decision_tree->right_leaf = get_sparse_leaf_node_class_value(builder->data, split->right, split->right_count);
+
+        tracked_free(split->left, MEMORY_TAG_SPLIT_SCRATCH);
+        tracked_free(split->right, MEMORY_TAG_SPLIT_SCRATCH);
+
+        return;
+    }
+    if (split->left_count <= builder->min_samples_leaf || !sparse_split_fits_budget(split->left_count))
+    {
+        decision_tree->left_leaf = get_sparse_leaf_node_class_value(builder->data, split->left, split->left_count);
+    }
+    else
+    {
+        struct SparseNodeSplit left_split = calculate_best_sparse_split(builder, split->left, split->left_count);
+
+        decision_tree->leftChild = empty_node(builder->nodeId);
+        decision_tree->leftChild->split_index = left_split.index;
+        decision_tree->leftChild->split_value = left_split.value;
+
+        grow_sparse(builder, decision_tree->leftChild, &left_split, depth + 1);
+    }
+    if (split->right_count <= builder->min_samples_leaf || !sparse_split_fits_budget(split->right_count))
+    {
+        decision_tree->right_leaf = get_sparse_leaf_node_class_value(builder->data, split->right, split->right_count);
+    }
+    else
+    {
+        struct SparseNodeSplit right_split = calculate_best_sparse_split(builder, split->right, split->right_count);
+
+        decision_tree->rightChild = empty_node(builder->nodeId);
+        decision_tree->rightChild->split_index = right_split.index;
+        decision_tree->rightChild->split_value = right_split.value;
+
+        grow_sparse(builder, decision_tree->rightChild, &right_split, depth + 1);
+    }
+
+    tracked_free(split->left, MEMORY_TAG_SPLIT_SCRATCH);
+    tracked_free(split->right, MEMORY_TAG_SPLIT_SCRATCH);
+}
+
+DecisionTreeNode *grow_sparse_tree(const SparseMatrix *data,
+                                   const SparseColumns *columns,
+                                   size_t max_depth,
+                                   size_t min_samples_leaf,
+                                   size_t max_features,
+                                   DecisionTreeSplitMode split_mode,
+                                   long *nodeId,
+                                   const ModelContext *ctx)
+{
+    if (split_mode == SPLIT_MODE_QUANTILE && ctx->split_candidates == NULL)
+    {
+        printf("Error: the quantile split mode requires split candidates in the ModelContext\n");
+        exit(1);
+    }
+    if (max_features > data->cols)
+        max_features = data->cols;
+
+    struct SparseTreeBuilder builder = {
+        data : data,
+        columns : columns,
+        max_depth : max_depth,
+        min_samples_leaf : min_samples_leaf,
+        max_features : max_features,
+        split_mode : split_mode,
+        nodeId : nodeId,
+        ctx : ctx,
+        row_stamp : tracked_calloc(data->rows, sizeof(long), MEMORY_TAG_SPLIT_SCRATCH),
+        stamp : 0,
+        entries : tracked_malloc((data->rows + 1) * sizeof(struct SparseSplitEntry), MEMORY_TAG_SPLIT_SCRATCH),
+        features : tracked_malloc(max_features * sizeof(int), MEMORY_TAG_SPLIT_SCRATCH)
+    };
+
+    // Train on every row that is not withheld for evaluation. If the testing fold covers all of the rows
+    // (a single fold) there is nothing to withhold and the model is trained on every row.
+    size_t *rows = tracked_malloc(data->rows * sizeof(size_t), MEMORY_TAG_SPLIT_SCRATCH);
+    size_t n = 0;
+    int single_fold = ctx->rowsPerFold >= data->rows;
+    for (size_t i = 0; i < data->rows; ++i)
+        if (single_fold || !is_row_part_of_testing_fold(i, ctx))
+            rows[n++] = i;
+
+    DecisionTreeNode *root = empty_node(nodeId);
+    struct SparseNodeSplit split = calculate_best_sparse_split(&builder, rows, n);
+    root->split_index = split.index;
+    root->split_value = split.value;
+
+    // Start building the tree recursively.
+    grow_sparse(&builder, root, &split, 1 /* Current depth. */);
+
+    tracked_free(rows, MEMORY_TAG_SPLIT_SCRATCH);
+    tracked_free(builder.row_stamp, MEMORY_TAG_SPLIT_SCRATCH);
+    tracked_free(builder.entries, MEMORY_TAG_SPLIT_SCRATCH);
+    tracked_free(builder.features, MEMORY_TAG_SPLIT_SCRATCH);
+
+    return root;
+}
+
+void make_prediction_sparse(const DecisionTreeNode *decision_tree,
+                            const uint32_t *indices,
+                            const double *values,
+                            size_t nnz,
+                            int *prediction_val)
+{
+    if (sparse_row_value(indices, values, nnz, decision_tree->split_index) < decision_tree->split_value)
+    {
+        if (decision_tree->leftChild != NULL)
+            make_prediction_sparse(decision_tree->leftChild, indices, values, nnz, prediction_val);
+        else
+            (*prediction_val) = decision_tree->left_leaf;
+    }
+    else
+    {
+        if (decision_tree->rightChild != NULL)
+            make_prediction_sparse(decision_tree->rightChild, indices, values, nnz, prediction_val);
+        else
+            (*prediction_val) = decision_tree->right_leaf;
+    }
+}
@@ -0,0 +1,43 @@
+/*
+@author andrii dobroshynski
+*/
+
+#ifndef sparse_tree_h
+#define sparse_tree_h
+
+#include <stdlib.h>
+#include "tree.h"
+#include "../utils/sparse.h"
+#include "../utils/utils.h"
+
+/*
+Grows a single decision tree on sparse 'data' and returns a pointer to its root DecisionTreeNode. The
+tree is built along the lines of 'grow' for dense data, but the split search only visits the non-zero
+entries of every sampled feature (found through 'columns'), handling all rows where the feature is zero
+as a single aggregated bucket. Rows that are part of the testing fold in 'ctx' are left out of training
+unless the testing fold covers every row.
+
+The trees are not the same as those 'grow' builds from the dense form of the data: 'grow' trains on every
+row, and scores the candidates in row order where this scores the distinct values in ascending order, so
+ties between equally good splits are broken differently.
+*/
+DecisionTreeNode *grow_sparse_tree(const SparseMatrix *data,
+                                   const SparseColumns *columns,
+                                   size_t max_depth,
+                                   size_t min_samples_leaf,
+                                   size_t max_features,
+                                   DecisionTreeSplitMode split_mode,
+                                   long *nodeId,
+                                   const ModelContext *ctx);
+
+/*
+Given a row in sparse form ('nnz' values with ascending feature 'indices') and a trained decision tree,
+computes the predicted class target value for the row and writes it into 'prediction_val'.
+*/
+void make_prediction_sparse(const DecisionTreeNode *decision_tree,
+                            const uint32_t *indices,
+                            const double *values,
+                            size_t nnz,
+                            int *prediction_val);
+
+#endif // sparse_tree_h
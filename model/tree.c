@@ -2,14 +2,20 @@
 @author andrii dobroshynski
 */
 
+#include <math.h>
 #include "tree.h"
+#include "../utils/memory.h"
+#include "../utils/stats.h"
+#include "../utils/trace.h"
 
 /*
 Allocates memory for an empty DecisionTreeNode and returns a pointer to the node.
 */
 DecisionTreeNode *empty_node(long *id)
 {
-    DecisionTreeNode *node = malloc(sizeof(DecisionTreeNode));
+    DecisionTreeNode *node = tracked_malloc(sizeof(DecisionTreeNode), MEMORY_TAG_TREE_NODES);
+    STATS_ADD(STATS_NODES_CREATED, 1);
+    STATS_ADD(STATS_BYTES_ALLOCATED, sizeof(DecisionTreeNode));
 
     node->id = (*id);
     node->leftChild = NULL;
@@ -53,7 +59,7 @@ DecisionTreeTargetClasses get_target_class_values(double **data, size_t rows, si
         printf("generating class value set...\n");
 
     size_t count = 0;
-    int *target_class_values = malloc(count * sizeof(int));
+    int *target_class_values = tracked_malloc(count * sizeof(int), MEMORY_TAG_SPLIT_SCRATCH);
 
     for (size_t i = 0; i < rows; ++i)
     {
@@ -71,9 +77,7 @@ DecisionTreeTargetClasses get_target_class_values(double **data, size_t rows, si
             if (log_level > 1)
                 printf("adding %d \n", class_target);
             count++;
-            int *temp = realloc(target_class_values, count * sizeof(int));
-            if (temp != NULL)
-                target_class_values = temp;
+            target_class_values = tracked_realloc(target_class_values, count * sizeof(int), MEMORY_TAG_SPLIT_SCRATCH);
             target_class_values[count - 1] = class_target;
         }
     }
@@ -124,75 +128,92 @@ DecisionTreeData *split_dataset(int feature_index,
     if (log_level > 1)
         printf("splitting dataset into two halves...\n");
 
-    // Buffers to hold rows of data as we are distributing rows based on the split.
-    double **left = (double **)malloc(1 * sizeof(double) * cols);
-    double **right = (double **)malloc(1 * sizeof(double) * cols);
+    STATS_PHASE_BEGIN(STATS_PHASE_PARTITION);
+    STATS_ADD(STATS_ROWS_SCANNED, rows);
 
+    // Count the rows of both halves first so that each half gets a buffer of exactly its row pointers. Both
+    // buffers are allocated even when a half is empty, 'grow' relies on the halves of a split being non-NULL.
     size_t left_count = 0;
-    size_t right_count = 0;
+    for (size_t i = 0; i < rows; ++i)
+        left_count += data[i][feature_index] < value;
+    size_t right_count = rows - left_count;
+
+    double **left = tracked_malloc(left_count * sizeof(double *), MEMORY_TAG_SPLIT_SCRATCH);
+    double **right = tracked_malloc(right_count * sizeof(double *), MEMORY_TAG_SPLIT_SCRATCH);
+    STATS_ADD(STATS_BYTES_ALLOCATED, rows * sizeof(double *));
 
+    size_t left_idx = 0;
+    size_t right_idx = 0;
     for (size_t i = 0; i < rows; ++i)
     {
         double *row = data[i];
         if (row[feature_index] < value)
-        {
-            // Copy the row into the left half and resize the buffer.
-            left[left_count++] = row;
-            double **temp = realloc(left, left_count * sizeof(double) * cols);
-            if (temp != NULL)
-                left = temp;
-        }
+            left[left_idx++] = row;
         else
-        {
-            // Copy the row into the right half and resize the buffer.
-            right[right_count++] = row;
-            double **temp = realloc(right, right_count * sizeof(double) * cols);
-            if (temp != NULL)
-                right = temp;
-        }
+            right[right_idx++] = row;
     }
-    DecisionTreeData *data_split = malloc(sizeof(DecisionTreeData) * 2);
+
+    DecisionTreeData *data_split = tracked_malloc(sizeof(DecisionTreeData) * 2, MEMORY_TAG_SPLIT_SCRATCH);
     data_split[0] = (DecisionTreeData){left_count, left};
     data_split[1] = (DecisionTreeData){right_count, right};
 
     if (log_level > 1)
         printf("split dataset into: %ld | %ld\n", left_count, right_count);
 
+    STATS_PHASE_END(STATS_PHASE_PARTITION);
+
     return data_split;
 }
 
-double calculate_gini_index(DecisionTreeData *data_split,
-                            int *class_labels,
-                            size_t class_labels_count,
-                            size_t cols)
+double calculate_gini_index(double **data,
+                            size_t rows,
+                            size_t cols,
+                            int feature_index,
+                            double value,
+                            const DecisionTreeTargetClasses *classes,
+                            size_t *class_counts)
 {
     if (log_level > 1)
         printf("calculating gini index based on split...\n");
 
-    // DecisionTreeData data split should consist of two halves.
-    int count = 2;
-    size_t n_instances = data_split[0].length + data_split[1].length;
-    double gini = 0.0;
-    for (size_t i = 0; i < count; ++i)
+    STATS_ADD(STATS_GINI_EVALUATIONS, 1);
+    STATS_ADD(STATS_ROWS_SCANNED, rows);
+
+    // Count the rows and the class targets of both halves of the split. Rows of class targets that are not in
+    // 'classes' (rows of the testing fold) only count towards the size of their half.
+    size_t *counts[2] = {class_counts, class_counts + classes->count};
+    size_t sizes[2] = {0, 0};
+    for (size_t j = 0; j < 2 * classes->count; ++j)
+        class_counts[j] = 0;
+
+    for (size_t k = 0; k < rows; ++k)
     {
-        DecisionTreeData group = data_split[i];
+        int side = data[k][feature_index] < value ? 0 : 1;
+        int label = (int)data[k][cols - 1];
+        sizes[side]++;
+        for (size_t j = 0; j < classes->count; ++j)
+        {
+            if (classes->labels[j] == label)
+            {
+                counts[side][j]++;
+                break;
+            }
+        }
+    }
 
-        size_t size = group.length;
+    // The data split consists of two halves.
+    size_t n_instances = rows;
+    double gini = 0.0;
+    for (size_t i = 0; i < 2; ++i)
+    {
+        size_t size = sizes[i];
         if (size == 0)
             continue;
 
         double sum = 0.0;
-        for (size_t j = 0; j < class_labels_count; ++j)
+        for (size_t j = 0; j < classes->count; ++j)
         {
-            int class = class_labels[j];
-            int occurences = 0;
-            for (size_t k = 0; k < size; ++k)
-            {
-                int label = (int)group.data[k][cols - 1];
-                if (label == class)
-                    occurences += 1;
-            }
-            double p_class = (double)occurences / (double)size;
+            double p_class = (double)counts[i][j] / (double)size;
             sum += (p_class * p_class);
         }
         gini += (1.0 - sum) * ((double)size / (double)n_instances);
@@ -207,30 +228,50 @@ double calculate_gini_index(DecisionTreeData *data_split,
     return gini;
 }
 
-DecisionTreeDataSplit calculate_best_data_split(double **data,
-                                                size_t max_features,
-                                                size_t rows,
-                                                size_t cols,
-                                                const ModelContext *ctx)
+double draw_random_threshold(double min, double max)
 {
-    if (log_level > 1)
+    // Uniform draw in (0, 1] from the seeded generator.
+    double u = ((double)rand() + 1.0) / ((double)RAND_MAX + 1.0);
+    double threshold = min + u * (max - min);
+
+    // The sum can round down onto 'min' (or past 'max'), which would leave the left half empty.
+    if (max > min && threshold <= min)
+        threshold = nextafter(min, max);
+    if (threshold > max)
+        threshold = max;
+    return threshold;
+}
+
+/*
+Draws a random threshold for the feature at 'feature_index' from (min, max] of the values of the feature
+in 'data' with 'draw_random_threshold'. Thresholds are drawn from the half-open interval so that, as long
+as the feature is not constant, both halves of a split on the threshold are non-empty.
+*/
+double get_random_threshold(double **data, int feature_index, size_t rows)
+{
+    double min = DBL_MAX;
+    double max = -DBL_MAX;
+    for (size_t i = 0; i < rows; ++i)
     {
-        printf("calculating best split for dataset...\n");
-        printf("rows: %ld\ncols: %ld\n", rows, cols);
+        double value = data[i][feature_index];
+        if (value < min)
+            min = value;
+        if (value > max)
+            max = value;
     }
 
-    // Target classes available in this dataset.
-    DecisionTreeTargetClasses classes = get_target_class_values(data, rows, cols, ctx);
+    double threshold = draw_random_threshold(min, max);
 
-    // Keeping track of best data split available along with best parameters associated with
-    // that data split.
-    DecisionTreeData *best_data_split = NULL;
-    double best_value = DBL_MAX;
-    double best_gini = DBL_MAX;
-    int best_index = INT_MAX;
+    if (log_level > 1)
+        printf("random threshold for feature %d in [%f, %f]: %f\n", feature_index, min, max, threshold);
+
+    return threshold;
+}
 
+int *sample_features(size_t max_features, size_t cols)
+{
     // Create a features array and initialize to avoid non-set memory.
-    int *features = malloc(max_features * sizeof(int));
+    int *features = tracked_malloc(max_features * sizeof(int), MEMORY_TAG_SPLIT_SCRATCH);
     for (size_t i = 0; i < max_features; ++i)
         features[i] = -1;
 
@@ -252,55 +293,159 @@ DecisionTreeDataSplit calculate_best_data_split(double **data,
     if (log_level > 1)
         printf("-----------------------------------------\n");
 
+    return features;
+}
+
+/*
+Returns a buffer of 'n_samples' of the 'rows' rows of 'data', taking every 'rows / n_samples'-th row from a
+random offset. Such a systematic sample is spread evenly over the rows and costs a single draw of 'rand()',
+so it stays deterministic under the seed of the tree.
+*/
+double **sample_rows(double **data, size_t rows, size_t n_samples)
+{
+    double **sample = tracked_malloc(n_samples * sizeof(double *), MEMORY_TAG_SPLIT_SCRATCH);
+    double step = (double)rows / (double)n_samples;
+    double offset = step * ((double)rand() / ((double)RAND_MAX + 1.0));
+    for (size_t i = 0; i < n_samples; ++i)
+    {
+        size_t row = (size_t)(offset + i * step);
+        sample[i] = data[row < rows ? row : rows - 1];
+    }
+    return sample;
+}
+
+DecisionTreeDataSplit calculate_best_data_split(double **data,
+                                                size_t max_features,
+                                                DecisionTreeSplitMode split_mode,
+                                                size_t max_split_samples,
+                                                size_t rows,
+                                                size_t cols,
+                                                const ModelContext *ctx)
+{
+    if (log_level > 1)
+    {
+        printf("calculating best split for dataset...\n");
+        printf("rows: %ld\ncols: %ld\n", rows, cols);
+    }
+
+    if (split_mode == SPLIT_MODE_QUANTILE && ctx->split_candidates == NULL)
+    {
+        printf("Error: the quantile split mode requires split candidates in the ModelContext\n");
+        exit(1);
+    }
+
+    STATS_PHASE_BEGIN(STATS_PHASE_SPLIT_SEARCH);
+    double trace_begin = trace_span_begin();
+
+    // Target classes available in this dataset.
+    DecisionTreeTargetClasses classes = get_target_class_values(data, rows, cols, ctx);
+
+    // Keeping track of the best split along with its parameters. Candidates are only scored by counting the
+    // class targets on both sides, and only the best one is built at the end.
+    int found_split = 0;
+    double best_value = DBL_MAX;
+    double best_gini = DBL_MAX;
+    int best_index = INT_MAX;
+
+    int *features = sample_features(max_features, cols);
+    size_t *class_counts = tracked_malloc(2 * classes.count * sizeof(size_t), MEMORY_TAG_SPLIT_SCRATCH);
+
+    // Large nodes score their candidates on a sample of the rows, the target classes above are still those
+    // of all rows.
+    double **search_data = data;
+    size_t search_rows = rows;
+    if (max_split_samples > 0 && rows > max_split_samples)
+    {
+        search_data = sample_rows(data, rows, max_split_samples);
+        search_rows = max_split_samples;
+    }
+
     for (size_t i = 0; i < max_features; ++i)
     {
         int feature_index = features[i];
-        for (size_t j = 0; j < rows; ++j)
+
+        // In the randomized mode a single threshold is drawn for the feature, so only one candidate
+        // split is evaluated instead of one for every row. In the quantile mode the candidates are the
+        // fixed thresholds precomputed for the feature.
+        size_t n_candidates = search_rows;
+        double *candidate_values = NULL;
+        double random_threshold = 0;
+        if (split_mode == SPLIT_MODE_RANDOM)
+        {
+            random_threshold = get_random_threshold(search_data, feature_index, search_rows);
+            n_candidates = 1;
+            candidate_values = &random_threshold;
+        }
+        else if (split_mode == SPLIT_MODE_QUANTILE)
         {
-            DecisionTreeData *data_split = split_dataset(feature_index,
-                                                         data[j][feature_index],
-                                                         data,
-                                                         rows,
-                                                         cols);
-            double gini = calculate_gini_index(data_split, classes.labels, classes.count, cols);
+            n_candidates = ctx->split_candidates->counts[feature_index];
+            candidate_values = ctx->split_candidates->values[feature_index];
+        }
+
+        STATS_ADD(STATS_CANDIDATE_SPLITS, n_candidates);
+        for (size_t j = 0; j < n_candidates; ++j)
+        {
+            double value = candidate_values != NULL ? candidate_values[j] : search_data[j][feature_index];
+            double gini = calculate_gini_index(search_data, search_rows, cols, feature_index, value, &classes, class_counts);
 
             if (gini < best_gini)
             {
                 best_index = feature_index;
-                best_value = data[j][feature_index];
+                best_value = value;
                 best_gini = gini;
-
-                // First free the memory that was previously allocated for the 'data_split' and pointer
-                // which was assigned to 'best_data_split' since now we have found a new better split.
-                if (best_data_split)
-                    free_decision_tree_data(best_data_split);
-
-                best_data_split = data_split;
-            }
-            else
-            {
-                free_decision_tree_data(data_split);
+                found_split = 1;
             }
         }
     }
 
+    DecisionTreeData *best_data_split = found_split ? split_dataset(best_index, best_value, data, rows, cols) : NULL;
+
     // Free any other memory.
-    free(features);
-    free(classes.labels);
+    if (search_data != data)
+        tracked_free(search_data, MEMORY_TAG_SPLIT_SCRATCH);
+    tracked_free(features, MEMORY_TAG_SPLIT_SCRATCH);
+    tracked_free(class_counts, MEMORY_TAG_SPLIT_SCRATCH);
+    tracked_free(classes.labels, MEMORY_TAG_SPLIT_SCRATCH);
+
+    trace_span_end("calculate_best_data_split", "rows", rows, trace_begin);
+    STATS_PHASE_END(STATS_PHASE_SPLIT_SEARCH);
 
     return (DecisionTreeDataSplit){best_index, best_value, best_gini, best_data_split};
 }
 
+/*
+Returns whether splitting a half of 'rows' rows fits into the memory budget, which takes a row pointer per row
+for the halves of the split and a node. Counts a budget leaf if it does not.
+
+Switching to 'SPLIT_MODE_QUANTILE' instead would not help: the halves take the same row pointers in every split
+mode, the exact search only counts class targets and needs no memory per candidate, and the quantile mode
+adds its sketches and candidate thresholds on top.
+*/
+int split_fits_budget(size_t rows)
+{
+    if (memory_budget_allows(rows * sizeof(double *) + sizeof(DecisionTreeNode)))
+        return 1;
+    record_budget_leaf();
+    return 0;
+}
+
 void grow(DecisionTreeNode *decision_tree,
           size_t max_depth,
           size_t min_samples_leaf,
           size_t max_features,
+          DecisionTreeSplitMode split_mode,
+          size_t max_split_samples,
           int depth,
           size_t rows,
           size_t cols,
           long *nodeId,
           const ModelContext *ctx)
 {
+    STATS_DEPTH(depth);
+
+    // Only the growth of inner nodes is traced, leaves return early below.
+    double trace_begin = trace_span_begin();
+
     DecisionTreeData left_half = decision_tree->split_data_halves[0];
     DecisionTreeData right_half = decision_tree->split_data_halves[1];
 
@@ -319,9 +464,9 @@ void grow(DecisionTreeNode *decision_tree,
         decision_tree->left_leaf = leaf;
         decision_tree->right_leaf = leaf;
 
-        free(left);
-        free(right);
-        free(combined_data);
+        tracked_free(left, MEMORY_TAG_SPLIT_SCRATCH);
+        tracked_free(right, MEMORY_TAG_SPLIT_SCRATCH);
+        tracked_free(combined_data, MEMORY_TAG_SPLIT_SCRATCH);
 
         return;
     }
@@ -330,19 +475,22 @@ void grow(DecisionTreeNode *decision_tree,
         decision_tree->left_leaf = get_leaf_node_class_value(left, left_half.length /* rows */, cols);
         decision_tree->right_leaf = get_leaf_node_class_value(right, right_half.length /* rows */, cols);
 
-        free(left);
-        free(right);
+        tracked_free(left, MEMORY_TAG_SPLIT_SCRATCH);
+        tracked_free(right, MEMORY_TAG_SPLIT_SCRATCH);
 
         return;
     }
-    if (left_half.length <= min_samples_leaf)
-    {
-        decision_tree->left_leaf = get_leaf_node_class_value(left, left_half.length /* rows */, cols);
-    }
-    else
+    // The majority class of each side is kept even where the side is split further, predictions never read it
+    // there but it is what the tree predicts when truncated at this depth, see 'make_truncated_predictions'.
+    decision_tree->left_leaf = get_leaf_node_class_value(left, left_half.length /* rows */, cols);
+    decision_tree->right_leaf = get_leaf_node_class_value(right, right_half.length /* rows */, cols);
+
+    if (left_half.length > min_samples_leaf && split_fits_budget(left_half.length))
     {
         DecisionTreeDataSplit data_split = calculate_best_data_split(left,
                                                                      max_features,
+                                                                     split_mode,
+                                                                     max_split_samples,
                                                                      left_half.length /* rows */,
                                                                      cols,
                                                                      ctx);
@@ -355,22 +503,22 @@ void grow(DecisionTreeNode *decision_tree,
              max_depth,
              min_samples_leaf,
              max_features,
+             split_mode,
+             max_split_samples,
              depth + 1 /* since we are now at the next 'level' in the tree */,
              rows,
              cols,
              nodeId,
              ctx);
 
-        free(data_split.data);
-    }
-    if (right_half.length <= min_samples_leaf)
-    {
-        decision_tree->right_leaf = get_leaf_node_class_value(right, right_half.length, cols);
+        tracked_free(data_split.data, MEMORY_TAG_SPLIT_SCRATCH);
     }
-    else
+    if (right_half.length > min_samples_leaf && split_fits_budget(right_half.length))
     {
         DecisionTreeDataSplit data_split = calculate_best_data_split(right,
                                                                      max_features,
+                                                                     split_mode,
+                                                                     max_split_samples,
                                                                      right_half.length /* rows */,
                                                                      cols,
                                                                      ctx);
@@ -383,17 +531,21 @@ void grow(DecisionTreeNode *decision_tree,
              max_depth,
              min_samples_leaf,
              max_features,
+             split_mode,
+             max_split_samples,
              depth + 1 /* since we are now at the next 'level' in the tree */,
              rows,
              cols,
              nodeId,
              ctx);
 
-        free(data_split.data);
+        tracked_free(data_split.data, MEMORY_TAG_SPLIT_SCRATCH);
     }
 
-    free(left);
-    free(right);
+    tracked_free(left, MEMORY_TAG_SPLIT_SCRATCH);
+    tracked_free(right, MEMORY_TAG_SPLIT_SCRATCH);
+
+    trace_span_end("grow", "depth", depth, trace_begin);
 }
 
 void make_prediction(const DecisionTreeNode *decision_tree, double *row, int *prediction_val)
@@ -414,6 +566,194 @@ void make_prediction(const DecisionTreeNode *decision_tree, double *row, int *pr
     }
 }
 
+void make_truncated_predictions(const DecisionTreeNode *decision_tree, double *row, int *predictions, size_t max_depth)
+{
+    size_t depth = 0;
+    const DecisionTreeNode *node = decision_tree;
+    while (depth < max_depth)
+    {
+        int go_left = row[node->split_index] < node->split_value;
+        predictions[depth++] = go_left ? node->left_leaf : node->right_leaf;
+
+        node = go_left ? node->leftChild : node->rightChild;
+        if (node == NULL)
+            break;
+    }
+
+    // Below a leaf every cutoff predicts the leaf.
+    for (; depth < max_depth; ++depth)
+        predictions[depth] = predictions[depth - 1];
+}
+
+long count_tree_nodes(const DecisionTreeNode *decision_tree)
+{
+    long count = 1;
+    if (decision_tree->leftChild)
+        count += count_tree_nodes(decision_tree->leftChild);
+    if (decision_tree->rightChild)
+        count += count_tree_nodes(decision_tree->rightChild);
+    return count;
+}
+
+long get_max_split_index(const DecisionTreeNode *decision_tree)
+{
+    long max = decision_tree->split_index;
+    if (decision_tree->leftChild)
+    {
+        long left = get_max_split_index(decision_tree->leftChild);
+        if (left > max)
+            max = left;
+    }
+    if (decision_tree->rightChild)
+    {
+        long right = get_max_split_index(decision_tree->rightChild);
+        if (right > max)
+            max = right;
+    }
+    return max;
+}
+
+/*
+Returns whether a node has no children and predicts the same class on both sides of its split.
+*/
+int is_constant_node(const DecisionTreeNode *node)
+{
+    return node->leftChild == NULL && node->rightChild == NULL && node->left_leaf == node->right_leaf;
+}
+
+/*
+Returns whether the trees rooted at 'a' and 'b' make the same splits and have the same leaves.
+*/
+int trees_equal(const DecisionTreeNode *a, const DecisionTreeNode *b)
+{
+    if (a == NULL || b == NULL)
+        return a == b;
+    if (a->split_index != b->split_index || a->split_value != b->split_value)
+        return 0;
+    if ((a->leftChild == NULL && a->left_leaf != b->left_leaf) ||
+        (a->rightChild == NULL && a->right_leaf != b->right_leaf))
+        return 0;
+    return trees_equal(a->leftChild, b->leftChild) && trees_equal(a->rightChild, b->rightChild);
+}
+
+/*
+Frees a single node without its children.
+*/
+void free_single_node(DecisionTreeNode *node, long *removedCount)
+{
+    node->leftChild = NULL;
+    node->rightChild = NULL;
+
+    long freeCount = 0;
+    free_decision_tree_node(node, &freeCount);
+    (*removedCount)++;
+}
+
+/*
+Frees a whole subtree, counting the freed nodes in 'removedCount'.
+*/
+void free_subtree(DecisionTreeNode *node, long *removedCount)
+{
+    if (node)
+        free_decision_tree_node(node, removedCount);
+}
+
+/*
+Recursively compacts the subtree rooted at 'node' and returns the node that replaces it. Rows that reach
+'node' are known to satisfy 'lower[f] <= row[f] < upper[f]' for every feature 'f' because of the splits
+made by its ancestors.
+*/
+DecisionTreeNode *compact_subtree(DecisionTreeNode *node, double *lower, double *upper, long *removedCount)
+{
+    long feature = node->split_index;
+    double value = node->split_value;
+
+    // If the ancestors already decide which side of the split every row takes, the node can be replaced
+    // by that side. When that side is a leaf the node is kept, but turned into a constant node.
+    if (value <= lower[feature] || value >= upper[feature])
+    {
+        int go_right = value <= lower[feature];
+        DecisionTreeNode *taken = go_right ? node->rightChild : node->leftChild;
+        DecisionTreeNode *dropped = go_right ? node->leftChild : node->rightChild;
+
+        free_subtree(dropped, removedCount);
+        if (taken == NULL)
+        {
+            int leaf = go_right ? node->right_leaf : node->left_leaf;
+            node->leftChild = NULL;
+            node->rightChild = NULL;
+            node->left_leaf = leaf;
+            node->right_leaf = leaf;
+            return node;
+        }
+
+        free_single_node(node, removedCount);
+        return compact_subtree(taken, lower, upper, removedCount);
+    }
+
+    if (node->leftChild)
+    {
+        double saved = upper[feature];
+        upper[feature] = value;
+        DecisionTreeNode *left = compact_subtree(node->leftChild, lower, upper, removedCount);
+        upper[feature] = saved;
+
+        // Children that always predict the same class are folded into the leaf of this node.
+        if (is_constant_node(left))
+        {
+            node->left_leaf = left->left_leaf;
+            free_single_node(left, removedCount);
+            left = NULL;
+        }
+        node->leftChild = left;
+    }
+    if (node->rightChild)
+    {
+        double saved = lower[feature];
+        lower[feature] = value;
+        DecisionTreeNode *right = compact_subtree(node->rightChild, lower, upper, removedCount);
+        lower[feature] = saved;
+
+        if (is_constant_node(right))
+        {
+            node->right_leaf = right->left_leaf;
+            free_single_node(right, removedCount);
+            right = NULL;
+        }
+        node->rightChild = right;
+    }
+
+    // When both sides of the split lead to identical subtrees the split makes no difference.
+    if (node->leftChild && node->rightChild && trees_equal(node->leftChild, node->rightChild))
+    {
+        DecisionTreeNode *kept = node->leftChild;
+        free_subtree(node->rightChild, removedCount);
+        free_single_node(node, removedCount);
+        return kept;
+    }
+
+    return node;
+}
+
+DecisionTreeNode *compact_tree(DecisionTreeNode *decision_tree, long *removedCount)
+{
+    size_t n_features = get_max_split_index(decision_tree) + 1;
+    double *lower = tracked_malloc(n_features * sizeof(double), MEMORY_TAG_SPLIT_SCRATCH);
+    double *upper = tracked_malloc(n_features * sizeof(double), MEMORY_TAG_SPLIT_SCRATCH);
+    for (size_t i = 0; i < n_features; ++i)
+    {
+        lower[i] = -INFINITY;
+        upper[i] = INFINITY;
+    }
+
+    DecisionTreeNode *root = compact_subtree(decision_tree, lower, upper, removedCount);
+
+    tracked_free(lower, MEMORY_TAG_SPLIT_SCRATCH);
+    tracked_free(upper, MEMORY_TAG_SPLIT_SCRATCH);
+
+    return root;
+}
+
 /*
 Frees memory for a given DecisionTreeNode.
 */
@@ -430,12 +770,12 @@ void free_decision_tree_node(const DecisionTreeNode *node, long *freeCount)
 
     if (node && node->split_data_halves && node->split_data_halves->length)
     {
-        free(node->split_data_halves[0].data);
-        free(node->split_data_halves[1].data);
-        free(node->split_data_halves);
+        tracked_free(node->split_data_halves[0].data, MEMORY_TAG_SPLIT_SCRATCH);
+        tracked_free(node->split_data_halves[1].data, MEMORY_TAG_SPLIT_SCRATCH);
+        tracked_free(node->split_data_halves, MEMORY_TAG_SPLIT_SCRATCH);
     }
 
-    free((void *)node);
+    tracked_free((void *)node, MEMORY_TAG_TREE_NODES);
 }
 
 /*
@@ -443,7 +783,7 @@ Frees memory for a given DecisionTreeData.
 */
 void free_decision_tree_data(DecisionTreeData *data_split)
 {
-    free(data_split[0].data);
-    free(data_split[1].data);
-    free(data_split);
+    tracked_free(data_split[0].data, MEMORY_TAG_SPLIT_SCRATCH);
+    tracked_free(data_split[1].data, MEMORY_TAG_SPLIT_SCRATCH);
+    tracked_free(data_split, MEMORY_TAG_SPLIT_SCRATCH);
 }
@@ -8,12 +8,25 @@
 #include <float.h>
 #include <stdlib.h>
 #include "../utils/utils.h"
+#include "../utils/sketch.h"
 
 typedef struct DecisionTreeData DecisionTreeData;
 typedef struct DecisionTreeNode DecisionTreeNode;
 typedef struct DecisionTreeDataSplit DecisionTreeDataSplit;
 typedef struct DecisionTreeTargetClasses DecisionTreeTargetClasses;
 
+/*
+Strategy used by 'calculate_best_data_split' to pick candidate thresholds for each sampled feature.
+*/
+enum DecisionTreeSplitMode
+{
+    SPLIT_MODE_BEST = 0,    // Try every row value of the feature as a threshold.
+    SPLIT_MODE_RANDOM = 1,  // Extremely randomized trees: one random threshold between the node-local min and max.
+    SPLIT_MODE_QUANTILE = 2 // Only try the per-feature candidate thresholds in 'ctx->split_candidates'.
+};
+
+typedef enum DecisionTreeSplitMode DecisionTreeSplitMode;
+
 /*
 Represents a single node in a decision tree that comprise a random forest.
 */
@@ -71,24 +84,92 @@ DecisionTreeNode *empty_node(long *id);
 
 /*
 Function to recursively grow a DecisionTreeNode by splitting the dataset and creating 
-left / right children until fully splitting the rows across all nodes.
+left / right children until fully splitting the rows across all nodes. A side is made a leaf instead of
+being split if its split would go over the memory budget, see 'set_memory_budget'.
 */
 void grow(DecisionTreeNode *decision_tree,
           size_t max_depth,
           size_t min_samples_leaf,
           size_t max_features,
+          DecisionTreeSplitMode split_mode,
+          size_t max_split_samples,
           int depth,
           size_t rows,
           size_t cols,
           long *nodeId,
           const ModelContext *ctx);
 
+/*
+Given a two dimensional array of data finds and returns a DecisionTreeTargetClasses struct with unique target
+classes found in the dataset at column with index 'cols - 1', skipping rows of the testing fold of 'ctx'.
+*/
+DecisionTreeTargetClasses get_target_class_values(double **data, size_t rows, size_t cols, const ModelContext *ctx);
+
+/*
+Returns the class target value of the majority of the 'rows' rows of 'data', class 1 on ties.
+*/
+int get_leaf_node_class_value(double **data, size_t rows, size_t cols);
+
+/*
+Given a two dimensional array of data and parameters for a split, splits the data into two halves and
+returns a pointer to an array of two DecisionTreeData for the two halves of the split.
+*/
+DecisionTreeData *split_dataset(int feature_index, double value, double **data, size_t rows, size_t cols);
+
+/*
+Returns the Gini impurity of splitting 'data' on 'value' of the feature at 'feature_index', weighted by the
+sizes of the two halves. Only counts rows, the split is not built. 'class_counts' is scratch space for
+'2 * classes->count' counts.
+*/
+double calculate_gini_index(double **data,
+                            size_t rows,
+                            size_t cols,
+                            int feature_index,
+                            double value,
+                            const DecisionTreeTargetClasses *classes,
+                            size_t *class_counts);
+
+/*
+Draws a threshold uniformly from (min, max], strictly above 'min' even where the draw rounds onto it, so that
+splitting values in [min, max] on it leaves both sides non-empty if 'max > min'.
+*/
+double draw_random_threshold(double min, double max);
+
+/*
+Draws a random threshold for the feature at 'feature_index' uniformly from (min, max] of its values in 'data'.
+*/
+double get_random_threshold(double **data, int feature_index, size_t rows);
+
+/*
+Draws 'max_features' distinct feature indices (out of the 'cols - 1' features) with 'rand()' and returns them
+in a buffer of the split scratch.
+*/
+int *sample_features(size_t max_features, size_t cols);
+
+/*
+Returns a buffer of 'n_samples' of the 'rows' rows of 'data', a systematic sample spread evenly over the rows.
+*/
+double **sample_rows(double **data, size_t rows, size_t n_samples);
+
+/*
+Returns whether splitting a half of 'rows' rows fits into the memory budget. Counts a budget leaf if it does not.
+*/
+int split_fits_budget(size_t rows);
+
 /*
 Calculates the best split for the 'data' given a number of randomly selected features from the data
-(columns) up to the number of maximum number of features 'max_features'.
+(columns) up to the number of maximum number of features 'max_features'. With 'SPLIT_MODE_RANDOM' only
+a single random threshold is evaluated per feature instead of every row value, and with 'SPLIT_MODE_QUANTILE'
+only the fixed set of candidate thresholds for the feature found in 'ctx->split_candidates'.
+
+If 'max_split_samples' is non-zero and the data has more rows, candidates are drawn from and scored on a sample
+of 'max_split_samples' rows only (see 'sample_rows'), so the cost of the search does not grow with the size of
+the node, and the best candidate then splits all of the rows.
 */
 DecisionTreeDataSplit calculate_best_data_split(double **data,
                                                 size_t max_features,
+                                                DecisionTreeSplitMode split_mode,
+                                                size_t max_split_samples,
                                                 size_t rows,
                                                 size_t cols,
                                                 const ModelContext *ctx);
@@ -104,4 +185,32 @@ and writes the prediction into the variable pointed to 'prediction_val'.
 */
 void make_prediction(const DecisionTreeNode *decision_tree, double *row, int *prediction_val);
 
+/*
+Computes the predictions of the tree rooted at 'decision_tree' for 'row' as if it had been grown with every
+'max_depth' up to 'max_depth', in a single walk down the tree, and writes the prediction of the tree
+truncated at depth 'd' into 'predictions[d - 1]'. Truncating a node predicts the majority class of the
+training rows on the side taken, same as 'grow' makes leaves at the maximum depth, so this only holds for
+trees that came out of 'grow' and were not compacted.
+*/
+void make_truncated_predictions(const DecisionTreeNode *decision_tree, double *row, int *predictions, size_t max_depth);
+
+/*
+Returns the number of DecisionTreeNode's in the tree rooted at 'decision_tree'.
+*/
+long count_tree_nodes(const DecisionTreeNode *decision_tree);
+
+/*
+Returns the largest feature index that any node in the tree rooted at 'decision_tree' splits on.
+*/
+long get_max_split_index(const DecisionTreeNode *decision_tree);
+
+/*
+Compacts a trained decision tree without changing any of its predictions and returns the new root, which
+may be a different node than 'decision_tree'. Working bottom-up, nodes that predict the same class on both
+sides are merged into the leaf of their parent, splits that an ancestor split on the same feature already
+decides are replaced by the only reachable side, and nodes with two identical subtrees are replaced by one
+of them. Every node removed from the tree is freed and counted in 'removedCount'.
+*/
+DecisionTreeNode *compact_tree(DecisionTreeNode *decision_tree, long *removedCount);
+
 #endif // tree_h
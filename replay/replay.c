@@ -0,0 +1,242 @@
+/*
+@author andrii dobroshynski
+*/
+
+#include <argp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../model/hoeffding.h"
+
+/* Program documentation. */
+static char doc[] =
+    "rf-replay -- Streams a csv file through an online forest and reports prequential accuracy and throughput";
+
+/* A description of the arguments we accept. */
+static char args_doc[] = "CSV_FILE";
+
+/* The options we understand. */
+static struct argp_option options[] = {
+    {"n_trees", 'n', "number", 0, "Number of trees. Defaults to 10.", 0},
+    {"max_features", 'm', "number", 0, "Number of features sampled for every leaf. Defaults to 3.", 0},
+    {"max_depth", 'd', "number", 0, "Maximum depth of a tree. Defaults to 12.", 0},
+    {"max_nodes", 'N', "number", 0, "Maximum number of nodes of a tree. Defaults to 1024.", 0},
+    {"grace_period", 'g', "number", 0, "Rows a leaf sees between split attempts. Defaults to 200.", 0},
+    {"delta", 'D', "probability", 0, "Allowed probability of choosing the wrong split feature. Defaults to 1e-6.", 0},
+    {"tie_threshold", 't', "number", 0, "Split anyway once the Hoeffding bound drops below this. Defaults to 0.05.", 0},
+    {"seed", 's', "number", 0, "Seed of the forest. Defaults to 1.", 0},
+    {"batch", 'b', "number", 0, "Number of rows predicted before they are learned as a mini-batch. Defaults to 1.", 1},
+    {"report_every", 'r', "number", 0, "Print progress every this many rows, 0 for only the summary. Defaults to 10000.", 1},
+    {0}};
+
+/* Used by main to communicate with parse_opt. */
+struct arguments
+{
+    OnlineForestParameters params;
+    size_t batch;
+    size_t report_every;
+    char *csv_file;
+};
+
+/* Parse a single option. */
+static error_t
+parse_opt(int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+
+    switch (key)
+    {
+    case 'n':
+        arguments->params.n_trees = atol(arg);
+        break;
+    case 'm':
+        arguments->params.max_features = atol(arg);
+        break;
+    case 'd':
+        arguments->params.max_depth = atol(arg);
+        break;
+    case 'N':
+        arguments->params.max_nodes = atol(arg);
+        break;
+    case 'g':
+        arguments->params.grace_period = atof(arg);
+        break;
+    case 'D':
+        arguments->params.delta = atof(arg);
+        break;
+    case 't':
+        arguments->params.tie_threshold = atof(arg);
+        break;
+    case 's':
+        arguments->params.seed = strtoull(arg, NULL, 10);
+        break;
+    case 'b':
+        arguments->batch = atol(arg);
+        break;
+    case 'r':
+        arguments->report_every = atol(arg);
+        break;
+
+    case ARGP_KEY_ARG:
+        if (state->arg_num >= 1)
+            argp_usage(state);
+        arguments->csv_file = arg;
+        break;
+
+    case ARGP_KEY_END:
+        if (state->arg_num < 1)
+            argp_usage(state);
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Our argp parser. */
+static struct argp argp = {options, parse_opt, args_doc, doc, 0, 0, 0};
+
+/*
+Returns the number of comma separated values of 'line'.
+*/
+size_t count_csv_values(const char *line)
+{
+    size_t count = 1;
+    for (const char *c = line; *c; ++c)
+        count += *c == ',';
+    return count;
+}
+
+/*
+Parses the 'cols' comma separated values of 'line' into 'row'. Returns 0 if the line does not have 'cols'
+values.
+*/
+int parse_csv_row(char *line, double *row, size_t cols)
+{
+    size_t col = 0;
+    for (char *token = strtok(line, ",\n\r"); token; token = strtok(NULL, ",\n\r"))
+    {
+        if (col == cols)
+            return 0;
+        row[col++] = atof(token);
+    }
+    return col == cols;
+}
+
+int main(int argc, char **argv)
+{
+    struct arguments arguments;
+    arguments.params = default_online_forest_parameters();
+    arguments.batch = 1;
+    arguments.report_every = 10000;
+    arguments.csv_file = NULL;
+
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    if (arguments.params.n_trees == 0 || arguments.params.max_features == 0 || arguments.batch == 0)
+    {
+        printf("Error: --n_trees, --max_features and --batch must be > 0\n");
+        exit(1);
+    }
+
+    FILE *file = fopen(arguments.csv_file, "r");
+    if (file == NULL)
+    {
+        printf("Error: can't open file: %s\n", arguments.csv_file);
+        exit(1);
+    }
+
+    char *line = NULL;
+    size_t line_capacity = 0;
+
+    // The first line is the header, which gives the number of columns.
+    if (getline(&line, &line_capacity, file) < 0)
+    {
+        printf("Error: empty file: %s\n", arguments.csv_file);
+        exit(1);
+    }
+    size_t cols = count_csv_values(line);
+    if (cols < 2)
+    {
+        printf("Error: expected at least one feature column and the class target column in %s\n", arguments.csv_file);
+        exit(1);
+    }
+
+    OnlineForest *forest = create_online_forest(&arguments.params, cols - 1);
+
+    // Rows of the current mini-batch, every row is predicted as it arrives and learned once the batch is full,
+    // so a row is never predicted by a model that has learned it.
+    double *batch = malloc(arguments.batch * cols * sizeof(double));
+    size_t batch_rows = 0;
+
+    size_t rows = 0;
+    size_t correct = 0;
+    size_t window_rows = 0;
+    size_t window_correct = 0;
+    double learn_time = 0;
+    double predict_time = 0;
+    const double start = get_monotonic_time();
+
+    while (getline(&line, &line_capacity, file) >= 0)
+    {
+        double *row = batch + batch_rows * cols;
+        if (!parse_csv_row(line, row, cols))
+            continue;
+
+        double begin = get_monotonic_time();
+        int prediction = predict_online_forest(forest, row);
+        predict_time += get_monotonic_time() - begin;
+
+        int label = (int)row[cols - 1];
+        correct += prediction == label;
+        window_correct += prediction == label;
+        ++rows;
+        ++window_rows;
+
+        if (++batch_rows == arguments.batch)
+        {
+            begin = get_monotonic_time();
+            update_online_forest_batch(forest, batch, batch_rows);
+            learn_time += get_monotonic_time() - begin;
+            batch_rows = 0;
+        }
+
+        if (arguments.report_every > 0 && rows % arguments.report_every == 0)
+        {
+            double elapsed = get_monotonic_time() - start;
+            printf("rows %ld accuracy %.4f window_accuracy %.4f rows_per_s %.0f nodes %ld\n",
+                   rows,
+                   (double)correct / rows,
+                   (double)window_correct / window_rows,
+                   rows / elapsed,
+                   count_online_forest_nodes(forest));
+            window_rows = 0;
+            window_correct = 0;
+        }
+    }
+
+    if (batch_rows > 0)
+    {
+        double begin = get_monotonic_time();
+        update_online_forest_batch(forest, batch, batch_rows);
+        learn_time += get_monotonic_time() - begin;
+    }
+    const double elapsed = get_monotonic_time() - start;
+
+    printf("{\"rows\": %ld, \"features\": %ld, \"accuracy\": %.6f, \"wall_time_s\": %.6f, \"rows_per_s\": %.1f, "
+           "\"learn_us_per_row\": %.3f, \"predict_us_per_row\": %.3f, \"nodes\": %ld}\n",
+           rows,
+           cols - 1,
+           rows ? (double)correct / rows : 0.0,
+           elapsed,
+           elapsed > 0 ? rows / elapsed : 0.0,
+           rows ? learn_time * 1e6 / rows : 0.0,
+           rows ? predict_time * 1e6 / rows : 0.0,
+           count_online_forest_nodes(forest));
+
+    free(batch);
+    free(line);
+    fclose(file);
+    free_online_forest(forest);
+}
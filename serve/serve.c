@@ -0,0 +1,715 @@
+/*
+@author andrii dobroshynski
+*/
+
+#define _GNU_SOURCE
+
+#include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../api/random_forest.h"
+#include "../utils/data.h"
+#include "../utils/utils.h"
+
+/*
+Protocol, the same on the Unix socket and on stdin / stdout. All integers are native-endian.
+
+  request:  uint32 n_rows, uint32 n_features, n_rows * n_features float32 values (row-major)
+  response: uint32 n_rows, n_rows uint8 predicted class targets
+
+'n_features' must match the model, otherwise the connection is closed.
+*/
+
+/* Largest number of rows accepted in a single request. */
+#define MAX_REQUEST_ROWS (1 << 20)
+
+/* Number of most recent request latencies kept for the percentiles. */
+#define LATENCY_SAMPLES 65536
+
+/* Most clients (including stdin) served at once. */
+#define MAX_CLIENTS 64
+
+/* Bytes of responses queued for a client past which no more of its requests are read until it catches up. */
+#define MAX_QUEUED_OUTPUT (16 << 20)
+
+/* Program documentation. */
+static char doc[] =
+    "rf-serve -- Answers prediction requests of a random forest model over a Unix socket and stdin";
+
+/* A description of the arguments we accept. */
+static char args_doc[] = "[CSV_FILE]";
+
+/* The options we understand. */
+static struct argp_option options[] = {
+    {"model", 'M', "file", 0, "Model saved with 'rf_save' (or 'random-forest --save_model') to serve. Without it a model is trained on CSV_FILE.", 0},
+    {"seed", 's', "number", 0, "Random seed when training on CSV_FILE.", 0},
+    {"socket", 'u', "path", 0, "Path of the Unix domain socket to listen on.", 1},
+    {"stdin", 'i', 0, 0, "Also answer requests read from stdin, with responses written to stdout.", 1},
+    {"batch_window", 'w', "microseconds", 0, "How long to wait for more requests to batch with the first pending one. Defaults to 200.", 2},
+    {"max_batch", 'b', "rows", 0, "Predict as soon as this many rows are pending. Defaults to 256.", 2},
+    {0}};
+
+/* Used by main to communicate with parse_opt. */
+struct arguments
+{
+    char *csv_file;
+    char *model_file;
+    unsigned int seed;
+    char *socket_path;
+    int use_stdin;
+    long batch_window_us;
+    size_t max_batch;
+};
+
+/* Parse a single option. */
+static error_t
+parse_opt(int key, char *arg, struct argp_state *state)
+{
+    struct arguments *arguments = state->input;
+
+    switch (key)
+    {
+    case 'M':
+        arguments->model_file = arg;
+        break;
+    case 's':
+        arguments->seed = (unsigned int)atol(arg);
+        break;
+    case 'u':
+        arguments->socket_path = arg;
+        break;
+    case 'i':
+        arguments->use_stdin = 1;
+        break;
+    case 'w':
+        arguments->batch_window_us = atol(arg);
+        break;
+    case 'b':
+        arguments->max_batch = atol(arg);
+        break;
+
+    case ARGP_KEY_ARG:
+        if (state->arg_num >= 1)
+            argp_usage(state);
+        arguments->csv_file = arg;
+        break;
+
+    case ARGP_KEY_END:
+        if ((arguments->csv_file == NULL) == (arguments->model_file == NULL))
+            argp_error(state, "either CSV_FILE or --model must be given");
+        if (arguments->socket_path == NULL && !arguments->use_stdin)
+            argp_error(state, "at least one of --socket or --stdin must be given");
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+/* Our argp parser. */
+static struct argp argp = {options, parse_opt, args_doc, doc};
+
+/*
+A connected client along with the bytes received from it that do not form a complete request yet, and the
+bytes of responses its socket did not take yet. A slot is free while 'in_fd' is -1, and 'generation' changes
+every time the slot is reused so that responses for a client that went away are dropped. A 'closing' client
+is not read from anymore and is closed once its queued responses are written.
+*/
+struct Client
+{
+    int in_fd;
+    int out_fd;
+    unsigned long generation;
+    int closing;
+
+    unsigned char *buffer;
+    size_t length;
+    size_t capacity;
+
+    unsigned char *output;
+    size_t output_length;
+    size_t output_capacity;
+};
+
+/*
+A complete request waiting for the next batch, its rows are stored at 'offset' of the batch.
+*/
+struct PendingRequest
+{
+    int client;
+    unsigned long generation;
+    size_t offset;
+    size_t n_rows;
+    double arrival_time;
+};
+
+/*
+Rows of every pending request, predicted together in a single batch traversal.
+*/
+struct Batch
+{
+    size_t n_features;
+    double *rows;
+    size_t n_rows;
+    size_t capacity;
+    int *predictions;
+
+    struct PendingRequest *requests;
+    size_t n_requests;
+    size_t requests_capacity;
+    double window_end; // Time at which the batch is predicted even if it is not full.
+};
+
+/*
+Latencies from a complete request being received until its response is written, or queued for a client that
+is not reading fast enough, along with counters.
+*/
+struct LatencyStats
+{
+    double samples[LATENCY_SAMPLES];
+    size_t n_samples; // Total samples recorded, only the last LATENCY_SAMPLES are kept.
+    unsigned long batches;
+    unsigned long rows;
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+static volatile sig_atomic_t report_requested = 0;
+
+void handle_stop_signal(int signal)
+{
+    stop_requested = 1;
+}
+
+void handle_report_signal(int signal)
+{
+    report_requested = 1;
+}
+
+int compare_latencies(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+Writes the latency percentiles and counters as JSON to stderr.
+*/
+void report_latency(const struct LatencyStats *stats)
+{
+    size_t n = stats->n_samples < LATENCY_SAMPLES ? stats->n_samples : LATENCY_SAMPLES;
+    double p50 = 0, p99 = 0, max = 0;
+    if (n > 0)
+    {
+        double *sorted = malloc(n * sizeof(double));
+        memcpy(sorted, stats->samples, n * sizeof(double));
+        qsort(sorted, n, sizeof(double), compare_latencies);
+        p50 = sorted[(n - 1) / 2];
+        p99 = sorted[(size_t)((n - 1) * 0.99)];
+        max = sorted[n - 1];
+        free(sorted);
+    }
+    fprintf(stderr,
+            "{\"requests\": %zu, \"rows\": %lu, \"batches\": %lu, \"p50_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f}\n",
+            stats->n_samples, stats->rows, stats->batches, p50 * 1e6, p99 * 1e6, max * 1e6);
+}
+
+/*
+Appends 'size' bytes to the responses queued for 'client'.
+*/
+void queue_output(struct Client *client, const void *data, size_t size)
+{
+    if (client->output_capacity - client->output_length < size)
+    {
+        if (client->output_capacity == 0)
+            client->output_capacity = 4096;
+        while (client->output_capacity - client->output_length < size)
+            client->output_capacity *= 2;
+        client->output = realloc(client->output, client->output_capacity);
+    }
+    memcpy(client->output + client->output_length, data, size);
+    client->output_length += size;
+}
+
+/*
+Writes as much of the queued responses of 'client' as it takes without blocking, returns -1 if the client
+went away.
+*/
+int write_output(struct Client *client)
+{
+    size_t written = 0;
+    while (written < client->output_length)
+    {
+        ssize_t n = write(client->out_fd, client->output + written, client->output_length - written);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return -1;
+        }
+        written += n;
+    }
+    memmove(client->output, client->output + written, client->output_length - written);
+    client->output_length -= written;
+    return 0;
+}
+
+void close_client(struct Client *client)
+{
+    if (client->in_fd > STDIN_FILENO)
+        close(client->in_fd);
+    client->in_fd = -1;
+    client->out_fd = -1;
+    client->closing = 0;
+    client->length = 0;
+    client->output_length = 0;
+    client->generation++;
+}
+
+/*
+Stops reading from 'client', which is closed as soon as the responses queued for it are written.
+*/
+void finish_client(struct Client *client)
+{
+    client->closing = 1;
+    if (client->output_length == 0)
+        close_client(client);
+}
+
+/*
+Predicts every pending request in one batch and queues the responses, writing what the clients take right
+away.
+*/
+void flush_batch(const RandomForest *forest, struct Batch *batch, struct Client *clients, struct LatencyStats *stats)
+{
+    if (batch->n_requests == 0)
+        return;
+
+    if (rf_predict_batch(forest, batch->rows, batch->n_rows, batch->predictions) != 0)
+    {
+        fprintf(stderr, "Error: %s\n", rf_last_error());
+
+        // Requests that can't be answered leave their clients waiting forever, so they are disconnected.
+        for (size_t r = 0; r < batch->n_requests; ++r)
+        {
+            struct Client *client = &clients[batch->requests[r].client];
+            if (client->in_fd >= 0 && client->generation == batch->requests[r].generation)
+                close_client(client);
+        }
+        batch->n_rows = 0;
+        batch->n_requests = 0;
+        return;
+    }
+
+    unsigned char *response = malloc(sizeof(uint32_t) + batch->n_rows);
+    for (size_t r = 0; r < batch->n_requests; ++r)
+    {
+        const struct PendingRequest *request = &batch->requests[r];
+        struct Client *client = &clients[request->client];
+        if (client->in_fd < 0 || client->generation != request->generation)
+            continue;
+
+        uint32_t n_rows = (uint32_t)request->n_rows;
+        memcpy(response, &n_rows, sizeof(n_rows));
+        for (size_t i = 0; i < request->n_rows; ++i)
+            response[sizeof(n_rows) + i] = (unsigned char)batch->predictions[request->offset + i];
+
+        queue_output(client, response, sizeof(n_rows) + request->n_rows);
+        if (write_output(client) != 0)
+        {
+            close_client(client);
+            continue;
+        }
+
+        stats->samples[stats->n_samples++ % LATENCY_SAMPLES] = get_monotonic_time() - request->arrival_time;
+    }
+    free(response);
+
+    stats->batches++;
+    stats->rows += batch->n_rows;
+    batch->n_rows = 0;
+    batch->n_requests = 0;
+}
+
+/*
+Moves every complete request in the buffer of 'client' into the batch. Returns -1 if the client sent a
+malformed request.
+*/
+int take_requests(struct Client *client, int client_idx, struct Batch *batch, double batch_window)
+{
+    size_t consumed = 0;
+    while (client->length - consumed >= 2 * sizeof(uint32_t))
+    {
+        uint32_t header[2];
+        memcpy(header, client->buffer + consumed, sizeof(header));
+        if (header[1] != batch->n_features || header[0] > MAX_REQUEST_ROWS)
+        {
+            fprintf(stderr, "Error: expected requests of at most %d rows of %zu features, got %u rows of %u features\n",
+                    MAX_REQUEST_ROWS, batch->n_features, header[0], header[1]);
+            return -1;
+        }
+
+        size_t n_values = (size_t)header[0] * header[1];
+        size_t size = sizeof(header) + n_values * sizeof(float);
+        if (client->length - consumed < size)
+            break;
+
+        double now = get_monotonic_time();
+        if (batch->n_requests == 0)
+            batch->window_end = now + batch_window;
+
+        if (batch->n_rows + header[0] > batch->capacity)
+        {
+            while (batch->n_rows + header[0] > batch->capacity)
+                batch->capacity *= 2;
+            batch->rows = realloc(batch->rows, batch->capacity * batch->n_features * sizeof(double));
+            batch->predictions = realloc(batch->predictions, batch->capacity * sizeof(int));
+        }
+        if (batch->n_requests == batch->requests_capacity)
+        {
+            batch->requests_capacity *= 2;
+            batch->requests = realloc(batch->requests, batch->requests_capacity * sizeof(struct PendingRequest));
+        }
+
+        // Widen the float rows into the batch.
+        const unsigned char *values = client->buffer + consumed + sizeof(header);
+        double *rows = batch->rows + batch->n_rows * batch->n_features;
+        for (size_t i = 0; i < n_values; ++i)
+        {
+            float value;
+            memcpy(&value, values + i * sizeof(float), sizeof(float));
+            rows[i] = value;
+        }
+
+        batch->requests[batch->n_requests++] = (struct PendingRequest){
+            client : client_idx,
+            generation : client->generation,
+            offset : batch->n_rows,
+            n_rows : header[0],
+            arrival_time : now
+        };
+        batch->n_rows += header[0];
+        consumed += size;
+    }
+
+    memmove(client->buffer, client->buffer + consumed, client->length - consumed);
+    client->length -= consumed;
+    return 0;
+}
+
+/*
+Reads what is available from 'client'. Returns -1 once the client closed the connection or misbehaved.
+*/
+int read_client(struct Client *client, int client_idx, struct Batch *batch, double batch_window)
+{
+    if (client->capacity - client->length < 4096)
+    {
+        client->capacity = client->capacity ? 2 * client->capacity : 65536;
+        client->buffer = realloc(client->buffer, client->capacity);
+    }
+
+    ssize_t n = read(client->in_fd, client->buffer + client->length, client->capacity - client->length);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    if (n <= 0)
+        return -1;
+
+    client->length += n;
+    return take_requests(client, client_idx, batch, batch_window);
+}
+
+/*
+Gives the clients that still have responses queued up to 'timeout_ms' at a time to take them, a client that
+takes nothing for that long is given up on.
+*/
+void drain_clients(struct Client *clients, int timeout_ms)
+{
+    struct pollfd fds[MAX_CLIENTS];
+    int fd_clients[MAX_CLIENTS];
+    for (;;)
+    {
+        nfds_t nfds = 0;
+        for (int i = 0; i < MAX_CLIENTS; ++i)
+        {
+            if (clients[i].in_fd < 0 || clients[i].output_length == 0)
+                continue;
+            fds[nfds] = (struct pollfd){fd : clients[i].out_fd, events : POLLOUT};
+            fd_clients[nfds++] = i;
+        }
+        if (nfds == 0 || poll(fds, nfds, timeout_ms) <= 0)
+            return;
+
+        for (nfds_t k = 0; k < nfds; ++k)
+            if (fds[k].revents && write_output(&clients[fd_clients[k]]) != 0)
+                close_client(&clients[fd_clients[k]]);
+    }
+}
+
+/*
+Creates the listening Unix domain socket at 'path', replacing any stale socket file.
+*/
+int listen_unix_socket(const char *path)
+{
+    struct sockaddr_un address = {sun_family : AF_UNIX};
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "Error: socket path is too long: %s\n", path);
+        exit(1);
+    }
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, 64) != 0)
+    {
+        fprintf(stderr, "Error: can't listen on %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    return fd;
+}
+
+/*
+Loads the model to serve, or trains one on the csv file.
+*/
+RandomForest *load_or_train(const struct arguments *arguments)
+{
+    if (arguments->model_file)
+    {
+        RandomForest *forest = rf_load(arguments->model_file);
+        if (forest == NULL)
+        {
+            fprintf(stderr, "Error: %s\n", rf_last_error());
+            exit(1);
+        }
+        return forest;
+    }
+
+    struct dim csv_dim = parse_csv_dims(arguments->csv_file);
+    double *data = malloc(sizeof(double) * csv_dim.rows * csv_dim.cols);
+    parse_csv(arguments->csv_file, &data, csv_dim, NULL /* sketches */, 0);
+
+    RandomForestConfig config = rf_default_config();
+    config.seed = arguments->seed;
+    RandomForest *forest = rf_create(&config);
+    if (forest == NULL || rf_train(forest, data, csv_dim.rows, csv_dim.cols) != 0)
+    {
+        fprintf(stderr, "Error: %s\n", rf_last_error());
+        exit(1);
+    }
+    free(data);
+    return forest;
+}
+
+int main(int argc, char **argv)
+{
+    struct arguments arguments = {
+        csv_file : NULL,
+        model_file : NULL,
+        seed : 0,
+        socket_path : NULL,
+        use_stdin : 0,
+        batch_window_us : 200,
+        max_batch : 256
+    };
+    argp_parse(&argp, argc, argv, 0, 0, &arguments);
+
+    // Responses may go to stdout, so nothing else is printed there.
+    set_log_level(0);
+
+    RandomForest *forest = load_or_train(&arguments);
+    const double batch_window = arguments.batch_window_us / 1e6;
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, handle_stop_signal);
+    signal(SIGTERM, handle_stop_signal);
+    signal(SIGUSR1, handle_report_signal);
+
+    int listen_fd = arguments.socket_path ? listen_unix_socket(arguments.socket_path) : -1;
+
+    struct Client clients[MAX_CLIENTS];
+    for (int i = 0; i < MAX_CLIENTS; ++i)
+        clients[i] = (struct Client){in_fd : -1, out_fd : -1, generation : 0, closing : 0, buffer : NULL, length : 0, capacity : 0,
+                                     output : NULL, output_length : 0, output_capacity : 0};
+
+    // Responses are never written with blocking writes, so a client that does not read them stalls nobody else.
+    int stdout_flags = -1;
+    if (arguments.use_stdin)
+    {
+        clients[0].in_fd = STDIN_FILENO;
+        clients[0].out_fd = STDOUT_FILENO;
+        stdout_flags = fcntl(STDOUT_FILENO, F_GETFL);
+        if (stdout_flags >= 0)
+            fcntl(STDOUT_FILENO, F_SETFL, stdout_flags | O_NONBLOCK);
+    }
+
+    struct Batch batch = {
+        n_features : rf_n_features(forest),
+        n_rows : 0,
+        capacity : arguments.max_batch ? arguments.max_batch : 1,
+        n_requests : 0,
+        requests_capacity : 64
+    };
+    batch.rows = malloc(batch.capacity * batch.n_features * sizeof(double) + 1);
+    batch.predictions = malloc(batch.capacity * sizeof(int));
+    batch.requests = malloc(batch.requests_capacity * sizeof(struct PendingRequest));
+
+    struct LatencyStats *stats = calloc(1, sizeof(struct LatencyStats));
+
+    fprintf(stderr, "serving a model of %zu features%s%s%s\n",
+            batch.n_features,
+            arguments.socket_path ? " on " : "",
+            arguments.socket_path ? arguments.socket_path : "",
+            arguments.use_stdin ? " and stdin" : "");
+
+    struct pollfd fds[2 * MAX_CLIENTS + 1];
+    int fd_clients[2 * MAX_CLIENTS + 1];
+    while (!stop_requested)
+    {
+        if (report_requested)
+        {
+            report_requested = 0;
+            report_latency(stats);
+        }
+
+        // Without any input left there is nothing more to serve.
+        int n_clients = 0;
+        for (int i = 0; i < MAX_CLIENTS; ++i)
+            n_clients += clients[i].in_fd >= 0;
+        if (n_clients == 0 && listen_fd < 0)
+            break;
+
+        nfds_t nfds = 0;
+        if (listen_fd >= 0)
+        {
+            fds[nfds] = (struct pollfd){fd : listen_fd, events : POLLIN};
+            fd_clients[nfds++] = -1;
+        }
+        for (int i = 0; i < MAX_CLIENTS; ++i)
+        {
+            if (clients[i].in_fd < 0)
+                continue;
+            // A client that does not take its responses is not read from until it catches up.
+            if (!clients[i].closing && clients[i].output_length < MAX_QUEUED_OUTPUT)
+            {
+                fds[nfds] = (struct pollfd){fd : clients[i].in_fd, events : POLLIN};
+                fd_clients[nfds++] = i;
+            }
+            if (clients[i].output_length > 0)
+            {
+                fds[nfds] = (struct pollfd){fd : clients[i].out_fd, events : POLLOUT};
+                fd_clients[nfds++] = i;
+            }
+        }
+
+        // Block until input arrives, or only until the batch window closes while requests are pending.
+        struct timespec timeout;
+        struct timespec *timeout_p = NULL;
+        if (batch.n_requests > 0)
+        {
+            double remaining = batch.window_end - get_monotonic_time();
+            if (remaining < 0)
+                remaining = 0;
+            timeout.tv_sec = (time_t)remaining;
+            timeout.tv_nsec = (long)((remaining - (double)timeout.tv_sec) * 1e9);
+            timeout_p = &timeout;
+        }
+
+        int ready = ppoll(fds, nfds, timeout_p, NULL);
+        if (ready < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "Error: poll failed: %s\n", strerror(errno));
+            break;
+        }
+
+        for (nfds_t k = 0; ready > 0 && k < nfds; ++k)
+        {
+            if (!(fds[k].revents & (POLLIN | POLLOUT | POLLHUP | POLLERR)))
+                continue;
+
+            if (fd_clients[k] < 0)
+            {
+                int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+                if (fd < 0)
+                    continue;
+
+                int slot = -1;
+                for (int i = arguments.use_stdin ? 1 : 0; i < MAX_CLIENTS && slot < 0; ++i)
+                    if (clients[i].in_fd < 0)
+                        slot = i;
+                if (slot < 0)
+                {
+                    close(fd);
+                    continue;
+                }
+                clients[slot].in_fd = fd;
+                clients[slot].out_fd = fd;
+                continue;
+            }
+
+            // The client may have been closed by an earlier entry of the same poll.
+            int i = fd_clients[k];
+            if (clients[i].in_fd < 0)
+                continue;
+
+            if (fds[k].events & POLLOUT)
+            {
+                if (write_output(&clients[i]) != 0)
+                    close_client(&clients[i]);
+                else if (clients[i].closing && clients[i].output_length == 0)
+                    close_client(&clients[i]);
+                continue;
+            }
+
+            // Answer the requests a client already sent before it goes away.
+            if (read_client(&clients[i], i, &batch, batch_window) != 0)
+            {
+                flush_batch(forest, &batch, clients, stats);
+                finish_client(&clients[i]);
+            }
+        }
+
+        if (batch.n_requests > 0 &&
+            (batch.n_rows >= arguments.max_batch || get_monotonic_time() >= batch.window_end))
+            flush_batch(forest, &batch, clients, stats);
+    }
+
+    // Answer whatever is still pending before shutting down.
+    flush_batch(forest, &batch, clients, stats);
+    drain_clients(clients, 1000);
+    report_latency(stats);
+
+    for (int i = 0; i < MAX_CLIENTS; ++i)
+    {
+        if (clients[i].in_fd >= 0)
+            close_client(&clients[i]);
+        free(clients[i].buffer);
+        free(clients[i].output);
+    }
+    if (stdout_flags >= 0)
+        fcntl(STDOUT_FILENO, F_SETFL, stdout_flags);
+    if (listen_fd >= 0)
+    {
+        close(listen_fd);
+        unlink(arguments.socket_path);
+    }
+
+    free(batch.rows);
+    free(batch.predictions);
+    free(batch.requests);
+    free(stats);
+    rf_free(forest);
+    return 0;
+}
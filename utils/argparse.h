@@ -3,15 +3,21 @@
 
 #include <stdlib.h>
 #include <argp.h>
+#include <string.h>
+
+/* Formats of the input file we accept. */
+#define INPUT_FORMAT_CSV 0
+#define INPUT_FORMAT_LIBSVM 1
+#define INPUT_FORMAT_CSR 2
+
+/* Hyperparameter search modes we accept, 'SEARCH_NONE' for a single cross validation. */
+#define SEARCH_NONE 0
+#define SEARCH_GRID 1
+#define SEARCH_HALVING 2
 
 /* How many arguments we accept. */
 #define COUNT_ARGS 1
 
-const char *argp_program_version =
-    "random-forests-c 1.0";
-const char *argp_program_bug_address =
-    "https://github.com/dobroshynski/random-forests-c";
-
 /* Program documentation. */
 static char doc[] =
     "random-forests-c -- Basic implementation of random forests and accompanying decision trees in C";
@@ -25,6 +31,32 @@ static struct argp_option options[] = {
     {"num_cols", 'c', "number", 0, "Optional number of cols in the input CSV_FILE, if known", 0},
     {"log_level", 'l', "number", 0, "Optional debug logging level [0-3]. Level 0 is no output, 3 is most verbose. Defaults to 1.", 1},
     {"seed", 's', "number", 0, "Optional random number seed.", 2},
+    {"extra_trees", 'x', 0, 0, "Optionally grow extremely randomized trees, drawing one random split threshold per sampled feature.", 3},
+    {"max_split_samples", 'N', "number", 0, "Optionally search the split of every node with more rows on a sample of this many of its rows, which bounds the cost of the split search of the top of the trees. The split found still partitions all rows. Not supported for sparse input.", 3},
+    {"quantile_bins", 'q', "number", 0, "Optional number of quantile bins per feature. If set, splits are only searched over the bin edges computed while reading CSV_FILE, without the rows a fold is evaluated on. Can't be combined with --extra_trees.", 3},
+    {"oblivious", 'O', 0, 0, "Optionally grow oblivious trees, which split every node of a level on the same feature and value, and evaluate them from branch-free lookup tables. Not supported for sparse input.", 3},
+    {"auto", 'A', 0, 0, "Optionally pick the split search (exact, sampled or quantile bins) and the evaluation format (trees or --quantize) that are fastest for CSV_FILE on this machine, by calibrating a cost model on a sample of its rows. Prints what it measured. Not supported for sparse input and --search, only changes a split search that was not picked with --extra_trees, --quantile_bins or --max_split_samples.", 3},
+    {"compact", 'C', 0, 0, "Optionally compact every tree after training by merging redundant splits, which never changes predictions.", 3},
+    {"quantize", 'Q', 0, 0, "Optionally evaluate the model in the compact 8-byte-per-node inference format.", 3},
+    {"search", 'H', "mode", 0, "Optionally search hyperparameters instead of a single cross validation: 'grid' cross validates every configuration of --grid, 'halving' uses successive halving to drop the worst ones early on a fraction of the trees and folds.", 3},
+    {"grid", 'G', "spec", 0, "Optional grid for --search, e.g. 'n_estimators=10,50,100;max_depth=3,7,11'. Hyperparameters are n_estimators, max_depth, min_samples_leaf and max_features, the ones left out keep their defaults.", 3},
+    {"eta", 'E', "number", 0, "Optional factor by which --search=halving cuts the configurations and grows their budget every round. Defaults to 3.", 3},
+    {"cache", 'K', "dir", 0, "Optionally cache the results of every cross validation fold in the existing directory 'dir', so that runs with the same data, parameters and --seed read them back instead of training. Requires --seed.", 4},
+    {"cache_size", 'Z', "MB", 0, "Optional size limit of the --cache directory, the least recently used entries are removed beyond it. Defaults to 1024.", 4},
+    {"checkpoint", 'k', "dir", 0, "Optionally checkpoint the trees of every model being trained, every cross validation fold done and the seed of the run into the existing directory 'dir', for --resume after the run was killed. Only supported for csv input and not together with --cache.", 4},
+    {"checkpoint_interval", 'I', "seconds", 0, "Optional time between two checkpoints of the trees of a model being trained. Defaults to 60.", 4},
+    {"resume", 'R', 0, 0, "Optionally continue the run that checkpointed into the --checkpoint directory, with the same results as if it had never been killed.", 4},
+    {"cache_models", 'F', 0, 0, "Optionally also save the model of every fold into the --cache directory, as '<key>.model' for 'rf_load'.", 4},
+    {"format", 'f', "format", 0, "Optional format of the input CSV_FILE: 'csv' (default), 'libsvm' for sparse text input or 'csr' for the binary sparse form.", 4},
+    {"write_csr", 'o', "file", 0, "Optionally write the loaded data in the binary sparse (CSR) form to 'file'.", 4},
+    {"save_model", 'm', "file", 0, "Optionally train a model on all rows of CSV_FILE after cross validation and save it to 'file', for loading with 'rf_load'.", 4},
+    {"prune", 'p', "epsilon", 0, "Optionally have --save_model hold out the last fifth of the rows of CSV_FILE, train on the others and keep the fewest trees, picked greedily, whose accuracy on the held out rows is at most 'epsilon' below that of all trees. Prints the accuracy and latency of every smaller model that is more accurate than the ones before it.", 4},
+    {"profile_layout", 'P', 0, 0, "Optionally have --save_model count the branches the rows of CSV_FILE take through the model and save the counts with it, so that 'rf_load' lays out its nodes with the likely paths in consecutive memory for faster single-row predictions.", 4},
+    {"warm_start", 'w', "file", 0, "Optionally have --save_model add its trees to the model saved in 'file' instead of training a new model.", 4},
+    {"trace", 'T', "file", 0, "Optionally record a timeline of training and evaluation and write it as Chrome trace-event JSON (for chrome://tracing or Perfetto) to 'file' at exit.", 5},
+    {"time_budget", 'B', "seconds", 0, "Optionally stop starting trees once the next one is not expected to finish within this many seconds. The cross validation shares the budget evenly between its folds and --save_model gets a budget of its own. Models keep the trees that finished, at least one. Not supported for sparse input, --search or --warm_start.", 3},
+    {"memory_budget", 'M', "MB", 0, "Optionally cap the memory of training at this many megabytes. Trees stop growing deeper instead of going over the budget, and data that can't fit is rejected before it is loaded.", 3},
+    {"stats", 'S', "file", OPTION_ARG_OPTIONAL, "Optionally write per-phase timings and hot-path counters as JSON to 'file', or to stdout if no file is given. Counters require a build with the RANDOM_FOREST_STATS CMake option.", 5},
     {0}};
 
 /* Used by main to communicate with parse_opt. */
@@ -35,6 +67,34 @@ struct arguments
     long rows, cols;
     int log_level;
     int random_seed;
+    int extra_trees;
+    long quantile_bins;
+    long max_split_samples;
+    int oblivious;
+    int auto_tune;
+    int compact;
+    int quantize;
+    long memory_budget_mb;
+    double time_budget;
+    int search;
+    char *grid;
+    double eta;
+    char *cache_dir;
+    long cache_size_mb;
+    int cache_models;
+    char *checkpoint_dir;
+    double checkpoint_interval;
+    int resume;
+    int format;
+    char *csr_output;
+    char *model_output;
+    char *warm_start;
+    int prune;
+    double prune_epsilon;
+    int profile_layout;
+    int stats;
+    char *stats_output;
+    char *trace_output;
 };
 
 /* Parse a single option. */
@@ -59,6 +119,98 @@ parse_opt(int key, char *arg, struct argp_state *state)
     case 's':
         arguments->random_seed = atoi(arg);
         break;
+    case 'x':
+        arguments->extra_trees = 1;
+        break;
+    case 'q':
+        arguments->quantile_bins = atol(arg);
+        break;
+    case 'N':
+        arguments->max_split_samples = atol(arg);
+        break;
+    case 'O':
+        arguments->oblivious = 1;
+        break;
+    case 'A':
+        arguments->auto_tune = 1;
+        break;
+    case 'C':
+        arguments->compact = 1;
+        break;
+    case 'Q':
+        arguments->quantize = 1;
+        break;
+    case 'M':
+        arguments->memory_budget_mb = atol(arg);
+        break;
+    case 'B':
+        arguments->time_budget = atof(arg);
+        break;
+    case 'H':
+        if (strcmp(arg, "grid") == 0)
+            arguments->search = SEARCH_GRID;
+        else if (strcmp(arg, "halving") == 0)
+            arguments->search = SEARCH_HALVING;
+        else
+            argp_error(state, "unknown search mode: %s", arg);
+        break;
+    case 'G':
+        arguments->grid = arg;
+        break;
+    case 'E':
+        arguments->eta = atof(arg);
+        break;
+    case 'K':
+        arguments->cache_dir = arg;
+        break;
+    case 'Z':
+        arguments->cache_size_mb = atol(arg);
+        break;
+    case 'F':
+        arguments->cache_models = 1;
+        break;
+    case 'k':
+        arguments->checkpoint_dir = arg;
+        break;
+    case 'I':
+        arguments->checkpoint_interval = atof(arg);
+        break;
+    case 'R':
+        arguments->resume = 1;
+        break;
+    case 'f':
+        if (strcmp(arg, "csv") == 0)
+            arguments->format = INPUT_FORMAT_CSV;
+        else if (strcmp(arg, "libsvm") == 0)
+            arguments->format = INPUT_FORMAT_LIBSVM;
+        else if (strcmp(arg, "csr") == 0)
+            arguments->format = INPUT_FORMAT_CSR;
+        else
+            argp_error(state, "unknown input format: %s", arg);
+        break;
+    case 'o':
+        arguments->csr_output = arg;
+        break;
+    case 'm':
+        arguments->model_output = arg;
+        break;
+    case 'p':
+        arguments->prune = 1;
+        arguments->prune_epsilon = atof(arg);
+        break;
+    case 'P':
+        arguments->profile_layout = 1;
+        break;
+    case 'w':
+        arguments->warm_start = arg;
+        break;
+    case 'T':
+        arguments->trace_output = arg;
+        break;
+    case 'S':
+        arguments->stats = 1;
+        arguments->stats_output = arg;
+        break;
 
     case ARGP_KEY_ARG:
         if (state->arg_num >= COUNT_ARGS)
@@ -3,6 +3,9 @@
 */
 
 #include "data.h"
+#include "sketch.h"
+#include "stats.h"
+#include "memory.h"
 
 struct dim parse_csv_dims(const char *file_name)
 {
@@ -17,7 +20,7 @@ struct dim parse_csv_dims(const char *file_name)
 
     const char *delimiter = ",";
 
-    char *buffer = malloc(BUFSIZ);
+    char *buffer = tracked_malloc(BUFSIZ, MEMORY_TAG_DATA);
     char *token;
 
     // Keeping track of how many rows and columns there are.
@@ -58,7 +61,7 @@ struct dim parse_csv_dims(const char *file_name)
     --rows;
 
     fclose(csv_file);
-    free(buffer);
+    tracked_free(buffer, MEMORY_TAG_DATA);
 
     // Make sure that the dimensions are valid.
     assert(rows > 0 && "# of rows in csv must be > 0");
@@ -67,7 +70,11 @@ struct dim parse_csv_dims(const char *file_name)
     return (struct dim){rows : rows, cols : cols};
 }
 
-void parse_csv(const char *file_name, double **data_p, const struct dim csv_dim)
+void parse_csv(const char *file_name,
+               double **data_p,
+               const struct dim csv_dim,
+               QuantileSketch **sketches,
+               size_t rows_per_chunk)
 {
     FILE *csv_file;
     csv_file = fopen(file_name, "r");
@@ -78,9 +85,11 @@ void parse_csv(const char *file_name, double **data_p, const struct dim csv_dim)
         exit(-1);
     }
 
+    STATS_PHASE_BEGIN(STATS_PHASE_LOAD);
+
     const char *delimiter = ",";
 
-    char *buffer = malloc(BUFSIZ);
+    char *buffer = tracked_malloc(BUFSIZ, MEMORY_TAG_DATA);
     char *token;
 
     // Keeping track which row we are on.
@@ -103,6 +112,15 @@ void parse_csv(const char *file_name, double **data_p, const struct dim csv_dim)
 
             (*data_p)[idx] = atof(token);
             // printf("%f\n", (*data)[idx]);
+
+            // Stream feature values (but not the class target) into the per-column sketches of the chunk.
+            size_t col = idx % csv_dim.cols;
+            if (sketches != NULL && col < csv_dim.cols - 1)
+            {
+                size_t chunk = (idx / csv_dim.cols) / rows_per_chunk;
+                quantile_sketch_update(sketches[chunk * (csv_dim.cols - 1) + col], (*data_p)[idx]);
+            }
+
             ++idx;
 
             // Get the next token.
@@ -114,14 +132,40 @@ void parse_csv(const char *file_name, double **data_p, const struct dim csv_dim)
         printf("read %d rows from file %s\n", row - 1, file_name);
 
     fclose(csv_file);
-    free(buffer);
+    tracked_free(buffer, MEMORY_TAG_DATA);
+
+    STATS_PHASE_END(STATS_PHASE_LOAD);
 }
 
 void pivot_data(double *data, const struct dim csv_dim, double ***pivoted_data_p)
 {
+    STATS_PHASE_BEGIN(STATS_PHASE_PIVOT);
+
     (*pivoted_data_p) = _2d_calloc(csv_dim.rows, csv_dim.cols);
 
     for (size_t i = 0; i < csv_dim.rows; ++i)
         for (size_t j = 0; j < csv_dim.cols; ++j)
             (*pivoted_data_p)[i][j] = data[(i * csv_dim.cols) + j];
+
+    STATS_PHASE_END(STATS_PHASE_PIVOT);
+}
+
+uint64_t hash_data(double **data, const struct dim *csv_dim)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < csv_dim->rows; ++i)
+    {
+        const unsigned char *bytes = (const unsigned char *)data[i];
+        for (size_t b = 0; b < csv_dim->cols * sizeof(double); ++b)
+            hash = (hash ^ bytes[b]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+uint64_t hash_words(uint64_t hash, const uint64_t *values, size_t n)
+{
+    const unsigned char *bytes = (const unsigned char *)values;
+    for (size_t b = 0; b < n * sizeof(uint64_t); ++b)
+        hash = (hash ^ bytes[b]) * 0x100000001B3ULL;
+    return hash;
 }
@@ -11,8 +11,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
 #include "utils.h"
 
+struct QuantileSketch;
+
 /*
 Struct for parsed data dimensions.
 */
@@ -38,8 +41,18 @@ Attempts to read a csv file at path given by 'file_name' and write the values on
 If an argument for '--num_rows' was provided to the program and is less than the actual number of 
 rows in the csv file, the function will stop reading at that row. This allows to read only the top
 'num_rows' in the input data file if needed.
+
+If 'sketches' is not NULL every value read for a feature is also added to a sketch, so that quantiles of the
+columns are available after a single pass over the file without sorting them. The rows are sketched in
+chunks of 'rows_per_chunk' consecutive rows (the last chunk may be shorter), with one QuantileSketch per
+feature column ('csv_dim.cols - 1' of them) for every chunk: column 'j' of chunk 'c' goes to
+'sketches[c * (csv_dim.cols - 1) + j]'. Sketches of chunks can be merged with 'quantile_sketch_merge'.
 */
-void parse_csv(const char *file_name, double **data_p, const struct dim csv_dim);
+void parse_csv(const char *file_name,
+               double **data_p,
+               const struct dim csv_dim,
+               struct QuantileSketch **sketches,
+               size_t rows_per_chunk);
 
 /*
 Pivots and transforms the data in 'data' array into a two-dimensional array of size 
@@ -47,4 +60,15 @@ Pivots and transforms the data in 'data' array into a two-dimensional array of s
 */
 void pivot_data(double *data, const struct dim csv_dim, double ***pivoted_data_p);
 
+/*
+Returns the FNV-1a hash of the values of the 'csv_dim.rows' rows of 'data', for telling whether two copies of
+a dataset are the same.
+*/
+uint64_t hash_data(double **data, const struct dim *csv_dim);
+
+/*
+Adds the 'n' values of 'values' to the FNV-1a 'hash'.
+*/
+uint64_t hash_words(uint64_t hash, const uint64_t *values, size_t n);
+
 #endif // data_h
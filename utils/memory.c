@@ -0,0 +1,138 @@
+/*
+@author andrii dobroshynski
+*/
+
+#include <malloc.h>
+#include "memory.h"
+
+static size_t memory_usage[MEMORY_TAG_COUNT + 1]; // Last entry is the total of all tags.
+static size_t memory_peak[MEMORY_TAG_COUNT + 1];
+static size_t memory_budget = 0;
+static size_t budget_leaves = 0;
+
+/*
+Raises the peak at 'index' to 'usage' if it is higher.
+*/
+void update_memory_peak(int index, size_t usage)
+{
+    size_t peak = __atomic_load_n(&memory_peak[index], __ATOMIC_RELAXED);
+    while (usage > peak &&
+           !__atomic_compare_exchange_n(&memory_peak[index], &peak, usage, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void account_allocation(void *ptr, MemoryTag tag)
+{
+    size_t size = malloc_usable_size(ptr);
+    update_memory_peak(tag, __atomic_add_fetch(&memory_usage[tag], size, __ATOMIC_RELAXED));
+    update_memory_peak(MEMORY_TAG_COUNT, __atomic_add_fetch(&memory_usage[MEMORY_TAG_COUNT], size, __ATOMIC_RELAXED));
+}
+
+void account_release(void *ptr, MemoryTag tag)
+{
+    size_t size = malloc_usable_size(ptr);
+    __atomic_sub_fetch(&memory_usage[tag], size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&memory_usage[MEMORY_TAG_COUNT], size, __ATOMIC_RELAXED);
+}
+
+void exit_out_of_memory(size_t size)
+{
+    printf("Error: out of memory allocating %ld bytes (%ld bytes in use)\n", size, get_memory_usage(MEMORY_TAG_COUNT));
+    exit(1);
+}
+
+void *tracked_malloc(size_t size, MemoryTag tag)
+{
+    // Zero sized allocations are bumped to a byte so that they are never NULL.
+    void *ptr = malloc(size ? size : 1);
+    if (ptr == NULL)
+        exit_out_of_memory(size);
+    account_allocation(ptr, tag);
+    return ptr;
+}
+
+void *tracked_calloc(size_t count, size_t size, MemoryTag tag)
+{
+    void *ptr = calloc(count ? count : 1, size ? size : 1);
+    if (ptr == NULL)
+        exit_out_of_memory(count * size);
+    account_allocation(ptr, tag);
+    return ptr;
+}
+
+void *tracked_realloc(void *ptr, size_t size, MemoryTag tag)
+{
+    if (ptr)
+        account_release(ptr, tag);
+    void *resized = realloc(ptr, size ? size : 1);
+    if (resized == NULL)
+        exit_out_of_memory(size);
+    account_allocation(resized, tag);
+    return resized;
+}
+
+void tracked_free(void *ptr, MemoryTag tag)
+{
+    if (ptr == NULL)
+        return;
+    account_release(ptr, tag);
+    free(ptr);
+}
+
+size_t get_memory_usage(MemoryTag tag)
+{
+    return __atomic_load_n(&memory_usage[tag], __ATOMIC_RELAXED);
+}
+
+size_t get_memory_peak(MemoryTag tag)
+{
+    return __atomic_load_n(&memory_peak[tag], __ATOMIC_RELAXED);
+}
+
+void reset_memory_peaks()
+{
+    for (int i = 0; i <= MEMORY_TAG_COUNT; ++i)
+        __atomic_store_n(&memory_peak[i], __atomic_load_n(&memory_usage[i], __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+void set_memory_budget(size_t bytes)
+{
+    memory_budget = bytes;
+}
+
+size_t get_memory_budget()
+{
+    return memory_budget;
+}
+
+int memory_budget_allows(size_t bytes)
+{
+    return memory_budget == 0 || get_memory_usage(MEMORY_TAG_COUNT) + bytes <= memory_budget;
+}
+
+void record_budget_leaf()
+{
+    __atomic_add_fetch(&budget_leaves, 1, __ATOMIC_RELAXED);
+}
+
+size_t get_budget_leaves()
+{
+    return __atomic_load_n(&budget_leaves, __ATOMIC_RELAXED);
+}
+
+void write_memory_json(FILE *out, int indent)
+{
+    const char *tag_names[MEMORY_TAG_COUNT + 1] = {"data", "tree_nodes", "split_scratch", "eval", "total"};
+
+    fprintf(out, "{\n");
+    for (int i = 0; i <= MEMORY_TAG_COUNT; ++i)
+        fprintf(out, "%*s  \"%s\": {\"current_bytes\": %ld, \"peak_bytes\": %ld},\n",
+                indent, "",
+                tag_names[i],
+                get_memory_usage((MemoryTag)i),
+                get_memory_peak((MemoryTag)i));
+    fprintf(out, "%*s  \"budget_bytes\": %ld,\n%*s  \"budget_leaves\": %ld\n%*s}",
+            indent, "", memory_budget,
+            indent, "", get_budget_leaves(),
+            indent, "");
+}
@@ -0,0 +1,84 @@
+/*
+@author andrii dobroshynski
+*/
+
+#ifndef memory_h
+#define memory_h
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+Accounting allocator used by the library. Every allocation is tagged with the subsystem it belongs to, and
+the current and peak number of bytes of every tag (counted as the usable size of the allocation, so
+allocator rounding is included) are tracked with atomics, so that any thread can allocate.
+
+Memory allocated with 'tracked_malloc', 'tracked_calloc' or 'tracked_realloc' is plain heap memory and must
+be released with 'tracked_free' under the same tag to keep the accounting right. Allocations that fail print
+an error and exit, same as the rest of the library does on fatal errors.
+
+An optional budget caps the memory of training. It never makes an allocation fail; instead the places that
+would grow memory without bound ask 'memory_budget_allows' first and degrade when it says no (trees stop
+growing and make a leaf, see 'grow'), and loading refuses data that can't fit at all before reading it.
+*/
+
+enum MemoryTag
+{
+    MEMORY_TAG_DATA,          // Loaded datasets and their sparse and sketched forms.
+    MEMORY_TAG_TREE_NODES,    // Trees and compiled models.
+    MEMORY_TAG_SPLIT_SCRATCH, // Row partitions and temporary buffers of the split search.
+    MEMORY_TAG_EVAL,          // Cross validation and hyperparameter search.
+    MEMORY_TAG_COUNT
+};
+
+typedef enum MemoryTag MemoryTag;
+
+void *tracked_malloc(size_t size, MemoryTag tag);
+void *tracked_calloc(size_t count, size_t size, MemoryTag tag);
+void *tracked_realloc(void *ptr, size_t size, MemoryTag tag);
+void tracked_free(void *ptr, MemoryTag tag);
+
+/*
+Returns the number of bytes currently allocated under 'tag', or under all tags for 'MEMORY_TAG_COUNT'.
+*/
+size_t get_memory_usage(MemoryTag tag);
+
+/*
+Returns the highest number of bytes allocated at once under 'tag', or under all tags for 'MEMORY_TAG_COUNT'.
+*/
+size_t get_memory_peak(MemoryTag tag);
+
+/*
+Lowers the peak of every tag to its current usage, so that the peaks of a single phase can be measured.
+*/
+void reset_memory_peaks();
+
+/*
+Sets the memory budget of the process in bytes, 0 for no budget (the default).
+*/
+void set_memory_budget(size_t bytes);
+
+size_t get_memory_budget();
+
+/*
+Returns 1 if 'bytes' more can be allocated without going over the budget, or if there is no budget.
+*/
+int memory_budget_allows(size_t bytes);
+
+/*
+Counts a tree node that was made a leaf because its split would have gone over the budget.
+*/
+void record_budget_leaf();
+
+/*
+Returns the number of tree nodes made leaves because of the budget.
+*/
+size_t get_budget_leaves();
+
+/*
+Writes the current and peak usage of every tag, the budget and the number of budget leaves as a JSON object
+into 'out', indented by 'indent' spaces.
+*/
+void write_memory_json(FILE *out, int indent);
+
+#endif // memory_h
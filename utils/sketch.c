@@ -0,0 +1,297 @@
+/*
+@author andrii dobroshynski
+*/
+
+#include "sketch.h"
+#include "memory.h"
+
+/*
+A value held by the sketch along with how many input values it stands for.
+*/
+struct WeightedValue
+{
+    double value;
+    double weight;
+};
+
+int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int compare_weighted_values(const void *a, const void *b)
+{
+    return compare_doubles(&((const struct WeightedValue *)a)->value, &((const struct WeightedValue *)b)->value);
+}
+
+QuantileSketch *empty_quantile_sketch(size_t k)
+{
+    // Levels are compacted by keeping every other value, so keep the capacity even such that the total
+    // weight of the sketch is preserved exactly.
+    if (k < 2)
+        k = 2;
+    if (k % 2)
+        ++k;
+
+    QuantileSketch *sketch = tracked_malloc(sizeof(QuantileSketch), MEMORY_TAG_DATA);
+    sketch->k = k;
+    sketch->n = 0;
+    sketch->n_levels = 0;
+    sketch->levels = NULL;
+    sketch->sizes = NULL;
+    sketch->offset = 0;
+    sketch->min = DBL_MAX;
+    sketch->max = -DBL_MAX;
+    return sketch;
+}
+
+/*
+Appends a new empty level to the top of the sketch.
+*/
+void add_sketch_level(QuantileSketch *sketch)
+{
+    size_t n_levels = sketch->n_levels + 1;
+
+    double **levels = tracked_realloc(sketch->levels, n_levels * sizeof(double *), MEMORY_TAG_DATA);
+    size_t *sizes = tracked_realloc(sketch->sizes, n_levels * sizeof(size_t), MEMORY_TAG_DATA);
+    if (levels == NULL || sizes == NULL)
+    {
+        printf("Error: failed to allocate memory for a quantile sketch level\n");
+        exit(1);
+    }
+
+    levels[n_levels - 1] = tracked_malloc(sketch->k * sizeof(double), MEMORY_TAG_DATA);
+    sizes[n_levels - 1] = 0;
+
+    sketch->levels = levels;
+    sketch->sizes = sizes;
+    sketch->n_levels = n_levels;
+}
+
+void insert_at_level(QuantileSketch *sketch, size_t level, double value);
+
+/*
+Sorts the values at 'level' and promotes every other one of them to the level above, emptying 'level'.
+*/
+void compact_level(QuantileSketch *sketch, size_t level)
+{
+    size_t size = sketch->sizes[level];
+    double *values = sketch->levels[level];
+    qsort(values, size, sizeof(double), compare_doubles);
+
+    // Copy out the promoted values first since inserting them may trigger further compactions.
+    size_t n_promoted = 0;
+    double *promoted = tracked_malloc((size / 2 + 1) * sizeof(double), MEMORY_TAG_DATA);
+    for (size_t i = sketch->offset; i < size; i += 2)
+        promoted[n_promoted++] = values[i];
+
+    sketch->offset ^= 1;
+    sketch->sizes[level] = 0;
+
+    if (level + 1 == sketch->n_levels)
+        add_sketch_level(sketch);
+
+    for (size_t i = 0; i < n_promoted; ++i)
+        insert_at_level(sketch, level + 1, promoted[i]);
+
+    tracked_free(promoted, MEMORY_TAG_DATA);
+}
+
+/*
+Inserts a 'value' carrying a weight of 2^'level' into the sketch.
+*/
+void insert_at_level(QuantileSketch *sketch, size_t level, double value)
+{
+    while (level >= sketch->n_levels)
+        add_sketch_level(sketch);
+
+    sketch->levels[level][sketch->sizes[level]++] = value;
+    if (sketch->sizes[level] == sketch->k)
+        compact_level(sketch, level);
+}
+
+void quantile_sketch_update(QuantileSketch *sketch, double value)
+{
+    ++sketch->n;
+    if (value < sketch->min)
+        sketch->min = value;
+    if (value > sketch->max)
+        sketch->max = value;
+
+    insert_at_level(sketch, 0, value);
+}
+
+void quantile_sketch_merge(QuantileSketch *sketch, const QuantileSketch *other)
+{
+    for (size_t level = 0; level < other->n_levels; ++level)
+        for (size_t i = 0; i < other->sizes[level]; ++i)
+            insert_at_level(sketch, level, other->levels[level][i]);
+
+    sketch->n += other->n;
+    if (other->min < sketch->min)
+        sketch->min = other->min;
+    if (other->max > sketch->max)
+        sketch->max = other->max;
+}
+
+double quantile_sketch_query(const QuantileSketch *sketch, double q)
+{
+    double quantile;
+    quantile_sketch_query_many(sketch, &q, 1, &quantile);
+    return quantile;
+}
+
+void quantile_sketch_query_many(const QuantileSketch *sketch, const double *qs, size_t n_queries, double *quantiles)
+{
+    if (sketch->n == 0)
+    {
+        for (size_t r = 0; r < n_queries; ++r)
+            quantiles[r] = 0;
+        return;
+    }
+
+    size_t count = 0;
+    for (size_t level = 0; level < sketch->n_levels; ++level)
+        count += sketch->sizes[level];
+
+    struct WeightedValue *values = tracked_malloc(count * sizeof(struct WeightedValue), MEMORY_TAG_DATA);
+    size_t idx = 0;
+    double total_weight = 0;
+    for (size_t level = 0; level < sketch->n_levels; ++level)
+    {
+        double weight = (double)((size_t)1 << level);
+        for (size_t i = 0; i < sketch->sizes[level]; ++i)
+        {
+            values[idx++] = (struct WeightedValue){value : sketch->levels[level][i], weight : weight};
+            total_weight += weight;
+        }
+    }
+    qsort(values, count, sizeof(struct WeightedValue), compare_weighted_values);
+
+    // Walk the values in sorted order once, every query is answered by the first value whose cumulative weight
+    // reaches its rank. The ranks ascend, so the walk picks up where the previous query stopped.
+    double cumulative = 0;
+    size_t i = 0;
+    for (size_t r = 0; r < n_queries; ++r)
+    {
+        if (qs[r] <= 0)
+        {
+            quantiles[r] = sketch->min;
+            continue;
+        }
+        if (qs[r] >= 1)
+        {
+            quantiles[r] = sketch->max;
+            continue;
+        }
+
+        double target = qs[r] * total_weight;
+        while (i < count && cumulative + values[i].weight < target)
+            cumulative += values[i++].weight;
+        quantiles[r] = i < count ? values[i].value : sketch->max;
+    }
+
+    tracked_free(values, MEMORY_TAG_DATA);
+}
+
+void sketch_data_columns(double **data,
+                         size_t row_begin,
+                         size_t row_end,
+                         size_t cols,
+                         QuantileSketch **sketches,
+                         const ModelContext *ctx)
+{
+    for (size_t i = row_begin; i < row_end; ++i)
+    {
+        if (ctx != NULL && is_row_part_of_testing_fold(i, ctx))
+            continue;
+
+        for (size_t j = 0; j < cols - 1; ++j)
+            quantile_sketch_update(sketches[j], data[i][j]);
+    }
+}
+
+SplitCandidates *split_candidates_from_sketches(QuantileSketch **sketches, size_t n_features, size_t max_bins)
+{
+    if (max_bins < 2)
+        max_bins = 2;
+
+    SplitCandidates *candidates = tracked_malloc(sizeof(SplitCandidates), MEMORY_TAG_DATA);
+    candidates->n_features = n_features;
+    candidates->counts = tracked_malloc(n_features * sizeof(size_t), MEMORY_TAG_DATA);
+    candidates->values = tracked_malloc(n_features * sizeof(double *), MEMORY_TAG_DATA);
+
+    // Ranks of the bin edges, the same for every feature.
+    double *ranks = tracked_malloc((max_bins - 1) * sizeof(double), MEMORY_TAG_DATA);
+    for (size_t b = 1; b < max_bins; ++b)
+        ranks[b - 1] = (double)b / (double)max_bins;
+
+    for (size_t j = 0; j < n_features; ++j)
+    {
+        double *values = tracked_malloc((max_bins - 1) * sizeof(double), MEMORY_TAG_DATA);
+        quantile_sketch_query_many(sketches[j], ranks, max_bins - 1, values);
+
+        // Quantiles come out of the sketch in ascending order, so duplicates are always adjacent.
+        size_t count = 0;
+        for (size_t b = 0; b < max_bins - 1; ++b)
+            if (count == 0 || values[b] != values[count - 1])
+                values[count++] = values[b];
+
+        candidates->counts[j] = count;
+        candidates->values[j] = values;
+
+        if (log_level > 2)
+            printf("feature %ld: %ld candidate thresholds from sketch of %ld values\n", j, count, sketches[j]->n);
+    }
+    tracked_free(ranks, MEMORY_TAG_DATA);
+    return candidates;
+}
+
+SplitCandidates **split_candidates_for_folds(QuantileSketch **sketches,
+                                             size_t n_chunks,
+                                             size_t n_features,
+                                             int k_folds,
+                                             size_t max_bins)
+{
+    SplitCandidates **candidates = tracked_malloc(k_folds * sizeof(SplitCandidates *), MEMORY_TAG_DATA);
+    QuantileSketch **merged = tracked_malloc(n_features * sizeof(QuantileSketch *), MEMORY_TAG_DATA);
+
+    for (int fold = 0; fold < k_folds; ++fold)
+    {
+        for (size_t j = 0; j < n_features; ++j)
+        {
+            merged[j] = empty_quantile_sketch(sketches[j]->k);
+            for (size_t c = 0; c < n_chunks; ++c)
+                if (k_folds == 1 || c != (size_t)fold)
+                    quantile_sketch_merge(merged[j], sketches[c * n_features + j]);
+        }
+
+        candidates[fold] = split_candidates_from_sketches(merged, n_features, max_bins);
+
+        for (size_t j = 0; j < n_features; ++j)
+            free_quantile_sketch(merged[j]);
+    }
+
+    tracked_free(merged, MEMORY_TAG_DATA);
+    return candidates;
+}
+
+void free_quantile_sketch(QuantileSketch *sketch)
+{
+    for (size_t level = 0; level < sketch->n_levels; ++level)
+        tracked_free(sketch->levels[level], MEMORY_TAG_DATA);
+    tracked_free(sketch->levels, MEMORY_TAG_DATA);
+    tracked_free(sketch->sizes, MEMORY_TAG_DATA);
+    tracked_free(sketch, MEMORY_TAG_DATA);
+}
+
+void free_split_candidates(SplitCandidates *candidates)
+{
+    for (size_t j = 0; j < candidates->n_features; ++j)
+        tracked_free(candidates->values[j], MEMORY_TAG_DATA);
+    tracked_free(candidates->values, MEMORY_TAG_DATA);
+    tracked_free(candidates->counts, MEMORY_TAG_DATA);
+    tracked_free(candidates, MEMORY_TAG_DATA);
+}
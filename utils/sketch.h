@@ -0,0 +1,117 @@
+/*
+@author andrii dobroshynski
+*/
+
+#ifndef sketch_h
+#define sketch_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "data.h"
+#include "utils.h"
+
+typedef struct QuantileSketch QuantileSketch;
+typedef struct SplitCandidates SplitCandidates;
+
+/*
+Mergeable streaming quantile sketch in the style of KLL. Values are kept in a stack of compactors where
+every value at level 'h' stands for 2^h values of the input. When a level fills up to 'k' values it is
+sorted and every other value is promoted to the next level, so memory stays O(k * log(n / k)) no matter
+how many values are streamed through. Compaction alternates which half is kept rather than flipping a
+random coin so that the sketch (and everything derived from it) is deterministic.
+*/
+struct QuantileSketch
+{
+    size_t k;        // Capacity of every compactor level, controls the accuracy of the sketch.
+    size_t n;        // Total number of values added to the sketch.
+    size_t n_levels; // Number of compactor levels currently allocated.
+    double **levels; // Values at 'levels[h]' each carry a weight of 2^h.
+    size_t *sizes;   // Number of values currently held at each level.
+    int offset;      // Alternating offset used when compacting a level.
+    double min;
+    double max;
+};
+
+/*
+Per-feature candidate thresholds for the split search, sorted ascending with duplicates removed.
+*/
+struct SplitCandidates
+{
+    size_t n_features;
+    size_t *counts;
+    double **values;
+};
+
+/*
+Allocates an empty QuantileSketch where every level holds up to 'k' values. Larger values of 'k' give
+more accurate quantiles at the cost of memory.
+*/
+QuantileSketch *empty_quantile_sketch(size_t k);
+
+/*
+Adds a single 'value' to the sketch.
+*/
+void quantile_sketch_update(QuantileSketch *sketch, double value);
+
+/*
+Merges the values summarized by 'other' into 'sketch'. Sketches built independently over chunks of a
+column can be merged into a single sketch of those chunks, see 'split_candidates_for_folds'.
+*/
+void quantile_sketch_merge(QuantileSketch *sketch, const QuantileSketch *other);
+
+/*
+Returns an approximation of the 'q'-th quantile (for 'q' in [0, 1]) of the values added to the sketch.
+*/
+double quantile_sketch_query(const QuantileSketch *sketch, double q);
+
+/*
+Same as 'quantile_sketch_query' for each of the 'n_queries' ascending 'qs', writing the quantiles into
+'quantiles'. The sketch is sorted once for all of them rather than once per query.
+*/
+void quantile_sketch_query_many(const QuantileSketch *sketch, const double *qs, size_t n_queries, double *quantiles);
+
+/*
+Adds the values of rows in the range ['row_begin', 'row_end') of 'data' to 'sketches', one sketch per
+feature column (the class target column 'cols - 1' is not sketched). Rows that are part of the testing
+fold in 'ctx' are skipped if 'ctx' is not NULL.
+*/
+void sketch_data_columns(double **data,
+                         size_t row_begin,
+                         size_t row_end,
+                         size_t cols,
+                         QuantileSketch **sketches,
+                         const ModelContext *ctx);
+
+/*
+Builds up to 'max_bins - 1' candidate thresholds per feature from the quantiles of the per-feature
+'sketches'. The thresholds are the bin edges for 'max_bins' equal-frequency bins.
+*/
+SplitCandidates *split_candidates_from_sketches(QuantileSketch **sketches, size_t n_features, size_t max_bins);
+
+/*
+Builds the candidate thresholds of each of 'k_folds' folds from the per-feature 'sketches' of 'n_chunks'
+consecutive chunks of rows, as 'parse_csv' fills them with chunks of one fold each (a last, shorter chunk
+holds the rows past the last fold). The sketches of every chunk but the testing fold of a fold are merged,
+so rows a fold is evaluated on never place its bin edges. A single fold trains on every row and so merges
+every chunk. Returns an array of 'k_folds' candidates.
+*/
+SplitCandidates **split_candidates_for_folds(QuantileSketch **sketches,
+                                             size_t n_chunks,
+                                             size_t n_features,
+                                             int k_folds,
+                                             size_t max_bins);
+
+/*
+Functions to free memory allocated for the structs.
+*/
+void free_quantile_sketch(QuantileSketch *sketch);
+void free_split_candidates(SplitCandidates *candidates);
+
+/*
+'qsort' comparator of doubles in ascending order.
+*/
+int compare_doubles(const void *a, const void *b);
+
+#endif // sketch_h
@@ -0,0 +1,336 @@
+/*
+@author andrii dobroshynski
+*/
+
+#include "sparse.h"
+#include "stats.h"
+#include "memory.h"
+
+/*
+Magic bytes at the start of a binary SparseMatrix file.
+*/
+static const char SPARSE_BINARY_MAGIC[8] = {'R', 'F', 'C', 'S', 'R', '0', '0', '1'};
+
+/*
+Allocates a SparseMatrix with room for 'rows' rows and 'nnz' stored values.
+*/
+SparseMatrix *empty_sparse_matrix(size_t rows, size_t cols, size_t nnz)
+{
+    SparseMatrix *data = tracked_malloc(sizeof(SparseMatrix), MEMORY_TAG_DATA);
+    data->rows = rows;
+    data->cols = cols;
+    data->nnz = nnz;
+    data->row_ptr = tracked_calloc(rows + 1, sizeof(size_t), MEMORY_TAG_DATA);
+    data->col_idx = tracked_malloc(nnz * sizeof(uint32_t), MEMORY_TAG_DATA);
+    data->values = tracked_malloc(nnz * sizeof(double), MEMORY_TAG_DATA);
+    data->labels = tracked_malloc(rows * sizeof(double), MEMORY_TAG_DATA);
+    return data;
+}
+
+SparseMatrix *parse_libsvm(const char *file_name)
+{
+    FILE *libsvm_file;
+    libsvm_file = fopen(file_name, "r");
+
+    if (libsvm_file == NULL)
+    {
+        printf("Error: can't open file: %s\n", file_name);
+        exit(-1);
+    }
+
+    STATS_PHASE_BEGIN(STATS_PHASE_LOAD);
+
+    const char *delimiter = " \t\r\n";
+
+    char *buffer = NULL;
+    size_t buffer_size = 0;
+    char *token;
+
+    // First pass to count rows, stored values and the number of features so that every array can be
+    // allocated up front.
+    size_t rows = 0;
+    size_t nnz = 0;
+    size_t cols = 0;
+    while (getline(&buffer, &buffer_size, libsvm_file) != -1)
+    {
+        token = strtok(buffer, delimiter);
+        if (token == NULL)
+            continue;
+        ++rows;
+
+        while ((token = strtok(NULL, delimiter)) != NULL)
+        {
+            char *separator = strchr(token, ':');
+            if (separator == NULL)
+            {
+                printf("Error: expected <index>:<value> on line %ld of %s, got: %s\n", rows, file_name, token);
+                exit(1);
+            }
+            size_t index = strtoul(token, NULL, 10);
+            if (index > cols)
+                cols = index;
+            if (atof(separator + 1) != 0)
+                ++nnz;
+        }
+    }
+
+    // Make sure that the dimensions are valid.
+    assert(rows > 0 && "# of rows in libsvm file must be > 0");
+    assert(cols > 0 && "# of features in libsvm file must be > 0");
+
+    SparseMatrix *data = empty_sparse_matrix(rows, cols, nnz);
+
+    rewind(libsvm_file);
+    size_t row = 0;
+    size_t idx = 0;
+    while (getline(&buffer, &buffer_size, libsvm_file) != -1)
+    {
+        token = strtok(buffer, delimiter);
+        if (token == NULL)
+            continue;
+
+        data->labels[row] = atof(token);
+        long previous_index = 0;
+        while ((token = strtok(NULL, delimiter)) != NULL)
+        {
+            char *separator = strchr(token, ':');
+            long index = strtol(token, NULL, 10);
+            double value = atof(separator + 1);
+
+            if (index <= previous_index)
+            {
+                printf("Error: feature indices must be 1-based and ascending on line %ld of %s\n", row + 1, file_name);
+                exit(1);
+            }
+            previous_index = index;
+
+            if (value == 0)
+                continue;
+
+            data->col_idx[idx] = (uint32_t)(index - 1);
+            data->values[idx] = value;
+            ++idx;
+        }
+        data->row_ptr[++row] = idx;
+    }
+
+    if (log_level > 1)
+        printf("read %ld rows (%ld features, %ld non-zero values) from file %s\n", rows, cols, nnz, file_name);
+
+    fclose(libsvm_file);
+    // Allocated by 'getline', so it was never accounted.
+    free(buffer);
+
+    STATS_PHASE_END(STATS_PHASE_LOAD);
+
+    return data;
+}
+
+/*
+Row offsets are stored as 'uint64_t', same as the header, so that the file does not depend on the width of
+'size_t'. Returns -1 if the file ends early.
+*/
+int read_row_offsets(FILE *file, size_t *row_ptr, size_t count)
+{
+    uint64_t *offsets = tracked_malloc(count * sizeof(uint64_t), MEMORY_TAG_DATA);
+    int complete = fread(offsets, sizeof(uint64_t), count, file) == count;
+    for (size_t i = 0; complete && i < count; ++i)
+        row_ptr[i] = (size_t)offsets[i];
+    tracked_free(offsets, MEMORY_TAG_DATA);
+    return complete ? 0 : -1;
+}
+
+int write_row_offsets(FILE *file, const size_t *row_ptr, size_t count)
+{
+    uint64_t *offsets = tracked_malloc(count * sizeof(uint64_t), MEMORY_TAG_DATA);
+    for (size_t i = 0; i < count; ++i)
+        offsets[i] = row_ptr[i];
+    int complete = fwrite(offsets, sizeof(uint64_t), count, file) == count;
+    tracked_free(offsets, MEMORY_TAG_DATA);
+    return complete ? 0 : -1;
+}
+
+/*
+Returns 1 if every value of 'data' can be visited through its CSR arrays without going out of bounds: the
+row offsets start at 0, never decrease and end at 'nnz', and every feature index is below 'cols'.
+*/
+int is_valid_sparse_matrix(const SparseMatrix *data)
+{
+    if (data->row_ptr[0] != 0 || data->row_ptr[data->rows] != data->nnz)
+        return 0;
+    for (size_t i = 0; i < data->rows; ++i)
+        if (data->row_ptr[i + 1] < data->row_ptr[i])
+            return 0;
+    for (size_t k = 0; k < data->nnz; ++k)
+        if (data->col_idx[k] >= data->cols)
+            return 0;
+    return 1;
+}
+
+SparseMatrix *load_sparse_binary(const char *file_name)
+{
+    FILE *file = fopen(file_name, "rb");
+    if (file == NULL)
+    {
+        printf("Error: can't open file: %s\n", file_name);
+        exit(-1);
+    }
+
+    STATS_PHASE_BEGIN(STATS_PHASE_LOAD);
+
+    char magic[8];
+    uint64_t header[3];
+    if (fread(magic, sizeof(magic), 1, file) != 1 ||
+        memcmp(magic, SPARSE_BINARY_MAGIC, sizeof(magic)) != 0 ||
+        fread(header, sizeof(header), 1, file) != 1 ||
+        header[0] >= SIZE_MAX / sizeof(double) || header[2] >= SIZE_MAX / sizeof(double))
+    {
+        printf("Error: %s is not a binary sparse matrix file\n", file_name);
+        exit(1);
+    }
+
+    SparseMatrix *data = empty_sparse_matrix(header[0], header[1], header[2]);
+    if (read_row_offsets(file, data->row_ptr, data->rows + 1) != 0 ||
+        fread(data->col_idx, sizeof(uint32_t), data->nnz, file) != data->nnz ||
+        fread(data->values, sizeof(double), data->nnz, file) != data->nnz ||
+        fread(data->labels, sizeof(double), data->rows, file) != data->rows)
+    {
+        printf("Error: binary sparse matrix file %s is truncated\n", file_name);
+        exit(1);
+    }
+
+    // A corrupt file would send the row and column walks out of bounds, so it is rejected here.
+    if (!is_valid_sparse_matrix(data))
+    {
+        printf("Error: %s is not a binary sparse matrix file\n", file_name);
+        exit(1);
+    }
+
+    if (log_level > 1)
+        printf("read %ld rows (%ld features, %ld non-zero values) from file %s\n",
+               data->rows, data->cols, data->nnz, file_name);
+
+    fclose(file);
+
+    STATS_PHASE_END(STATS_PHASE_LOAD);
+
+    return data;
+}
+
+void save_sparse_binary(const SparseMatrix *data, const char *file_name)
+{
+    FILE *file = fopen(file_name, "wb");
+    if (file == NULL)
+    {
+        printf("Error: can't open file for writing: %s\n", file_name);
+        exit(-1);
+    }
+
+    uint64_t header[3] = {data->rows, data->cols, data->nnz};
+    if (fwrite(SPARSE_BINARY_MAGIC, sizeof(SPARSE_BINARY_MAGIC), 1, file) != 1 ||
+        fwrite(header, sizeof(header), 1, file) != 1 ||
+        write_row_offsets(file, data->row_ptr, data->rows + 1) != 0 ||
+        fwrite(data->col_idx, sizeof(uint32_t), data->nnz, file) != data->nnz ||
+        fwrite(data->values, sizeof(double), data->nnz, file) != data->nnz ||
+        fwrite(data->labels, sizeof(double), data->rows, file) != data->rows)
+    {
+        printf("Error: failed to write binary sparse matrix file %s\n", file_name);
+        exit(1);
+    }
+
+    fclose(file);
+}
+
+SparseMatrix *dense_to_sparse(double **data, const struct dim *csv_dim)
+{
+    size_t cols = csv_dim->cols - 1;
+
+    size_t nnz = 0;
+    for (size_t i = 0; i < csv_dim->rows; ++i)
+        for (size_t j = 0; j < cols; ++j)
+            if (data[i][j] != 0)
+                ++nnz;
+
+    SparseMatrix *sparse = empty_sparse_matrix(csv_dim->rows, cols, nnz);
+    size_t idx = 0;
+    for (size_t i = 0; i < csv_dim->rows; ++i)
+    {
+        for (size_t j = 0; j < cols; ++j)
+        {
+            if (data[i][j] == 0)
+                continue;
+            sparse->col_idx[idx] = (uint32_t)j;
+            sparse->values[idx] = data[i][j];
+            ++idx;
+        }
+        sparse->labels[i] = data[i][cols];
+        sparse->row_ptr[i + 1] = idx;
+    }
+    return sparse;
+}
+
+SparseColumns *sparse_to_columns(const SparseMatrix *data)
+{
+    SparseColumns *columns = tracked_malloc(sizeof(SparseColumns), MEMORY_TAG_DATA);
+    columns->cols = data->cols;
+    columns->col_ptr = tracked_calloc(data->cols + 1, sizeof(size_t), MEMORY_TAG_DATA);
+    columns->row_idx = tracked_malloc(data->nnz * sizeof(uint32_t), MEMORY_TAG_DATA);
+    columns->values = tracked_malloc(data->nnz * sizeof(double), MEMORY_TAG_DATA);
+
+    // Count the values in every column and turn the counts into offsets.
+    for (size_t k = 0; k < data->nnz; ++k)
+        columns->col_ptr[data->col_idx[k] + 1]++;
+    for (size_t j = 0; j < data->cols; ++j)
+        columns->col_ptr[j + 1] += columns->col_ptr[j];
+
+    // Scatter the values, walking rows in order keeps the row indices ascending within every column.
+    size_t *next = tracked_malloc(data->cols * sizeof(size_t), MEMORY_TAG_DATA);
+    memcpy(next, columns->col_ptr, data->cols * sizeof(size_t));
+    for (size_t i = 0; i < data->rows; ++i)
+    {
+        for (size_t k = data->row_ptr[i]; k < data->row_ptr[i + 1]; ++k)
+        {
+            size_t position = next[data->col_idx[k]]++;
+            columns->row_idx[position] = (uint32_t)i;
+            columns->values[position] = data->values[k];
+        }
+    }
+    tracked_free(next, MEMORY_TAG_DATA);
+
+    return columns;
+}
+
+double sparse_row_value(const uint32_t *indices, const double *values, size_t nnz, size_t feature_index)
+{
+    // Binary search for the feature among the ascending indices of the row.
+    size_t lo = 0;
+    size_t hi = nnz;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (indices[mid] < feature_index)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo < nnz && indices[lo] == feature_index)
+        return values[lo];
+    return 0;
+}
+
+void free_sparse_matrix(SparseMatrix *data)
+{
+    tracked_free(data->row_ptr, MEMORY_TAG_DATA);
+    tracked_free(data->col_idx, MEMORY_TAG_DATA);
+    tracked_free(data->values, MEMORY_TAG_DATA);
+    tracked_free(data->labels, MEMORY_TAG_DATA);
+    tracked_free(data, MEMORY_TAG_DATA);
+}
+
+void free_sparse_columns(SparseColumns *columns)
+{
+    tracked_free(columns->col_ptr, MEMORY_TAG_DATA);
+    tracked_free(columns->row_idx, MEMORY_TAG_DATA);
+    tracked_free(columns->values, MEMORY_TAG_DATA);
+    tracked_free(columns, MEMORY_TAG_DATA);
+}
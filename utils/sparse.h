@@ -0,0 +1,88 @@
+/*
+@author andrii dobroshynski
+*/
+
+#ifndef sparse_h
+#define sparse_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "data.h"
+#include "utils.h"
+
+typedef struct SparseMatrix SparseMatrix;
+typedef struct SparseColumns SparseColumns;
+
+/*
+Feature matrix stored in compressed sparse row (CSR) form. Only non-zero feature values are stored, every
+value not present is implicitly zero. The class targets are kept in a separate dense 'labels' array
+rather than in the last column as they are for dense data.
+
+The values of row 'i' are 'values[row_ptr[i]]' .. 'values[row_ptr[i + 1] - 1]' with the matching feature
+indices in 'col_idx', sorted ascending within every row.
+*/
+struct SparseMatrix
+{
+    size_t rows;
+    size_t cols; // Number of feature columns, not counting the class target.
+    size_t nnz;  // Number of stored (non-zero) values.
+
+    size_t *row_ptr;
+    uint32_t *col_idx;
+    double *values;
+    double *labels;
+};
+
+/*
+Compressed sparse column (CSC) view of a SparseMatrix, used to visit only the non-zero entries of a single
+feature during the split search.
+*/
+struct SparseColumns
+{
+    size_t cols;
+    size_t *col_ptr;
+    uint32_t *row_idx;
+    double *values;
+};
+
+/*
+Attempts to read a file in the libsvm text format at path given by 'file_name', where every line is of
+the form '<label> <index>:<value> <index>:<value> ...' with 1-based, ascending feature indices. Explicit
+zero values are dropped. Returns the data as a newly allocated SparseMatrix.
+*/
+SparseMatrix *parse_libsvm(const char *file_name);
+
+/*
+Reads and writes the binary form of a SparseMatrix. The file holds a small header followed by the raw
+CSR arrays in native byte order (the row offsets as 64-bit integers), so loading it is a handful of 'fread'
+calls without any parsing. Loading exits with an error if the arrays are inconsistent.
+*/
+SparseMatrix *load_sparse_binary(const char *file_name);
+void save_sparse_binary(const SparseMatrix *data, const char *file_name);
+
+/*
+Converts dense data of dimensions 'csv_dim' (with the class target in column 'cols - 1') into a
+SparseMatrix, dropping all zero feature values.
+*/
+SparseMatrix *dense_to_sparse(double **data, const struct dim *csv_dim);
+
+/*
+Builds the CSC view of the feature values in 'data'.
+*/
+SparseColumns *sparse_to_columns(const SparseMatrix *data);
+
+/*
+Given a sparse row with 'nnz' values and their ascending feature 'indices', returns the value of
+feature 'feature_index' in the row, which is zero if it is not stored.
+*/
+double sparse_row_value(const uint32_t *indices, const double *values, size_t nnz, size_t feature_index);
+
+/*
+Functions to free memory allocated for the structs.
+*/
+void free_sparse_matrix(SparseMatrix *data);
+void free_sparse_columns(SparseColumns *columns);
+
+#endif // sparse_h
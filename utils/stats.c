@@ -0,0 +1,84 @@
+/*
+@author andrii dobroshynski
+*/
+
+#include <string.h>
+#include "memory.h"
+#include "stats.h"
+
+struct RandomForestStats rf_stats;
+
+/*
+Atomically adds 'value' to 'total', or raises 'total' to 'value' if 'max' is set.
+*/
+void update_stats_double(double *total, double value, int max)
+{
+    double current;
+    double updated;
+    __atomic_load(total, &current, __ATOMIC_RELAXED);
+    do
+    {
+        if (max && value <= current)
+            return;
+        updated = max ? value : current + value;
+    } while (!__atomic_compare_exchange(total, &current, &updated, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void record_stats_phase(enum StatsPhase phase, double seconds)
+{
+    __atomic_add_fetch(&rf_stats.phase_calls[phase], 1, __ATOMIC_RELAXED);
+    update_stats_double(&rf_stats.phase_time[phase], seconds, 0);
+    update_stats_double(&rf_stats.phase_max_time[phase], seconds, 1);
+}
+
+void record_stats_depth(long depth)
+{
+    long deepest = __atomic_load_n(&rf_stats.max_depth, __ATOMIC_RELAXED);
+    while (depth > deepest &&
+           !__atomic_compare_exchange_n(&rf_stats.max_depth, &deepest, depth, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+void record_stats_trees(size_t requested, size_t trained)
+{
+    __atomic_add_fetch(&rf_stats.trees_requested, requested, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&rf_stats.trees_trained, trained, __ATOMIC_RELAXED);
+}
+
+void reset_stats()
+{
+    memset(&rf_stats, 0, sizeof(rf_stats));
+}
+
+void write_stats_json(FILE *out, double wall_time)
+{
+    const char *phase_names[STATS_PHASE_COUNT] = {
+        "load", "pivot", "train_tree", "split_search", "partition", "predict"};
+    const char *counter_names[STATS_COUNTER_COUNT] = {
+        "nodes_created", "candidate_splits", "gini_evaluations", "rows_scanned", "bytes_allocated"};
+
+    fprintf(out, "{\n  \"enabled\": %s,\n  \"wall_time_s\": %.9f,\n", STATS_ENABLED ? "true" : "false", wall_time);
+
+    fprintf(out, "  \"phases\": {\n");
+    for (int i = 0; i < STATS_PHASE_COUNT; ++i)
+        fprintf(out, "    \"%s\": {\"calls\": %lu, \"total_s\": %.9f, \"max_s\": %.9f}%s\n",
+                phase_names[i],
+                rf_stats.phase_calls[i],
+                rf_stats.phase_time[i],
+                rf_stats.phase_max_time[i],
+                i + 1 < STATS_PHASE_COUNT ? "," : "");
+    fprintf(out, "  },\n");
+
+    fprintf(out, "  \"counters\": {\n");
+    for (int i = 0; i < STATS_COUNTER_COUNT; ++i)
+        fprintf(out, "    \"%s\": %lu,\n", counter_names[i], rf_stats.counters[i]);
+    fprintf(out, "    \"max_depth\": %ld\n  },\n", rf_stats.max_depth);
+
+    // Trees are always counted, so that a run cut short by its time budget shows how many it got.
+    fprintf(out, "  \"trees\": {\"requested\": %lu, \"trained\": %lu},\n", rf_stats.trees_requested, rf_stats.trees_trained);
+
+    // Memory is always accounted, see 'memory.h'.
+    fprintf(out, "  \"memory\": ");
+    write_memory_json(out, 2);
+    fprintf(out, "\n}\n");
+}
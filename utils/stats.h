@@ -0,0 +1,109 @@
+/*
+@author andrii dobroshynski
+*/
+
+#ifndef stats_h
+#define stats_h
+
+#include <stdio.h>
+#include "utils.h"
+
+/*
+Phases of loading, training and evaluation that are timed. Phases nest (for example the split search runs
+within the training of a tree), so the time of every phase includes the time of the phases within it.
+*/
+enum StatsPhase
+{
+    STATS_PHASE_LOAD,
+    STATS_PHASE_PIVOT,
+    STATS_PHASE_TRAIN_TREE,
+    STATS_PHASE_SPLIT_SEARCH,
+    STATS_PHASE_PARTITION,
+    STATS_PHASE_PREDICT,
+    STATS_PHASE_COUNT
+};
+
+/*
+Counters of work done on the hot paths of training.
+*/
+enum StatsCounter
+{
+    STATS_NODES_CREATED,
+    STATS_CANDIDATE_SPLITS,
+    STATS_GINI_EVALUATIONS,
+    STATS_ROWS_SCANNED,
+    STATS_BYTES_ALLOCATED,
+    STATS_COUNTER_COUNT
+};
+
+/*
+Accumulated timings and counters of the current process.
+*/
+struct RandomForestStats
+{
+    unsigned long phase_calls[STATS_PHASE_COUNT];
+    double phase_time[STATS_PHASE_COUNT];     // Total wall time of every phase in seconds.
+    double phase_max_time[STATS_PHASE_COUNT]; // Slowest single call of every phase in seconds.
+
+    unsigned long counters[STATS_COUNTER_COUNT];
+    long max_depth; // Deepest level of any tree grown.
+
+    // Trees asked for and trees trained, which are fewer if a time budget ran out. Always recorded.
+    unsigned long trees_requested;
+    unsigned long trees_trained;
+};
+
+extern struct RandomForestStats rf_stats;
+
+/*
+Instrumentation macros. Unless the library is compiled with 'RF_STATS' defined (the RANDOM_FOREST_STATS
+CMake option) they expand to nothing, so that the hot paths carry no cost at all. Stats are updated
+atomically, so concurrent predictions from several threads (see 'api/random_forest.h') are safe to count.
+
+  STATS_PHASE_BEGIN(STATS_PHASE_LOAD);
+  ...
+  STATS_PHASE_END(STATS_PHASE_LOAD);
+
+must be used in the same scope, and a phase can only be begun once per scope.
+*/
+#ifdef RF_STATS
+#define STATS_ENABLED 1
+#define STATS_ADD(counter, n) ((void)__atomic_add_fetch(&rf_stats.counters[(counter)], (n), __ATOMIC_RELAXED))
+#define STATS_DEPTH(depth) record_stats_depth((long)(depth))
+#define STATS_PHASE_BEGIN(phase) double phase##_begin = get_monotonic_time()
+#define STATS_PHASE_END(phase) record_stats_phase((phase), get_monotonic_time() - phase##_begin)
+#else
+#define STATS_ENABLED 0
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_DEPTH(depth) ((void)0)
+#define STATS_PHASE_BEGIN(phase) ((void)0)
+#define STATS_PHASE_END(phase) ((void)0)
+#endif
+
+/*
+Adds a single call of 'phase' that took 'seconds' to the stats.
+*/
+void record_stats_phase(enum StatsPhase phase, double seconds);
+
+/*
+Raises the deepest level of any tree grown to 'depth' if it is deeper.
+*/
+void record_stats_depth(long depth);
+
+/*
+Adds a training that was asked for 'requested' trees and trained 'trained' of them to the stats.
+*/
+void record_stats_trees(size_t requested, size_t trained);
+
+/*
+Resets all stats to zero.
+*/
+void reset_stats();
+
+/*
+Writes the stats as JSON into 'out', along with the total 'wall_time' of the run in seconds and the current and
+peak memory usage.
+*/
+void write_stats_json(FILE *out, double wall_time);
+
+#endif // stats_h
@@ -0,0 +1,111 @@
+/*
+@author andrii dobroshynski
+*/
+
+#include "synthetic.h"
+#include "memory.h"
+
+/*
+Returns the next value of a splitmix64 generator with state 'state'.
+*/
+uint64_t next_synthetic_random(uint64_t *state)
+{
+    uint64_t z = ((*state) += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/*
+Returns a uniform random number in [0, 1) from the generator with state 'state'.
+*/
+double next_synthetic_uniform(uint64_t *state)
+{
+    return (double)(next_synthetic_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int compare_synthetic_scores(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+double **generate_synthetic_data(const SyntheticDataParameters *params)
+{
+    assert(params->cols > 1 && "synthetic data needs at least one feature column");
+    assert(params->classes > 0 && "synthetic data needs at least one class");
+
+    size_t n_features = params->cols - 1;
+    size_t n_informative = (size_t)(params->informative * n_features + 0.5);
+    if (n_informative < 1)
+        n_informative = 1;
+    if (n_informative > n_features)
+        n_informative = n_features;
+
+    uint64_t state = params->seed;
+    double **data = _2d_malloc(params->rows, params->cols);
+
+    // Random weights of the informative features, which are spread evenly across the columns.
+    double *weights = tracked_calloc(n_features, sizeof(double), MEMORY_TAG_DATA);
+    for (size_t k = 0; k < n_informative; ++k)
+        weights[(k * n_features) / n_informative] = 2.0 * next_synthetic_uniform(&state) - 1.0;
+
+    double *scores = tracked_malloc(params->rows * sizeof(double), MEMORY_TAG_DATA);
+    for (size_t i = 0; i < params->rows; ++i)
+    {
+        double score = 0;
+        for (size_t j = 0; j < n_features; ++j)
+        {
+            double value = next_synthetic_uniform(&state);
+            if (next_synthetic_uniform(&state) < params->sparsity)
+                value = 0;
+            data[i][j] = value;
+            score += weights[j] * value;
+        }
+        scores[i] = score;
+    }
+
+    // Cut the scores at their quantiles so that every class gets the same number of rows.
+    double *sorted = tracked_malloc(params->rows * sizeof(double), MEMORY_TAG_DATA);
+    memcpy(sorted, scores, params->rows * sizeof(double));
+    qsort(sorted, params->rows, sizeof(double), compare_synthetic_scores);
+
+    for (size_t i = 0; i < params->rows; ++i)
+    {
+        size_t class_target = 0;
+        while (class_target + 1 < params->classes &&
+               scores[i] >= sorted[((class_target + 1) * params->rows) / params->classes])
+            ++class_target;
+        data[i][n_features] = (double)class_target;
+    }
+
+    tracked_free(weights, MEMORY_TAG_DATA);
+    tracked_free(scores, MEMORY_TAG_DATA);
+    tracked_free(sorted, MEMORY_TAG_DATA);
+
+    return data;
+}
+
+void write_csv(double **data, const struct dim *csv_dim, const char *file_name)
+{
+    FILE *csv_file = fopen(file_name, "w");
+    if (csv_file == NULL)
+    {
+        printf("Error: can't open file for writing: %s\n", file_name);
+        exit(-1);
+    }
+
+    for (size_t j = 0; j < csv_dim->cols; ++j)
+        fprintf(csv_file, j ? ",%ld" : "%ld", j);
+    fprintf(csv_file, "\n");
+
+    for (size_t i = 0; i < csv_dim->rows; ++i)
+    {
+        for (size_t j = 0; j < csv_dim->cols; ++j)
+            fprintf(csv_file, j ? ",%.10g" : "%.10g", data[i][j]);
+        fprintf(csv_file, "\n");
+    }
+
+    fclose(csv_file);
+}
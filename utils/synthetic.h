@@ -0,0 +1,44 @@
+/*
+@author andrii dobroshynski
+*/
+
+#ifndef synthetic_h
+#define synthetic_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "data.h"
+#include "utils.h"
+
+/*
+Parameters for generating a synthetic classification dataset.
+*/
+struct SyntheticDataParameters
+{
+    size_t rows;
+    size_t cols;        // Number of columns including the class target column 'cols - 1'.
+    size_t classes;     // Number of class target values, the targets are 0 .. 'classes - 1'.
+    double informative; // Fraction of the features the class target depends on, in (0, 1].
+    double sparsity;    // Fraction of the feature values that are zero, in [0, 1).
+    uint64_t seed;
+};
+
+typedef struct SyntheticDataParameters SyntheticDataParameters;
+
+/*
+Generates a dataset of 'params->rows' * 'params->cols' in the same two-dimensional layout 'pivot_data'
+produces. Feature values are uniform in [0, 1) and are zeroed with probability 'sparsity'. The class target
+is a weighted sum of the informative features cut into 'classes' equally sized buckets, so that the classes
+are balanced and learnable. The generator has its own random number state, so the output only depends on
+'params' and not on the state of 'rand()'.
+*/
+double **generate_synthetic_data(const SyntheticDataParameters *params);
+
+/*
+Writes 'data' of dimensions 'csv_dim' into a csv file at path 'file_name' with a header row, in the format
+that 'parse_csv' reads.
+*/
+void write_csv(double **data, const struct dim *csv_dim, const char *file_name);
+
+#endif // synthetic_h
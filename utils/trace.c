@@ -0,0 +1,136 @@
+/*
+@author andrii dobroshynski
+*/
+
+#include "trace.h"
+
+#define TRACE_BUFFER_INITIAL_CAPACITY 1024
+
+static const char *trace_file_name = NULL;
+static double trace_start_time = 0;
+
+// Head of the list of the buffers of every thread that recorded a span, and the next thread id to assign.
+static struct TraceBuffer *trace_buffers = NULL;
+static int trace_next_tid = 1;
+
+// Buffer of the current thread, NULL until it records its first span.
+static __thread struct TraceBuffer *thread_trace_buffer = NULL;
+
+/*
+Writes the trace into 'trace_file_name', registered with 'atexit' by 'start_trace'.
+*/
+void write_trace_file()
+{
+    FILE *out = fopen(trace_file_name, "w");
+    if (out == NULL)
+    {
+        printf("Error: can't open file for writing: %s\n", trace_file_name);
+        return;
+    }
+    write_trace_json(out);
+    fclose(out);
+
+    if (log_level > 0)
+        printf("wrote trace to %s\n", trace_file_name);
+}
+
+void start_trace(const char *file_name)
+{
+    if (trace_file_name != NULL)
+    {
+        printf("Error: tracing was already started\n");
+        exit(1);
+    }
+    trace_start_time = get_monotonic_time();
+    trace_file_name = file_name;
+    atexit(write_trace_file);
+}
+
+double trace_span_begin()
+{
+    if (trace_file_name == NULL)
+        return 0;
+    return get_monotonic_time();
+}
+
+/*
+Returns the buffer of the current thread, allocating and publishing it on first use. Publishing pushes the
+buffer onto the global list with a compare-and-swap, so threads never wait on each other.
+*/
+struct TraceBuffer *get_thread_trace_buffer()
+{
+    if (thread_trace_buffer != NULL)
+        return thread_trace_buffer;
+
+    struct TraceBuffer *buffer = malloc(sizeof(struct TraceBuffer));
+    buffer->tid = __atomic_fetch_add(&trace_next_tid, 1, __ATOMIC_RELAXED);
+    buffer->count = 0;
+    buffer->capacity = TRACE_BUFFER_INITIAL_CAPACITY;
+    buffer->events = malloc(buffer->capacity * sizeof(struct TraceEvent));
+
+    buffer->next = __atomic_load_n(&trace_buffers, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&trace_buffers, &buffer->next, buffer, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+
+    thread_trace_buffer = buffer;
+    return buffer;
+}
+
+void trace_span_end(const char *name, const char *arg_name, long arg, double begin)
+{
+    if (trace_file_name == NULL)
+        return;
+
+    double end = get_monotonic_time();
+    struct TraceBuffer *buffer = get_thread_trace_buffer();
+
+    if (buffer->count == buffer->capacity)
+    {
+        struct TraceEvent *events = realloc(buffer->events, 2 * buffer->capacity * sizeof(struct TraceEvent));
+        if (events == NULL)
+            return; // Drop the span rather than fail the run.
+        buffer->events = events;
+        buffer->capacity *= 2;
+    }
+
+    buffer->events[buffer->count++] = (struct TraceEvent){
+        name : name,
+        arg_name : arg_name,
+        arg : arg,
+        begin : begin,
+        end : end
+    };
+}
+
+void write_trace_json(FILE *out)
+{
+    fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+    int first = 1;
+    for (struct TraceBuffer *buffer = __atomic_load_n(&trace_buffers, __ATOMIC_ACQUIRE);
+         buffer != NULL;
+         buffer = buffer->next)
+    {
+        // Metadata event naming the thread in the timeline.
+        fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"thread %d\"}}",
+                first ? "" : ",\n", buffer->tid, buffer->tid);
+        first = 0;
+
+        for (size_t i = 0; i < buffer->count; ++i)
+        {
+            const struct TraceEvent *event = &buffer->events[i];
+
+            // Chrome trace timestamps are in microseconds.
+            fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                    event->name,
+                    buffer->tid,
+                    (event->begin - trace_start_time) * 1e6,
+                    (event->end - event->begin) * 1e6);
+            if (event->arg_name != NULL)
+                fprintf(out, ", \"args\": {\"%s\": %ld}", event->arg_name, event->arg);
+            fprintf(out, "}");
+        }
+    }
+
+    fprintf(out, "\n]}\n");
+}
@@ -0,0 +1,70 @@
+/*
+@author andrii dobroshynski
+*/
+
+#ifndef trace_h
+#define trace_h
+
+#include <stdio.h>
+#include "utils.h"
+
+/*
+Span tracing of training and evaluation. Once 'start_trace' is called every span is recorded into a buffer
+owned by the calling thread, so recording never takes a lock, and all buffers are written out as a Chrome
+trace-event JSON file (viewable in chrome://tracing or Perfetto) when the process exits. A span is recorded
+with
+
+  double begin = trace_span_begin();
+  ...
+  trace_span_end("calculate_best_data_split", "rows", rows, begin);
+
+where 'name' and 'arg_name' must be string literals (or otherwise outlive the process). While tracing is off
+both calls return immediately.
+*/
+
+/*
+A single completed span.
+*/
+struct TraceEvent
+{
+    const char *name;
+    const char *arg_name; // Can be NULL if the span has no argument.
+    long arg;
+    double begin; // Monotonic time of the start of the span in seconds.
+    double end;
+};
+
+/*
+Spans recorded by one thread. Buffers are linked into a global list when a thread records its first span.
+*/
+struct TraceBuffer
+{
+    int tid;
+    size_t count;
+    size_t capacity;
+    struct TraceEvent *events;
+    struct TraceBuffer *next;
+};
+
+/*
+Turns on tracing and registers writing the trace into 'file_name' at exit.
+*/
+void start_trace(const char *file_name);
+
+/*
+Returns the begin time to pass to 'trace_span_end', or 0 if tracing is off.
+*/
+double trace_span_begin();
+
+/*
+Records a span called 'name' from 'begin' until now, with an optional integer argument 'arg' named 'arg_name'
+(can be NULL).
+*/
+void trace_span_end(const char *name, const char *arg_name, long arg, double begin);
+
+/*
+Writes every recorded span as Chrome trace-event JSON into 'out'.
+*/
+void write_trace_json(FILE *out);
+
+#endif // trace_h
@@ -2,7 +2,11 @@
 @author andrii dobroshynski
 */
 
+#include <time.h>
 #include "utils.h"
+#include "memory.h"
+
+int log_level = 0;
 
 int get_log_level()
 {
@@ -19,6 +23,13 @@ void set_log_level(int selected_log_level)
     log_level = selected_log_level;
 }
 
+double get_monotonic_time()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
 int contains_int(int *arr, size_t n, int val)
 {
     for (size_t i = 0; i < n; ++i)
@@ -31,6 +42,10 @@ int contains_int(int *arr, size_t n, int val)
 
 int is_row_part_of_testing_fold(int row, const ModelContext *ctx)
 {
+    // Without a testing fold every row is used for training.
+    if (ctx->rowsPerFold == 0)
+        return 0;
+
     size_t lower_bound = ctx->testingFoldIdx * ctx->rowsPerFold;
     size_t upper_bound = lower_bound + ctx->rowsPerFold;
 
@@ -42,7 +57,7 @@ int is_row_part_of_testing_fold(int row, const ModelContext *ctx)
 
 double **combine_arrays(double **first, double **second, size_t n1, size_t n2, size_t cols)
 {
-    double **combined = (double **)malloc((n1 + n2) * sizeof(double) * cols);
+    double **combined = (double **)tracked_malloc((n1 + n2) * sizeof(double *), MEMORY_TAG_SPLIT_SCRATCH);
     int row_index = 0;
     for (size_t i = 0; i < n1; ++i)
     {
@@ -62,8 +77,8 @@ double **_2d_malloc(const size_t rows, const size_t cols)
     double **data;
     double *ptr;
 
-    int len = sizeof(double *) * rows + sizeof(double) * cols * rows;
-    data = (double **)malloc(len);
+    size_t len = sizeof(double *) * rows + sizeof(double) * cols * rows;
+    data = (double **)tracked_malloc(len, MEMORY_TAG_DATA);
 
     ptr = (double *)(data + rows);
 
@@ -78,8 +93,8 @@ double **_2d_calloc(const size_t rows, const size_t cols)
     double **data;
     double *ptr;
 
-    int len = sizeof(double *) * rows + sizeof(double) * cols * rows;
-    data = (double **)calloc(len, sizeof(double));
+    size_t len = sizeof(double *) * rows + sizeof(double) * cols * rows;
+    data = (double **)tracked_calloc(len, 1, MEMORY_TAG_DATA);
 
     ptr = (double *)(data + rows);
 
@@ -15,14 +15,17 @@ struct ModelContext
 {
     const size_t testingFoldIdx;
     const size_t rowsPerFold;
+
+    // Optional per-feature candidate thresholds used by the quantile split mode, can be NULL.
+    const struct SplitCandidates *split_candidates;
 };
 
 typedef struct ModelContext ModelContext;
 
 /*
-The debug log level that can be adjusted via an argument.
+The debug log level that can be adjusted via an argument, defined in utils.c.
 */
-int log_level;
+extern int log_level;
 
 /*
 Given a pointer to a buffer array of integers returns whether or not a given integer 'n'
@@ -38,7 +41,8 @@ double **combine_arrays(double **first, double **second, size_t n1, size_t n2, s
 
 /*
 Given a row number and a model context returns whether or not the particular
-row belongs to a fold that is designated as the evaluation / testing fold.
+row belongs to a fold that is designated as the evaluation / testing fold. A context with 'rowsPerFold' of
+zero has no testing fold.
 */
 int is_row_part_of_testing_fold(int row, const ModelContext *ctx);
 
@@ -52,6 +56,12 @@ Returns whatever the current 'log_level' is.
 */
 int get_log_level();
 
+/*
+Returns the current time of a monotonic clock in seconds. Unlike 'clock()', which measures the CPU time of
+the process, differences of this time are the elapsed wall time.
+*/
+double get_monotonic_time();
+
 /*
 Allocates memory for a two-dimensional like array of size 'rows' * 'cols'.
 */